@@ -0,0 +1,196 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Bridge.h
+ \brief     Provides the UDP bridge of the operation and event queues to a
+            simulation on another host.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_BRIDGE_H
+#define CANFD_BCM_BRIDGE_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Worker.h"
+#include <netinet/in.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <sys/socket.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define BRIDGE_MAGIC   0x4742434Du // "MCBG", marks a datagram of the bridge
+#define BRIDGE_VERSION 2u          // Changes with the layout of the header or the records
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * The side of the bridge.
+ */
+enum bcmBridgeMode{
+    BRIDGE_GATEWAY,   // Sends the events of the workers, receives the operations for their channels
+    BRIDGE_SIMULATION // Sends the operations of the simulation, receives the events of the gateway
+};
+
+/**
+ * The kinds of records a datagram carries.
+ */
+enum bcmBridgeKind{
+    BRIDGE_KIND_OPERATIONS, // struct bcmOperation records from the simulation
+    BRIDGE_KIND_EVENTS      // struct bcmEvent records from the gateway
+};
+
+/**
+ * Struct for the header of a datagram of the bridge.
+ * Each record follows as a uint16_t length and the fields of the record.
+ * Only the union member the type uses and the valid part of the payload
+ * are sent, the receiver fills the rest with 0.
+ *
+ * Note: The header and the records are sent field by field with fixed
+ * widths in little endian byte order, so the hosts may differ in their
+ * architecture. The header is 16 bytes on the wire.
+ */
+struct bcmBridgeHeader{
+    uint32_t magic;    // BRIDGE_MAGIC
+    uint8_t version;   // BRIDGE_VERSION
+    uint8_t kind;      // The enum bcmBridgeKind of the records
+    uint16_t count;    // The number of records
+    uint32_t session;  // Random number of the sending bridge, a new session restarts the sequence
+    uint32_t sequence; // The number of the datagram in the session
+};
+
+/**
+ * Struct for a bridge between the queues and a UDP socket.
+ *
+ * The bridge thread is the simulation side of the queues: On the gateway
+ * it drains the event queues of the workers and enqueues the received
+ * operations to the worker of their channel. On the simulation host it
+ * drains its own operation queue the simulation fills and enqueues the
+ * received events to its own event queue.
+ *
+ * The records are packed into datagrams of up to BRIDGE_DATAGRAM_SIZE bytes.
+ * The datagrams are sent together with sendmmsg when BRIDGE_FLUSH_BYTES are
+ * pending, the oldest record waited BRIDGE_FLUSH_US or all BRIDGE_BATCH_SIZE
+ * datagrams are used. The receive takes BRIDGE_BATCH_SIZE datagrams per recvmmsg.
+ *
+ * Note: Lost and late datagrams are only counted, UDP never waits for a
+ * resend. The receiver tracks the sequence of each session.
+ */
+struct bcmBridge{
+    _Atomic int running;                                      // Cleared to stop the bridge thread
+    int retCode;                                              // The result of the bridge thread
+    int hasThread;                                            // Flag for a started bridge thread
+    pthread_t thread;                                         // The bridge thread
+
+    int mode;                                                 // The enum bcmBridgeMode of the bridge
+    int socketFD;                                             // The UDP socket (-1 = not set up)
+    struct sockaddr_in peer;                                  // Gateway: The simulation of the current session
+    int hasPeer;                                              // Gateway: A simulation announced itself
+    struct sockaddr_in expectedPeer;                          // Gateway: The accepted source (0 = any address or port)
+
+    struct bcmEventQueue *eventSources[MAX_CHANNELS];         // Gateway: The event queues of the workers
+    int nsources;                                             // Gateway: Number of event queues
+    struct bcmOperationQueue *operationTargets[MAX_CHANNELS]; // Gateway: The operation queue of each channel handle
+    struct bcmOperationQueue operationQueue;                  // Simulation: The operations the simulation enqueues
+    struct bcmEventQueue eventQueue;                          // Simulation: The events the simulation dequeues
+
+    unsigned char *txBuffers;                                 // The BRIDGE_BATCH_SIZE datagrams that are filled
+    uint32_t txLengths[BRIDGE_BATCH_SIZE];                    // The used bytes of each datagram
+    uint16_t txCounts[BRIDGE_BATCH_SIZE];                     // The number of records of each datagram
+    int ntx;                                                  // Number of started datagrams, the last one is open
+    uint32_t pendingBytes;                                    // Bytes of the records that were not sent yet
+    uint64_t pendingSince;                                    // Monotonic time the oldest pending record was added
+    uint64_t lastSend;                                        // Monotonic time of the last sendmmsg
+    uint32_t session;                                         // The session of the datagrams that are sent
+    uint32_t sequence;                                        // The sequence of the next datagram that is sent
+
+    unsigned char *rxBuffers;                                 // The BRIDGE_BATCH_SIZE datagrams of a recvmmsg
+    uint32_t rxSession;                                       // The session of the peer
+    uint32_t rxExpected;                                      // The next sequence expected from the peer
+    int hasRxSession;                                         // Flag for a received datagram
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Sets up the gateway side of a bridge. Only datagrams of the expected
+ * peer are accepted, all others are dropped and counted. The events of all
+ * workers are sent to the simulation that started the current session.
+ * Until a simulation announced itself the events wait in the queues of
+ * the workers.
+ *
+ * Note: A datagram of the running session from another port is dropped,
+ * only a new session, e.g. of a restarted simulation, moves the peer.
+ *
+ * Note: The bridge takes the place of the simulation, the queues of the
+ * workers must not be used by anything else.
+ *
+ * @param bridge      - The bridge.
+ * @param workers     - The set up workers.
+ * @param address     - The local IPv4 address the bridge listens on ("0.0.0.0" = all interfaces).
+ * @param port        - The UDP port the bridge listens on.
+ * @param peerAddress - The IPv4 address of the simulation ("0.0.0.0" = any).
+ * @param peerPort    - The UDP port of the simulation (0 = any).
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT, ERR_SOCKET_FAILED, ERR_BIND_FAILED or ERR_MALLOC_FAILED.
+ */
+extern int setupBridgeGateway(struct bcmBridge *bridge, struct bcmWorkers *workers, char const *address,
+                              uint16_t port, char const *peerAddress, uint16_t peerPort);
+
+/**
+ * Sets up the simulation side of a bridge. The simulation uses the queues
+ * bridge->operationQueue and bridge->eventQueue like the in-process ones.
+ * The bridge announces itself to the gateway right away and again
+ * every BRIDGE_HELLO_MS without traffic.
+ *
+ * @param bridge - The bridge.
+ * @param host   - The host name or address of the gateway.
+ * @param port   - The UDP port of the gateway.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT, ERR_SOCKET_FAILED, ERR_EVENTFD_FAILED or ERR_MALLOC_FAILED.
+ */
+extern int setupBridgeSimulation(struct bcmBridge *bridge, char const *host, uint16_t port);
+
+/**
+ * Starts the bridge thread.
+ *
+ * @param bridge - The set up bridge.
+ * @return RET_E_OK or ERR_THREAD_FAILED.
+ */
+extern int startBridge(struct bcmBridge *bridge);
+
+/**
+ * Stops the bridge thread and sends the pending records.
+ *
+ * @param bridge - The bridge.
+ * @return The result of the bridge thread, RET_E_OK or ERR_WRITE_FAILED.
+ */
+extern int stopBridge(struct bcmBridge *bridge);
+
+/**
+ * Frees a stopped bridge.
+ * It is safe to call freeBridge on a bridge whose setup failed or that was already freed.
+ *
+ * @param bridge - The bridge.
+ */
+extern void freeBridge(struct bcmBridge *bridge);
+
+
+#endif //CANFD_BCM_BRIDGE_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Capture.h
+ \brief     Provides the binary capture of all received BCM messages.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_CAPTURE_H
+#define CANFD_BCM_CAPTURE_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Log.h"
+#include "CANFD_BCM_Queue.h"
+#include <linux/can.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for a received message in the queue to the capture writer.
+ * The record is written to the file with only len bytes of the data.
+ */
+struct bcmCaptureEntry{
+    struct bcmLogRecord record;   // The record of the binary log
+    uint8_t data[CANFD_MAX_DLEN]; // The payload of the frame
+};
+
+/**
+ * Struct for the capture of the received messages of all channels.
+ * The event loops only copy each message into the queue of its channel.
+ * The writer thread collects the queues into a large aligned buffer and
+ * writes it to the file when it is full.
+ *
+ * Note: There is one queue per channel, so each queue has exactly one
+ * producer (the worker of the channel) and one consumer (the writer).
+ */
+struct bcmCapture{
+    _Atomic int running;                 // Cleared to stop the writer thread
+    int retCode;                         // The result of the writer thread
+    int hasThread;                       // Flag for a started writer thread
+    pthread_t thread;                    // The writer thread
+
+    int fileFD;                          // The file descriptor of the capture
+    struct bcmRing *rings[MAX_CHANNELS]; // The queues of the channels with struct bcmCaptureEntry elements
+    struct bcmChannels *channels;        // The channels that are captured
+    unsigned char *buffer;               // The aligned buffer of CAPTURE_BUFFER_SIZE bytes
+    size_t used;                         // The filled bytes of the buffer
+
+    uint64_t records;                    // Number of written records
+    uint64_t bytes;                      // Number of written bytes
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Creates the capture file and the queues and attaches the capture to
+ * all channels. Must be called before the event loops run.
+ *
+ * @param capture  - The capture.
+ * @param path     - The path of the capture file. An existing file is overwritten.
+ * @param channels - The open channels.
+ * @return RET_E_OK, ERR_OPEN_FAILED or ERR_MALLOC_FAILED.
+ */
+extern int setupCapture(struct bcmCapture *capture, char const *path, struct bcmChannels *channels);
+
+/**
+ * Starts the writer thread.
+ * All signals are blocked in the thread.
+ *
+ * @param capture - The set up capture.
+ * @return RET_E_OK or ERR_THREAD_FAILED.
+ */
+extern int startCapture(struct bcmCapture *capture);
+
+/**
+ * Copies a received BCM message into the queue of its channel.
+ * If the queue is full the message is dropped and counted.
+ *
+ * @param capture   - The capture.
+ * @param channel   - The channel handle the message was received on.
+ * @param msg       - The received message.
+ * @param timestamp - The receive time in nanoseconds.
+ */
+extern void captureMessage(struct bcmCapture *capture, int channel, struct bcmMsgSingleFrameCanFD const* msg,
+                           uint64_t timestamp);
+
+/**
+ * Stops the writer thread and writes all queued messages.
+ * Should be called after the event loops stopped, otherwise the last
+ * messages can be missing.
+ *
+ * @param capture - The capture.
+ * @return The result of the writer thread, RET_E_OK or ERR_WRITE_FAILED.
+ */
+extern int stopCapture(struct bcmCapture *capture);
+
+/**
+ * Detaches the capture from the channels and closes the file.
+ *
+ * @param capture - The stopped capture.
+ */
+extern void freeCapture(struct bcmCapture *capture);
+
+
+#endif //CANFD_BCM_CAPTURE_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
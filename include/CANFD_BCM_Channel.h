@@ -0,0 +1,82 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Channel.h
+ \brief     Provides one BCM socket per CAN/CANFD bus addressed by a channel handle.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_CHANNEL_H
+#define CANFD_BCM_CHANNEL_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Queue.h"
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the set of channels of the process.
+ * The channel handle of a bus is its index in the array of contexts.
+ */
+struct bcmChannels{
+    struct bcmContext contexts[MAX_CHANNELS]; // The context of each channel
+    int nchannels;                            // Number of opened channels
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Initializes an empty set of channels.
+ * It is safe to call closeChannels on an initialized set.
+ *
+ * @param channels - The set of channels.
+ */
+extern void initChannels(struct bcmChannels *channels);
+
+/**
+ * Opens a BCM socket and sets up a context for each interface.
+ * The interfaces get the channel handles 0 to ninterfaces - 1 in the given order.
+ *
+ * @param channels    - The initialized set of channels.
+ * @param interfaces  - The names of the interfaces e.g. "vcan0".
+ * @param ninterfaces - The number of interfaces (at most MAX_CHANNELS).
+ * @param isBlocking  - Flag for blocking sockets.
+ * @param eventQueue  - The queue for the received events of all channels.
+ */
+extern int openChannels(struct bcmChannels *channels, char const *const interfaces[], int ninterfaces,
+                        int isBlocking, struct bcmEventQueue *eventQueue);
+
+/**
+ * Returns the context of a channel.
+ *
+ * @param channels - The set of channels.
+ * @param channel  - The channel handle.
+ * @return The context or NULL if there is no such channel.
+ */
+extern struct bcmContext* getChannel(struct bcmChannels *channels, int channel);
+
+/**
+ * Frees the contexts and closes the sockets of all channels.
+ *
+ * @param channels - The set of channels.
+ */
+extern void closeChannels(struct bcmChannels *channels);
+
+
+#endif //CANFD_BCM_CHANNEL_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -15,7 +15,86 @@
  ******************************************************************************/
 #define INTERFACE    "vcan0"    // The name of the interface that should be configured
 
-#define VERBOSE      1          // Enables printing information during the recv-send loop
+#define INTERFACES   {"vcan0"}  // The interfaces that are opened if none are given on the command line
+#define MAX_CHANNELS 8          // Maximum number of interfaces (channels) one process can drive
+
+#define VERBOSE      1          // Enables printing the statistics when the application stops
+
+#define STATS        1          // Enables the counters and latency histograms of the event loops
+#define STATS_DUMP_INTERVAL_MS 0 // Interval of the periodic statistics dump (0 = disabled)
+
+#define TX_SEND_POLICY_BCM  0   // createTxSend always sends TX_SEND messages on the BCM socket
+#define TX_SEND_POLICY_RAW  1   // createTxSend always sends the frames on the CAN_RAW socket
+#define TX_SEND_POLICY_AUTO 2   // createTxSend uses the CAN_RAW socket from RAW_BULK_THRESHOLD frames on
+#define TX_SEND_POLICY      TX_SEND_POLICY_AUTO // The transport of createTxSend for new channels
+#define RAW_BULK_THRESHOLD  4   // Minimum number of frames of a createTxSend that go over CAN_RAW (AUTO)
+#define RAW_ENOBUFS_RETRIES 100 // Number of 100us waits for a full TX queue of the interface before giving up
+
+#define SEND_RETRY_QUEUE_SIZE 256   // Number of control messages each channel holds back after ENOBUFS or EAGAIN (0 = fail right away)
+#define SEND_RETRY_BASE_US    100   // Wait before the first retry of a held back message, doubled for every further retry
+#define SEND_RETRY_MAX_US     10000 // Longest wait between two retries of a held back message
+#define SEND_RETRY_ATTEMPTS   8     // Number of retries before a held back message is given up
+
+#define SOCKET_RCVBUF 0         // Receive buffer of the BCM sockets in bytes, forced if permitted (0 = kernel default)
+#define SOCKET_SNDBUF 0         // Send buffer of the BCM and CAN_RAW sockets in bytes, forced if permitted (0 = kernel default)
+
+#define RX_BATCH_SIZE 32        // Maximum number of BCM messages received with one recvmmsg call
+#define TX_BATCH_SIZE 256       // Maximum number of BCM messages sent with one sendmmsg call
+
+#define REGISTRY_SIZE 4096      // Maximum number of BCM TX/RX tasks tracked per socket
+
+#define OPERATION_QUEUE_SIZE 1024 // Number of operations the queue from the simulation can hold (power of two)
+#define OPERATION_BATCH_SIZE 64   // Maximum number of operations processed per event loop iteration
+#define EVENT_QUEUE_SIZE     4096 // Number of events the queue to the simulation can hold (power of two)
+
+#define EPOLL_TIMEOUT_MS 100    // Maximum time the event loop blocks before it checks keepRunning again
+#define BUSY_POLL_US     0      // Time the event loop keeps polling for work before it blocks (0 = disabled)
+
+#define WORKER_THREADS  0       // Number of worker threads for the channels (0 = run the event loop on the main thread)
+#define WORKER_CPUS     {-1}    // CPU each worker is pinned to, missing entries are not pinned (-1 = no pinning)
+#define WORKER_PRIORITY 0       // SCHED_FIFO priority of the workers (0 = default scheduler, 1 to 99 = realtime)
+
+#define REPLAY_BATCH_SIZE   64  // Maximum number of log frames that are sent together by the replay
+#define REPLAY_QUEUE_WAIT_US 50 // Time the replay waits for space in a full operation queue
+
+#define CAPTURE_FILE        ""         // Path of the binary capture of all received BCM messages ("" = disabled)
+#define CAPTURE_QUEUE_SIZE  4096       // Number of messages each channel can queue for the capture writer (power of two)
+#define CAPTURE_BUFFER_SIZE (1u << 20) // Size of the aligned writes of the capture writer in bytes
+#define CAPTURE_POLL_US     1000       // Time the capture writer sleeps when all queues are empty
+
+#define DBC_FILE ""                    // Path of the DBC the received frames are decoded with ("" = raw events only)
+
+#define WATCHDOG_IDS            0   // Number of CAN IDs the watchdog of each channel can supervise (0 = disabled)
+#define WATCHDOG_TICK_MS        10  // Interval the watchdogs check their deadlines and report at
+#define WATCHDOG_LOST_CYCLES    3   // Number of cycles an ID can miss before it is lost
+#define WATCHDOG_JITTER_PERCENT 50  // Part of a cycle a frame may be late without being missed
+#define WATCHDOG_SILENT_MS      500 // Time without any frame after which the bus is silent
+
+#define URING_ENTRIES 0  // Number of control messages each channel can have in flight on its io_uring (0 = synchronous send)
+#define URING_BUFFERS 64 // Number of receive buffers of the multishot receive of each io_uring (0 = recvmmsg)
+
+#define SHM_PATH       ""    // Unix socket a simulation in another process connects to, ".<worker>" is appended ("" = in-process)
+#define SHM_TIMEOUT_MS 10000 // Time the gateway waits for the simulation to connect (-1 = no timeout)
+
+#define BRIDGE_PORT          0    // UDP port a simulation on another host sends its operations to (0 = disabled)
+#define BRIDGE_BIND_ADDRESS  "127.0.0.1" // Local IPv4 address the gateway listens on ("0.0.0.0" = all interfaces)
+#define BRIDGE_PEER_ADDRESS  "127.0.0.1" // IPv4 address of the only simulation the gateway accepts ("0.0.0.0" = any)
+#define BRIDGE_PEER_PORT     0    // UDP port of the simulation the gateway accepts (0 = any port of the peer address)
+#define BRIDGE_DATAGRAM_SIZE 1472 // Largest datagram of the bridge in bytes, fits in an Ethernet frame
+#define BRIDGE_BATCH_SIZE    32   // Maximum number of datagrams sent with one sendmmsg or received with one recvmmsg
+#define BRIDGE_FLUSH_BYTES   8192 // Pending record bytes that are sent without waiting for the deadline
+#define BRIDGE_FLUSH_US      100  // Time a record waits for more records before it is sent (0 = send right away)
+#define BRIDGE_POLL_US       100  // Time the bridge sleeps when the socket and the queues are empty
+#define BRIDGE_HELLO_MS      1000 // Time without a datagram after which the simulation announces itself again
+
+#define STEPPER_TASKS      0    // Number of cyclic TX tasks each channel can run in simulation time (0 = kernel timers)
+#define STEPPER_TICK_US    10   // Resolution of the simulation time of the stepped mode
+#define STEPPER_BATCH_SIZE 1024 // Maximum number of due frames that are collected before they are sent
+#define SEQUENCER_TASKS    4    // Number of sequences of more than MAXFRAMES frames with kernel timers (0 = none)
+
+#define FANOUT_QUEUE_SIZE   0    // Number of events the ring of each subscriber can hold (power of two, 0 = no fan-out)
+#define FANOUT_COALESCE_IDS 2048 // Number of CAN IDs a slow subscriber keeps the latest event of
+#define FANOUT_RETRY_US     1000 // Time the latest events wait before a full ring is tried again
 
 
 #endif //CANFD_BCM_CONFIG_H
@@ -0,0 +1,205 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Context.h
+ \brief     Provides the per-socket context with the reusable BCM message buffers.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_CONTEXT_H
+#define CANFD_BCM_CONTEXT_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Registry.h"
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <net/if.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <time.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+
+/**
+ * Defines how many frames can be put in a bcmMsgMultipleFrames operation.
+ * The socketCAN BCM can send up to 256 CAN frames in a sequence in the case
+ * of a cyclic TX task configuration. Check the socketCAN documentation.
+ */
+#define MAXFRAMES 256
+
+/**
+ * Defines the alignment of the message buffers in the context.
+ */
+#define CACHE_LINE_SIZE 64
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+// Note: Defined in CANFD_BCM_Queue.h
+struct bcmEventQueue;
+
+// Note: Defined in CANFD_BCM_Capture.h
+struct bcmCapture;
+
+// Note: Defined in CANFD_BCM_Dbc.h
+struct bcmDbc;
+
+// Note: Defined in CANFD_BCM_Watchdog.h
+struct bcmWatchdog;
+
+// Note: Defined in CANFD_BCM_Uring.h
+struct bcmUring;
+
+// Note: Defined in CANFD_BCM_Stepper.h
+struct bcmStepper;
+struct bcmSequencer;
+
+// Note: Defined in CANFD_BCM_Fanout.h
+struct bcmFanout;
+
+/**
+ * Struct for a BCM message with a single CAN frame.
+ */
+struct bcmMsgSingleFrameCan{
+    struct bcm_msg_head msg_head;
+    struct can_frame canFrame[1];
+};
+
+/**
+ * Struct for a BCM message with a single CANFD frame.
+ */
+struct bcmMsgSingleFrameCanFD{
+    struct bcm_msg_head msg_head;
+    struct canfd_frame canfdFrame[1];
+};
+
+/**
+ * Struct for a BCM message with multiple CAN frames.
+ */
+ struct bcmMsgMultipleFramesCan{
+     struct bcm_msg_head msg_head;
+     struct can_frame canFrames[MAXFRAMES];
+ };
+
+/**
+* Struct for a BCM message with multiple CANFD frames.
+*/
+struct bcmMsgMultipleFramesCanFD{
+    struct bcm_msg_head msg_head;
+    struct canfd_frame canfdFrames[MAXFRAMES];
+};
+
+/**
+ * Union for the control messages of a received BCM message.
+ * Big enough for the SO_TIMESTAMPNS timestamp and the SO_RXQ_OVFL drop
+ * counter and aligned for cmsghdr.
+ */
+union bcmRxControl{
+    struct cmsghdr align; // Aligns the buffer for cmsghdr
+    unsigned char buffer[CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t))]; // The control messages
+};
+
+/**
+ * Struct for a control message that is held back after a transient send error.
+ */
+struct bcmRetry{
+    struct bcmMsgSingleFrameCanFD msg; // The message, a single frame message is the largest that fits
+    uint32_t size;                     // The size of the message
+    uint32_t attempts;                 // Number of sends of the message that failed
+    uint64_t due;                      // Monotonic time of the next send in nanoseconds
+    uint64_t queued;                   // Monotonic time of the first send in nanoseconds
+};
+
+/**
+ * Struct for the context of a BCM socket.
+ * The context owns a message buffer for each message shape so the TX and
+ * RX functions do not need to allocate memory after the setup.
+ */
+struct bcmContext{
+    int socketFD;                                     // The socket file descriptor
+    int rawSocketFD;                                  // The CAN_RAW socket for bulk one-shot frames (-1 = none)
+    int txSendPolicy;                                 // The transport of createTxSend (TX_SEND_POLICY_*)
+    struct sockaddr_can addr;                         // The address of the socket
+    int channel;                                      // The channel handle of the socket
+    char interfaceName[IFNAMSIZ];                     // The name of the interface of the socket
+    int txQueueLength;                                // The TX queue length of the interface in frames (-1 = unknown)
+    uint32_t rxDrops;                                 // The last drop counter of the socket reported with SO_RXQ_OVFL
+    int epollFD;                                      // The epoll instance of the event loop watching the channel or -1
+    int isDown;                                       // The channel was shut down after a fatal socket error
+
+    struct bcmMsgSingleFrameCan      *txSingleCan;     // Buffer for messages with a single CAN frame
+    struct bcmMsgSingleFrameCanFD    *txSingleCanFD;   // Buffer for messages with a single CANFD frame
+    struct bcmMsgMultipleFramesCan   *txMultipleCan;   // Buffer for messages with multiple CAN frames
+    struct bcmMsgMultipleFramesCanFD *txMultipleCanFD; // Buffer for messages with multiple CANFD frames
+
+    unsigned char                    *txBatch;         // Contiguous buffer for TX_BATCH_SIZE single frame messages
+    struct iovec                     *txBatchIovecs;   // One iovec per message in the batch buffer
+    struct mmsghdr                   *txBatchMsgs;     // One message header per message in the batch buffer
+
+    struct bcmMsgSingleFrameCanFD    *rxBuffers;       // Ring of RX_BATCH_SIZE receive buffers
+    struct iovec                     *rxIovecs;        // One iovec per receive buffer
+    struct mmsghdr                   *rxMsgs;          // One message header per receive buffer
+    union bcmRxControl               *rxControls;      // One control message buffer per receive buffer
+
+    struct bcmEventQueue             *eventQueue;      // The queue for the received events to the simulation
+    struct bcmCapture                *capture;         // The capture of the received messages (NULL = disabled)
+    struct bcmDbc const              *dbc;             // The signal database of the received frames (NULL = disabled)
+    struct bcmWatchdog               *watchdog;        // The supervision of the cyclic RX CAN IDs (NULL = disabled)
+    struct bcmUring                  *uring;           // The io_uring of the control messages (NULL = synchronous send)
+    struct bcmStepper                *stepper;         // The cyclic TX tasks in simulation time (NULL = kernel timers)
+    struct bcmSequencer              *sequencer;       // The long sequences of the kernel timer mode (NULL = none)
+    struct bcmFanout                 *fanout;          // The subscribers of the RX events (NULL = only the event queue)
+
+    struct bcmRetry                  *retries;         // Ring of the control messages that wait for another send
+    uint32_t                         retryCapacity;    // The number of messages the ring has room for
+    uint32_t                         retryHead;        // The index of the oldest held back message
+    uint32_t                         nretries;         // The number of held back messages
+
+    struct bcmRegistry               registry;         // The registry of the active TX/RX tasks of the socket
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Initializes an empty context without a socket and without buffers.
+ * It is safe to call freeContext on an initialized context.
+ *
+ * @param ctx - The context that should be initialized.
+ */
+extern void initContext(struct bcmContext *ctx);
+
+/**
+ * Allocates the cache line aligned message buffers of the context,
+ * sets up the message headers for the batched receive and the task registry.
+ *
+ * @param ctx - The context with an already created socket.
+ */
+extern int setupContext(struct bcmContext *ctx);
+
+/**
+ * Frees the message buffers and the task registry of the context.
+ * The socket of the context is not closed.
+ *
+ * @param ctx - The context that should be freed.
+ */
+extern void freeContext(struct bcmContext *ctx);
+
+
+#endif //CANFD_BCM_CONTEXT_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,209 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Dbc.h
+ \brief     Provides the signal database (DBC) and the decoding of received frames into signal values.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_DBC_H
+#define CANFD_BCM_DBC_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include <linux/can.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define DBC_NAME_SIZE   64                   // Size of the names of messages and signals including the terminating 0
+#define DBC_UNIT_SIZE   16                   // Size of the units of signals including the terminating 0
+#define DBC_MAX_SIGNALS (CANFD_MAX_DLEN * 8) // Most signals of a message, one per bit of a CANFD frame
+#define DBC_NO_MUX      -1                   // The signal is not multiplexed or the message has no multiplexor
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the extractor of a signal.
+ * Only the fields needed to get the raw value out of the payload are kept
+ * here, so the extractors of a message are a few cache lines.
+ *
+ * Note: Intel signals are read as 64 bit little endian word starting at byte
+ * and shifted right, Motorola signals as big endian word shifted left. The
+ * ninth byte after the word covers signals that are not byte aligned.
+ */
+struct bcmDbcSignal{
+    uint64_t mask;       // The bits of the raw value (length bits)
+    uint64_t signBit;    // The highest bit of a signed signal (0 = unsigned)
+    uint8_t byte;        // The first byte of the word that holds the signal
+    uint8_t shift;       // The bit position of the signal in the first byte
+    uint8_t length;      // The number of bits (1 to 64)
+    uint8_t isBigEndian; // Flag for Motorola byte order
+    int16_t muxValue;    // The value of the multiplexor the signal is sent with (DBC_NO_MUX = always)
+    uint16_t reserved;   // Unused, keeps the layout explicit
+};
+
+/**
+ * Struct for the description of a signal that is not needed to decode it.
+ */
+struct bcmDbcSignalInfo{
+    char name[DBC_NAME_SIZE]; // The name of the signal
+    char unit[DBC_UNIT_SIZE]; // The unit of the physical value
+    uint16_t startBit;        // The start bit as written in the DBC
+    uint8_t isSigned;         // Flag for signed raw values
+    uint32_t message;         // The index of the message of the signal
+    double minimum;           // The minimum of the physical value
+    double maximum;           // The maximum of the physical value
+};
+
+/**
+ * Struct for a message of the signal database.
+ * The signals of a message are stored one after the other from firstSignal on.
+ */
+struct bcmDbcMessage{
+    canid_t canID;            // The CAN ID with CAN_EFF_FLAG for extended frames
+    uint32_t firstSignal;     // The index of the first signal of the message
+    uint16_t nsignals;        // The number of signals of the message
+    int16_t multiplexor;      // The index of the multiplexor in the signals of the message (DBC_NO_MUX = none)
+    uint8_t len;              // The payload length in bytes
+    char name[DBC_NAME_SIZE]; // The name of the message
+};
+
+/**
+ * Struct for a slot of the perfect hash of the messages.
+ */
+struct bcmDbcSlot{
+    canid_t canID;    // The CAN ID of the message in the slot
+    uint32_t message; // The index of the message (UINT32_MAX = empty slot)
+};
+
+/**
+ * Struct for a signal database compiled into decode tables.
+ *
+ * The messages are found with a perfect hash (hash and displace): The CAN ID
+ * selects a bucket, the seed of the bucket selects the slot. Every CAN ID of
+ * the database has its own slot, so a lookup is two hashes and one compare.
+ *
+ * Note: The scales and offsets are kept in their own arrays, so the
+ * conversion of the raw values of a message is a loop the compiler can
+ * vectorize.
+ */
+struct bcmDbc{
+    struct bcmDbcMessage *messages;  // The messages
+    uint32_t nmessages;              // The number of messages
+
+    struct bcmDbcSignal *signals;    // The extractors of all signals
+    struct bcmDbcSignalInfo *infos;  // The descriptions of all signals
+    double *scales;                  // The factor of each signal
+    double *offsets;                 // The offset of each signal
+    uint32_t nsignals;               // The number of signals
+
+    struct bcmDbcSlot *slots;        // The slots of the perfect hash
+    uint32_t slotMask;               // The number of slots - 1
+    uint32_t *seeds;                 // The seed of each bucket of the perfect hash
+    uint32_t bucketMask;             // The number of buckets - 1
+
+    uint64_t skipped;                // Number of lines that could not be read
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Loads a DBC file and compiles the messages (BO_) and their signals (SG_)
+ * into the decode tables. All other sections are ignored. Lines that can
+ * not be read and signals outside of a CANFD frame are skipped and counted.
+ *
+ * Note: Float signals (SIG_VALTYPE_) are decoded as integer signals.
+ *
+ * @param dbc  - The signal database.
+ * @param path - The path of the DBC file.
+ * @return RET_E_OK, ERR_OPEN_FAILED, ERR_DBC_FORMAT if a CAN ID is defined twice, ERR_SETUP_FAILED if the
+ *         perfect hash could not be built or ERR_MALLOC_FAILED.
+ */
+extern int loadDbc(struct bcmDbc *dbc, char const *path);
+
+/**
+ * Returns the message of a CAN ID.
+ * The RTR and ERR flags of the CAN ID are ignored.
+ *
+ * @param dbc   - The signal database.
+ * @param canID - The CAN ID with CAN_EFF_FLAG for extended frames.
+ * @return The message or NULL if the CAN ID is not in the database.
+ */
+extern struct bcmDbcMessage const* findDbcMessage(struct bcmDbc const* dbc, canid_t canID);
+
+/**
+ * Returns the index of a signal of a message.
+ * The description of the signal is dbc->infos[index].
+ *
+ * @param dbc     - The signal database.
+ * @param message - The message.
+ * @param name    - The name of the signal.
+ * @return The index of the signal in all signals or ERR_INVALID_ARGUMENT.
+ */
+extern int findDbcSignal(struct bcmDbc const* dbc, struct bcmDbcMessage const* message, char const *name);
+
+/**
+ * Decodes the payload of a frame into the physical values of all signals
+ * of its message. Missing bytes of a short frame are read as 0.
+ * Multiplexed signals that are not sent with the current value of the
+ * multiplexor are NAN.
+ *
+ * @param dbc     - The signal database.
+ * @param message - The message of the frame.
+ * @param data    - The payload of the frame.
+ * @param len     - The length of the payload in bytes.
+ * @param values  - Storage for message->nsignals values.
+ * @return The number of values.
+ */
+extern int decodeDbcMessage(struct bcmDbc const* dbc, struct bcmDbcMessage const* message, uint8_t const* data,
+                            size_t len, double values[]);
+
+/**
+ * Encodes the physical value of a signal into a payload.
+ * Only the bits of the signal are changed. The raw value is rounded and
+ * limited to the range of the signal, NAN is encoded as 0.
+ *
+ * @param dbc    - The signal database.
+ * @param signal - The index of the signal.
+ * @param value  - The physical value.
+ * @param data   - The payload of CANFD_MAX_DLEN bytes.
+ */
+extern void encodeDbcSignal(struct bcmDbc const* dbc, uint32_t signal, double value, uint8_t data[]);
+
+/**
+ * Sets the bits of a signal in a content mask.
+ * For a multiplexed signal the bits of the multiplexor are set as well.
+ *
+ * @param dbc    - The signal database.
+ * @param signal - The index of the signal.
+ * @param mask   - The mask of CANFD_MAX_DLEN bytes.
+ */
+extern void addDbcSignalMask(struct bcmDbc const* dbc, uint32_t signal, uint8_t mask[]);
+
+/**
+ * Frees the decode tables.
+ * It is safe to call freeDbc on a zeroed or already freed database.
+ *
+ * @param dbc - The signal database.
+ */
+extern void freeDbc(struct bcmDbc *dbc);
+
+
+#endif //CANFD_BCM_DBC_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -24,6 +24,20 @@
 #define ERR_RX_SETUP_FAILED         -8
 #define ERR_RECV_FAILED             -9
 #define ERR_MALLOC_FAILED          -10
+#define ERR_EVENTFD_FAILED         -11
+#define ERR_EPOLL_FAILED           -12
+#define ERR_INVALID_ARGUMENT       -13
+#define ERR_THREAD_FAILED          -14
+#define ERR_SETSOCKOPT_FAILED      -15
+#define ERR_BIND_FAILED            -16
+#define ERR_OPEN_FAILED            -17
+#define ERR_MMAP_FAILED            -18
+#define ERR_LOG_FORMAT             -19
+#define ERR_WRITE_FAILED           -20
+#define ERR_DBC_FORMAT             -21
+#define ERR_URING_FAILED           -22
+#define ERR_SCENARIO_FORMAT        -23
+#define ERR_SHM_FAILED             -24
 
 #endif //CANFD_BCM_ERROR_H
 
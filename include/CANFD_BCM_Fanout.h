@@ -0,0 +1,220 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Fanout.h
+ \brief     Provides the fan-out of the RX events to several subscribers with
+            their own CAN IDs, rates and rings.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_FANOUT_H
+#define CANFD_BCM_FANOUT_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Worker.h"
+#include <linux/can.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define FANOUT_MAX_SUBSCRIBERS 8                                        // Most subscribers of a fan-out
+#define FANOUT_PAGE_BITS       16                                       // Bits of an extended CAN ID within its page
+#define FANOUT_PAGE_WORDS      ((1u << FANOUT_PAGE_BITS) / 64)          // Bitmap words of a page
+#define FANOUT_PAGES           ((CAN_EFF_MASK >> FANOUT_PAGE_BITS) + 1) // Pages of the 29 bit CAN IDs
+#define FANOUT_STANDARD_WORDS  ((CAN_SFF_MASK + 1) / 64)                // Bitmap words of the 11 bit CAN IDs
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the latest event of a CAN ID that waits for a slow subscriber.
+ * Signal events of a message with more than EVENT_MAX_VALUES signals have
+ * one entry per chunk.
+ */
+struct bcmSubscriberEntry{
+    struct bcmEvent event; // The latest event, also the key (canID, isCANFD, channel, type, first)
+    uint64_t lastSent;     // Monotonic time the subscriber got the last event of the entry
+    uint8_t isUsed;        // The entry holds a key of the table
+    uint8_t isPending;     // The event was not put in the ring yet
+};
+
+/**
+ * Struct for a subscriber of the RX events, e.g. a logger or a monitoring UI.
+ *
+ * The subscriber gets the events of its CAN IDs in its own ring and reads
+ * them with dequeueEvents and waitEvents like the simulation. A subscriber
+ * with a maximum rate gets each CAN ID at most maxRateHz times a second.
+ * In between and while its ring is full only the latest event of each
+ * CAN ID is kept, so a slow subscriber never stalls the event loop and
+ * never reads stale values. The events of more CAN IDs than the table
+ * holds are dropped if the subscriber has a maximum rate.
+ *
+ * Note: The standard CAN IDs are a plain bitmap. The extended CAN IDs are
+ * a bitmap in pages of 2^FANOUT_PAGE_BITS IDs, a page is only allocated
+ * when one of its IDs is subscribed.
+ */
+struct bcmSubscriber{
+    struct bcmEventQueue queue;                       // The ring of the subscriber
+    struct bcmDoorbell doorbell;                      // The subscriber sleeps on it in waitEvents
+
+    int isAll;                                        // Flag for a subscriber of all CAN IDs
+    uint64_t standard[FANOUT_STANDARD_WORDS];         // The bitmap of the subscribed 11 bit CAN IDs
+    uint64_t *extended[FANOUT_PAGES];                 // The bitmap pages of the subscribed 29 bit CAN IDs (NULL = none)
+    uint64_t interval;                                // The minimum time between two events of a CAN ID in ns (0 = all)
+
+    struct bcmSubscriberEntry *entries;               // The open addressing table of the latest events (NULL = none)
+    uint32_t mask;                                    // The number of entries - 1
+    uint32_t shift;                                   // 64 - log2 of the number of entries (fibonacci hashing)
+    uint32_t nused;                                   // Number of entries that hold a key
+    uint32_t capacity;                                // Maximum number of keys (half of the entries)
+    uint32_t *pending;                                // The entries whose latest event was not put in the ring yet
+    uint32_t npending;                                // Number of pending entries
+
+    uint64_t delivered;                               // Events put in the ring
+    uint64_t coalesced;                               // Events replaced by a later one of the same CAN ID
+    uint64_t dropped;                                 // Events lost because the ring or the table was full
+};
+
+/**
+ * Struct for the fan-out of the RX events of the channels of a worker.
+ * Every event that goes to the event queue of the simulation is also
+ * put in the rings of the subscribers of its CAN ID.
+ *
+ * Note: Subscribers can be added while the worker runs but not removed.
+ * Their CAN IDs only change before addSubscriber or while the worker is
+ * stopped. The event loop is the only producer of the rings.
+ */
+struct bcmFanout{
+    struct bcmSubscriber *subscribers[FANOUT_MAX_SUBSCRIBERS]; // The subscribers
+    _Atomic uint32_t nsubscribers;                             // Number of subscribers the event loop serves
+    uint64_t due;                                              // Monotonic time the next latest event is sent
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Initializes a fan-out without subscribers.
+ *
+ * @param fanout - The fan-out.
+ */
+extern void initFanout(struct bcmFanout *fanout);
+
+/**
+ * Sets up a subscriber without CAN IDs.
+ *
+ * @param subscriber  - The subscriber.
+ * @param capacity    - The number of events the ring can hold (power of two).
+ * @param maxRateHz   - The most events of each CAN ID per second (0 = every event).
+ * @param coalesceIDs - The number of CAN IDs whose latest event can wait (0 = drop the events of a full ring).
+ *                      A maximum rate needs at least one.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT or ERR_MALLOC_FAILED.
+ */
+extern int setupSubscriber(struct bcmSubscriber *subscriber, uint32_t capacity, uint32_t maxRateHz,
+                           uint32_t coalesceIDs);
+
+/**
+ * Frees the ring, the bitmap pages and the table of a subscriber.
+ * Only free a subscriber after the worker of its fan-out stopped.
+ *
+ * @param subscriber - The subscriber.
+ */
+extern void freeSubscriber(struct bcmSubscriber *subscriber);
+
+/**
+ * Subscribes a CAN ID. The CAN_EFF_FLAG selects the 29 bit CAN IDs.
+ *
+ * Note: Subscribe the CAN IDs before addSubscriber, the event loop
+ * reads the bitmap without a lock.
+ *
+ * @param subscriber - The subscriber.
+ * @param canID      - The CAN ID.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+extern int subscribeCanID(struct bcmSubscriber *subscriber, canid_t canID);
+
+/**
+ * Unsubscribes a CAN ID. The CAN_EFF_FLAG selects the 29 bit CAN IDs.
+ *
+ * Note: Only call it before addSubscriber or while the worker of the
+ * fan-out is stopped. The event loop reads the bitmap without a lock,
+ * so a change while it dispatches is a data race.
+ *
+ * @param subscriber - The subscriber.
+ * @param canID      - The CAN ID.
+ */
+extern void unsubscribeCanID(struct bcmSubscriber *subscriber, canid_t canID);
+
+/**
+ * Subscribes all CAN IDs, e.g. for a logger.
+ *
+ * Note: Like subscribeCanID only call it before addSubscriber.
+ *
+ * @param subscriber - The subscriber.
+ */
+extern void subscribeAllCanIDs(struct bcmSubscriber *subscriber);
+
+/**
+ * Adds a set up subscriber to a fan-out.
+ *
+ * @param fanout     - The fan-out.
+ * @param subscriber - The subscriber.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if the fan-out has FANOUT_MAX_SUBSCRIBERS subscribers.
+ */
+extern int addSubscriber(struct bcmFanout *fanout, struct bcmSubscriber *subscriber);
+
+/**
+ * Lets a worker and its channels use a fan-out.
+ *
+ * Note: Attach before the worker runs.
+ *
+ * @param fanout - The fan-out.
+ * @param worker - The set up worker.
+ */
+extern void attachFanout(struct bcmFanout *fanout, struct bcmWorker *worker);
+
+/**
+ * Puts an event in the rings of the subscribers of its CAN ID.
+ * Must only be called by the event loop.
+ *
+ * @param fanout - The fan-out.
+ * @param event  - The event.
+ */
+extern void dispatchFanout(struct bcmFanout *fanout, struct bcmEvent const *event);
+
+/**
+ * Puts the latest events whose wait is over in the rings and wakes up
+ * the subscribers. Must only be called by the event loop, once per wakeup.
+ *
+ * @param fanout - The fan-out.
+ * @return The number of latest events that were put in the rings.
+ */
+extern int flushFanout(struct bcmFanout *fanout);
+
+/**
+ * Returns when the next latest event waits no longer.
+ *
+ * @param fanout - The fan-out.
+ * @return The monotonic time in nanoseconds or UINT64_MAX if nothing waits.
+ */
+extern uint64_t getFanoutDue(struct bcmFanout const *fanout);
+
+
+#endif //CANFD_BCM_FANOUT_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,177 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Log.h
+ \brief     Provides a memory mapped reader and the formats of candump and binary CAN/CANFD logs.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_LOG_H
+#define CANFD_BCM_LOG_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include <linux/can.h>
+#include <net/if.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define LOG_MAGIC          "CANFDBCM"  // The first 8 bytes of a binary log
+#define LOG_VERSION        1           // The version of the binary log format
+#define LOG_RECORD_CANFD   0x80        // Flag in the kind of a record for CANFD frames
+#define LOG_RECORD_CHANNEL 0x7F        // The channel in the kind of a record
+#define LOG_RELEASE_SIZE   (16u << 20) // Bytes behind the read position after which the mapping is released
+#define LOG_LINE_SIZE      256         // Size of a buffer that fits every candump line
+
+/**
+ * Returns the size of a binary record with len bytes of payload.
+ * The payload is padded so the next record is 8 byte aligned.
+ */
+#define LOG_RECORD_SIZE(len) (sizeof(struct bcmLogRecord) + (((size_t) (len) + 7u) & ~(size_t) 7u))
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the header at the start of a binary log.
+ */
+struct bcmLogHeader{
+    char magic[8];     // LOG_MAGIC without the terminating 0
+    uint32_t version;  // LOG_VERSION
+    uint32_t reserved; // Unused, must be 0
+};
+
+/**
+ * Struct for the fixed part of a record of a binary log.
+ * The len bytes of the payload follow directly after it.
+ */
+struct bcmLogRecord{
+    uint64_t timestamp; // Receive time in nanoseconds (CLOCK_REALTIME)
+    canid_t canID;      // The CAN ID with the EFF/RTR/ERR flags
+    uint8_t len;        // The number of bytes of the payload
+    uint8_t flags;      // The CANFD flags of the frame (CANFD_BRS, CANFD_ESI)
+    uint8_t opcode;     // The BCM opcode the frame was received with (0 = plain frame)
+    uint8_t kind;       // LOG_RECORD_CANFD and the channel of the frame
+};
+
+/**
+ * Struct for a frame read from a log.
+ */
+struct bcmLogFrame{
+    uint64_t timestamp;           // Time of the frame in nanoseconds as recorded
+    struct canfd_frame frame;     // The frame
+    int isCANFD;                  // Flag for CANFD frames
+    int opcode;                   // The BCM opcode of a binary record (0 for candump)
+    int channel;                  // The channel of a binary record (-1 for candump)
+    char interfaceName[IFNAMSIZ]; // The interface of a candump line (empty for binary logs)
+};
+
+/**
+ * Struct for a log that is read from a memory mapped file.
+ *
+ * Note: The file is parsed lazily while it is read. Only the pages around
+ * the read position are needed, the ones behind it are released regularly.
+ */
+struct bcmLogReader{
+    int fileFD;                  // The file descriptor of the log
+    unsigned char const *data;   // The mapping of the whole file
+    size_t size;                 // The size of the file in bytes
+    size_t offset;               // The read position
+    size_t released;             // The mapping before this offset was released
+    size_t start;                // The offset of the first frame
+    int isBinary;                // Flag for a binary log
+    uint64_t line;               // The number of the current candump line
+    uint64_t skipped;            // Number of lines or records that could not be replayed
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Opens and maps a log. Binary logs are recognized by LOG_MAGIC,
+ * everything else is read as candump log.
+ *
+ * @param reader - The reader.
+ * @param path   - The path of the log.
+ * @return RET_E_OK, ERR_OPEN_FAILED, ERR_MMAP_FAILED or ERR_LOG_FORMAT.
+ */
+extern int openLogReader(struct bcmLogReader *reader, char const *path);
+
+/**
+ * Reads the next frame of the log.
+ * Lines and records that can not be replayed, e.g. error frames, are
+ * skipped and counted.
+ *
+ * @param reader - The reader.
+ * @param frame  - Storage for the frame.
+ * @return 1 for a frame, 0 at the end of the log or ERR_LOG_FORMAT for a truncated binary log.
+ */
+extern int readLogFrame(struct bcmLogReader *reader, struct bcmLogFrame *frame);
+
+/**
+ * Moves the read position back to the first frame.
+ *
+ * @param reader - The reader.
+ */
+extern void rewindLogReader(struct bcmLogReader *reader);
+
+/**
+ * Unmaps and closes a log.
+ *
+ * @param reader - The reader.
+ */
+extern void closeLogReader(struct bcmLogReader *reader);
+
+/**
+ * Parses a line of a candump log, e.g.
+ * "(1436509052.249713) vcan0 123#11223344" or
+ * "(1436509052.249713) vcan0 12345678##1112233".
+ *
+ * @param line   - The line without the line break.
+ * @param length - The length of the line.
+ * @param frame  - Storage for the frame.
+ * @return RET_E_OK or ERR_LOG_FORMAT if the line is no CAN/CANFD frame.
+ */
+extern int parseCandumpLine(char const *line, size_t length, struct bcmLogFrame *frame);
+
+/**
+ * Parses the frame of a candump line, e.g. "123#11223344" or "12345678##1112233".
+ * The frame ends at the end of the text or at the first space.
+ *
+ * @param text    - The frame.
+ * @param length  - The length of the text.
+ * @param frame   - Storage for the frame.
+ * @param isCANFD - Storage for the flag for CANFD frames.
+ * @return RET_E_OK or ERR_LOG_FORMAT if the text is no CAN/CANFD frame.
+ */
+extern int parseCandumpFrame(char const *text, size_t length, struct canfd_frame *frame, int *isCANFD);
+
+/**
+ * Formats a frame as line of a candump log without the line break.
+ * parseCandumpLine reads the line back to the same frame.
+ *
+ * @param frame         - The frame.
+ * @param interfaceName - The interface name of the line.
+ * @param buffer        - Storage for the line, LOG_LINE_SIZE bytes are always enough.
+ * @param size          - The size of the buffer.
+ * @return The length of the line or ERR_INVALID_ARGUMENT if the buffer is too small.
+ */
+extern int formatCandumpLine(struct bcmLogFrame const* frame, char const *interfaceName, char *buffer, size_t size);
+
+
+#endif //CANFD_BCM_LOG_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
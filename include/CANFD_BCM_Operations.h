@@ -0,0 +1,363 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Operations.h
+ \brief     Provides the BCM operations for CAN/CANFD transmission tasks and RX filters.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_OPERATIONS_H
+#define CANFD_BCM_OPERATIONS_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Context.h"
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Handles the shutdown procedure.
+ *
+ * @param retCode - The return code.
+ * @param ctx     - The context of the BCM socket.
+ */
+extern void shutdownHandler(int retCode, struct bcmContext *ctx);
+
+/**
+ * Checks if an errno of a socket call means that nothing can be sent or
+ * received on the channel anymore, e.g. because its interface was removed.
+ * Only these errors shut the channel down, all others are reported to the caller.
+ *
+ * @param error - The errno.
+ * @return 1 for a fatal error, otherwise 0.
+ */
+extern int isFatalSocketError(int error);
+
+/**
+ * Shuts a channel down after a fatal socket error. Its sockets are removed
+ * from the event loop and closed, its held back messages are dropped and
+ * the simulation gets an EVENT_CHANNEL_DOWN. The other channels and the
+ * process keep running, the operations for the channel are dropped.
+ *
+ * Note: The context itself stays allocated, it is freed with the channels.
+ *
+ * @param ctx   - The context of the BCM socket.
+ * @param error - The errno of the fatal error.
+ */
+extern void shutdownChannel(struct bcmContext *ctx, int error);
+
+/**
+ * Selects the transport of createTxSend.
+ * TX_SEND_POLICY_BCM sends a TX_SEND message per frame on the BCM socket.
+ * TX_SEND_POLICY_RAW sends all frames on the CAN_RAW socket with sendmmsg.
+ * TX_SEND_POLICY_AUTO uses the CAN_RAW socket from RAW_BULK_THRESHOLD frames on.
+ *
+ * @param ctx    - The context of the BCM socket.
+ * @param policy - The TX_SEND_POLICY_*.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if the policy needs a raw socket that was not set up.
+ */
+extern int setTxSendPolicy(struct bcmContext *ctx, int policy);
+
+/**
+ * Create a non cyclic transmission task for multiple CAN/CANFD frames.
+ * Depending on the TX_SEND policy of the context the frames are sent
+ * on the CAN_RAW socket instead. Cyclic and filtered traffic always
+ * stays on the BCM socket.
+ *
+ * Note: Frames sent on the CAN_RAW socket and frames sent by the BCM
+ * are not ordered against each other.
+ *
+ * Note: A message the BCM socket can not take right now (ENOBUFS, EAGAIN)
+ * is held back and sent again later, see processSendRetries. It counts as
+ * sent. Frames the full TX queue of the interface still does not take after
+ * RAW_ENOBUFS_RETRIES waits count as failed.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames that should be send.
+ * @param nframes  - The number of CAN/CANFD frames that should be send.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return The number of frames that could not be sent.
+ */
+extern int createTxSend(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, int isCANFD);
+
+/**
+ * Works like createTxSend but the TX_SEND messages are sent with as few
+ * sendmmsg calls as possible and the result is reported per frame.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames that should be send.
+ * @param nframes  - The number of CAN/CANFD frames that should be send.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param status   - Storage for the status of each frame (RET_E_OK or ERR_TX_SEND_FAILED).
+ * @return The number of frames that could not be sent.
+ */
+extern int createTxSendBatch(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, int isCANFD,
+                             int status[]);
+
+/**
+ * Create a cyclic transmission task for one or multiple CAN/CANFD frames.
+ *
+ * Note: The frames will not be send as a atomic sequence. For each frame
+ * a new cyclic transmission task will be created. There will be a delay
+ * between the frames.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames that should be send cyclic.
+ * @param nframes  - The number of CAN/CANFD frames that should be send cyclic.
+ * @param count    - Number of times the frame is send with the first interval.
+ *                   If count is zero only the second interval is being used.
+ * @param ival1    - First interval.
+ * @param ival2    - Second interval.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return The number of frames that could not be set up.
+ */
+extern int createTxSetup(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, const uint32_t count[],
+                         struct bcm_timeval ival1[], struct bcm_timeval ival2[], int isCANFD);
+
+/**
+ * Create a cyclic transmission task for one or multiple CAN/CANFD frames.
+ * If more than one frame should be send cyclic the provided sequence of
+ * the frames is kept by the BCM.
+ *
+ * A sequence of more than MAXFRAMES frames does not fit in a BCM task.
+ * It needs the stepped mode (ctx->stepper) or, with the kernel timers, a
+ * sequencer (ctx->sequencer). Both run it as one task from one timer, so
+ * the frames keep their order.
+ *
+ * Note: The cyclic transmission task for the sequence can only be deleted
+ * with the CAN ID that was set in the bcm_msg_head! The registry remembers
+ * it for all frames of the sequence, so createTxDelete resolves it.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames that should be send cyclic.
+ * @param nframes  - The number of CAN/CANFD frames that should be send cyclic.
+ * @param count    - Number of times the frame is send with the first interval.
+ *                   If count is zero only the second interval is being used.
+ * @param ival1    - First interval.
+ * @param ival2    - Second interval.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT if the sequence can not be set up or ERR_TX_SETUP_FAILED if it could
+ *         not be sent.
+ */
+extern int createTxSetupSequence(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, uint32_t count,
+                                 struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD);
+
+/**
+ * Updates a cyclic transmission task for one or multiple CAN/CANFD frames.
+ * Frames with the same payload as the last one sent to the BCM are skipped.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames with the updated data.
+ * @param nframes  - The number of CAN/CANFD frames that should be updated.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param announce - The cycle is retained but the changed data will be send immediately once.
+ * @return The number of frames that could not be updated.
+ */
+extern int createTxSetupUpdate(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, int isCANFD, int announce);
+
+/**
+ * Create a cyclic transmission task for one or multiple CAN/CANFD frames.
+ * Works like createTxSetup but all TX_SETUP messages are built in one
+ * contiguous buffer and sent with as few sendmmsg calls as possible.
+ *
+ * Note: A failed frame does not stop the other frames. The result of
+ * each frame is reported in the status array.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frames  - The array of CAN/CANFD frames that should be send cyclic.
+ * @param nframes - The number of CAN/CANFD frames that should be send cyclic.
+ * @param count   - Number of times the frame is send with the first interval.
+ *                  If count is zero only the second interval is being used.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ * @param isCANFD - Flag for CANFD frames.
+ * @param status  - Storage for the status of each frame (RET_E_OK or ERR_TX_SETUP_FAILED).
+ * @return The number of frames that could not be set up.
+ */
+extern int createTxSetupBatch(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, const uint32_t count[],
+                              struct bcm_timeval ival1[], struct bcm_timeval ival2[], int isCANFD, int status[]);
+
+/**
+ * Updates a cyclic transmission task for one or multiple CAN/CANFD frames.
+ * Works like createTxSetupUpdate but all TX_SETUP messages are built in one
+ * contiguous buffer and sent with as few sendmmsg calls as possible.
+ * Frames with the same payload as the last one sent to the BCM are skipped
+ * and reported as RET_E_OK.
+ *
+ * Note: A failed frame does not stop the other frames. The result of
+ * each frame is reported in the status array.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames with the updated data.
+ * @param nframes  - The number of CAN/CANFD frames that should be updated.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param announce - The cycle is retained but the changed data will be send immediately once.
+ * @param status   - Storage for the status of each frame (RET_E_OK or ERR_TX_SETUP_FAILED).
+ * @return The number of frames that could not be updated.
+ */
+extern int createTxSetupUpdateBatch(struct bcmContext *ctx, struct canfd_frame frames[], int nframes, int isCANFD,
+                                    int announce, int status[]);
+
+/**
+ * Changes the value of a signal of a cyclic transmission task.
+ * The signal is encoded with the DBC of the context into the frame image of
+ * the task in the registry and the task is marked dirty. Nothing is sent
+ * until flushTxSignals is called, so all signals changed in a simulation
+ * step go out together.
+ *
+ * Note: The task must have been created with createTxSetup. A message of
+ * up to CAN_MAX_DLEN bytes is looked up as CAN task first. A whole frame
+ * sent for the task before the flush replaces the changed signals.
+ *
+ * @param ctx    - The context of the BCM socket with a DBC.
+ * @param signal - The index of the signal in the DBC (see findDbcSignal).
+ * @param value  - The physical value.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if there is no DBC, no such signal or no cyclic task for its message.
+ */
+extern int setTxSignal(struct bcmContext *ctx, uint32_t signal, double value);
+
+/**
+ * Sends the frame images of all dirty tasks with createTxSetupUpdateBatch.
+ * Images with the payload the BCM is already sending are skipped.
+ * Tasks whose update could not be sent stay dirty for the next call.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param announce - The cycle is retained but the changed data will be send immediately once.
+ * @return The number of frames that could not be updated.
+ */
+extern int flushTxSignals(struct bcmContext *ctx, int announce);
+
+/**
+ * Removes a cyclic transmission task for a CAN ID.
+ *
+ * Note: If the cyclic transmission task was created with createTxSetupSequence
+ * it can only be removed with the CAN ID that was set in the bcm_msg_head even
+ * if the CAN IDs of the sequence are different. The registry knows the CAN ID
+ * of the sequence for each of its frames, so deleting any frame of a sequence
+ * stops the cyclic transmission of all frames in the sequence. A CAN ID that
+ * has no registered task is not sent to the BCM at all.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param canID    - The CAN ID of the cyclic transmission task that should be removed.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_TX_SETUP_FAILED if the TX_DELETE could not be sent, the task is kept then.
+ */
+extern int createTxDelete(struct bcmContext *ctx, canid_t canID, int isCANFD);
+
+/**
+ * Creates a RX filter for the CAN ID.
+ * I. e. we get notified on all received frames with this CAN ID!
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param canID    - The CAN ID that should be added to the RX filter.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_RX_SETUP_FAILED.
+ */
+extern int createRxSetupCanID(struct bcmContext *ctx, canid_t canID, int isCANFD);
+
+/**
+ * Creates a RX filter for the CAN ID and the relevant bits of the frame.
+ * I. e. we only get notified on changes for the set bits in the mask.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param canID    - The CAN ID that should be added to the RX filter.
+ * @param mask     - The mask for the relevant bits of the frame.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_RX_SETUP_FAILED.
+ */
+extern int createRxSetupMask(struct bcmContext *ctx, canid_t canID, struct canfd_frame mask, int isCANFD);
+
+/**
+ * Creates RX filters for the messages of a list of signals.
+ * Each message gets one filter whose mask has exactly the bits of its
+ * subscribed signals, so we only get notified when one of them changes.
+ * All RX_SETUP messages are built in one contiguous buffer and sent with
+ * as few sendmmsg calls as possible.
+ *
+ * Note: An existing filter for a message is replaced, so all signals of a
+ * message must be subscribed with the same call.
+ *
+ * @param ctx      - The context of the BCM socket with a DBC.
+ * @param signals  - The indices of the signals in the DBC (see findDbcSignal).
+ * @param nsignals - The number of signals.
+ * @param isCANFD  - Flag for CANFD frames. Messages longer than CAN_MAX_DLEN are always CANFD frames.
+ * @return The number of filters that could not be set up, ERR_INVALID_ARGUMENT if there is no DBC
+ *         or no such signal or ERR_MALLOC_FAILED.
+ */
+extern int createRxSetupSignals(struct bcmContext *ctx, uint32_t const signals[], int nsignals, int isCANFD);
+
+/**
+ * Removes a RX filter for the CAN ID.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param canID    - The CAN ID that should be removed from the RX filter.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_RX_SETUP_FAILED if the RX_DELETE could not be sent, the filter is kept then.
+ */
+extern int createRxDelete(struct bcmContext *ctx, canid_t canID, int isCANFD);
+
+/**
+ * Removes all registered cyclic transmission tasks and RX filters.
+ * Only the registered tasks are visited, there is no scan over CAN IDs.
+ *
+ * Note: A failed delete is reported but does not stop the teardown.
+ *
+ * @param ctx - The context of the BCM socket.
+ */
+extern void deleteAllTasks(struct bcmContext *ctx);
+
+/**
+ * Handles the result of a control message that was queued on the io_uring.
+ * The send is recorded like a synchronous one. A message the socket could
+ * not take right now is held back for processSendRetries. If the kernel
+ * rejected the message the registry forgets the task it was about (a failed
+ * update only drops the shadow frame) and the simulation gets an EVENT_OP_FAILED.
+ *
+ * @param ctx    - The context of the BCM socket.
+ * @param msg    - The message, only its head is read if the send succeeded.
+ * @param size   - The size of the message.
+ * @param res    - The result of the sendmsg, a negative errno on failure.
+ * @param queued - The monotonic time the message was queued in nanoseconds.
+ */
+extern void processControlCompletion(struct bcmContext *ctx, void const* msg, size_t size, int res, uint64_t queued);
+
+/**
+ * Sends the held back control messages whose wait is over, oldest first.
+ * After a message failed again with ENOBUFS or EAGAIN it waits twice as long
+ * (SEND_RETRY_BASE_US up to SEND_RETRY_MAX_US) and the messages behind it
+ * wait as well, so the order of the messages is kept. A message that still
+ * fails after SEND_RETRY_ATTEMPTS retries or fails with another error is
+ * handled like a rejected message of the io_uring (see processControlCompletion).
+ *
+ * Note: Call it from the thread that owns the context, the event loop does
+ * this on every wakeup.
+ *
+ * @param ctx - The context of the BCM socket.
+ * @return The number of messages that were sent or given up.
+ */
+extern int processSendRetries(struct bcmContext *ctx);
+
+/**
+ * Returns when the oldest held back control message is sent again.
+ *
+ * @param ctx - The context of the BCM socket.
+ * @return The monotonic time in nanoseconds or UINT64_MAX if no message is held back.
+ */
+extern uint64_t getNextSendRetry(struct bcmContext const* ctx);
+
+
+#endif //CANFD_BCM_OPERATIONS_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,390 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Queue.h
+ \brief     Provides lock-free single-producer/single-consumer queues between
+            the simulation and the BCM socket.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_QUEUE_H
+#define CANFD_BCM_QUEUE_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Context.h"
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+
+/**
+ * Defines how many signal values fit in one event.
+ */
+#define EVENT_MAX_VALUES (CANFD_MAX_DLEN / sizeof(double))
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for a bounded single-producer/single-consumer ring buffer.
+ *
+ * Note: The ring does not contain any pointers. The elements are stored
+ * inline after the header so the whole ring is one block of memory.
+ * The producer and the consumer indices are on their own cache lines
+ * so the two sides do not invalidate each other on every access.
+ */
+struct bcmRing{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t head; // Next slot written by the producer
+    uint32_t cachedTail;                             // Last tail seen by the producer
+
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t tail; // Next slot read by the consumer
+    uint32_t cachedHead;                             // Last head seen by the consumer
+
+    _Alignas(CACHE_LINE_SIZE) uint32_t capacity;     // Number of slots (power of two)
+    uint32_t mask;                                   // capacity - 1
+    uint32_t elemSize;                               // Size of one element in bytes
+
+    _Alignas(CACHE_LINE_SIZE) unsigned char data[];  // The slots of the ring
+};
+
+/**
+ * Struct for the geometry of a ring that a queue keeps in its own memory.
+ *
+ * Note: A ring in shared memory can be written by the other process at any
+ * time. The queues copy the geometry when the ring is set up and only read
+ * the indices from the ring afterwards, so no copy can leave the slots.
+ */
+struct bcmRingGeometry{
+    uint32_t capacity; // Number of slots (power of two)
+    uint32_t mask;     // capacity - 1
+    uint32_t elemSize; // Size of one element in bytes
+};
+
+/**
+ * The types of operations the simulation can request.
+ */
+enum bcmOperationType{
+    OP_TX_SEND,         // Send a frame once (createTxSend)
+    OP_TX_SETUP,        // Create a cyclic transmission task (createTxSetup)
+    OP_TX_SETUP_UPDATE, // Update the data of a cyclic transmission task (createTxSetupUpdate)
+    OP_TX_DELETE,       // Remove a cyclic transmission task (createTxDelete)
+    OP_RX_SETUP,        // Create a RX filter (createRxSetupCanID or createRxSetupMask)
+    OP_RX_DELETE,       // Remove a RX filter (createRxDelete)
+    OP_TX_SIGNAL,       // Change a signal of a cyclic transmission task (setTxSignal)
+    OP_TX_FLUSH,        // Send the changed signals of the channel, the end of a simulation step (flushTxSignals)
+    OP_STEP             // Advance the simulation time of the cyclic transmission tasks (stepChannel)
+};
+
+/**
+ * Struct for an operation from the simulation.
+ * The frame is stored inline so nothing is allocated per operation.
+ * For TX_DELETE, RX_SETUP and RX_DELETE only the can_id of the frame
+ * is used unless hasMask is set for RX_SETUP. TX_SIGNAL, TX_FLUSH and STEP
+ * do not use the frame.
+ */
+struct bcmOperation{
+    uint8_t type;             // The enum bcmOperationType of the operation
+    uint8_t isCANFD;          // Flag for CANFD frames
+    uint8_t announce;         // TX_SETUP update: Send the changed data immediately once
+    uint8_t hasMask;          // RX_SETUP: The frame is the mask for the relevant bits
+    uint8_t channel;          // The channel handle of the bus the operation is for
+    uint8_t reserved[3];      // Unused, keeps the layout explicit
+    uint32_t count;           // TX_SETUP: Number of times the frame is send with ival1
+    uint64_t timestamp;       // Monotonic time of enqueueOperations in nanoseconds (set by the queue)
+    union{
+        struct{
+            struct bcm_timeval ival1; // TX_SETUP: First interval
+            struct bcm_timeval ival2; // TX_SETUP: Second interval
+        };
+        struct{
+            double value;             // TX_SIGNAL: The physical value
+            uint32_t signal;          // TX_SIGNAL: The index of the signal in the DBC
+        };
+        uint64_t duration;            // STEP: The simulated time of the step in nanoseconds
+    };
+    struct canfd_frame frame; // The frame, the mask or just the CAN ID
+};
+
+/**
+ * Struct for the operation queue from the simulation to the BCM socket.
+ * The eventfd wakes up the event loop when operations were enqueued.
+ */
+struct bcmOperationQueue{
+    struct bcmRing *ring;            // The ring with the struct bcmOperation elements
+    struct bcmRingGeometry geometry; // The geometry of the ring, copied when it is set up
+    int eventFD;                     // The eventfd that signals new operations
+};
+
+
+/**
+ * The types of events that are reported to the simulation.
+ */
+enum bcmEventType{
+    EVENT_RX_CHANGED,   // A frame was received or its content changed (RX_CHANGED)
+    EVENT_RX_TIMEOUT,   // A cyclic frame is absent (RX_TIMEOUT)
+    EVENT_RX_SIGNALS,   // The decoded signal values of a received frame that is in the DBC (RX_CHANGED)
+    EVENT_BUS_SILENT,   // No frame was received for WATCHDOG_SILENT_MS (watchdog)
+    EVENT_BUS_ACTIVE,   // The first frame after a silent bus was received (watchdog)
+    EVENT_ID_LOST,      // A supervised CAN ID missed WATCHDOG_LOST_CYCLES cycles or timed out (watchdog)
+    EVENT_ID_RECOVERED, // A lost CAN ID was received again (watchdog)
+    EVENT_OP_FAILED,    // The kernel rejected a control message that was queued on the io_uring
+    EVENT_STEP_DONE,    // A simulation step of the stepped mode sent all its frames (stepChannel)
+    EVENT_CHANNEL_DOWN  // A fatal socket error shut the channel down, e.g. its adapter was unplugged (shutdownChannel)
+};
+
+/**
+ * Struct for a received event for the simulation.
+ * The payload is stored inline so nothing is allocated per event.
+ *
+ * Note: A frame with more than EVENT_MAX_VALUES signals is reported with
+ * several EVENT_RX_SIGNALS events. Value k of an event belongs to the signal
+ * message->firstSignal + first + k of the DBC. The watchdog events carry no
+ * frame, the bus events have no CAN ID.
+ */
+struct bcmEvent{
+    uint64_t timestamp;                  // Kernel receive time in nanoseconds (CLOCK_REALTIME, SO_TIMESTAMPNS)
+    canid_t canID;                       // The CAN ID with the EFF/RTR/ERR flags
+    uint8_t type;                        // The enum bcmEventType of the event
+    uint8_t flags;                       // The CANFD flags of the frame (CANFD_BRS, CANFD_ESI)
+    uint8_t len;                         // The number of valid bytes in data or values in values
+    uint8_t isCANFD;                     // Flag for CANFD frames
+    uint8_t channel;                     // The channel handle of the bus the frame was received on
+    uint8_t reserved;                    // Unused, keeps the layout explicit
+    uint16_t first;                      // EVENT_RX_SIGNALS: The index of the first value in the signals of the message
+    union{
+        uint8_t data[CANFD_MAX_DLEN];    // The payload of the frame
+        double values[EVENT_MAX_VALUES]; // EVENT_RX_SIGNALS: The physical values of the signals
+        struct{
+            uint64_t silentFor;          // Watchdog: Nanoseconds the ID or the bus is away (RECOVERED/ACTIVE: was away)
+            uint32_t missed;             // EVENT_ID_LOST: The number of missed cycles
+            uint32_t nlost;              // Watchdog: The number of lost IDs of the channel
+        } watch;
+        struct{
+            int32_t error;               // EVENT_OP_FAILED/CHANNEL_DOWN: The errno of the failed message or socket
+            uint32_t opcode;             // EVENT_OP_FAILED: The BCM opcode of the failed message
+        } op;
+        struct{
+            uint64_t time;               // EVENT_STEP_DONE: The simulation time at the end of the step in nanoseconds
+            uint32_t nframes;            // EVENT_STEP_DONE: The number of frames the step sent
+            uint32_t failed;             // EVENT_STEP_DONE: The number of frames that could not be sent
+        } step;
+    };
+};
+
+/**
+ * Struct for the doorbell a consumer in another process sleeps on.
+ * The sequence is a futex word, the producer only increments it and calls
+ * FUTEX_WAKE if a consumer announced that it sleeps.
+ *
+ * Note: The doorbell lives in shared memory, so it has no pointers and
+ * is on its own cache line.
+ */
+struct bcmDoorbell{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t sequence; // Incremented for every wakeup
+    _Atomic uint32_t waiters;                            // Number of consumers that sleep on the sequence
+};
+
+/**
+ * Struct for the event queue from the BCM socket to the simulation.
+ *
+ * Note: The receive path must never wait for the simulation. If the queue is
+ * full the event is dropped and counted instead.
+ */
+struct bcmEventQueue{
+    struct bcmRing *ring;            // The ring with the struct bcmEvent elements
+    struct bcmRingGeometry geometry; // The geometry of the ring, copied when it is set up
+    uint64_t dropped;                // Number of events dropped because the queue was full
+    struct bcmDoorbell *doorbell;    // Wakes up a simulation in another process (NULL = polled in-process)
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Returns the number of bytes needed for a ring.
+ *
+ * @param capacity - The number of slots (power of two).
+ * @param elemSize - The size of one element in bytes.
+ */
+extern size_t getRingSize(uint32_t capacity, uint32_t elemSize);
+
+/**
+ * Initializes a ring in already allocated memory of getRingSize bytes.
+ * The memory must be aligned to CACHE_LINE_SIZE.
+ *
+ * @param ring     - The memory of the ring.
+ * @param capacity - The number of slots (power of two).
+ * @param elemSize - The size of one element in bytes.
+ */
+extern int initRing(struct bcmRing *ring, uint32_t capacity, uint32_t elemSize);
+
+/**
+ * Allocates and initializes a ring.
+ *
+ * @param capacity - The number of slots (power of two).
+ * @param elemSize - The size of one element in bytes.
+ * @return The ring or NULL on failure.
+ */
+extern struct bcmRing* allocateRing(uint32_t capacity, uint32_t elemSize);
+
+/**
+ * Frees a ring allocated with allocateRing.
+ *
+ * @param ring - The ring that should be freed.
+ */
+extern void freeRing(struct bcmRing *ring);
+
+/**
+ * Fills the geometry of a ring with the given capacity and element size.
+ *
+ * @param geometry - The geometry.
+ * @param capacity - The number of slots (power of two).
+ * @param elemSize - The size of one element in bytes.
+ */
+extern void initRingGeometry(struct bcmRingGeometry *geometry, uint32_t capacity, uint32_t elemSize);
+
+/**
+ * Copies up to nelems elements into the ring.
+ * Must only be called by the producer.
+ *
+ * @param ring   - The ring.
+ * @param elems  - The elements that should be enqueued.
+ * @param nelems - The number of elements.
+ * @return The number of enqueued elements. Less than nelems if the ring is full.
+ */
+extern uint32_t enqueueRing(struct bcmRing *ring, void const *elems, uint32_t nelems);
+
+/**
+ * Copies up to maxElems elements out of the ring.
+ * Must only be called by the consumer.
+ *
+ * @param ring     - The ring.
+ * @param elems    - Storage for the dequeued elements.
+ * @param maxElems - The maximum number of elements that should be dequeued.
+ * @return The number of dequeued elements.
+ */
+extern uint32_t dequeueRing(struct bcmRing *ring, void *elems, uint32_t maxElems);
+
+/**
+ * Returns the number of elements in the ring.
+ * The value can be outdated as soon as it is returned.
+ *
+ * @param ring - The ring.
+ */
+extern uint32_t getRingCount(struct bcmRing *ring);
+
+/**
+ * Creates the ring and the eventfd of an operation queue.
+ *
+ * @param queue    - The operation queue.
+ * @param capacity - The number of operations the queue can hold (power of two).
+ */
+extern int setupOperationQueue(struct bcmOperationQueue *queue, uint32_t capacity);
+
+/**
+ * Frees the ring and closes the eventfd of an operation queue.
+ *
+ * @param queue - The operation queue.
+ */
+extern void freeOperationQueue(struct bcmOperationQueue *queue);
+
+/**
+ * Enqueues operations and wakes up the event loop.
+ * Must only be called by the simulation. The operations are stamped
+ * with the enqueue time for the dequeue to send latency.
+ *
+ * @param queue - The operation queue.
+ * @param ops   - The operations that should be enqueued.
+ * @param nops  - The number of operations.
+ * @return The number of enqueued operations. Less than nops if the queue is full.
+ */
+extern uint32_t enqueueOperations(struct bcmOperationQueue *queue, struct bcmOperation ops[], uint32_t nops);
+
+/**
+ * Dequeues up to maxOps operations.
+ * Must only be called by the event loop.
+ *
+ * @param queue  - The operation queue.
+ * @param ops    - Storage for the dequeued operations.
+ * @param maxOps - The maximum number of operations that should be dequeued.
+ * @return The number of dequeued operations.
+ */
+extern uint32_t dequeueOperations(struct bcmOperationQueue *queue, struct bcmOperation ops[], uint32_t maxOps);
+
+
+/**
+ * Creates the ring of an event queue.
+ *
+ * @param queue    - The event queue.
+ * @param capacity - The number of events the queue can hold (power of two).
+ */
+extern int setupEventQueue(struct bcmEventQueue *queue, uint32_t capacity);
+
+/**
+ * Frees the ring of an event queue.
+ *
+ * @param queue - The event queue.
+ */
+extern void freeEventQueue(struct bcmEventQueue *queue);
+
+/**
+ * Enqueues an event for the simulation.
+ * Must only be called by the event loop.
+ *
+ * @param queue - The event queue.
+ * @param event - The event that should be enqueued.
+ * @return 1 if the event was enqueued or 0 if it was dropped.
+ */
+extern int enqueueEvent(struct bcmEventQueue *queue, struct bcmEvent const *event);
+
+/**
+ * Dequeues up to maxEvents events.
+ * Must only be called by the simulation.
+ *
+ * @param queue     - The event queue.
+ * @param events    - Storage for the dequeued events.
+ * @param maxEvents - The maximum number of events that should be dequeued.
+ * @return The number of dequeued events.
+ */
+extern uint32_t dequeueEvents(struct bcmEventQueue *queue, struct bcmEvent events[], uint32_t maxEvents);
+
+/**
+ * Wakes up a simulation that sleeps in waitEvents.
+ * Must only be called by the event loop, once after a batch of events.
+ * Without a doorbell or a sleeping simulation it costs no system call.
+ *
+ * @param queue - The event queue.
+ */
+extern void notifyEvents(struct bcmEventQueue *queue);
+
+/**
+ * Waits until the queue has events or the timeout expired.
+ * Must only be called by the simulation. Queues without a doorbell
+ * return right away.
+ *
+ * @param queue     - The event queue.
+ * @param timeoutMs - The maximum time to wait in milliseconds (-1 = no timeout).
+ * @return The number of events in the queue, 0 after the timeout.
+ */
+extern uint32_t waitEvents(struct bcmEventQueue *queue, int timeoutMs);
+
+
+#endif //CANFD_BCM_QUEUE_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,197 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Registry.h
+ \brief     Provides a hash-indexed registry of the active BCM TX/RX tasks.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_REGISTRY_H
+#define CANFD_BCM_REGISTRY_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * The kinds of registry entries.
+ * The BCM keeps TX and RX tasks apart, so the same CAN ID can have one of each.
+ */
+enum bcmTaskKind{
+    TASK_KIND_TX,             // A cyclic transmission task
+    TASK_KIND_RX,             // A RX filter
+    TASK_KIND_SEQUENCE_MEMBER // A frame of a sequence that is not the CAN ID in the bcm_msg_head
+};
+
+/**
+ * The types of registered tasks.
+ */
+enum bcmTaskType{
+    TASK_TX_CYCLIC,       // Single frame task created with createTxSetup
+    TASK_TX_SEQUENCE,     // Sequence task created with createTxSetupSequence
+    TASK_SEQUENCE_MEMBER, // Frame of a sequence, headID is the CAN ID of the sequence task
+    TASK_RX_FILTER_ID,    // RX filter created with createRxSetupCanID
+    TASK_RX_FILTER_MASK   // RX filter created with createRxSetupMask
+};
+
+/**
+ * Struct for a registered BCM task.
+ */
+struct bcmTask{
+    canid_t canID;            // The CAN ID of the task
+    uint8_t isCANFD;          // Flag for CANFD frames
+    uint8_t kind;             // The enum bcmTaskKind of the task
+    uint8_t type;             // The enum bcmTaskType of the task
+    uint8_t hasNext;          // Sequence: nextID links to the next member
+    uint8_t hasShadow;        // TX cyclic: shadow holds the last sent frame, RX mask filter: shadow holds the mask
+    uint8_t isDirty;          // TX cyclic: image was changed by the signal encoder and is not sent yet
+    uint32_t nframes;         // Number of frames of the task
+    canid_t headID;           // Sequence member: The CAN ID of the sequence task
+    canid_t nextID;           // Sequence and member: The CAN ID of the next member
+    uint32_t count;           // TX: Number of times the frame is send with ival1
+    struct bcm_timeval ival1; // TX: First interval
+    struct bcm_timeval ival2; // TX: Second interval
+    uint64_t digest;          // Sequence: Hash of the frames (getFramesDigest)
+    struct canfd_frame shadow; // TX cyclic: Copy of the last frame sent to the BCM, RX mask filter: The mask
+    struct canfd_frame image;  // TX cyclic: The frame the signal encoder patches, only valid while isDirty
+};
+
+/**
+ * Struct for the registry of the tasks of a BCM socket.
+ *
+ * Note: The tasks are stored densely so all tasks can be visited without
+ * scanning empty slots. The hash table is an open addressing table with
+ * linear probing that maps the key of a task to its index in the array.
+ */
+struct bcmRegistry{
+    struct bcmTask *tasks; // The dense array of registered tasks
+    uint32_t *slots;       // The hash table: 0 = empty, otherwise index + 1
+    uint32_t *dirty;       // The indices of the tasks with isDirty set
+    uint32_t ndirty;       // Number of tasks with isDirty set
+    uint32_t ntasks;       // Number of registered tasks
+    uint32_t capacity;     // Maximum number of registered tasks
+    uint32_t mask;         // Number of slots - 1
+    uint32_t shift;        // 64 - log2(number of slots)
+    int overflowed;        // Set when a task could not be registered because the registry was full
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Allocates the task array and the hash table of a registry.
+ *
+ * @param registry - The registry.
+ * @param capacity - The maximum number of tasks.
+ */
+extern int setupRegistry(struct bcmRegistry *registry, uint32_t capacity);
+
+/**
+ * Frees the task array and the hash table of a registry.
+ *
+ * @param registry - The registry.
+ */
+extern void freeRegistry(struct bcmRegistry *registry);
+
+/**
+ * Looks up a task.
+ *
+ * @param registry - The registry.
+ * @param canID    - The CAN ID of the task.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param kind     - The enum bcmTaskKind of the task.
+ * @return The task or NULL if it is not registered.
+ */
+extern struct bcmTask* findTask(struct bcmRegistry *registry, canid_t canID, int isCANFD, int kind);
+
+/**
+ * Looks up a task and registers it if it does not exist yet.
+ * A new task is zeroed except for its key.
+ *
+ * Note: The returned pointer is only valid until the next removeTask call.
+ *
+ * @param registry - The registry.
+ * @param canID    - The CAN ID of the task.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param kind     - The enum bcmTaskKind of the task.
+ * @return The task or NULL if the registry is full.
+ */
+extern struct bcmTask* addTask(struct bcmRegistry *registry, canid_t canID, int isCANFD, int kind);
+
+/**
+ * Sets isDirty of a task and adds it to the dirty tasks.
+ * Nothing happens if the task is already dirty.
+ *
+ * @param registry - The registry.
+ * @param task     - The task.
+ */
+extern void markTaskDirty(struct bcmRegistry *registry, struct bcmTask *task);
+
+/**
+ * Removes a task if it is registered.
+ * A dirty task is removed from the dirty tasks as well.
+ *
+ * @param registry - The registry.
+ * @param canID    - The CAN ID of the task.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param kind     - The enum bcmTaskKind of the task.
+ */
+extern void removeTask(struct bcmRegistry *registry, canid_t canID, int isCANFD, int kind);
+
+/**
+ * Removes all tasks.
+ *
+ * @param registry - The registry.
+ */
+extern void clearRegistry(struct bcmRegistry *registry);
+
+/**
+ * Checks if a frame has the same payload as the shadow frame of a task.
+ * Only len, the CANFD flags and the first len bytes of data are compared.
+ *
+ * @param task    - The task with the shadow frame.
+ * @param frame   - The new frame.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return 1 if the payload is unchanged, otherwise 0.
+ */
+extern int hasSamePayload(struct bcmTask const *task, struct canfd_frame const *frame, int isCANFD);
+
+/**
+ * Stores a frame as the shadow frame of a task.
+ * The image of a dirty task is replaced by the frame as well.
+ *
+ * @param task    - The task.
+ * @param frame   - The frame that was sent to the BCM.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+extern void setShadowFrame(struct bcmTask *task, struct canfd_frame const *frame, int isCANFD);
+
+/**
+ * Returns a hash of the CAN IDs, lengths, flags and payloads of frames.
+ * Bytes behind the length of a frame are ignored.
+ *
+ * @param frames  - The frames.
+ * @param nframes - The number of frames.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return The 64 bit FNV-1a hash of the frames.
+ */
+extern uint64_t getFramesDigest(struct canfd_frame const frames[], int nframes, int isCANFD);
+
+
+#endif //CANFD_BCM_REGISTRY_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,125 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Replay.h
+ \brief     Provides the replay of recorded candump and binary logs on the channels.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_REPLAY_H
+#define CANFD_BCM_REPLAY_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Log.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Worker.h"
+#include <linux/can.h>
+#include <net/if.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the replay of a log on the channels.
+ * The frames are sent with createTxSend, either directly on the channels
+ * or through the operation queues of the workers that serve them.
+ *
+ * Note: With workers the replay is the producer of their operation queues,
+ * so nothing else may enqueue operations for them while it runs.
+ */
+struct bcmReplay{
+    _Atomic int running;                         // Cleared to stop the replay
+
+    struct bcmLogReader reader;                  // The log
+    struct bcmChannels *channels;                // The channels the frames are sent on
+    struct bcmWorkers *workers;                  // The workers of the channels (NULL = send directly)
+    char logInterfaces[MAX_CHANNELS][IFNAMSIZ];  // The interface in a candump log of each channel
+    double speed;                                // Factor of the recorded speed (0 = max speed)
+
+    struct canfd_frame batch[REPLAY_BATCH_SIZE]; // The frames that are sent together
+    struct bcmOperation ops[REPLAY_BATCH_SIZE];  // The operations of a batch for the workers
+    int nbatch;                                  // Number of frames in the batch
+    int batchChannel;                            // The channel of the batch
+    int batchIsCANFD;                            // Flag for a batch of CANFD frames
+
+    char lastInterface[IFNAMSIZ];                // The last looked up candump interface
+    int lastChannel;                             // The channel of the last looked up interface
+
+    uint64_t frames;                             // Number of replayed frames
+    uint64_t skipped;                            // Number of frames that were not replayed
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Opens a log for the replay on the channels.
+ * The frames of a candump log are sent on the channel with the same
+ * interface name, see setReplayInterface. The frames of a binary log are
+ * sent on the channel they were recorded on.
+ *
+ * @param replay   - The replay.
+ * @param path     - The path of the log.
+ * @param channels - The open channels.
+ * @param workers  - The set up workers of the channels or NULL to send directly on the channels.
+ * @param speed    - Factor of the recorded speed, e.g. 2.0 for twice as fast (0 = max speed).
+ * @return RET_E_OK or the error of openLogReader.
+ */
+extern int setupReplay(struct bcmReplay *replay, char const *path, struct bcmChannels *channels,
+                       struct bcmWorkers *workers, double speed);
+
+/**
+ * Sends the frames of an interface in a candump log on a channel.
+ * E.g. to replay a log recorded on can0 on the channel of vcan0.
+ *
+ * @param replay       - The replay.
+ * @param channel      - The channel handle.
+ * @param logInterface - The interface name in the log.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT for an unknown channel.
+ */
+extern int setReplayInterface(struct bcmReplay *replay, int channel, char const *logInterface);
+
+/**
+ * Replays the log until its end or until stopReplay is called.
+ * Each frame is sent at the monotonic time of the first frame plus its
+ * recorded distance to the first frame divided by the speed. Frames that
+ * are already due are sent together. At max speed the frames are sent in
+ * batches of REPLAY_BATCH_SIZE without waiting.
+ *
+ * @param replay - The replay.
+ * @return RET_E_OK or ERR_LOG_FORMAT for a truncated binary log.
+ */
+extern int runReplay(struct bcmReplay *replay);
+
+/**
+ * Stops a running replay. Can be called from a signal handler.
+ *
+ * @param replay - The replay.
+ */
+extern void stopReplay(struct bcmReplay *replay);
+
+/**
+ * Closes the log of a replay.
+ *
+ * @param replay - The replay.
+ */
+extern void freeReplay(struct bcmReplay *replay);
+
+
+#endif //CANFD_BCM_REPLAY_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
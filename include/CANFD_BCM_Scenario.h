@@ -0,0 +1,206 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Scenario.h
+ \brief     Provides scenarios, complete sets of TX tasks and RX filters that are applied as difference.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_SCENARIO_H
+#define CANFD_BCM_SCENARIO_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Context.h"
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for a cyclic transmission task of a scenario.
+ */
+struct bcmScenarioTx{
+    struct canfd_frame frame; // The frame
+    uint32_t count;           // Number of times the frame is send with ival1
+    struct bcm_timeval ival1; // First interval
+    struct bcm_timeval ival2; // Second interval
+    int isCANFD;              // Flag for CANFD frames
+};
+
+/**
+ * Struct for a sequence of a scenario.
+ * The frames are stored one after the other in the frames of the scenario.
+ */
+struct bcmScenarioSequence{
+    uint32_t firstFrame;      // The index of the first frame, its CAN ID is the key of the sequence
+    uint32_t nframes;         // The number of frames
+    struct bcm_timeval ival2; // The interval between the frames
+    int isCANFD;              // Flag for CANFD frames
+};
+
+/**
+ * Struct for a RX filter of a scenario.
+ */
+struct bcmScenarioRx{
+    struct canfd_frame mask; // The CAN ID and the mask of the relevant bits
+    int hasMask;             // Flag for a filter on the content, otherwise every frame is reported
+    int isCANFD;             // Flag for CANFD frames
+};
+
+/**
+ * Struct for a scenario, the complete set of cyclic TX tasks, sequences
+ * and RX filters a test case needs.
+ *
+ * A scenario is applied as difference to the registry of a context: Tasks
+ * that are not in the scenario are deleted, tasks with the same timers only
+ * get their new payload and identical tasks are not sent at all.
+ *
+ * The text format has one task per line, "#" starts a comment:
+ *
+ *     TX  <ival2_us> <frame> [<count> <ival1_us>]
+ *     SEQ <ival2_us> <frame> [<frame> ...]
+ *     RX  <frame>
+ *
+ * The frames are written like in a candump log, "123#1122" or "123##1112233"
+ * for CANFD. A RX frame without payload is a filter on the CAN ID, otherwise
+ * its payload is the mask of the relevant bits.
+ */
+struct bcmScenario{
+    struct bcmScenarioTx *txs;             // The cyclic transmission tasks
+    uint32_t ntxs;                         // The number of cyclic transmission tasks
+    uint32_t txCapacity;                   // The number of tasks the array has room for
+
+    struct bcmScenarioSequence *sequences; // The sequences
+    uint32_t nsequences;                   // The number of sequences
+    uint32_t sequenceCapacity;             // The number of sequences the array has room for
+
+    struct canfd_frame *frames;            // The frames of all sequences
+    uint32_t nframes;                      // The number of frames
+    uint32_t frameCapacity;                // The number of frames the array has room for
+
+    struct bcmScenarioRx *rxs;             // The RX filters
+    uint32_t nrxs;                         // The number of RX filters
+    uint32_t rxCapacity;                   // The number of filters the array has room for
+};
+
+/**
+ * Struct for what applyScenario changed.
+ */
+struct bcmScenarioDiff{
+    uint32_t kept;    // Tasks and filters that were already active as described
+    uint32_t added;   // Tasks and filters that were set up
+    uint32_t updated; // Cyclic tasks that only got a new payload
+    uint32_t deleted; // Tasks and filters that were removed
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Initializes an empty scenario.
+ * It is safe to call freeScenario on an initialized scenario.
+ *
+ * @param scenario - The scenario.
+ */
+extern void initScenario(struct bcmScenario *scenario);
+
+/**
+ * Frees a scenario.
+ *
+ * @param scenario - The scenario.
+ */
+extern void freeScenario(struct bcmScenario *scenario);
+
+/**
+ * Adds a cyclic transmission task to a scenario.
+ *
+ * @param scenario - The scenario.
+ * @param frame    - The frame.
+ * @param count    - Number of times the frame is send with the first interval.
+ * @param ival1    - First interval.
+ * @param ival2    - Second interval.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+extern int addScenarioTx(struct bcmScenario *scenario, struct canfd_frame const* frame, uint32_t count,
+                         struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD);
+
+/**
+ * Adds a sequence to a scenario. The frames are copied.
+ *
+ * @param scenario - The scenario.
+ * @param frames   - The frames of the sequence, the first CAN ID is its key.
+ * @param nframes  - The number of frames.
+ * @param ival2    - The interval between the frames.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT for an empty sequence or ERR_MALLOC_FAILED.
+ */
+extern int addScenarioSequence(struct bcmScenario *scenario, struct canfd_frame const frames[], int nframes,
+                               struct bcm_timeval ival2, int isCANFD);
+
+/**
+ * Adds a RX filter to a scenario.
+ *
+ * @param scenario - The scenario.
+ * @param canID    - The CAN ID.
+ * @param mask     - The mask of the relevant bits (NULL = every frame of the CAN ID).
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+extern int addScenarioRx(struct bcmScenario *scenario, canid_t canID, struct canfd_frame const* mask, int isCANFD);
+
+/**
+ * Loads a scenario file and checks it with checkScenario.
+ * The first line that can not be read stops the load.
+ *
+ * @param scenario - The scenario.
+ * @param path     - The path of the scenario file.
+ * @return RET_E_OK, ERR_OPEN_FAILED, ERR_SCENARIO_FORMAT, ERR_INVALID_ARGUMENT or ERR_MALLOC_FAILED.
+ */
+extern int loadScenario(struct bcmScenario *scenario, char const *path);
+
+/**
+ * Checks a whole scenario before anything is sent: Every CAN ID is
+ * sent by one task only and received by one filter only, every task has
+ * an interval and a valid frame and the scenario fits in a registry.
+ *
+ * @param scenario - The scenario.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT or ERR_MALLOC_FAILED.
+ */
+extern int checkScenario(struct bcmScenario const* scenario);
+
+/**
+ * Makes the tasks of a context match a scenario.
+ * The scenario is checked first, an invalid scenario changes nothing.
+ * Only the differences to the registry are sent: Deletes for the tasks
+ * that are not in the scenario, payload updates for cyclic tasks whose
+ * timers did not change and setups for everything else. The setups are
+ * sent in batches, with an io_uring all messages are one submit.
+ *
+ * Note: Only the tasks in the registry are known. Call it from the thread
+ * that owns the context, like the other create functions.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param scenario - The scenario.
+ * @param diff     - Storage for what was changed (NULL = not needed).
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT, ERR_MALLOC_FAILED or ERR_TX_SETUP_FAILED if a task could not be set up
+ *         or deleted.
+ */
+extern int applyScenario(struct bcmContext *ctx, struct bcmScenario const* scenario, struct bcmScenarioDiff *diff);
+
+
+#endif //CANFD_BCM_SCENARIO_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,160 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Shm.h
+ \brief     Provides the shared memory transport of the operation and event
+            queues to a simulation in another process.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_SHM_H
+#define CANFD_BCM_SHM_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Worker.h"
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/un.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define SHM_MAGIC     0x4D484342u // "BCHM", marks a mapping of this transport
+#define SHM_VERSION   1u          // Changes with the layout of the header, the rings or the records
+#define SHM_PATH_SIZE 108         // Size of sun_path of struct sockaddr_un, the longest path including the terminator
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the header at the start of the shared memory.
+ * The operation ring and the event ring follow the header, each on its
+ * own cache line. The simulation checks the header before it uses the rings.
+ *
+ * Note: Like the rings the header has no pointers, the two processes
+ * map the memory at different addresses.
+ */
+struct bcmShmHeader{
+    uint32_t magic;                   // SHM_MAGIC
+    uint32_t version;                 // SHM_VERSION
+    uint32_t operationSize;           // sizeof(struct bcmOperation) of the gateway
+    uint32_t eventSize;               // sizeof(struct bcmEvent) of the gateway
+    uint64_t size;                    // The size of the whole mapping
+    uint64_t operationOffset;         // The offset of the operation ring
+    uint64_t eventOffset;             // The offset of the event ring
+
+    struct bcmDoorbell eventDoorbell; // The simulation sleeps on it until events arrive
+};
+
+/**
+ * Struct for one side of the shared memory transport.
+ *
+ * The gateway creates a memfd with the header and the two rings and listens
+ * on a unix socket. A simulation that connects gets the memfd and the eventfd
+ * of the operation queue with SCM_RIGHTS and maps the same memory.
+ * After that the records are copied straight into the rings, there is no
+ * serialization and no socket in the path of a frame:
+ *
+ *  - The simulation enqueues operations with enqueueOperations, the eventfd
+ *    wakes up the event loop of the gateway like for an in-process simulation.
+ *  - The event loop enqueues events and rings the futex doorbell with
+ *    notifyEvents, the simulation sleeps in waitEvents.
+ *
+ * Note: The rings are single-producer/single-consumer, so only one
+ * simulation may use a transport at a time.
+ */
+struct bcmShm{
+    struct bcmShmHeader *header;             // The mapping, starts with the header (NULL = not mapped)
+    size_t size;                             // The size of the mapping, kept out of the shared header
+    int memFD;                               // The memfd of the mapping
+    int listenFD;                            // Gateway: The socket the simulation connects to (-1 = none)
+    char path[SHM_PATH_SIZE];                // Gateway: The path of the socket
+
+    struct bcmOperationQueue operationQueue; // The operation ring in the mapping and its eventfd
+    struct bcmEventQueue eventQueue;         // The event ring in the mapping and its doorbell
+    struct bcmWorker *worker;                // Gateway: The worker that uses the rings (NULL = none)
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Initializes a transport that is not set up.
+ * It is safe to call closeShmChannel on an initialized transport.
+ *
+ * @param shm - The transport.
+ */
+extern void initShmChannel(struct bcmShm *shm);
+
+/**
+ * Creates the shared memory with both rings and listens for the simulation.
+ * The size of the memfd is sealed, so the simulation can not shrink the
+ * memory under the gateway.
+ *
+ * @param shm               - The initialized transport.
+ * @param path              - The path of the unix socket the simulation connects to.
+ * @param operationCapacity - The number of operations the queue can hold (power of two).
+ * @param eventCapacity     - The number of events the queue can hold (power of two).
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT, ERR_SHM_FAILED, ERR_MMAP_FAILED, ERR_EVENTFD_FAILED, ERR_SOCKET_FAILED
+ *         or ERR_BIND_FAILED.
+ */
+extern int createShmChannel(struct bcmShm *shm, char const *path, uint32_t operationCapacity, uint32_t eventCapacity);
+
+/**
+ * Waits for a simulation and hands it the memfd and the eventfd.
+ * The connection is closed afterwards, the rings are all that is shared.
+ *
+ * @param shm       - The transport created with createShmChannel.
+ * @param timeoutMs - The maximum time to wait in milliseconds (-1 = no timeout).
+ * @return RET_E_OK, ERR_SHM_FAILED if no simulation connected in time or ERR_WRITE_FAILED.
+ */
+extern int acceptShmChannel(struct bcmShm *shm, int timeoutMs);
+
+/**
+ * Connects a simulation to the transport of a gateway and maps its memory.
+ * The header is checked, a gateway built with other records is rejected.
+ *
+ * @param shm  - The initialized transport.
+ * @param path - The path of the unix socket of the gateway.
+ * @return RET_E_OK, ERR_SOCKET_FAILED, ERR_RECV_FAILED, ERR_MMAP_FAILED or ERR_SHM_FAILED.
+ */
+extern int connectShmChannel(struct bcmShm *shm, char const *path);
+
+/**
+ * Replaces the queues of a worker with the rings of the transport.
+ * The channels of the worker already use the event queue of the worker,
+ * so their events go to the simulation in the other process.
+ *
+ * Note: Attach before the worker runs. Call closeShmChannel before
+ * freeWorkers, the worker must not free the shared rings.
+ *
+ * @param shm    - The transport created with createShmChannel.
+ * @param worker - The set up worker that is not running.
+ */
+extern void attachShmChannel(struct bcmShm *shm, struct bcmWorker *worker);
+
+/**
+ * Detaches the worker, unmaps the memory and closes the descriptors.
+ * The gateway removes the socket path.
+ *
+ * @param shm - The transport.
+ */
+extern void closeShmChannel(struct bcmShm *shm);
+
+
+#endif //CANFD_BCM_SHM_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
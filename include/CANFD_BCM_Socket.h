@@ -32,6 +32,79 @@
  */
 extern int setupSocket(int *socketFD, struct sockaddr_can *addr, int isBlocking);
 
+/**
+ * Creates a CAN/CANFD BCM socket on the given interface.
+ * Works like setupSocket but the interface is chosen at runtime.
+ *
+ * @param socketFD   - Storage for the created socket descriptor
+ * @param addr       - Storage for the sockaddr_can of the socket
+ * @param ifname     - The name of the interface e.g. "vcan0"
+ * @param isBlocking - Flag for blocking
+ */
+extern int setupSocketOnInterface(int *socketFD, struct sockaddr_can *addr, char const *ifname, int isBlocking);
+
+/**
+ * Creates a CAN_RAW socket on the given interface for sending only.
+ * CANFD frames are enabled and the receive filter is empty, so the
+ * socket never queues received frames. The socket is blocking.
+ *
+ * @param socketFD   - Storage for the created socket descriptor
+ * @param ifname     - The name of the interface e.g. "vcan0"
+ */
+extern int setupRawSocketOnInterface(int *socketFD, char const *ifname);
+
+/**
+ * Sets the receive and send buffer sizes of a socket.
+ * SO_RCVBUFFORCE/SO_SNDBUFFORCE are used if the process has CAP_NET_ADMIN,
+ * otherwise the sizes are capped by net.core.rmem_max/wmem_max with a warning.
+ * The BCM and CAN_RAW sockets of a channel get SOCKET_RCVBUF/SOCKET_SNDBUF
+ * when they are created.
+ *
+ * Note: Each BCM message takes a whole skb in the receive buffer, so the
+ * buffer holds far fewer messages than its size suggests. Watch the rx
+ * overruns counter under the heaviest burst to size it.
+ *
+ * @param socketFD - The socket descriptor
+ * @param rcvbuf   - The receive buffer size in bytes (0 = unchanged)
+ * @param sndbuf   - The send buffer size in bytes (0 = unchanged)
+ * @return RET_E_OK or ERR_SETSOCKOPT_FAILED
+ */
+extern int setSocketBuffers(int socketFD, int rcvbuf, int sndbuf);
+
+/**
+ * Returns the buffer sizes of a socket like the kernel reports them,
+ * i. e. twice the requested sizes.
+ *
+ * @param socketFD - The socket descriptor
+ * @param rcvbuf   - Storage for the receive buffer size in bytes
+ * @param sndbuf   - Storage for the send buffer size in bytes
+ * @return RET_E_OK or ERR_SETSOCKOPT_FAILED
+ */
+extern int getSocketBuffers(int socketFD, int *rcvbuf, int *sndbuf);
+
+/**
+ * Returns the TX queue length of an interface (txqueuelen), the number of
+ * frames the interface queues before a send fails with ENOBUFS.
+ *
+ * @param socketFD - A socket descriptor for the ioctl
+ * @param ifname   - The name of the interface
+ * @return The TX queue length in frames or ERR_IF_NOT_FOUND
+ */
+extern int getInterfaceTxQueueLength(int socketFD, char const *ifname);
+
+/**
+ * Returns the ifindex of an interface.
+ * The result is cached so the ioctl is only done once per interface.
+ *
+ * Note: If an interface is removed and created again it can get a new
+ * ifindex. The cache does not notice that.
+ *
+ * @param socketFD - A socket descriptor for the ioctl
+ * @param ifname   - The name of the interface
+ * @return The ifindex or ERR_IF_NOT_FOUND
+ */
+extern int getInterfaceIndex(int socketFD, char const *ifname);
+
 
 #endif //CANFD_BCM_SOCKET_H
 
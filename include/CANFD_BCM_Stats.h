@@ -0,0 +1,254 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Stats.h
+ \brief     Provides lock-free counters and latency histograms for the event loops.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_STATS_H
+#define CANFD_BCM_STATS_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+
+/**
+ * Defines the layout of the log-linear histograms.
+ * Values below STATS_SUB_BUCKETS get a bucket each. Above that every power
+ * of two is split into STATS_SUB_BUCKETS buckets, so the relative error is
+ * below 1 / STATS_SUB_BUCKETS. Values with more than STATS_MAX_BITS bits
+ * are counted in the last bucket.
+ */
+#define STATS_SUB_BITS    4
+#define STATS_SUB_BUCKETS (1 << STATS_SUB_BITS)
+#define STATS_MAX_BITS    40
+#define STATS_BUCKETS     ((STATS_MAX_BITS - STATS_SUB_BITS + 1) * STATS_SUB_BUCKETS)
+
+/**
+ * Defines how many threads can record statistics.
+ * The workers, the main thread, the bridge and one spare for the simulation.
+ */
+#define STATS_MAX_SLOTS   (MAX_CHANNELS + 3)
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * The counters of the statistics.
+ */
+enum bcmStatsCounter{
+    STATS_OPERATIONS,      // Operations dequeued from the simulation
+    STATS_SENDS,           // Calls of send and sendmmsg
+    STATS_SEND_ERRORS,     // Calls of send and sendmmsg that failed
+    STATS_RECEIVES,        // Calls of recv and recvmmsg
+    STATS_RECEIVES_EAGAIN, // Calls of recv and recvmmsg that found nothing
+    STATS_MESSAGES,        // Received BCM messages
+    STATS_EVENTS,          // Events put in the queue to the simulation
+    STATS_EVENTS_DROPPED,  // Events dropped because the queue was full
+    STATS_UPDATES_SKIPPED, // TX_SETUP updates skipped because the data was unchanged
+    STATS_WAKEUPS,         // Number of times epoll_wait returned
+    STATS_IDLE_WAKEUPS,    // Number of wakeups that did not process anything
+    STATS_BUSY_POLLS,      // Number of busy poll rounds that found work
+    STATS_REPLAY_FRAMES,   // Frames handed to the TX path by the log replay
+    STATS_CAPTURED,        // Received messages put in the queue to the capture writer
+    STATS_CAPTURE_DROPPED, // Received messages dropped because the capture queue was full
+    STATS_DECODED,         // Received frames decoded into signal values with the DBC
+    STATS_URING_QUEUED,    // Control messages queued on an io_uring
+    STATS_URING_SUBMITS,   // Calls of io_uring_enter
+    STATS_SEND_RETRIES,    // Sends of control messages that were held back after a transient error
+    STATS_RETRY_DROPPED,   // Control messages given up because the retry queue was full or out of attempts
+    STATS_RECV_ERRORS,     // Failed receives and received messages of unexpected size or opcode
+    STATS_RX_OVERRUNS,     // BCM messages the kernel dropped because the receive buffer was full (SO_RXQ_OVFL)
+    STATS_TX_QUEUE_FULL,   // Sends that failed with ENOBUFS because the TX queue of the interface was full
+    STATS_BRIDGE_SENT,     // Datagrams sent by the bridge
+    STATS_BRIDGE_RECEIVED, // Datagrams received by the bridge
+    STATS_BRIDGE_LOST,     // Datagrams of the peer that never arrived, counted from the gaps in the sequence
+    STATS_BRIDGE_LATE,     // Datagrams of the peer that arrived after a later one and were dropped
+    STATS_BRIDGE_INVALID,  // Received datagrams or records that were malformed
+    STATS_BRIDGE_REJECTED, // Received datagrams from another source than the expected peer
+    STATS_BRIDGE_DROPPED,  // Records the bridge could not send or enqueue
+    STATS_STEPS,           // Simulation steps of the stepped mode
+    STATS_STEP_FRAMES,     // Frames the stepped mode sent for the cyclic tasks
+    STATS_FANOUT_EVENTS,   // Events put in the rings of the subscribers
+    STATS_FANOUT_MERGED,   // Events of slow subscribers replaced by a later one of the same CAN ID
+    STATS_FANOUT_DROPPED,  // Events of subscribers lost because the ring and the table of latest events were full
+    STATS_COUNTERS         // Number of counters
+};
+
+/**
+ * The high-water marks of the statistics.
+ */
+enum bcmStatsMaximum{
+    STATS_OPERATION_QUEUE_MAX, // Most operations waiting in an operation queue
+    STATS_EVENT_QUEUE_MAX,     // Most events waiting in an event queue
+    STATS_MAXIMA               // Number of high-water marks
+};
+
+/**
+ * The latency histograms of the statistics. All values are in nanoseconds.
+ */
+enum bcmStatsHistogram{
+    STATS_DEQUEUE_TO_SEND, // Time from enqueueOperations until the operation was sent
+    STATS_RX_TO_HANDLER,   // Time from the kernel receive timestamp until the message is handled
+    STATS_SEND_TX_SEND,    // Duration of a send with TX_SEND
+    STATS_SEND_TX_SETUP,   // Duration of a send or sendmmsg with TX_SETUP
+    STATS_SEND_TX_DELETE,  // Duration of a send with TX_DELETE
+    STATS_SEND_RX_SETUP,   // Duration of a send with RX_SETUP
+    STATS_SEND_RX_DELETE,  // Duration of a send with RX_DELETE
+    STATS_SEND_RAW,        // Duration of a sendmmsg on the CAN_RAW socket
+    STATS_REPLAY_LATENESS, // Time the log replay woke up after the deadline of a frame
+    STATS_HISTOGRAMS       // Number of histograms
+};
+
+/**
+ * Struct for a histogram that is written by a single thread.
+ */
+struct bcmHistogram{
+    _Atomic uint64_t counts[STATS_BUCKETS]; // Number of values per bucket
+    _Atomic uint64_t total;                 // Number of values
+    _Atomic uint64_t sum;                   // Sum of the values
+    _Atomic uint64_t max;                   // Largest value
+};
+
+/**
+ * Struct for the statistics of one thread.
+ * Only the owning thread writes the slot, so no read-modify-write is needed.
+ *
+ * Note: Each slot starts on its own cache line to avoid false sharing.
+ */
+struct bcmStatsSlot{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t counters[STATS_COUNTERS]; // The counters
+    _Atomic uint64_t maxima[STATS_MAXIMA];                               // The high-water marks
+    struct bcmHistogram histograms[STATS_HISTOGRAMS];                    // The latency histograms
+};
+
+/**
+ * Struct for a copy of a histogram.
+ */
+struct bcmHistogramSnapshot{
+    uint64_t counts[STATS_BUCKETS]; // Number of values per bucket
+    uint64_t total;                 // Number of values
+    uint64_t sum;                   // Sum of the values
+    uint64_t max;                   // Largest value
+};
+
+/**
+ * Struct for the statistics of all threads at one point in time.
+ */
+struct bcmStatsSnapshot{
+    uint64_t time;                                            // Monotonic time of the snapshot in nanoseconds
+    uint64_t counters[STATS_COUNTERS];                        // The sums of the counters
+    uint64_t maxima[STATS_MAXIMA];                            // The high-water marks
+    struct bcmHistogramSnapshot histograms[STATS_HISTOGRAMS]; // The merged histograms
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Returns the current time of the monotonic clock in nanoseconds.
+ */
+extern uint64_t getStatsTime(void);
+
+/**
+ * Returns the current time of the realtime clock in nanoseconds.
+ * This is the clock of the kernel receive timestamps.
+ */
+extern uint64_t getStatsRealtime(void);
+
+/**
+ * Adds a value to a counter of the calling thread.
+ *
+ * @param counter - The enum bcmStatsCounter.
+ * @param value   - The value that is added.
+ */
+extern void addStatsCounter(int counter, uint64_t value);
+
+/**
+ * Raises a high-water mark of the calling thread.
+ *
+ * @param maximum - The enum bcmStatsMaximum.
+ * @param value   - The current value.
+ */
+extern void updateStatsMaximum(int maximum, uint64_t value);
+
+/**
+ * Records a value in a histogram of the calling thread.
+ *
+ * @param histogram - The enum bcmStatsHistogram.
+ * @param value     - The value in nanoseconds.
+ */
+extern void recordStatsValue(int histogram, uint64_t value);
+
+/**
+ * Records a value in a histogram that is only used by the calling thread.
+ * E.g. for the local measurements of a benchmark.
+ *
+ * @param histogram - The histogram.
+ * @param value     - The value in nanoseconds.
+ */
+extern void addHistogramValue(struct bcmHistogramSnapshot *histogram, uint64_t value);
+
+/**
+ * Returns the send duration histogram of a BCM opcode.
+ *
+ * @param opcode - The opcode of the bcm_msg_head.
+ * @return The enum bcmStatsHistogram or -1 if the opcode is not sent.
+ */
+extern int getSendHistogram(uint32_t opcode);
+
+/**
+ * Takes a snapshot of the statistics of all threads.
+ * The threads keep running, so the values of a snapshot are not
+ * exactly from the same point in time.
+ *
+ * @param snapshot - Storage for the snapshot.
+ */
+extern void getStatsSnapshot(struct bcmStatsSnapshot *snapshot);
+
+/**
+ * Returns the value below which the given share of the values lies.
+ *
+ * @param histogram  - The histogram.
+ * @param percentile - The percentile between 0 and 100.
+ * @return The lower bound of the bucket of the percentile in nanoseconds.
+ */
+extern uint64_t getHistogramPercentile(struct bcmHistogramSnapshot const* histogram, double percentile);
+
+/**
+ * Prints a snapshot.
+ * If a previous snapshot is given, the rates since then are printed too.
+ *
+ * @param snapshot - The snapshot.
+ * @param previous - The previous snapshot or NULL.
+ */
+extern void printStatsSnapshot(struct bcmStatsSnapshot const* snapshot, struct bcmStatsSnapshot const* previous);
+
+/**
+ * Prints the statistics every STATS_DUMP_INTERVAL_MS.
+ * Meant to be called from the event loops. If several threads call it
+ * only one of them prints.
+ */
+extern void dumpStatsPeriodic(void);
+
+
+#endif //CANFD_BCM_STATS_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,252 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Stepper.h
+ \brief     Provides the stepped mode that runs the cyclic TX tasks in
+            simulation time with a hierarchical timer wheel.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_STEPPER_H
+#define CANFD_BCM_STEPPER_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define STEPPER_LEVELS    4                                  // Number of levels of the timer wheel
+#define STEPPER_SLOT_BITS 6                                  // Bits of the tick that select the slot of a level
+#define STEPPER_SLOTS     (1u << STEPPER_SLOT_BITS)          // Number of slots of each level
+#define STEPPER_SPAN      (1ull << (STEPPER_LEVELS * STEPPER_SLOT_BITS)) // Ticks the wheel covers
+#define STEPPER_NONE      UINT32_MAX                         // Marks the end of a slot list and unused links
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+// Note: Defined in CANFD_BCM_Context.h
+struct bcmContext;
+
+/**
+ * Struct for a cyclic transmission task that runs in simulation time.
+ * It mirrors a BCM TX task: The frames are sent one after the other, count
+ * frames with ival1 and then every ival2.
+ */
+struct bcmStepTask{
+    uint64_t ival1;             // First interval in ticks
+    uint64_t ival2;             // Second interval in ticks
+    uint64_t due;               // The tick the next frame is sent at
+    uint64_t expire;            // The tick the entry is checked at, due or the end of the wheel
+    struct canfd_frame *frames; // The frames of the task
+    uint32_t nframes;           // Number of frames
+    uint32_t frameCapacity;     // Number of frames the array has room for
+    uint32_t currentFrame;      // The frame that is sent next
+    uint32_t announceFrame;     // The frame that is sent at the start of the next step (TX_ANNOUNCE)
+    uint32_t count;             // Number of frames that are still sent with ival1
+    uint32_t next;              // The next entry in the slot (STEPPER_NONE = last)
+    uint32_t prev;              // The previous entry in the slot (STEPPER_NONE = first)
+    uint32_t slot;              // The slot of the entry, level * STEPPER_SLOTS + slot (STEPPER_NONE = timer stopped)
+    canid_t canID;              // The CAN ID in the bcm_msg_head of the task
+    uint8_t isCANFD;            // Flag for CANFD frames
+    uint8_t isUsed;             // The entry holds a key of the table
+    uint8_t isActive;           // The task exists (cleared by TX_DELETE, the key stays in the table)
+    uint8_t isRunning;          // The timer of the task runs
+    uint8_t isAnnounced;        // The task is in the announced list
+};
+
+/**
+ * Struct for the stepped mode of a channel.
+ *
+ * The TX_SETUP and TX_DELETE messages of the context are not sent to the
+ * BCM. The stepper applies them to its own tasks like the BCM would, the
+ * registry of the context is kept as usual. Each step advances the timer
+ * wheel by the simulated time and sends every frame that got due with one
+ * TX_SEND batch, in the order of their due times. The BCM RX filters stay
+ * in the kernel.
+ *
+ * Note: Like the watchdog the table has no deletion. A deleted task keeps
+ * its entry and its frames, so setting it up again needs no memory.
+ */
+struct bcmStepper{
+    struct bcmStepTask *tasks;                       // The open addressing table of the tasks
+    uint32_t mask;                                   // The number of entries - 1
+    uint32_t shift;                                  // 64 - log2 of the number of entries (fibonacci hashing)
+    uint32_t nused;                                  // Number of entries that hold a key
+    uint32_t capacity;                               // Maximum number of keys (half of the entries)
+    uint32_t nrunning;                               // Number of tasks with a running timer
+
+    uint32_t wheel[STEPPER_LEVELS][STEPPER_SLOTS];   // The first entry of each slot (STEPPER_NONE = empty)
+    uint64_t tick;                                   // The current tick
+    uint64_t now;                                    // The simulation time in nanoseconds
+
+    uint32_t *announced;                             // The tasks whose frame is sent at the start of the next step
+    uint32_t nannounced;                             // Number of announced tasks
+
+    struct canfd_frame *batch;                       // The frames of the step that were not sent yet
+    uint8_t *batchIsCANFD;                           // Flag for CANFD frames of each frame of the batch
+    uint32_t nbatch;                                 // Number of frames in the batch
+    uint32_t sent;                                   // Number of frames the current step sent
+    uint32_t failed;                                 // Number of frames the current step could not send
+};
+
+/**
+ * Struct for the sequencer of a channel that uses the kernel timers.
+ *
+ * The BCM can not run a sequence of more than MAXFRAMES frames in one task
+ * and several tasks do not keep the order of the frames. The sequencer runs
+ * such a sequence from the one timer of a stepper task instead, whose
+ * simulation time follows the monotonic clock. A timerfd in the event loop
+ * of the worker expires when the next frame is due. The TX_SETUP and
+ * TX_DELETE messages of the CAN IDs it runs are applied to it, all others
+ * still go to the BCM.
+ */
+struct bcmSequencer{
+    struct bcmStepper stepper; // The tasks of the long sequences
+    uint64_t origin;           // The monotonic time in nanoseconds the simulation time of the stepper starts at
+    int timerFD;               // The timerfd that expires when the next frame is due (-1 = not set up)
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Allocates the table and the batch of a stepper and starts the simulation
+ * time at 0. The stepper is used by a channel by attaching it to
+ * ctx->stepper before any TX task is set up.
+ *
+ * @param stepper  - The stepper.
+ * @param capacity - Maximum number of cyclic transmission tasks, a sequence counts as one task.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT or ERR_MALLOC_FAILED.
+ */
+extern int setupStepper(struct bcmStepper *stepper, uint32_t capacity);
+
+/**
+ * Frees the table and the batch of a stepper.
+ * It is safe to call freeStepper on a zeroed or already freed stepper.
+ *
+ * @param stepper - The stepper.
+ */
+extern void freeStepper(struct bcmStepper *stepper);
+
+/**
+ * Applies a TX_SETUP or TX_DELETE message to the tasks of the stepper
+ * instead of sending it. Called by the send path for every control message.
+ *
+ * @param stepper - The stepper.
+ * @param msg     - The message that starts with a bcm_msg_head.
+ * @param size    - The size of the message.
+ * @return 1 if the message was applied, 0 if it must be sent to the BCM or
+ *         -1 with errno set if the BCM would reject it.
+ */
+extern int holdStepMessage(struct bcmStepper *stepper, void const *msg, size_t size);
+
+/**
+ * Sets up a cyclic transmission task of a sequence like a TX_SETUP with
+ * SETTIMER and STARTTIMER, but without the MAXFRAMES limit of the BCM.
+ * All frames run from the one timer of the task, so they keep their order.
+ * The task key is the CAN ID of the first frame.
+ *
+ * @param stepper - The stepper.
+ * @param frames  - The frames of the sequence (the CAN frames in canfd_frame structs).
+ * @param nframes - The number of frames.
+ * @param count   - Number of frames sent with ival1.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return 1 or -1 with errno set if the BCM would reject the task.
+ */
+extern int holdStepSequence(struct bcmStepper *stepper, struct canfd_frame const frames[], uint32_t nframes,
+                            uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD);
+
+/**
+ * Advances the simulation time of a channel by one step. The frames that
+ * got due are sent with one TX_SEND batch, then an EVENT_STEP_DONE is put
+ * in the event queue of the context.
+ *
+ * Note: Call it from the thread that owns the context, like the create functions.
+ *
+ * @param ctx      - The context with an attached stepper.
+ * @param duration - The simulated time of the step in nanoseconds.
+ * @return The number of frames that could not be sent.
+ */
+extern int stepChannel(struct bcmContext *ctx, uint64_t duration);
+
+/**
+ * Allocates the table of a sequencer and creates its timerfd. The sequencer
+ * is used by a channel by attaching it to ctx->sequencer before the event
+ * loop starts, the loop watches its timerfd.
+ *
+ * @param sequencer - The sequencer.
+ * @param capacity  - Maximum number of long sequences.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT, ERR_MALLOC_FAILED or ERR_EPOLL_FAILED.
+ */
+extern int setupSequencer(struct bcmSequencer *sequencer, uint32_t capacity);
+
+/**
+ * Closes the timerfd and frees the table of a sequencer.
+ * It is safe to call freeSequencer on a zeroed or already freed sequencer.
+ *
+ * @param sequencer - The sequencer.
+ */
+extern void freeSequencer(struct bcmSequencer *sequencer);
+
+/**
+ * Applies a TX_SETUP or TX_DELETE message to the sequencer of a context if
+ * the sequencer runs the task of its CAN ID. Called by the send path for
+ * every control message.
+ *
+ * @param ctx  - The context with an attached sequencer.
+ * @param msg  - The message that starts with a bcm_msg_head.
+ * @param size - The size of the message.
+ * @return 1 if the message was applied, 0 if it must be sent to the BCM or
+ *         -1 with errno set if the BCM would reject it.
+ */
+extern int holdSequencerMessage(struct bcmContext *ctx, void const *msg, size_t size);
+
+/**
+ * Sets up a long sequence in the sequencer of a context like holdStepSequence.
+ * The first frame is sent right away like with STARTTIMER.
+ *
+ * @param ctx     - The context with an attached sequencer.
+ * @param frames  - The frames of the sequence (the CAN frames in canfd_frame structs).
+ * @param nframes - The number of frames.
+ * @param count   - Number of frames sent with ival1.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return 1 or -1 with errno set if the BCM would reject the task.
+ */
+extern int holdSequencerSequence(struct bcmContext *ctx, struct canfd_frame const frames[], uint32_t nframes,
+                                 uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD);
+
+/**
+ * Sends the frames of the sequencer of a context that got due. Called by
+ * the event loop when the timerfd of the sequencer expired.
+ *
+ * Note: Call it from the thread that owns the context, like the create functions.
+ *
+ * @param ctx - The context with an attached sequencer.
+ * @return The number of frames that were sent.
+ */
+extern int runSequencer(struct bcmContext *ctx);
+
+
+#endif //CANFD_BCM_STEPPER_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,192 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Uring.h
+ \brief     Provides the io_uring backend for the BCM control messages and the multishot receive.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_URING_H
+#define CANFD_BCM_URING_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Context.h"
+#include <linux/io_uring.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define URING_RECV_TAG     UINT64_MAX // The user_data of the multishot receive
+#define URING_BUFFER_GROUP 0          // The provided buffer group of the multishot receive
+
+/**
+ * Defines the size of a receive buffer of the multishot receive.
+ * The kernel puts the io_uring_recvmsg_out header, the control messages
+ * and the BCM message one after the other in the buffer.
+ */
+#define URING_BUFFER_SIZE                                                                                     \
+    ((sizeof(struct io_uring_recvmsg_out) + sizeof(union bcmRxControl) + sizeof(struct bcmMsgSingleFrameCanFD) \
+      + CACHE_LINE_SIZE - 1) & ~(size_t) (CACHE_LINE_SIZE - 1))
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for a control message that was handed to the kernel.
+ * The message is copied into the slot, so the caller can reuse its buffer
+ * right away. The slot is released when the completion was processed.
+ */
+struct bcmUringSlot{
+    struct bcmMsgSingleFrameCanFD msg; // The message, a single frame message is the largest that fits
+    struct iovec iov;                  // The iovec of the message
+    struct msghdr hdr;                 // The header of the sendmsg
+    uint64_t queued;                   // Monotonic time the message was queued in nanoseconds
+    uint32_t next;                     // The next free slot (UINT32_MAX = none)
+};
+
+/**
+ * Struct for the io_uring of a BCM socket.
+ *
+ * The control messages are queued as IORING_OP_SENDMSG entries and
+ * submitted together with one io_uring_enter. Their results come back as
+ * completions and are handed to processControlCompletion. If the ring
+ * receives, one multishot IORING_OP_RECVMSG with provided buffers replaces
+ * the recvmmsg calls on the socket.
+ *
+ * Note: The BCM handles a sendmsg right away and never waits, so the kernel
+ * applies the messages in the order they were queued.
+ */
+struct bcmUring{
+    int ringFD;                        // The io_uring file descriptor (-1 = not set up)
+    struct bcmContext *ctx;            // The context of the BCM socket
+
+    void *sqRing;                      // The mapping of the submission ring
+    size_t sqRingSize;                 // The size of the mapping of the submission ring
+    uint32_t *sqHead;                  // The head of the submission ring (written by the kernel)
+    uint32_t *sqTail;                  // The tail of the submission ring
+    uint32_t *sqArray;                 // The indices of the submission entries
+    uint32_t *sqFlags;                 // The flags of the submission ring (written by the kernel)
+    uint32_t sqMask;                   // The number of submission entries - 1
+    uint32_t sqEntries;                // The number of submission entries
+    struct io_uring_sqe *sqes;         // The submission entries
+    size_t sqesSize;                   // The size of the mapping of the submission entries
+
+    void *cqRing;                      // The mapping of the completion ring (may be the one of the submission ring)
+    size_t cqRingSize;                 // The size of the mapping of the completion ring
+    uint32_t *cqHead;                  // The head of the completion ring
+    uint32_t *cqTail;                  // The tail of the completion ring (written by the kernel)
+    uint32_t cqMask;                   // The number of completion entries - 1
+    struct io_uring_cqe *cqes;         // The completion entries
+
+    struct bcmUringSlot *slots;        // The slots of the messages in flight
+    uint32_t nslots;                   // The number of slots
+    uint32_t freeSlot;                 // The first free slot (UINT32_MAX = none)
+    uint32_t queued;                   // Number of entries that were not submitted yet
+    uint32_t inflight;                 // Number of messages whose completion was not processed yet
+    int depth;                         // Nesting of beginUringBatch, the entries are submitted at 0
+
+    struct io_uring_buf_ring *bufRing; // The ring of the provided receive buffers (NULL = no receive)
+    unsigned char *buffers;            // The receive buffers of URING_BUFFER_SIZE bytes
+    uint32_t nbuffers;                 // The number of receive buffers (power of two)
+    uint16_t bufTail;                  // The tail of the ring of the provided buffers
+    int isReceiving;                   // The multishot receive is armed
+    struct msghdr recvHdr;             // The header that tells the multishot receive the size of the control messages
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Creates an io_uring for the BCM socket of a context.
+ * The ring is used by a channel by attaching it to ctx->uring.
+ *
+ * @param uring    - The io_uring.
+ * @param ctx      - The context with an already created socket.
+ * @param entries  - The number of submission entries and message slots (power of two).
+ * @param nbuffers - The number of receive buffers of the multishot receive (power of two, 0 = no receive).
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT, ERR_URING_FAILED or ERR_MALLOC_FAILED.
+ */
+extern int setupUring(struct bcmUring *uring, struct bcmContext *ctx, uint32_t entries, uint32_t nbuffers);
+
+/**
+ * Waits for all messages in flight and frees the io_uring.
+ * It is safe to call freeUring on a zeroed or already freed io_uring.
+ *
+ * @param uring - The io_uring.
+ */
+extern void freeUring(struct bcmUring *uring);
+
+/**
+ * Queues a control message. It is submitted right away unless a batch is
+ * open. If all slots are in flight the oldest completions are waited for.
+ *
+ * @param uring - The io_uring.
+ * @param msg   - The message that starts with a bcm_msg_head.
+ * @param size  - The size of the message.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if the message does not fit in a slot.
+ */
+extern int queueUringMessage(struct bcmUring *uring, void const *msg, size_t size);
+
+/**
+ * Opens a batch. The messages queued until the matching endUringBatch
+ * are submitted with one io_uring_enter.
+ *
+ * @param uring - The io_uring.
+ */
+extern void beginUringBatch(struct bcmUring *uring);
+
+/**
+ * Closes a batch and submits the queued messages when the outermost
+ * batch is closed.
+ *
+ * @param uring - The io_uring.
+ */
+extern void endUringBatch(struct bcmUring *uring);
+
+/**
+ * Submits the queued messages and waits until the completions of all
+ * messages in flight were processed.
+ *
+ * @param uring - The io_uring.
+ */
+extern void flushUring(struct bcmUring *uring);
+
+/**
+ * Arms the multishot receive on the socket of the context.
+ * Only has an effect if the ring was set up with receive buffers.
+ *
+ * @param uring - The io_uring.
+ * @return RET_E_OK or ERR_URING_FAILED.
+ */
+extern int startUringReceive(struct bcmUring *uring);
+
+/**
+ * Processes the available completions without waiting: The results of the
+ * control messages go to processControlCompletion, the received messages
+ * to processReceivedMessage. The multishot receive is armed again if the
+ * kernel stopped it.
+ *
+ * @param uring - The io_uring.
+ * @return The number of processed completions.
+ */
+extern int processUring(struct bcmUring *uring);
+
+
+#endif //CANFD_BCM_URING_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
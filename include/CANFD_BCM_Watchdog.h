@@ -0,0 +1,181 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Watchdog.h
+ \brief     Provides the supervision of cyclic RX CAN IDs with a hierarchical timer wheel.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_WATCHDOG_H
+#define CANFD_BCM_WATCHDOG_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include <linux/can.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define WATCHDOG_LEVELS    4                                   // Number of levels of the timer wheel
+#define WATCHDOG_SLOT_BITS 6                                   // Bits of the tick that select the slot of a level
+#define WATCHDOG_SLOTS     (1u << WATCHDOG_SLOT_BITS)          // Number of slots of each level
+#define WATCHDOG_SPAN      (1ull << (WATCHDOG_LEVELS * WATCHDOG_SLOT_BITS)) // Ticks the wheel covers
+#define WATCHDOG_NONE      UINT32_MAX                          // Marks the end of a slot list and unused links
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+// Note: Defined in CANFD_BCM_Context.h
+struct bcmContext;
+
+/**
+ * Struct for a supervised CAN ID.
+ * The entries of a slot of the timer wheel are a doubly linked list of
+ * indices, so an entry can be moved to another slot in constant time.
+ */
+struct bcmWatchEntry{
+    uint64_t cycle;     // The expected cycle in nanoseconds (0 = only supervised by BCM RX_TIMEOUT)
+    uint64_t lastSeen;  // Monotonic time of the tick the ID was last seen in
+    uint64_t lostAt;    // Monotonic time of the tick the ID was lost in
+    uint64_t expire;    // The tick the entry is checked at
+    uint32_t next;      // The next entry in the slot (WATCHDOG_NONE = last)
+    uint32_t prev;      // The previous entry in the slot (WATCHDOG_NONE = first)
+    uint32_t slot;      // The slot of the entry, level * WATCHDOG_SLOTS + slot (WATCHDOG_NONE = not scheduled)
+    uint32_t missed;    // Number of cycles missed in a row
+    canid_t canID;      // The CAN ID with CAN_EFF_FLAG for extended frames
+    uint8_t isCANFD;    // Flag for CANFD frames
+    uint8_t isUsed;     // The entry holds a key of the table
+    uint8_t isWatched;  // The ID is supervised (cleared by unwatchCanID, the key stays in the table)
+    uint8_t isLost;     // The ID is lost
+    uint8_t isReported; // The simulation got an EVENT_ID_LOST for the ID
+    uint8_t isPending;  // The state changed and is reported with the next tick
+    uint16_t reserved;  // Unused, keeps the layout explicit
+};
+
+/**
+ * Struct for the supervision of the cyclic RX CAN IDs of a channel.
+ *
+ * The watchdog only looks at the IDs once per tick: A received frame just
+ * stores the time of the current tick, the timer wheel finds the IDs whose
+ * deadline passed. Lost and recovered IDs are collected and reported with
+ * the next tick. If the whole bus is silent, the lost IDs are merged into
+ * one EVENT_BUS_SILENT instead of one EVENT_ID_LOST per ID.
+ *
+ * Note: The table has no deletion. An unwatched ID keeps its entry, so the
+ * probe sequences stay intact and watching it again needs no memory.
+ */
+struct bcmWatchdog{
+    struct bcmWatchEntry *entries;                      // The open addressing table of the entries
+    uint32_t mask;                                      // The number of entries - 1
+    uint32_t shift;                                     // 64 - log2 of the number of entries (fibonacci hashing)
+    uint32_t nused;                                     // Number of entries that hold a key
+    uint32_t capacity;                                  // Maximum number of keys (half of the entries)
+
+    uint32_t wheel[WATCHDOG_LEVELS][WATCHDOG_SLOTS];    // The first entry of each slot (WATCHDOG_NONE = empty)
+    uint64_t tick;                                      // The current tick
+    uint64_t start;                                     // Monotonic time of tick 0 in nanoseconds
+    uint64_t now;                                       // Monotonic time of the current tick in nanoseconds
+
+    uint32_t *pending;                                  // The entries whose state changed since the last report
+    uint32_t npending;                                  // Number of pending entries
+    uint32_t nlost;                                     // Number of lost IDs
+
+    uint64_t lastFrame;                                 // Monotonic time of the tick the last frame was received in
+    uint64_t silentSince;                               // The lastFrame of a silent bus
+    int isSilent;                                       // Flag for a silent bus
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Allocates the table of a watchdog and starts its timer wheel at the
+ * current time. The watchdog is used by a channel by attaching it to
+ * ctx->watchdog before the event loop starts.
+ *
+ * @param watchdog - The watchdog.
+ * @param capacity - Maximum number of supervised CAN IDs.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT or ERR_MALLOC_FAILED.
+ */
+extern int setupWatchdog(struct bcmWatchdog *watchdog, uint32_t capacity);
+
+/**
+ * Frees the table of a watchdog.
+ * It is safe to call freeWatchdog on a zeroed or already freed watchdog.
+ *
+ * @param watchdog - The watchdog.
+ */
+extern void freeWatchdog(struct bcmWatchdog *watchdog);
+
+/**
+ * Starts the supervision of a CAN ID. The ID counts as seen now.
+ * An ID that is already supervised gets the new cycle.
+ *
+ * Note: Only the event loop of the channel may change a watchdog that is
+ * attached to a context. IDs with a content filter (createRxSetupMask) are
+ * not reported on every frame, supervise them with cycle 0 and a BCM timer.
+ *
+ * @param watchdog - The watchdog.
+ * @param canID    - The CAN ID with CAN_EFF_FLAG for extended frames.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param cycleUs  - The expected cycle in microseconds (0 = only lost on a BCM RX_TIMEOUT).
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if the watchdog is full.
+ */
+extern int watchCanID(struct bcmWatchdog *watchdog, canid_t canID, int isCANFD, uint64_t cycleUs);
+
+/**
+ * Stops the supervision of a CAN ID. A lost ID is not reported as recovered.
+ *
+ * @param watchdog - The watchdog.
+ * @param canID    - The CAN ID with CAN_EFF_FLAG for extended frames.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if the ID is not supervised.
+ */
+extern int unwatchCanID(struct bcmWatchdog *watchdog, canid_t canID, int isCANFD);
+
+/**
+ * Notes a received frame. Called by the receive path for every RX_CHANGED.
+ *
+ * @param watchdog - The watchdog.
+ * @param canID    - The CAN ID of the frame.
+ * @param isCANFD  - Flag for CANFD frames.
+ */
+extern void noteWatchdogFrame(struct bcmWatchdog *watchdog, canid_t canID, int isCANFD);
+
+/**
+ * Notes a BCM RX_TIMEOUT. A supervised ID is lost immediately and
+ * reported with the next tick.
+ *
+ * @param watchdog - The watchdog.
+ * @param canID    - The CAN ID of the timeout.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @return 1 if the ID is supervised, 0 if the timeout should be reported as it is.
+ */
+extern int noteWatchdogTimeout(struct bcmWatchdog *watchdog, canid_t canID, int isCANFD);
+
+/**
+ * Advances the timer wheel to the current time and puts the changes since
+ * the last tick in the event queue of the context: EVENT_BUS_SILENT,
+ * EVENT_BUS_ACTIVE, EVENT_ID_LOST and EVENT_ID_RECOVERED.
+ *
+ * @param ctx - The context the watchdog is attached to.
+ * @param now - The monotonic time in nanoseconds.
+ * @return The number of events.
+ */
+extern int tickWatchdog(struct bcmContext *ctx, uint64_t now);
+
+
+#endif //CANFD_BCM_WATCHDOG_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,218 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Worker.h
+ \brief     Provides the event loop and the worker threads that serve the channels.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+#ifndef CANFD_BCM_WORKER_H
+#define CANFD_BCM_WORKER_H
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Queue.h"
+#include <pthread.h>
+#include <stdint.h>
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+struct bcmWorkers;
+
+// Note: Defined in CANFD_BCM_Fanout.h
+struct bcmFanout;
+
+/**
+ * Struct for a worker that runs the event loop for a group of channels.
+ * A worker owns its channels and queues, so workers never share state.
+ *
+ * Note: Each worker starts on its own cache line to avoid false sharing
+ * between workers that run on different cores.
+ */
+struct bcmWorker{
+    _Alignas(CACHE_LINE_SIZE) _Atomic int running; // Cleared to stop the event loop
+    int retCode;                                   // The result of the event loop
+    int cpu;                                       // CPU the worker is pinned to (-1 = no pinning)
+    int priority;                                  // SCHED_FIFO priority (0 = default scheduler)
+    int hasThread;                                 // Flag for a started worker thread
+    pthread_t thread;                              // The worker thread
+
+    struct bcmContext *contexts[MAX_CHANNELS];     // The contexts of the channels indexed by channel handle
+    int ncontexts;                                 // Number of channels served by the worker
+
+    struct bcmOperationQueue operationQueue;       // Operations from the simulation for the channels of the worker
+    struct bcmEventQueue eventQueue;               // Events of the channels of the worker to the simulation
+    struct bcmFanout *fanout;                      // The subscribers of the RX events of the channels (NULL = none)
+
+    struct bcmWorkers *group;                      // The group the worker belongs to
+};
+
+/**
+ * Struct for the group of workers of the process.
+ */
+struct bcmWorkers{
+    struct bcmWorker workers[MAX_CHANNELS]; // The workers
+    int nworkers;                           // Number of set up workers
+};
+
+
+/*******************************************************************************
+ * FUNCTION DECLARATIONS
+ ******************************************************************************/
+
+/**
+ * Processes the pending operations of the queue from the simulation.
+ * Up to OPERATION_BATCH_SIZE operations are processed per call.
+ * Each operation is sent on the socket of its channel.
+ * Consecutive TX operations of the same kind and channel are sent as one batch.
+ *
+ * @param worker - The worker that serves the channels.
+ * @return The number of processed operations.
+ */
+extern int processOperation(struct bcmWorker *worker);
+
+/**
+ * Processes the timeout of a cyclic CAN/CANFD message.
+ *
+ * @param ctx       - The context of the BCM socket.
+ * @param msg       - The received timeout message from the BCM socket.
+ * @param timestamp - The receive time in nanoseconds.
+ */
+extern void processTimeout(struct bcmContext *ctx, struct bcmMsgSingleFrameCanFD const* msg, uint64_t timestamp);
+
+/**
+ * Processes the content change of a CAN/CANFD message.
+ *
+ * @param ctx       - The context of the BCM socket.
+ * @param msg       - The received content change message from the BCM socket.
+ * @param timestamp - The receive time in nanoseconds.
+ */
+extern void processContentChange(struct bcmContext *ctx, struct bcmMsgSingleFrameCanFD const* msg, uint64_t timestamp);
+
+/**
+ * Receive CAN/CANFD frame and put the extracted data in the queue to the simulation.
+ *
+ * @param ctx - The context of the BCM socket.
+ */
+extern void processReceive(struct bcmContext *ctx);
+
+/**
+ * Receive up to RX_BATCH_SIZE CAN/CANFD frames with a single recvmmsg call
+ * and put the extracted data in the queue to the simulation.
+ *
+ * Note: The receive ring of the context is set up by setupContext.
+ * The receive time of each message is read from its control buffer,
+ * so the timestamps cost no extra syscall.
+ *
+ * @param ctx - The context of the BCM socket.
+ * @return The number of received messages.
+ */
+extern int processReceiveBatch(struct bcmContext *ctx);
+
+/**
+ * Handles a message that was received elsewhere, e.g. by the multishot
+ * receive of the io_uring, like one received by processReceiveBatch.
+ *
+ * @param ctx    - The context of the BCM socket.
+ * @param msg    - The received message.
+ * @param nbytes - The number of bytes that were received.
+ * @param hdr    - The header with the control messages of the receive.
+ */
+extern void processReceivedMessage(struct bcmContext *ctx, struct bcmMsgSingleFrameCanFD const* msg, int nbytes,
+                                   struct msghdr *hdr);
+
+/**
+ * Runs the event loop of a worker until it is stopped.
+ * The loop sleeps in epoll_wait until one of the BCM sockets or the operation
+ * queue has something for us. If BUSY_POLL_US is set the loop keeps
+ * polling for that time after it did some work before it blocks again.
+ *
+ * Note: The BCM sockets must be non-blocking!
+ *
+ * @param worker - The worker that serves the channels.
+ * @return RET_E_OK or ERR_EPOLL_FAILED.
+ */
+extern int runEventLoop(struct bcmWorker *worker);
+
+/**
+ * Initializes an empty group of workers.
+ * It is safe to call stopWorkers and freeWorkers on an initialized group.
+ *
+ * @param workers - The group of workers.
+ */
+extern void initWorkers(struct bcmWorkers *workers);
+
+/**
+ * Sets up the queues of the workers and distributes the channels.
+ * Channel c is served by worker c % nworkers and its events go to the
+ * event queue of that worker. There are never more workers than channels.
+ *
+ * @param workers  - The initialized group of workers.
+ * @param channels - The opened channels.
+ * @param nworkers - The number of workers.
+ * @param cpus     - The CPU of each worker (-1 = no pinning).
+ * @param ncpus    - The number of entries in cpus. Workers without an entry are not pinned.
+ * @param priority - The SCHED_FIFO priority of the workers (0 = default scheduler).
+ */
+extern int setupWorkers(struct bcmWorkers *workers, struct bcmChannels *channels, int nworkers, int const cpus[],
+                        int ncpus, int priority);
+
+/**
+ * Runs the event loop of a worker on the calling thread.
+ * The thread is pinned and scheduled as configured for the worker before.
+ *
+ * @param worker - The worker that serves the channels.
+ * @return The result of the event loop.
+ */
+extern int runWorker(struct bcmWorker *worker);
+
+/**
+ * Starts a thread for each worker.
+ * The worker threads block all signals so they are handled by the caller.
+ *
+ * @param workers - The set up group of workers.
+ * @return RET_E_OK or ERR_THREAD_FAILED. On failure no worker is running.
+ */
+extern int startWorkers(struct bcmWorkers *workers);
+
+/**
+ * Asks all workers to leave their event loop.
+ *
+ * Note: Only async-signal-safe calls are used, so this can be called
+ * from a signal handler.
+ *
+ * @param workers - The group of workers.
+ */
+extern void stopWorkers(struct bcmWorkers *workers);
+
+/**
+ * Waits until all worker threads finished.
+ *
+ * @param workers - The group of workers.
+ * @return RET_E_OK or the first error of a worker.
+ */
+extern int joinWorkers(struct bcmWorkers *workers);
+
+/**
+ * Frees the queues of all workers.
+ * The channels are not closed.
+ *
+ * @param workers - The group of workers.
+ */
+extern void freeWorkers(struct bcmWorkers *workers);
+
+
+#endif //CANFD_BCM_WORKER_H
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,399 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Benchmark.c
+ \brief     Runs repeatable TX/RX throughput and latency scenarios on a (v)can interface.
+            Every result is printed as one JSON object per line.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Worker.h"
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define BENCH_DEFAULT_REPEATS 20        // Number of repetitions per scenario if none is given
+#define BENCH_TX_SEND_FRAMES  10000     // Number of frames per TX_SEND repetition
+#define BENCH_UPDATE_TASKS    256       // Number of cyclic tasks that are updated
+#define BENCH_UPDATES         10000     // Number of updates per update repetition
+#define BENCH_RX_SAMPLES      1000      // Number of notifications per RX repetition
+#define BENCH_RX_TIMEOUT_NS   100000000 // Time to wait for a notification before it counts as lost
+#define BENCH_FIRST_ID        0x100     // The first CAN ID of the scenarios
+#define BENCH_MAX_TASKS       2048      // Most cyclic tasks set up by one scenario
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the state of the benchmark.
+ * The RX scenarios send on the TX channel and receive on the RX channel.
+ */
+struct benchmark{
+    struct bcmChannels channels;   // The TX and the RX channel on the same interface
+    struct bcmEventQueue events;   // The events of the RX channel
+    struct bcmContext *tx;         // The channel for the sent frames
+    struct bcmContext *rx;         // The channel with the RX filters
+    int repeats;                   // Number of repetitions per scenario
+};
+
+
+/*******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+static struct bcmHistogramSnapshot histogram;     // The latencies of the running scenario
+static struct canfd_frame frames[BENCH_MAX_TASKS]; // The frames of the running scenario
+static uint32_t counts[BENCH_MAX_TASKS];           // The counts of the running scenario
+static struct bcm_timeval ival1s[BENCH_MAX_TASKS]; // The first intervals of the running scenario
+static struct bcm_timeval ival2s[BENCH_MAX_TASKS]; // The second intervals of the running scenario
+static int status[BENCH_MAX_TASKS];                // The status of each frame of a batch
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Fills a frame with a payload that depends on a sequence number.
+ * A new sequence number always gives a new payload.
+ *
+ * @param frame  - The frame.
+ * @param canID  - The CAN ID.
+ * @param len    - The length of the payload.
+ * @param seqNum - The sequence number.
+ */
+static void makeFrame(struct canfd_frame *const frame, canid_t canID, int len, uint32_t seqNum){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(frame, 0, sizeof(struct canfd_frame));
+
+    frame->can_id = canID;
+    frame->len    = (uint8_t) len;
+
+    for(int index = 0; index < len; index++){
+        frame->data[index] = (uint8_t) (seqNum >> ((index % 4) * 8));
+    }
+}
+
+/**
+ * Prints the result of a scenario as one JSON object.
+ *
+ * @param scenario   - The name of the scenario.
+ * @param variant    - The name of the variant of the scenario.
+ * @param operations - The number of measured operations.
+ * @param elapsed    - The time the operations took in nanoseconds.
+ * @param lost       - The number of operations that did not complete.
+ */
+static void printResult(char const *const scenario, char const *const variant, uint64_t operations, uint64_t elapsed,
+                        uint64_t lost){
+
+    double rate = elapsed > 0 ? (double) operations * 1e9 / (double) elapsed : 0;
+
+    printf("{\"scenario\":\"%s\",\"variant\":\"%s\",\"operations\":%llu,\"lost\":%llu,\"rate_per_s\":%.1f,"
+           "\"mean_ns\":%llu,\"p50_ns\":%llu,\"p90_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,\"max_ns\":%llu}\n",
+           scenario, variant, (unsigned long long) operations, (unsigned long long) lost, rate,
+           (unsigned long long) (histogram.total > 0 ? histogram.sum / histogram.total : 0),
+           (unsigned long long) getHistogramPercentile(&histogram, 50.0),
+           (unsigned long long) getHistogramPercentile(&histogram, 90.0),
+           (unsigned long long) getHistogramPercentile(&histogram, 99.0),
+           (unsigned long long) getHistogramPercentile(&histogram, 99.9), (unsigned long long) histogram.max);
+
+    fflush(stdout);
+}
+
+/**
+ * Starts a new scenario.
+ */
+static void resetHistogram(void){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&histogram, 0, sizeof(histogram));
+}
+
+/**
+ * Measures the TX_SEND rate and the duration of a single TX_SEND.
+ *
+ * @param bench   - The benchmark.
+ * @param variant - The name of the payload variant.
+ * @param isCANFD - Flag for CANFD frames.
+ * @param len     - The length of the payload.
+ */
+static void benchTxSend(struct benchmark *const bench, char const *const variant, int isCANFD, int len){
+
+    uint64_t elapsed = 0;
+
+    resetHistogram();
+
+    for(int repeat = 0; repeat < bench->repeats; repeat++){
+        for(uint32_t index = 0; index < BENCH_TX_SEND_FRAMES; index++){
+
+            struct canfd_frame frame;
+            makeFrame(&frame, BENCH_FIRST_ID, len, index);
+
+            uint64_t start = getStatsTime();
+            createTxSend(bench->tx, &frame, 1, isCANFD);
+            uint64_t duration = getStatsTime() - start;
+
+            addHistogramValue(&histogram, duration);
+            elapsed += duration;
+        }
+    }
+
+    printResult("tx_send", variant, (uint64_t) bench->repeats * BENCH_TX_SEND_FRAMES, elapsed, 0);
+}
+
+/**
+ * Measures how long it takes to set up a number of cyclic tasks.
+ * Every repetition sets up the tasks, measures it and deletes them again.
+ *
+ * @param bench   - The benchmark.
+ * @param ntasks  - The number of cyclic tasks.
+ * @param isBatch - Flag for createTxSetupBatch instead of createTxSetup.
+ */
+static void benchTxSetup(struct benchmark *const bench, int ntasks, int isBatch){
+
+    char variant[32];
+    uint64_t elapsed = 0;
+
+    snprintf(variant, sizeof(variant), "%s_%d", isBatch ? "batch" : "single", ntasks);
+    resetHistogram();
+
+    // Note: count 0 means only ival2 is used. A long interval keeps the bus quiet.
+    for(int index = 0; index < ntasks; index++){
+        makeFrame(&frames[index], BENCH_FIRST_ID + (canid_t) index, 8, (uint32_t) index);
+        counts[index]         = 0;
+        ival1s[index].tv_sec  = 0;
+        ival1s[index].tv_usec = 0;
+        ival2s[index].tv_sec  = 1;
+        ival2s[index].tv_usec = 0;
+    }
+
+    for(int repeat = 0; repeat < bench->repeats; repeat++){
+
+        uint64_t start = getStatsTime();
+
+        if(isBatch){
+            createTxSetupBatch(bench->tx, frames, ntasks, counts, ival1s, ival2s, 0, status);
+        }else{
+            createTxSetup(bench->tx, frames, ntasks, counts, ival1s, ival2s, 0);
+        }
+
+        uint64_t duration = getStatsTime() - start;
+
+        // The latency of one setup within the run
+        addHistogramValue(&histogram, duration / (uint64_t) ntasks);
+        elapsed += duration;
+
+        deleteAllTasks(bench->tx);
+    }
+
+    printResult("tx_setup", variant, (uint64_t) bench->repeats * (uint64_t) ntasks, elapsed, 0);
+}
+
+/**
+ * Measures the rate of createTxSetupUpdate on running cyclic tasks.
+ * Every update changes the payload so nothing is skipped as unchanged.
+ *
+ * @param bench   - The benchmark.
+ * @param variant - The name of the payload variant.
+ * @param isCANFD - Flag for CANFD frames.
+ * @param len     - The length of the payload.
+ */
+static void benchTxSetupUpdate(struct benchmark *const bench, char const *const variant, int isCANFD, int len){
+
+    uint64_t elapsed = 0;
+
+    resetHistogram();
+
+    for(int index = 0; index < BENCH_UPDATE_TASKS; index++){
+        makeFrame(&frames[index], BENCH_FIRST_ID + (canid_t) index, len, 0);
+        counts[index]         = 0;
+        ival1s[index].tv_sec  = 0;
+        ival1s[index].tv_usec = 0;
+        ival2s[index].tv_sec  = 1;
+        ival2s[index].tv_usec = 0;
+    }
+
+    createTxSetupBatch(bench->tx, frames, BENCH_UPDATE_TASKS, counts, ival1s, ival2s, isCANFD, status);
+
+    for(int repeat = 0; repeat < bench->repeats; repeat++){
+        for(uint32_t update = 0; update < BENCH_UPDATES; update++){
+
+            struct canfd_frame frame;
+            uint32_t seqNum = (uint32_t) repeat * BENCH_UPDATES + update + 1;
+
+            makeFrame(&frame, BENCH_FIRST_ID + (canid_t) (update % BENCH_UPDATE_TASKS), len, seqNum);
+
+            uint64_t start = getStatsTime();
+            createTxSetupUpdate(bench->tx, &frame, 1, isCANFD, 0);
+            uint64_t duration = getStatsTime() - start;
+
+            addHistogramValue(&histogram, duration);
+            elapsed += duration;
+        }
+    }
+
+    printResult("tx_setup_update", variant, (uint64_t) bench->repeats * BENCH_UPDATES, elapsed, 0);
+
+    deleteAllTasks(bench->tx);
+}
+
+/**
+ * Measures the notification latency with a number of installed RX filters.
+ * The time is taken from before the TX_SEND on the TX channel until the
+ * event of the RX channel was dequeued.
+ *
+ * @param bench    - The benchmark.
+ * @param nfilters - The number of installed RX filters.
+ * @param isCANFD  - Flag for CANFD frames.
+ */
+static void benchRxFilters(struct benchmark *const bench, int nfilters, int isCANFD){
+
+    char variant[32];
+    uint64_t elapsed = 0;
+    uint64_t lost    = 0;
+
+    snprintf(variant, sizeof(variant), "%s_%d", isCANFD ? "canfd" : "can", nfilters);
+    resetHistogram();
+
+    for(int index = 0; index < nfilters; index++){
+        createRxSetupCanID(bench->rx, BENCH_FIRST_ID + (canid_t) index, isCANFD);
+    }
+
+    for(int repeat = 0; repeat < bench->repeats; repeat++){
+        for(uint32_t sample = 0; sample < BENCH_RX_SAMPLES; sample++){
+
+            struct canfd_frame frame;
+            struct bcmEvent event;
+
+            // Spread the samples over all filters
+            makeFrame(&frame, BENCH_FIRST_ID + (canid_t) (sample % (uint32_t) nfilters), isCANFD ? 64 : 8, sample);
+
+            uint64_t start = getStatsTime();
+            createTxSend(bench->tx, &frame, 1, isCANFD);
+
+            // Poll the RX channel until the notification arrived
+            uint32_t received = 0;
+
+            while(received == 0 && getStatsTime() - start < BENCH_RX_TIMEOUT_NS){
+                processReceiveBatch(bench->rx);
+                received = dequeueEvents(&bench->events, &event, 1);
+            }
+
+            uint64_t duration = getStatsTime() - start;
+
+            if(received == 0){
+                lost++;
+                continue;
+            }
+
+            addHistogramValue(&histogram, duration);
+            elapsed += duration;
+
+            // Drop anything that came in on top
+            while(dequeueEvents(&bench->events, &event, 1) > 0){
+            }
+        }
+    }
+
+    printResult("rx_filter_latency", variant, (uint64_t) bench->repeats * BENCH_RX_SAMPLES - lost, elapsed, lost);
+
+    deleteAllTasks(bench->rx);
+}
+
+int main(int argc, char *argv[]){
+
+    struct benchmark bench;                                      // The state of the benchmark
+    char const *interface = argc > 1 ? argv[1] : INTERFACE;      // The interface the scenarios run on
+    char const *interfaces[2];                                   // The TX and the RX channel
+
+    static int const setupSizes[]  = {1, 16, 128, 512, 1024, 2048};
+    static int const filterSizes[] = {1, 16, 256, 1024};
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&bench, 0, sizeof(bench));
+
+    bench.repeats = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_REPEATS;
+
+    if(bench.repeats <= 0){
+        printf("Usage: %s [interface] [repeats]\n", argv[0]);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    initChannels(&bench.channels);
+
+    if(setupEventQueue(&bench.events, EVENT_QUEUE_SIZE) != RET_E_OK){
+        printf("Error could not setup the event queue \n");
+        return ERR_MALLOC_FAILED;
+    }
+
+    // Two sockets on the same interface, the frames of one are received by the other
+    interfaces[0] = interface;
+    interfaces[1] = interface;
+
+    if(openChannels(&bench.channels, interfaces, 2, 0, &bench.events) != RET_E_OK){
+        printf("Error could not setup the channels on %s \n", interface);
+        closeChannels(&bench.channels);
+        freeEventQueue(&bench.events);
+        return ERR_SETUP_FAILED;
+    }
+
+    bench.tx = getChannel(&bench.channels, 0);
+    bench.rx = getChannel(&bench.channels, 1);
+
+    // TX_SEND rate for CAN and the CANFD payload sizes
+    benchTxSend(&bench, "can_8", 0, 8);
+    benchTxSend(&bench, "canfd_8", 1, 8);
+    benchTxSend(&bench, "canfd_16", 1, 16);
+    benchTxSend(&bench, "canfd_32", 1, 32);
+    benchTxSend(&bench, "canfd_64", 1, 64);
+
+    // TX_SETUP setup rate for 1 to 2048 IDs
+    for(size_t index = 0; index < sizeof(setupSizes) / sizeof(setupSizes[0]); index++){
+        benchTxSetup(&bench, setupSizes[index], 0);
+        benchTxSetup(&bench, setupSizes[index], 1);
+    }
+
+    // Update rate of running cyclic tasks
+    benchTxSetupUpdate(&bench, "can_8", 0, 8);
+    benchTxSetupUpdate(&bench, "canfd_64", 1, 64);
+
+    // Notification latency against the number of RX filters
+    for(size_t index = 0; index < sizeof(filterSizes) / sizeof(filterSizes[0]); index++){
+        benchRxFilters(&bench, filterSizes[index], 0);
+        benchRxFilters(&bench, filterSizes[index], 1);
+    }
+
+    closeChannels(&bench.channels);
+    freeEventQueue(&bench.events);
+
+    return RET_E_OK;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,1237 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Bridge.c
+ \brief     Provides the UDP bridge of the operation and event queues to a
+            simulation on another host.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Bridge.h"
+#include "CANFD_BCM_Stats.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/random.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define BRIDGE_DRAIN_BATCH 64 // Number of records taken from a queue at once
+
+#define BRIDGE_HEADER_SIZE    16u // Bytes of the header on the wire
+#define BRIDGE_COUNT_OFFSET   6u  // Position of the count in the header on the wire
+#define BRIDGE_EVENT_HEAD     19u // Bytes of the members of an event before its payload on the wire
+#define BRIDGE_OPERATION_HEAD 9u  // Bytes of the members of an operation before its parameters on the wire
+#define BRIDGE_FRAME_HEAD     8u  // Bytes of the members of a frame before its payload on the wire
+#define BRIDGE_TIMEVAL_SIZE   12u // Bytes of a bcm_timeval on the wire, 64 bit seconds and 32 bit microseconds
+
+/**
+ * Defines the most operations a datagram can carry, each one needs at least
+ * its length, its members and the members of its frame.
+ */
+#define BRIDGE_MAX_OPERATIONS                                       \
+    ((BRIDGE_DATAGRAM_SIZE - BRIDGE_HEADER_SIZE)                    \
+     / (sizeof(uint16_t) + BRIDGE_OPERATION_HEAD + BRIDGE_FRAME_HEAD))
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Writes a value in little endian byte order.
+ *
+ * @param out    - The position in the datagram.
+ * @param value  - The value.
+ * @param nbytes - The number of bytes of the value on the wire.
+ * @return The position after the value.
+ */
+static unsigned char* putBridgeValue(unsigned char *const out, uint64_t value, size_t nbytes){
+
+    for(size_t index = 0; index < nbytes; index++){
+        out[index] = (unsigned char) (value >> (8 * index));
+    }
+
+    return out + nbytes;
+}
+
+/**
+ * Reads a value in little endian byte order.
+ *
+ * @param in     - The position in the datagram, advanced past the value.
+ * @param nbytes - The number of bytes of the value on the wire.
+ */
+static uint64_t getBridgeValue(unsigned char const **const in, size_t nbytes){
+
+    uint64_t value = 0;
+
+    for(size_t index = 0; index < nbytes; index++){
+        value |= (uint64_t) (*in)[index] << (8 * index);
+    }
+
+    *in += nbytes;
+    return value;
+}
+
+/**
+ * Writes a double as its IEEE 754 bits in little endian byte order.
+ *
+ * @param out   - The position in the datagram.
+ * @param value - The value.
+ * @return The position after the value.
+ */
+static unsigned char* putBridgeDouble(unsigned char *const out, double value){
+
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+
+    return putBridgeValue(out, bits, sizeof(bits));
+}
+
+/**
+ * Reads a double from its IEEE 754 bits in little endian byte order.
+ *
+ * @param in - The position in the datagram, advanced past the value.
+ */
+static double getBridgeDouble(unsigned char const **const in){
+
+    uint64_t bits = getBridgeValue(in, sizeof(bits));
+    double value;
+
+    memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+/**
+ * Writes an interval with 64 bit seconds and 32 bit microseconds,
+ * so the size does not depend on the long of the host.
+ *
+ * @param out  - The position in the datagram.
+ * @param ival - The interval.
+ * @return The position after the interval.
+ */
+static unsigned char* putBridgeTimeval(unsigned char *out, struct bcm_timeval ival){
+
+    out = putBridgeValue(out, (uint64_t) (int64_t) ival.tv_sec, sizeof(int64_t));
+    return putBridgeValue(out, (uint64_t) (uint32_t) ival.tv_usec, sizeof(uint32_t));
+}
+
+/**
+ * Reads an interval with 64 bit seconds and 32 bit microseconds.
+ *
+ * @param in - The position in the datagram, advanced past the interval.
+ */
+static struct bcm_timeval getBridgeTimeval(unsigned char const **const in){
+
+    struct bcm_timeval ival;
+
+    ival.tv_sec  = (long) (int64_t) getBridgeValue(in, sizeof(int64_t));
+    ival.tv_usec = (long) (int32_t) getBridgeValue(in, sizeof(uint32_t));
+
+    return ival;
+}
+
+/**
+ * Limits the len of an event to the values its payload can hold.
+ *
+ * @param type - The enum bcmEventType of the event.
+ * @param len  - The len of the event.
+ */
+static uint8_t getEventLen(uint8_t type, uint8_t len){
+
+    if(type == EVENT_RX_SIGNALS){
+        return len > EVENT_MAX_VALUES ? (uint8_t) EVENT_MAX_VALUES : len;
+    }
+
+    return len > CANFD_MAX_DLEN ? (uint8_t) CANFD_MAX_DLEN : len;
+}
+
+/**
+ * Returns the number of bytes of the payload of an event on the wire.
+ * The payload is only sent up to the valid values.
+ *
+ * @param type - The enum bcmEventType of the event.
+ * @param len  - The len of the event, limited by getEventLen.
+ */
+static uint16_t getEventPayloadSize(uint8_t type, uint8_t len){
+
+    switch(type){
+
+        case EVENT_RX_SIGNALS:
+            return (uint16_t) (len * sizeof(uint64_t));
+
+        case EVENT_BUS_SILENT:
+        case EVENT_BUS_ACTIVE:
+        case EVENT_ID_LOST:
+        case EVENT_ID_RECOVERED:
+        case EVENT_STEP_DONE:
+            return sizeof(uint64_t) + 2 * sizeof(uint32_t);
+
+        case EVENT_OP_FAILED:
+        case EVENT_CHANNEL_DOWN:
+            return 2 * sizeof(uint32_t);
+
+        default:
+            return len;
+    }
+}
+
+/**
+ * Returns the number of bytes of an event on the wire.
+ *
+ * @param event - The event.
+ */
+static uint16_t getEventLength(struct bcmEvent const* const event){
+
+    return (uint16_t) (BRIDGE_EVENT_HEAD + getEventPayloadSize(event->type, getEventLen(event->type, event->len)));
+}
+
+/**
+ * Writes an event with its fields in little endian byte order.
+ *
+ * @param out   - The position in the datagram with room for getEventLength bytes.
+ * @param event - The event.
+ */
+static void putBridgeEvent(unsigned char *out, struct bcmEvent const* const event){
+
+    uint8_t len = getEventLen(event->type, event->len);
+
+    out = putBridgeValue(out, event->timestamp, sizeof(uint64_t));
+    out = putBridgeValue(out, event->canID, sizeof(uint32_t));
+    out = putBridgeValue(out, event->type, sizeof(uint8_t));
+    out = putBridgeValue(out, event->flags, sizeof(uint8_t));
+    out = putBridgeValue(out, len, sizeof(uint8_t));
+    out = putBridgeValue(out, event->isCANFD, sizeof(uint8_t));
+    out = putBridgeValue(out, event->channel, sizeof(uint8_t));
+    out = putBridgeValue(out, event->first, sizeof(uint16_t));
+
+    switch(event->type){
+
+        case EVENT_RX_SIGNALS:
+            for(uint8_t index = 0; index < len; index++){
+                out = putBridgeDouble(out, event->values[index]);
+            }
+            break;
+
+        case EVENT_BUS_SILENT:
+        case EVENT_BUS_ACTIVE:
+        case EVENT_ID_LOST:
+        case EVENT_ID_RECOVERED:
+            out = putBridgeValue(out, event->watch.silentFor, sizeof(uint64_t));
+            out = putBridgeValue(out, event->watch.missed, sizeof(uint32_t));
+            putBridgeValue(out, event->watch.nlost, sizeof(uint32_t));
+            break;
+
+        case EVENT_OP_FAILED:
+        case EVENT_CHANNEL_DOWN:
+            out = putBridgeValue(out, (uint32_t) event->op.error, sizeof(uint32_t));
+            putBridgeValue(out, event->op.opcode, sizeof(uint32_t));
+            break;
+
+        case EVENT_STEP_DONE:
+            out = putBridgeValue(out, event->step.time, sizeof(uint64_t));
+            out = putBridgeValue(out, event->step.nframes, sizeof(uint32_t));
+            putBridgeValue(out, event->step.failed, sizeof(uint32_t));
+            break;
+
+        default:
+            memcpy(out, event->data, len);
+            break;
+    }
+}
+
+/**
+ * Reads an event with its fields in little endian byte order.
+ *
+ * @param in     - The record in the datagram.
+ * @param length - The number of bytes of the record.
+ * @param event  - The zeroed event.
+ * @return 1 if the record is a valid event, otherwise 0.
+ */
+static int getBridgeEvent(unsigned char const *in, uint16_t length, struct bcmEvent *const event){
+
+    if(length < BRIDGE_EVENT_HEAD){
+        return 0;
+    }
+
+    event->timestamp = getBridgeValue(&in, sizeof(uint64_t));
+    event->canID     = (canid_t) getBridgeValue(&in, sizeof(uint32_t));
+    event->type      = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    event->flags     = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    event->len       = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    event->isCANFD   = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    event->channel   = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    event->first     = (uint16_t) getBridgeValue(&in, sizeof(uint16_t));
+
+    if(getEventLen(event->type, event->len) != event->len ||
+       length != BRIDGE_EVENT_HEAD + getEventPayloadSize(event->type, event->len)){
+        return 0;
+    }
+
+    switch(event->type){
+
+        case EVENT_RX_SIGNALS:
+            for(uint8_t index = 0; index < event->len; index++){
+                event->values[index] = getBridgeDouble(&in);
+            }
+            break;
+
+        case EVENT_BUS_SILENT:
+        case EVENT_BUS_ACTIVE:
+        case EVENT_ID_LOST:
+        case EVENT_ID_RECOVERED:
+            event->watch.silentFor = getBridgeValue(&in, sizeof(uint64_t));
+            event->watch.missed    = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+            event->watch.nlost     = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+            break;
+
+        case EVENT_OP_FAILED:
+        case EVENT_CHANNEL_DOWN:
+            event->op.error  = (int32_t) getBridgeValue(&in, sizeof(uint32_t));
+            event->op.opcode = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+            break;
+
+        case EVENT_STEP_DONE:
+            event->step.time    = getBridgeValue(&in, sizeof(uint64_t));
+            event->step.nframes = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+            event->step.failed  = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+            break;
+
+        default:
+            memcpy(event->data, in, event->len);
+            break;
+    }
+
+    return 1;
+}
+
+/**
+ * Returns the number of bytes of the parameters of an operation on the wire.
+ * Only the union member the type uses is sent.
+ *
+ * @param type - The enum bcmOperationType of the operation.
+ */
+static uint16_t getOperationParameterSize(uint8_t type){
+
+    switch(type){
+
+        case OP_TX_SETUP:
+            return 2 * BRIDGE_TIMEVAL_SIZE;
+
+        case OP_TX_SIGNAL:
+            return sizeof(uint64_t) + sizeof(uint32_t);
+
+        case OP_STEP:
+            return sizeof(uint64_t);
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Returns the number of bytes of an operation on the wire.
+ * The frame is the last member, its payload is only sent up to its length.
+ *
+ * @param op - The operation.
+ */
+static uint16_t getOperationLength(struct bcmOperation const* const op){
+
+    size_t len = op->frame.len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : op->frame.len;
+
+    return (uint16_t) (BRIDGE_OPERATION_HEAD + getOperationParameterSize(op->type) + BRIDGE_FRAME_HEAD + len);
+}
+
+/**
+ * Writes an operation with its fields in little endian byte order.
+ *
+ * Note: The timestamp is not sent, it is set again by the queue of the gateway.
+ *
+ * @param out - The position in the datagram with room for getOperationLength bytes.
+ * @param op  - The operation.
+ */
+static void putBridgeOperation(unsigned char *out, struct bcmOperation const* const op){
+
+    uint8_t len = op->frame.len > CANFD_MAX_DLEN ? (uint8_t) CANFD_MAX_DLEN : op->frame.len;
+
+    out = putBridgeValue(out, op->type, sizeof(uint8_t));
+    out = putBridgeValue(out, op->isCANFD, sizeof(uint8_t));
+    out = putBridgeValue(out, op->announce, sizeof(uint8_t));
+    out = putBridgeValue(out, op->hasMask, sizeof(uint8_t));
+    out = putBridgeValue(out, op->channel, sizeof(uint8_t));
+    out = putBridgeValue(out, op->count, sizeof(uint32_t));
+
+    switch(op->type){
+
+        case OP_TX_SETUP:
+            out = putBridgeTimeval(out, op->ival1);
+            out = putBridgeTimeval(out, op->ival2);
+            break;
+
+        case OP_TX_SIGNAL:
+            out = putBridgeDouble(out, op->value);
+            out = putBridgeValue(out, op->signal, sizeof(uint32_t));
+            break;
+
+        case OP_STEP:
+            out = putBridgeValue(out, op->duration, sizeof(uint64_t));
+            break;
+
+        default:
+            break;
+    }
+
+    out = putBridgeValue(out, op->frame.can_id, sizeof(uint32_t));
+    out = putBridgeValue(out, len, sizeof(uint8_t));
+    out = putBridgeValue(out, op->frame.flags, sizeof(uint8_t));
+    out = putBridgeValue(out, op->frame.__res0, sizeof(uint8_t));
+    out = putBridgeValue(out, op->frame.__res1, sizeof(uint8_t));
+    memcpy(out, op->frame.data, len);
+}
+
+/**
+ * Reads an operation with its fields in little endian byte order.
+ *
+ * @param in     - The record in the datagram.
+ * @param length - The number of bytes of the record.
+ * @param op     - The zeroed operation.
+ * @return 1 if the record is a valid operation, otherwise 0.
+ */
+static int getBridgeOperation(unsigned char const *in, uint16_t length, struct bcmOperation *const op){
+
+    if(length < BRIDGE_OPERATION_HEAD + BRIDGE_FRAME_HEAD){
+        return 0;
+    }
+
+    op->type     = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->isCANFD  = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->announce = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->hasMask  = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->channel  = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->count    = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+
+    uint16_t parameterSize = getOperationParameterSize(op->type);
+
+    if(length < BRIDGE_OPERATION_HEAD + parameterSize + BRIDGE_FRAME_HEAD){
+        return 0;
+    }
+
+    switch(op->type){
+
+        case OP_TX_SETUP:
+            op->ival1 = getBridgeTimeval(&in);
+            op->ival2 = getBridgeTimeval(&in);
+            break;
+
+        case OP_TX_SIGNAL:
+            op->value  = getBridgeDouble(&in);
+            op->signal = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+            break;
+
+        case OP_STEP:
+            op->duration = getBridgeValue(&in, sizeof(uint64_t));
+            break;
+
+        default:
+            break;
+    }
+
+    op->frame.can_id = (canid_t) getBridgeValue(&in, sizeof(uint32_t));
+    op->frame.len    = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->frame.flags  = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->frame.__res0 = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    op->frame.__res1 = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+
+    if(op->frame.len > CANFD_MAX_DLEN ||
+       length != BRIDGE_OPERATION_HEAD + parameterSize + BRIDGE_FRAME_HEAD + op->frame.len){
+        return 0;
+    }
+
+    memcpy(op->frame.data, in, op->frame.len);
+
+    return 1;
+}
+
+/**
+ * Writes the header of a datagram in little endian byte order.
+ *
+ * @param out    - The start of the datagram.
+ * @param header - The header.
+ */
+static void putBridgeHeader(unsigned char *out, struct bcmBridgeHeader const* const header){
+
+    out = putBridgeValue(out, header->magic, sizeof(uint32_t));
+    out = putBridgeValue(out, header->version, sizeof(uint8_t));
+    out = putBridgeValue(out, header->kind, sizeof(uint8_t));
+    out = putBridgeValue(out, header->count, sizeof(uint16_t));
+    out = putBridgeValue(out, header->session, sizeof(uint32_t));
+    putBridgeValue(out, header->sequence, sizeof(uint32_t));
+}
+
+/**
+ * Reads the header of a datagram in little endian byte order.
+ *
+ * @param in     - The start of the datagram with at least BRIDGE_HEADER_SIZE bytes.
+ * @param header - Storage for the header.
+ */
+static void getBridgeHeader(unsigned char const *in, struct bcmBridgeHeader *const header){
+
+    header->magic    = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+    header->version  = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    header->kind     = (uint8_t) getBridgeValue(&in, sizeof(uint8_t));
+    header->count    = (uint16_t) getBridgeValue(&in, sizeof(uint16_t));
+    header->session  = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+    header->sequence = (uint32_t) getBridgeValue(&in, sizeof(uint32_t));
+}
+
+/**
+ * Starts a new datagram with its header.
+ * The caller makes sure there is a free datagram.
+ *
+ * @param bridge - The bridge.
+ */
+static void openBridgeDatagram(struct bcmBridge *const bridge){
+
+    struct bcmBridgeHeader header;
+
+    header.magic    = BRIDGE_MAGIC;
+    header.version  = BRIDGE_VERSION;
+    header.kind     = bridge->mode == BRIDGE_GATEWAY ? BRIDGE_KIND_EVENTS : BRIDGE_KIND_OPERATIONS;
+    header.count    = 0;
+    header.session  = bridge->session;
+    header.sequence = bridge->sequence++;
+
+    // Note: The count is written when the datagram is sent
+    putBridgeHeader(bridge->txBuffers + (size_t) bridge->ntx * BRIDGE_DATAGRAM_SIZE, &header);
+    bridge->txLengths[bridge->ntx] = BRIDGE_HEADER_SIZE;
+    bridge->txCounts[bridge->ntx]  = 0;
+    bridge->ntx++;
+}
+
+/**
+ * Counts the records of the datagrams that could not be sent as dropped.
+ *
+ * @param bridge - The bridge.
+ * @param first  - The first datagram that was not sent.
+ */
+static void dropBridgeDatagrams(struct bcmBridge *const bridge, int first){
+
+    for(int index = first; index < bridge->ntx; index++){
+
+        addStatsCounter(STATS_BRIDGE_DROPPED, bridge->txCounts[index]);
+    }
+}
+
+/**
+ * Sends all started datagrams with sendmmsg.
+ * Datagrams the socket does not take are dropped, UDP never waits.
+ *
+ * @param bridge - The bridge.
+ */
+static void flushBridge(struct bcmBridge *const bridge){
+
+    struct mmsghdr msgs[BRIDGE_BATCH_SIZE];
+    struct iovec iovs[BRIDGE_BATCH_SIZE];
+
+    if(bridge->ntx == 0){
+        return;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(msgs, 0, sizeof(msgs));
+
+    for(int index = 0; index < bridge->ntx; index++){
+
+        iovs[index].iov_base = bridge->txBuffers + (size_t) index * BRIDGE_DATAGRAM_SIZE;
+        iovs[index].iov_len  = bridge->txLengths[index];
+
+        putBridgeValue((unsigned char*) iovs[index].iov_base + BRIDGE_COUNT_OFFSET, bridge->txCounts[index],
+                       sizeof(uint16_t));
+
+        msgs[index].msg_hdr.msg_iov    = &iovs[index];
+        msgs[index].msg_hdr.msg_iovlen = 1;
+
+        // Note: The socket of the simulation is connected to the gateway
+        if(bridge->mode == BRIDGE_GATEWAY){
+            msgs[index].msg_hdr.msg_name    = &bridge->peer;
+            msgs[index].msg_hdr.msg_namelen = sizeof(bridge->peer);
+        }
+    }
+
+    int sent = 0;
+
+    while(sent < bridge->ntx){
+
+        int ret = sendmmsg(bridge->socketFD, &msgs[sent], (unsigned int) (bridge->ntx - sent), 0);
+
+        if(ret < 0 && errno == EINTR){
+            continue;
+        }
+
+        // Note: Without an error errno is not set, the socket just took nothing
+        if(ret == 0){
+            dropBridgeDatagrams(bridge, sent);
+            break;
+        }
+
+        if(ret < 0){
+
+            // Note: A full socket buffer or a peer that is gone only costs the datagrams
+            if(errno != EAGAIN && errno != EWOULDBLOCK && errno != ENOBUFS && errno != ECONNREFUSED){
+                printf("Error could not send the datagrams of the bridge: %s\n", strerror(errno));
+                bridge->retCode = ERR_WRITE_FAILED;
+            }
+
+            dropBridgeDatagrams(bridge, sent);
+            break;
+        }
+
+        sent += ret;
+    }
+
+    addStatsCounter(STATS_BRIDGE_SENT, (uint64_t) sent);
+
+    bridge->ntx          = 0;
+    bridge->pendingBytes = 0;
+    bridge->lastSend     = getStatsTime();
+}
+
+/**
+ * Reserves the room for a record in the open datagram. A full datagram is
+ * closed and the next one is started, all datagrams are sent when none is left.
+ *
+ * @param bridge - The bridge.
+ * @param length - The number of bytes of the record on the wire.
+ * @return The position the record is written to.
+ */
+static unsigned char* reserveBridgeRecord(struct bcmBridge *const bridge, uint16_t length){
+
+    uint32_t needed = sizeof(uint16_t) + length;
+
+    if(bridge->ntx == 0 || bridge->txLengths[bridge->ntx - 1] + needed > BRIDGE_DATAGRAM_SIZE){
+
+        if(bridge->ntx == BRIDGE_BATCH_SIZE){
+            flushBridge(bridge);
+        }
+
+        openBridgeDatagram(bridge);
+    }
+
+    unsigned char *const datagram = bridge->txBuffers + (size_t) (bridge->ntx - 1) * BRIDGE_DATAGRAM_SIZE;
+    uint32_t used = bridge->txLengths[bridge->ntx - 1];
+
+    putBridgeValue(datagram + used, length, sizeof(uint16_t));
+
+    bridge->txCounts[bridge->ntx - 1]++;
+    bridge->txLengths[bridge->ntx - 1] = used + needed;
+
+    if(bridge->pendingBytes == 0){
+        bridge->pendingSince = getStatsTime();
+    }
+
+    bridge->pendingBytes += needed;
+
+    return datagram + used + sizeof(uint16_t);
+}
+
+/**
+ * Moves the records of the queues the bridge sends into the datagrams.
+ *
+ * @param bridge - The bridge.
+ * @return The number of moved records.
+ */
+static uint32_t drainBridge(struct bcmBridge *const bridge){
+
+    uint32_t total = 0;
+
+    if(bridge->mode == BRIDGE_SIMULATION){
+
+        struct bcmOperation ops[BRIDGE_DRAIN_BATCH];
+        uint32_t nops;
+
+        while((nops = dequeueOperations(&bridge->operationQueue, ops, BRIDGE_DRAIN_BATCH)) > 0){
+
+            for(uint32_t index = 0; index < nops; index++){
+                putBridgeOperation(reserveBridgeRecord(bridge, getOperationLength(&ops[index])), &ops[index]);
+            }
+
+            total += nops;
+        }
+
+        return total;
+    }
+
+    // Note: The events stay in the queues until a simulation announced itself
+    if(!bridge->hasPeer){
+        return 0;
+    }
+
+    struct bcmEvent events[BRIDGE_DRAIN_BATCH];
+
+    for(int source = 0; source < bridge->nsources; source++){
+
+        uint32_t nevents;
+
+        while((nevents = dequeueEvents(bridge->eventSources[source], events, BRIDGE_DRAIN_BATCH)) > 0){
+
+            for(uint32_t index = 0; index < nevents; index++){
+                putBridgeEvent(reserveBridgeRecord(bridge, getEventLength(&events[index])), &events[index]);
+            }
+
+            total += nevents;
+        }
+    }
+
+    return total;
+}
+
+/**
+ * Checks the sequence of a datagram of the peer.
+ * A new session starts a new sequence, gaps are counted as lost.
+ *
+ * @param bridge - The bridge.
+ * @param header - The header of the datagram.
+ * @return 1 if the datagram should be processed or 0 if it is late.
+ */
+static int checkBridgeSequence(struct bcmBridge *const bridge, struct bcmBridgeHeader const* const header){
+
+    if(!bridge->hasRxSession || header->session != bridge->rxSession){
+        bridge->hasRxSession = 1;
+        bridge->rxSession    = header->session;
+        bridge->rxExpected   = header->sequence + 1;
+        return 1;
+    }
+
+    // Note: The difference is signed so the sequence can wrap around
+    int32_t gap = (int32_t) (header->sequence - bridge->rxExpected);
+
+    if(gap < 0){
+        addStatsCounter(STATS_BRIDGE_LATE, 1);
+        return 0;
+    }
+
+    addStatsCounter(STATS_BRIDGE_LOST, (uint64_t) gap);
+    bridge->rxExpected = header->sequence + 1;
+
+    return 1;
+}
+
+/**
+ * Enqueues the operations of a datagram to the workers of their channels.
+ * Consecutive operations of the same worker are enqueued together.
+ *
+ * @param bridge - The bridge.
+ * @param ops    - The operations of the datagram.
+ * @param nops   - The number of operations.
+ */
+static void enqueueBridgeOperations(struct bcmBridge *const bridge, struct bcmOperation ops[], uint32_t nops){
+
+    uint32_t first = 0;
+
+    while(first < nops){
+
+        struct bcmOperationQueue *const queue = bridge->operationTargets[ops[first].channel];
+        uint32_t last = first + 1;
+
+        while(last < nops && bridge->operationTargets[ops[last].channel] == queue){
+            last++;
+        }
+
+        uint32_t enqueued = enqueueOperations(queue, &ops[first], last - first);
+        addStatsCounter(STATS_BRIDGE_DROPPED, last - first - enqueued);
+
+        first = last;
+    }
+}
+
+/**
+ * Checks if a datagram comes from the expected peer of the gateway.
+ *
+ * @param bridge - The bridge.
+ * @param source - The sender of the datagram.
+ * @return 1 if the datagram is accepted, otherwise 0.
+ */
+static int isBridgePeer(struct bcmBridge const* const bridge, struct sockaddr_in const* const source){
+
+    struct sockaddr_in const* const expected = &bridge->expectedPeer;
+
+    return source->sin_family == AF_INET &&
+           (expected->sin_addr.s_addr == htonl(INADDR_ANY) || expected->sin_addr.s_addr == source->sin_addr.s_addr) &&
+           (expected->sin_port == 0 || expected->sin_port == source->sin_port);
+}
+
+/**
+ * Unpacks the records of a received datagram into the queues.
+ *
+ * @param bridge   - The bridge.
+ * @param datagram - The datagram.
+ * @param size     - The size of the datagram.
+ * @param source   - The sender of the datagram.
+ * @return 1 if the datagram was valid, otherwise 0.
+ */
+static int processBridgeDatagram(struct bcmBridge *const bridge, unsigned char const *const datagram, size_t size,
+                                 struct sockaddr_in const* const source){
+
+    struct bcmOperation ops[BRIDGE_MAX_OPERATIONS]; // The operations of the datagram
+    struct bcmBridgeHeader header;
+
+    uint8_t kind = bridge->mode == BRIDGE_GATEWAY ? BRIDGE_KIND_OPERATIONS : BRIDGE_KIND_EVENTS;
+
+    if(size < BRIDGE_HEADER_SIZE){
+        return 0;
+    }
+
+    getBridgeHeader(datagram, &header);
+
+    // Note: A peer with another layout of the records is never read
+    if(header.magic != BRIDGE_MAGIC || header.version != BRIDGE_VERSION || header.kind != kind){
+        return 0;
+    }
+
+    // Note: Only a new session moves the events to its sender. A datagram of the
+    // running session from another address or port is dropped.
+    if(bridge->mode == BRIDGE_GATEWAY){
+
+        if(!bridge->hasRxSession || header.session != bridge->rxSession){
+            bridge->peer    = *source;
+            bridge->hasPeer = 1;
+        }else if(source->sin_addr.s_addr != bridge->peer.sin_addr.s_addr || source->sin_port != bridge->peer.sin_port){
+            addStatsCounter(STATS_BRIDGE_REJECTED, 1);
+            return 1;
+        }
+    }
+
+    if(!checkBridgeSequence(bridge, &header)){
+        return 1;
+    }
+
+    size_t offset = BRIDGE_HEADER_SIZE;
+    uint32_t nops = 0;
+
+    for(uint16_t index = 0; index < header.count && nops < BRIDGE_MAX_OPERATIONS; index++){
+
+        if(offset + sizeof(uint16_t) > size){
+            addStatsCounter(STATS_BRIDGE_INVALID, 1);
+            break;
+        }
+
+        unsigned char const *in = datagram + offset;
+        uint16_t length         = (uint16_t) getBridgeValue(&in, sizeof(uint16_t));
+
+        offset += sizeof(uint16_t);
+
+        if(offset + length > size){
+            addStatsCounter(STATS_BRIDGE_INVALID, 1);
+            break;
+        }
+
+        if(kind == BRIDGE_KIND_EVENTS){
+
+            struct bcmEvent event;
+
+            // Note: Always initialize the whole struct with 0.
+            // Random values in the memory can cause weird bugs!
+            memset(&event, 0, sizeof(event));
+
+            if(!getBridgeEvent(datagram + offset, length, &event)){
+                addStatsCounter(STATS_BRIDGE_INVALID, 1);
+            }else if(!enqueueEvent(&bridge->eventQueue, &event)){
+                addStatsCounter(STATS_BRIDGE_DROPPED, 1);
+            }
+
+        }else{
+
+            struct bcmOperation *const op = &ops[nops];
+
+            // Note: Always initialize the whole struct with 0.
+            // Random values in the memory can cause weird bugs!
+            memset(op, 0, sizeof(struct bcmOperation));
+
+            if(getBridgeOperation(datagram + offset, length, op) && op->channel < MAX_CHANNELS &&
+               bridge->operationTargets[op->channel] != NULL){
+                nops++;
+            }else{
+                addStatsCounter(STATS_BRIDGE_INVALID, 1);
+            }
+        }
+
+        offset += length;
+    }
+
+    enqueueBridgeOperations(bridge, ops, nops);
+
+    return 1;
+}
+
+/**
+ * Receives the available datagrams with recvmmsg and unpacks them.
+ *
+ * @param bridge - The bridge.
+ * @return The number of received datagrams.
+ */
+static uint32_t receiveBridge(struct bcmBridge *const bridge){
+
+    struct mmsghdr msgs[BRIDGE_BATCH_SIZE];
+    struct iovec iovs[BRIDGE_BATCH_SIZE];
+    struct sockaddr_in sources[BRIDGE_BATCH_SIZE];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(msgs, 0, sizeof(msgs));
+
+    for(int index = 0; index < BRIDGE_BATCH_SIZE; index++){
+
+        iovs[index].iov_base = bridge->rxBuffers + (size_t) index * BRIDGE_DATAGRAM_SIZE;
+        iovs[index].iov_len  = BRIDGE_DATAGRAM_SIZE;
+
+        msgs[index].msg_hdr.msg_iov     = &iovs[index];
+        msgs[index].msg_hdr.msg_iovlen  = 1;
+        msgs[index].msg_hdr.msg_name    = &sources[index];
+        msgs[index].msg_hdr.msg_namelen = sizeof(sources[index]);
+    }
+
+    int nmsgs = recvmmsg(bridge->socketFD, msgs, BRIDGE_BATCH_SIZE, MSG_DONTWAIT, NULL);
+
+    if(nmsgs <= 0){
+
+        // Note: A refused datagram of the simulation only means the gateway is not up yet
+        if(nmsgs < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNREFUSED){
+            printf("Error could not receive the datagrams of the bridge: %s\n", strerror(errno));
+        }
+
+        return 0;
+    }
+
+    addStatsCounter(STATS_BRIDGE_RECEIVED, (uint64_t) nmsgs);
+
+    for(int index = 0; index < nmsgs; index++){
+
+        // Note: The socket of the gateway is not connected, so anyone can send to it
+        if(bridge->mode == BRIDGE_GATEWAY && !isBridgePeer(bridge, &sources[index])){
+            addStatsCounter(STATS_BRIDGE_REJECTED, 1);
+            continue;
+        }
+
+        if((msgs[index].msg_hdr.msg_flags & MSG_TRUNC) ||
+           !processBridgeDatagram(bridge, iovs[index].iov_base, msgs[index].msg_len, &sources[index])){
+            addStatsCounter(STATS_BRIDGE_INVALID, 1);
+        }
+    }
+
+    return (uint32_t) nmsgs;
+}
+
+/**
+ * Sleeps until a datagram arrives, the simulation enqueues operations,
+ * the flush deadline is reached or BRIDGE_POLL_US passed.
+ *
+ * @param bridge - The bridge.
+ * @param now    - The current monotonic time in nanoseconds.
+ */
+static void waitBridge(struct bcmBridge *const bridge, uint64_t now){
+
+    struct pollfd pfds[2];
+    nfds_t npfds = 1;
+
+    pfds[0].fd      = bridge->socketFD;
+    pfds[0].events  = POLLIN;
+    pfds[0].revents = 0;
+
+    // Note: The event loops never notify the bridge, their queues are polled.
+    // The simulation wakes up the bridge with the eventfd of its queue.
+    if(bridge->mode == BRIDGE_SIMULATION){
+        pfds[1].fd      = bridge->operationQueue.eventFD;
+        pfds[1].events  = POLLIN;
+        pfds[1].revents = 0;
+        npfds = 2;
+    }
+
+    uint64_t wait = BRIDGE_POLL_US * 1000ull;
+
+    if(bridge->pendingBytes > 0){
+
+        uint64_t deadline = bridge->pendingSince + BRIDGE_FLUSH_US * 1000ull;
+        wait = deadline <= now ? 0 : (deadline - now < wait ? deadline - now : wait);
+    }
+
+    struct timespec timeout = {(time_t) (wait / 1000000000ull), (long) (wait % 1000000000ull)};
+
+    if(ppoll(pfds, npfds, &timeout, NULL) > 0 && npfds == 2 && (pfds[1].revents & POLLIN)){
+
+        uint64_t value;
+
+        // Consume the notification, the queue is drained right after
+        if(read(bridge->operationQueue.eventFD, &value, sizeof(value)) < 0 && errno != EAGAIN){
+            printf("Error could not read the eventfd of the bridge: %s\n", strerror(errno));
+        }
+    }
+}
+
+/**
+ * The thread function of the bridge.
+ *
+ * @param arg - The bridge.
+ */
+static void* bridgeThread(void *arg){
+
+    struct bcmBridge *const bridge = arg;
+
+    while(atomic_load_explicit(&bridge->running, memory_order_relaxed)){
+
+        uint32_t work = receiveBridge(bridge);
+        work += drainBridge(bridge);
+
+        uint64_t now = getStatsTime();
+
+        // Note: An empty datagram announces the simulation, e.g. after the gateway restarted
+        if(bridge->mode == BRIDGE_SIMULATION && bridge->ntx == 0 &&
+           now - bridge->lastSend >= BRIDGE_HELLO_MS * 1000000ull){
+            openBridgeDatagram(bridge);
+        }
+
+        if(bridge->ntx > 0 && (bridge->pendingBytes >= BRIDGE_FLUSH_BYTES || bridge->pendingBytes == 0 ||
+                               now - bridge->pendingSince >= BRIDGE_FLUSH_US * 1000ull)){
+            flushBridge(bridge);
+        }
+
+        if(work == 0){
+            waitBridge(bridge, now);
+        }
+    }
+
+    // Send everything that was queued until the stop
+    drainBridge(bridge);
+    flushBridge(bridge);
+
+    return NULL;
+}
+
+/**
+ * Allocates the datagrams and starts a new session.
+ *
+ * @param bridge - The bridge with the mode set.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+static int setupBridgeBuffers(struct bcmBridge *const bridge){
+
+    bridge->txBuffers = malloc((size_t) BRIDGE_BATCH_SIZE * BRIDGE_DATAGRAM_SIZE);
+    bridge->rxBuffers = malloc((size_t) BRIDGE_BATCH_SIZE * BRIDGE_DATAGRAM_SIZE);
+
+    if(bridge->txBuffers == NULL || bridge->rxBuffers == NULL){
+        printf("Error could not allocate the datagrams of the bridge \n");
+        return ERR_MALLOC_FAILED;
+    }
+
+    // Note: The session tells the peer that the sequence starts again
+    if(getrandom(&bridge->session, sizeof(bridge->session), GRND_NONBLOCK) != sizeof(bridge->session)){
+        bridge->session = (uint32_t) (getStatsRealtime() ^ ((uint64_t) getpid() << 16));
+    }
+
+    bridge->retCode = RET_E_OK;
+    atomic_store(&bridge->running, 1);
+
+    return RET_E_OK;
+}
+
+int setupBridgeGateway(struct bcmBridge *const bridge, struct bcmWorkers *const workers, char const *const address,
+                       uint16_t port, char const *const peerAddress, uint16_t peerPort){
+
+    struct sockaddr_in addr;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(bridge, 0, sizeof(struct bcmBridge));
+    bridge->mode                   = BRIDGE_GATEWAY;
+    bridge->socketFD               = -1;
+    bridge->operationQueue.eventFD = -1;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port   = htons(port);
+
+    bridge->expectedPeer.sin_family = AF_INET;
+    bridge->expectedPeer.sin_port   = htons(peerPort);
+
+    if(inet_pton(AF_INET, address, &addr.sin_addr) != 1 ||
+       inet_pton(AF_INET, peerAddress, &bridge->expectedPeer.sin_addr) != 1){
+        printf("Error the addresses %s and %s of the bridge are no IPv4 addresses \n", address, peerAddress);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    for(int index = 0; index < workers->nworkers; index++){
+
+        struct bcmWorker *const worker = &workers->workers[index];
+
+        bridge->eventSources[bridge->nsources++] = &worker->eventQueue;
+
+        for(int channel = 0; channel < MAX_CHANNELS; channel++){
+            if(worker->contexts[channel] != NULL){
+                bridge->operationTargets[channel] = &worker->operationQueue;
+            }
+        }
+    }
+
+    bridge->socketFD = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    if(bridge->socketFD < 0){
+        printf("Error could not create the socket of the bridge: %s\n", strerror(errno));
+        return ERR_SOCKET_FAILED;
+    }
+
+    if(bind(bridge->socketFD, (struct sockaddr*) &addr, sizeof(addr)) < 0){
+        printf("Error could not bind the bridge to %s:%u: %s\n", address, port, strerror(errno));
+        freeBridge(bridge);
+        return ERR_BIND_FAILED;
+    }
+
+    int ret = setupBridgeBuffers(bridge);
+
+    if(ret != RET_E_OK){
+        freeBridge(bridge);
+    }
+
+    return ret;
+}
+
+int setupBridgeSimulation(struct bcmBridge *const bridge, char const *const host, uint16_t port){
+
+    struct addrinfo hints;
+    struct addrinfo *result = NULL;
+    char service[8];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(bridge, 0, sizeof(struct bcmBridge));
+    bridge->mode                   = BRIDGE_SIMULATION;
+    bridge->socketFD               = -1;
+    bridge->operationQueue.eventFD = -1;
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family   = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    snprintf(service, sizeof(service), "%u", port);
+
+    int error = getaddrinfo(host, service, &hints, &result);
+
+    if(error != 0){
+        printf("Error could not resolve the gateway %s: %s\n", host, gai_strerror(error));
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    bridge->socketFD = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+
+    // Note: The connected socket only receives the datagrams of the gateway
+    if(bridge->socketFD < 0 || connect(bridge->socketFD, result->ai_addr, result->ai_addrlen) < 0){
+        printf("Error could not connect the bridge to %s:%u: %s\n", host, port, strerror(errno));
+        freeaddrinfo(result);
+        freeBridge(bridge);
+        return ERR_SOCKET_FAILED;
+    }
+
+    freeaddrinfo(result);
+
+    if(setupOperationQueue(&bridge->operationQueue, OPERATION_QUEUE_SIZE) != RET_E_OK){
+        freeBridge(bridge);
+        return ERR_EVENTFD_FAILED;
+    }
+
+    if(setupEventQueue(&bridge->eventQueue, EVENT_QUEUE_SIZE) != RET_E_OK){
+        freeBridge(bridge);
+        return ERR_MALLOC_FAILED;
+    }
+
+    int ret = setupBridgeBuffers(bridge);
+
+    if(ret != RET_E_OK){
+        freeBridge(bridge);
+        return ret;
+    }
+
+    // Announce the simulation so the gateway knows where to send the events
+    openBridgeDatagram(bridge);
+    flushBridge(bridge);
+
+    return RET_E_OK;
+}
+
+int startBridge(struct bcmBridge *const bridge){
+
+    sigset_t allSignals; // Blocked in the bridge thread
+    sigset_t oldSignals; // The signal mask of the caller
+
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+
+    int ret = pthread_create(&bridge->thread, NULL, bridgeThread, bridge);
+
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    if(ret != 0){
+        printf("Error could not start the bridge: %s\n", strerror(ret));
+        return ERR_THREAD_FAILED;
+    }
+
+    bridge->hasThread = 1;
+    return RET_E_OK;
+}
+
+int stopBridge(struct bcmBridge *const bridge){
+
+    atomic_store(&bridge->running, 0);
+
+    if(bridge->hasThread){
+        pthread_join(bridge->thread, NULL);
+        bridge->hasThread = 0;
+    }else if(bridge->socketFD != -1){
+        // Without a thread send what was queued on the caller
+        bridgeThread(bridge);
+    }
+
+    return bridge->retCode;
+}
+
+void freeBridge(struct bcmBridge *const bridge){
+
+    if(bridge->socketFD != -1){
+        close(bridge->socketFD);
+        bridge->socketFD = -1;
+    }
+
+    // Note: The queues of the gateway belong to the workers
+    if(bridge->mode == BRIDGE_SIMULATION){
+        freeOperationQueue(&bridge->operationQueue);
+        freeEventQueue(&bridge->eventQueue);
+    }
+
+    free(bridge->txBuffers);
+    free(bridge->rxBuffers);
+
+    bridge->txBuffers = NULL;
+    bridge->rxBuffers = NULL;
+    bridge->nsources  = 0;
+    bridge->hasPeer   = 0;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,285 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Capture.c
+ \brief     Provides the binary capture of all received BCM messages.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Capture.h"
+#include "CANFD_BCM_Stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/can/bcm.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define CAPTURE_ALIGNMENT   4096 // Alignment of the write buffer, one page
+#define CAPTURE_DRAIN_BATCH 64   // Number of entries taken from a queue at once
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Writes the filled part of the buffer to the file.
+ * After an error the capture stops writing and only drains the queues.
+ *
+ * @param capture - The capture.
+ */
+static void writeCaptureBuffer(struct bcmCapture *const capture){
+
+    size_t written = 0;
+
+    while(written < capture->used && capture->retCode == RET_E_OK){
+
+        ssize_t nbytes = write(capture->fileFD, capture->buffer + written, capture->used - written);
+
+        if(nbytes < 0 && errno == EINTR){
+            continue;
+        }
+
+        if(nbytes <= 0){
+            printf("Error could not write the capture: %s\n", strerror(errno));
+            capture->retCode = ERR_WRITE_FAILED;
+            break;
+        }
+
+        written += (size_t) nbytes;
+    }
+
+    capture->bytes += written;
+    capture->used   = 0;
+}
+
+/**
+ * Moves the queued messages of all channels into the buffer.
+ *
+ * @param capture - The capture.
+ * @return The number of moved messages.
+ */
+static uint32_t drainCapture(struct bcmCapture *const capture){
+
+    struct bcmCaptureEntry entries[CAPTURE_DRAIN_BATCH]; // The entries taken from a queue
+    uint32_t total = 0;
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+
+        if(capture->rings[channel] == NULL){
+            continue;
+        }
+
+        uint32_t nentries = dequeueRing(capture->rings[channel], entries, CAPTURE_DRAIN_BATCH);
+
+        for(uint32_t index = 0; index < nentries; index++){
+
+            size_t recordSize = LOG_RECORD_SIZE(entries[index].record.len);
+
+            // Note: The buffer is only written when full, so the writes are large and aligned
+            if(capture->used + recordSize > CAPTURE_BUFFER_SIZE){
+                writeCaptureBuffer(capture);
+            }
+
+            // Note: The padding of the payload is zeroed by captureMessage
+            memcpy(capture->buffer + capture->used, &entries[index], recordSize);
+            capture->used += recordSize;
+        }
+
+        capture->records += nentries;
+        total            += nentries;
+    }
+
+    return total;
+}
+
+/**
+ * The thread function of the writer.
+ *
+ * @param arg - The capture.
+ */
+static void* captureThread(void *arg){
+
+    struct bcmCapture *const capture = arg;
+    struct timespec wait = {0, CAPTURE_POLL_US * 1000};
+
+    // Note: The event loops never notify the writer, it polls the queues instead
+    while(atomic_load_explicit(&capture->running, memory_order_relaxed)){
+
+        if(drainCapture(capture) == 0){
+            nanosleep(&wait, NULL);
+        }
+    }
+
+    // Write everything that was queued until the stop
+    while(drainCapture(capture) > 0){
+    }
+
+    writeCaptureBuffer(capture);
+    return NULL;
+}
+
+int setupCapture(struct bcmCapture *const capture, char const *const path, struct bcmChannels *const channels){
+
+    struct bcmLogHeader header;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(capture, 0, sizeof(struct bcmCapture));
+    capture->fileFD   = -1;
+    capture->channels = channels;
+
+    capture->fileFD = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+
+    if(capture->fileFD == -1){
+        printf("Error could not create the capture %s: %s\n", path, strerror(errno));
+        return ERR_OPEN_FAILED;
+    }
+
+    if(posix_memalign((void **) &capture->buffer, CAPTURE_ALIGNMENT, CAPTURE_BUFFER_SIZE) != 0){
+        printf("Error could not allocate the capture buffer \n");
+        freeCapture(capture);
+        return ERR_MALLOC_FAILED;
+    }
+
+    for(int channel = 0; channel < channels->nchannels; channel++){
+
+        capture->rings[channel] = allocateRing(CAPTURE_QUEUE_SIZE, sizeof(struct bcmCaptureEntry));
+
+        if(capture->rings[channel] == NULL){
+            printf("Error could not allocate the capture queue of channel %d \n", channel);
+            freeCapture(capture);
+            return ERR_MALLOC_FAILED;
+        }
+    }
+
+    // The header goes out with the first buffer
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, LOG_MAGIC, sizeof(header.magic));
+    header.version = LOG_VERSION;
+
+    memcpy(capture->buffer, &header, sizeof(header));
+    capture->used = sizeof(header);
+
+    for(int channel = 0; channel < channels->nchannels; channel++){
+        getChannel(channels, channel)->capture = capture;
+    }
+
+    capture->retCode = RET_E_OK;
+    atomic_store(&capture->running, 1);
+
+    return RET_E_OK;
+}
+
+int startCapture(struct bcmCapture *const capture){
+
+    sigset_t allSignals; // Blocked in the writer thread
+    sigset_t oldSignals; // The signal mask of the caller
+
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+
+    int ret = pthread_create(&capture->thread, NULL, captureThread, capture);
+
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    if(ret != 0){
+        printf("Error could not start the capture writer: %s\n", strerror(ret));
+        return ERR_THREAD_FAILED;
+    }
+
+    capture->hasThread = 1;
+    return RET_E_OK;
+}
+
+void captureMessage(struct bcmCapture *const capture, int channel, struct bcmMsgSingleFrameCanFD const* const msg,
+                    uint64_t timestamp){
+
+    struct bcmCaptureEntry entry;
+    struct canfd_frame const* const frame = &msg->canfdFrame[0];
+    int isCANFD = (msg->msg_head.flags & CAN_FD_FRAME) ? 1 : 0;
+
+    // Note: A RX_TIMEOUT message has no frame. Only the head is valid.
+    if(msg->msg_head.opcode == RX_TIMEOUT){
+        entry.record.canID = msg->msg_head.can_id;
+        entry.record.len   = 0;
+        entry.record.flags = 0;
+    }else{
+        entry.record.canID = frame->can_id;
+        entry.record.len   = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+        entry.record.flags = isCANFD ? frame->flags : 0;
+    }
+
+    entry.record.timestamp = timestamp;
+    entry.record.opcode    = (uint8_t) msg->msg_head.opcode;
+    entry.record.kind      = (uint8_t) ((isCANFD ? LOG_RECORD_CANFD : 0) | (channel & LOG_RECORD_CHANNEL));
+
+    // Note: Only the payload up to the padding of the record is written
+    size_t dataSize = LOG_RECORD_SIZE(entry.record.len) - sizeof(struct bcmLogRecord);
+
+    memset(entry.data, 0, dataSize);
+    memcpy(entry.data, frame->data, entry.record.len);
+
+    if(enqueueRing(capture->rings[channel], &entry, 1) == 1){
+        addStatsCounter(STATS_CAPTURED, 1);
+    }else{
+        addStatsCounter(STATS_CAPTURE_DROPPED, 1);
+    }
+}
+
+int stopCapture(struct bcmCapture *const capture){
+
+    atomic_store(&capture->running, 0);
+
+    if(capture->hasThread){
+        pthread_join(capture->thread, NULL);
+        capture->hasThread = 0;
+    }else{
+        // Without a thread write what was queued on the caller
+        captureThread(capture);
+    }
+
+    return capture->retCode;
+}
+
+void freeCapture(struct bcmCapture *const capture){
+
+    if(capture->channels != NULL){
+        for(int channel = 0; channel < capture->channels->nchannels; channel++){
+            getChannel(capture->channels, channel)->capture = NULL;
+        }
+    }
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+        freeRing(capture->rings[channel]);
+        capture->rings[channel] = NULL;
+    }
+
+    free(capture->buffer);
+    capture->buffer = NULL;
+
+    if(capture->fileFD != -1){
+        close(capture->fileFD);
+        capture->fileFD = -1;
+    }
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,120 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Channel.c
+ \brief     Provides one BCM socket per CAN/CANFD bus addressed by a channel handle.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Socket.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+void initChannels(struct bcmChannels *const channels){
+
+    for(int index = 0; index < MAX_CHANNELS; index++){
+        initContext(&channels->contexts[index]);
+    }
+
+    channels->nchannels = 0;
+}
+
+int openChannels(struct bcmChannels *const channels, char const *const interfaces[], int ninterfaces,
+                 int isBlocking, struct bcmEventQueue *const eventQueue){
+
+    if(ninterfaces <= 0 || ninterfaces > MAX_CHANNELS){
+        printf("Error the number of interfaces must be between 1 and %d \n", MAX_CHANNELS);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    for(int index = 0; index < ninterfaces; index++){
+
+        struct bcmContext *const ctx = &channels->contexts[index];
+
+        // Note: Count the channel first so closeChannels also cleans up a partly opened one
+        channels->nchannels = index + 1;
+
+        if(setupSocketOnInterface(&ctx->socketFD, &ctx->addr, interfaces[index], isBlocking) != RET_E_OK){
+            printf("Error could not setup the socket on the interface %s \n", interfaces[index]);
+            return ERR_SETUP_FAILED;
+        }
+
+        if(setupContext(ctx) != RET_E_OK){
+            printf("Error could not setup the context of the interface %s \n", interfaces[index]);
+            return ERR_MALLOC_FAILED;
+        }
+
+        // The raw socket is optional. Without it createTxSend stays on the BCM socket.
+        if(ctx->txSendPolicy != TX_SEND_POLICY_BCM &&
+           setupRawSocketOnInterface(&ctx->rawSocketFD, interfaces[index]) != RET_E_OK){
+            printf("Warning could not setup the raw socket on %s. TX_SEND uses the BCM socket.\n", interfaces[index]);
+            ctx->txSendPolicy = TX_SEND_POLICY_BCM;
+        }
+
+        snprintf(ctx->interfaceName, sizeof(ctx->interfaceName), "%s", interfaces[index]);
+        ctx->channel       = index;
+        ctx->eventQueue    = eventQueue;
+        ctx->txQueueLength = getInterfaceTxQueueLength(ctx->socketFD, interfaces[index]);
+
+        // Report the sizes the kernel applied, they are the base for sizing the buffers to the traffic
+        int rcvbuf = 0;
+        int sndbuf = 0;
+
+        if(VERBOSE && getSocketBuffers(ctx->socketFD, &rcvbuf, &sndbuf) == RET_E_OK){
+            printf("Channel %d on %s: receive buffer %d, send buffer %d bytes, TX queue length %d frames\n", index,
+                   interfaces[index], rcvbuf, sndbuf, ctx->txQueueLength);
+        }
+    }
+
+    return RET_E_OK;
+}
+
+struct bcmContext* getChannel(struct bcmChannels *const channels, int channel){
+
+    if(channel < 0 || channel >= channels->nchannels){
+        return NULL;
+    }
+
+    return &channels->contexts[channel];
+}
+
+void closeChannels(struct bcmChannels *const channels){
+
+    for(int index = 0; index < channels->nchannels; index++){
+
+        struct bcmContext *const ctx = &channels->contexts[index];
+
+        freeContext(ctx);
+
+        if(ctx->socketFD != -1){
+            close(ctx->socketFD);
+            ctx->socketFD = -1;
+        }
+
+        if(ctx->rawSocketFD != -1){
+            close(ctx->rawSocketFD);
+            ctx->rawSocketFD = -1;
+        }
+    }
+
+    channels->nchannels = 0;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
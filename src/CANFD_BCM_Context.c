@@ -0,0 +1,159 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Context.c
+ \brief     Provides the per-socket context with the reusable BCM message buffers.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Allocates a zeroed, cache line aligned buffer.
+ *
+ * @param size - The size of the buffer in bytes.
+ * @return The buffer or NULL on failure.
+ */
+static void* allocateAligned(size_t size){
+
+    void *buffer = NULL;
+
+    if(posix_memalign(&buffer, CACHE_LINE_SIZE, size) != 0){
+        return NULL;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(buffer, 0, size);
+
+    return buffer;
+}
+
+void initContext(struct bcmContext *const ctx){
+
+    memset(ctx, 0, sizeof(struct bcmContext));
+    ctx->socketFD     = -1;
+    ctx->rawSocketFD  = -1;
+    ctx->epollFD      = -1;
+    ctx->txSendPolicy  = TX_SEND_POLICY;
+    ctx->txQueueLength = -1;
+}
+
+int setupContext(struct bcmContext *const ctx){
+
+    // Allocate one buffer for each message shape
+    ctx->txSingleCan     = allocateAligned(sizeof(struct bcmMsgSingleFrameCan));
+    ctx->txSingleCanFD   = allocateAligned(sizeof(struct bcmMsgSingleFrameCanFD));
+    ctx->txMultipleCan   = allocateAligned(sizeof(struct bcmMsgMultipleFramesCan));
+    ctx->txMultipleCanFD = allocateAligned(sizeof(struct bcmMsgMultipleFramesCanFD));
+
+    // Allocate the contiguous buffer for the batched send
+    ctx->txBatch       = allocateAligned(sizeof(struct bcmMsgSingleFrameCanFD) * TX_BATCH_SIZE);
+    ctx->txBatchIovecs = allocateAligned(sizeof(struct iovec) * TX_BATCH_SIZE);
+    ctx->txBatchMsgs   = allocateAligned(sizeof(struct mmsghdr) * TX_BATCH_SIZE);
+
+    // Allocate the ring for the batched receive
+    ctx->rxBuffers  = allocateAligned(sizeof(struct bcmMsgSingleFrameCanFD) * RX_BATCH_SIZE);
+    ctx->rxIovecs   = allocateAligned(sizeof(struct iovec) * RX_BATCH_SIZE);
+    ctx->rxMsgs     = allocateAligned(sizeof(struct mmsghdr) * RX_BATCH_SIZE);
+    ctx->rxControls = allocateAligned(sizeof(union bcmRxControl) * RX_BATCH_SIZE);
+
+    // Allocate the ring of the messages that are held back after a transient send error
+    if(SEND_RETRY_QUEUE_SIZE > 0){
+        ctx->retries       = allocateAligned(sizeof(struct bcmRetry) * SEND_RETRY_QUEUE_SIZE);
+        ctx->retryCapacity = ctx->retries != NULL ? SEND_RETRY_QUEUE_SIZE : 0;
+    }
+
+    // Error handling
+    if(ctx->txSingleCan == NULL || ctx->txSingleCanFD == NULL || ctx->txMultipleCan == NULL ||
+       ctx->txMultipleCanFD == NULL || ctx->txBatch == NULL || ctx->txBatchIovecs == NULL || ctx->txBatchMsgs == NULL ||
+       ctx->rxBuffers == NULL || ctx->rxIovecs == NULL || ctx->rxMsgs == NULL || ctx->rxControls == NULL ||
+       (SEND_RETRY_QUEUE_SIZE > 0 && ctx->retries == NULL)){
+        printf("Error could not allocate memory for the message buffers \n");
+        freeContext(ctx);
+        return ERR_MALLOC_FAILED;
+    }
+
+    // Set up the registry of the active tasks
+    if(setupRegistry(&ctx->registry, REGISTRY_SIZE) != RET_E_OK){
+        freeContext(ctx);
+        return ERR_MALLOC_FAILED;
+    }
+
+    // Note: The iovec of a batch message is filled in by the send because the
+    // message size depends on CAN or CANFD. The header always uses the same iovec.
+    for(int index = 0; index < TX_BATCH_SIZE; index++){
+        ctx->txBatchMsgs[index].msg_hdr.msg_iov    = &ctx->txBatchIovecs[index];
+        ctx->txBatchMsgs[index].msg_hdr.msg_iovlen = 1;
+    }
+
+    // Note: The iovecs and headers always point to the same buffer
+    // so there is nothing to set up on the receive path. Only the length
+    // of the control buffer is overwritten by the kernel on every receive.
+    for(int index = 0; index < RX_BATCH_SIZE; index++){
+        ctx->rxIovecs[index].iov_base = &ctx->rxBuffers[index];
+        ctx->rxIovecs[index].iov_len  = sizeof(struct bcmMsgSingleFrameCanFD);
+
+        ctx->rxMsgs[index].msg_hdr.msg_iov        = &ctx->rxIovecs[index];
+        ctx->rxMsgs[index].msg_hdr.msg_iovlen     = 1;
+        ctx->rxMsgs[index].msg_hdr.msg_control    = &ctx->rxControls[index];
+        ctx->rxMsgs[index].msg_hdr.msg_controllen = sizeof(union bcmRxControl);
+    }
+
+    return RET_E_OK;
+}
+
+void freeContext(struct bcmContext *const ctx){
+
+    // Note: free(NULL) is a no-op so a partly set up context can be freed
+    free(ctx->txSingleCan);
+    free(ctx->txSingleCanFD);
+    free(ctx->txMultipleCan);
+    free(ctx->txMultipleCanFD);
+    free(ctx->txBatch);
+    free(ctx->txBatchIovecs);
+    free(ctx->txBatchMsgs);
+    free(ctx->rxBuffers);
+    free(ctx->rxIovecs);
+    free(ctx->rxMsgs);
+    free(ctx->rxControls);
+    free(ctx->retries);
+
+    freeRegistry(&ctx->registry);
+
+    ctx->txSingleCan     = NULL;
+    ctx->txSingleCanFD   = NULL;
+    ctx->txMultipleCan   = NULL;
+    ctx->txMultipleCanFD = NULL;
+    ctx->txBatch         = NULL;
+    ctx->txBatchIovecs   = NULL;
+    ctx->txBatchMsgs     = NULL;
+    ctx->rxBuffers       = NULL;
+    ctx->rxIovecs        = NULL;
+    ctx->rxMsgs          = NULL;
+    ctx->rxControls      = NULL;
+    ctx->retries         = NULL;
+    ctx->retryCapacity   = 0;
+    ctx->retryHead       = 0;
+    ctx->nretries        = 0;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,790 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Dbc.c
+ \brief     Provides the signal database (DBC) and the decoding of received frames into signal values.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Dbc.h"
+#include <endian.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define DBC_BUCKET_SEED   0x9E3779B9u // Seed of the hash that selects the bucket of a CAN ID
+#define DBC_SEED_TRIES    (1u << 16)  // Seeds tried for a bucket before the number of slots is doubled
+#define DBC_GROW_TRIES    8           // Number of times the number of slots is doubled
+#define DBC_EFF_ID_FLAG   0x80000000u // Flag for extended frames in the IDs of a DBC file
+#define DBC_PSEUDO_ID     0x40000000u // Flag of the pseudo messages of a DBC file, e.g. VECTOR__INDEPENDENT_SIG_MSG
+#define DBC_EMPTY_SLOT    UINT32_MAX  // The message index of an empty slot
+#define DBC_MAX_BUCKET    64          // Most messages of a bucket of the perfect hash
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Hashes a CAN ID with a seed (finalizer of MurmurHash3).
+ *
+ * @param key  - The CAN ID.
+ * @param seed - The seed.
+ */
+static uint32_t hashKey(uint32_t key, uint32_t seed){
+
+    key ^= seed;
+    key ^= key >> 16;
+    key *= 0x85EBCA6Bu;
+    key ^= key >> 13;
+    key *= 0xC2B2AE35u;
+    key ^= key >> 16;
+
+    return key;
+}
+
+/**
+ * Returns the key of a CAN ID in the perfect hash.
+ * Only the CAN ID and the EFF flag are kept.
+ *
+ * @param canID - The CAN ID.
+ */
+static canid_t getKey(canid_t canID){
+
+    return (canID & CAN_EFF_FLAG) ? (canID & (CAN_EFF_FLAG | CAN_EFF_MASK)) : (canID & CAN_SFF_MASK);
+}
+
+/**
+ * Returns the smallest power of two that is at least value.
+ *
+ * @param value - The value.
+ */
+static uint32_t getPowerOfTwo(uint32_t value){
+
+    uint32_t power = 1;
+
+    while(power < value){
+        power <<= 1;
+    }
+
+    return power;
+}
+
+/**
+ * Makes sure an array has room for one more element.
+ *
+ * @param array    - The array.
+ * @param capacity - The number of elements the array has room for.
+ * @param count    - The number of elements in the array.
+ * @param elemSize - The size of one element in bytes.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+static int reserveArray(void **const array, uint32_t *const capacity, uint32_t count, size_t elemSize){
+
+    if(count < *capacity){
+        return RET_E_OK;
+    }
+
+    uint32_t newCapacity = *capacity > 0 ? *capacity * 2 : 64;
+    void *newArray = realloc(*array, newCapacity * elemSize);
+
+    if(newArray == NULL){
+        return ERR_MALLOC_FAILED;
+    }
+
+    *array    = newArray;
+    *capacity = newCapacity;
+
+    return RET_E_OK;
+}
+
+/**
+ * Skips spaces and tabs.
+ *
+ * @param text - The text.
+ */
+static char const* skipSpaces(char const *text){
+
+    while(*text == ' ' || *text == '\t'){
+        text++;
+    }
+
+    return text;
+}
+
+/**
+ * Copies the next word up to a space, a tab, a colon or the end of the line.
+ *
+ * @param text - The text after leading spaces.
+ * @param word - Storage for the word.
+ * @param size - The size of the storage.
+ * @return The text after the word or NULL if the word is empty or too long.
+ */
+static char const* readWord(char const *text, char *const word, size_t size){
+
+    size_t length = strcspn(text, " \t:\r\n");
+
+    if(length == 0 || length >= size){
+        return NULL;
+    }
+
+    memcpy(word, text, length);
+    word[length] = '\0';
+
+    return text + length;
+}
+
+/**
+ * Reads a message line, e.g. "BO_ 100 EngineData: 8 Vector__XXX".
+ *
+ * @param dbc      - The signal database.
+ * @param capacity - The number of messages the array has room for.
+ * @param line     - The line after "BO_".
+ * @return RET_E_OK, ERR_DBC_FORMAT if the line is skipped or ERR_MALLOC_FAILED.
+ */
+static int readMessage(struct bcmDbc *const dbc, uint32_t *const capacity, char const *line){
+
+    char *end = NULL;
+    unsigned long id = 0;
+    unsigned long len = 0;
+    char name[DBC_NAME_SIZE];
+
+    line = skipSpaces(line);
+    id   = strtoul(line, &end, 10);
+
+    if(end == line || (line = readWord(skipSpaces(end), name, sizeof(name))) == NULL){
+        return ERR_DBC_FORMAT;
+    }
+
+    line = skipSpaces(line);
+
+    if(*line != ':'){
+        return ERR_DBC_FORMAT;
+    }
+
+    len = strtoul(line + 1, &end, 10);
+
+    // Note: The pseudo messages only collect signals without a message
+    if(end == line + 1 || (id & DBC_PSEUDO_ID) != 0){
+        return ERR_DBC_FORMAT;
+    }
+
+    if(reserveArray((void **) &dbc->messages, capacity, dbc->nmessages, sizeof(struct bcmDbcMessage)) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    struct bcmDbcMessage *const message = &dbc->messages[dbc->nmessages];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(message, 0, sizeof(struct bcmDbcMessage));
+
+    if(id & DBC_EFF_ID_FLAG){
+        message->canID = ((canid_t) id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    }else{
+        message->canID = (canid_t) id & CAN_SFF_MASK;
+    }
+
+    message->firstSignal = dbc->nsignals;
+    message->multiplexor = DBC_NO_MUX;
+    message->len         = (uint8_t) (len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : len);
+    memcpy(message->name, name, sizeof(name));
+
+    dbc->nmessages++;
+    return RET_E_OK;
+}
+
+/**
+ * Makes sure the signal arrays have room for one more signal.
+ *
+ * @param dbc      - The signal database.
+ * @param capacity - The number of signals the arrays have room for.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+static int reserveSignal(struct bcmDbc *const dbc, uint32_t *const capacity){
+
+    // Note: Each array gets its own copy of the capacity, it is only updated when all arrays were grown
+    uint32_t capacities[4] = {*capacity, *capacity, *capacity, *capacity};
+
+    if(reserveArray((void **) &dbc->signals, &capacities[0], dbc->nsignals, sizeof(struct bcmDbcSignal)) != RET_E_OK ||
+       reserveArray((void **) &dbc->infos, &capacities[1], dbc->nsignals, sizeof(struct bcmDbcSignalInfo)) != RET_E_OK ||
+       reserveArray((void **) &dbc->scales, &capacities[2], dbc->nsignals, sizeof(double)) != RET_E_OK ||
+       reserveArray((void **) &dbc->offsets, &capacities[3], dbc->nsignals, sizeof(double)) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    *capacity = capacities[0];
+    return RET_E_OK;
+}
+
+/**
+ * Reads a signal line of the last message, e.g.
+ * "SG_ EngineSpeed : 24|16@1+ (0.125,0) [0|8031.875] "rpm" Vector__XXX".
+ *
+ * @param dbc      - The signal database.
+ * @param capacity - The number of signals the arrays have room for.
+ * @param line     - The line after "SG_".
+ * @return RET_E_OK, ERR_DBC_FORMAT if the line is skipped or ERR_MALLOC_FAILED.
+ */
+static int readSignal(struct bcmDbc *const dbc, uint32_t *const capacity, char const *line){
+
+    struct bcmDbcMessage *const message = &dbc->messages[dbc->nmessages - 1];
+    char name[DBC_NAME_SIZE];
+    char mux[DBC_NAME_SIZE];
+    unsigned int startBit = 0;
+    unsigned int length   = 0;
+    char order            = 0;
+    char sign             = 0;
+    double scale          = 0;
+    double offset         = 0;
+    double minimum        = 0;
+    double maximum        = 0;
+    char unit[DBC_UNIT_SIZE];
+    int muxValue          = DBC_NO_MUX;
+    int isMultiplexor     = 0;
+
+    if((line = readWord(skipSpaces(line), name, sizeof(name))) == NULL){
+        return ERR_DBC_FORMAT;
+    }
+
+    line = skipSpaces(line);
+
+    // The optional multiplexer indicator: "M" for the multiplexor, "m<value>" for a multiplexed signal
+    if(*line != ':'){
+
+        if((line = readWord(line, mux, sizeof(mux))) == NULL){
+            return ERR_DBC_FORMAT;
+        }
+
+        if(strcmp(mux, "M") == 0){
+            isMultiplexor = 1;
+        }else if(mux[0] != 'm' || sscanf(mux + 1, "%d", &muxValue) != 1 || muxValue < 0 || muxValue > INT16_MAX){
+            return ERR_DBC_FORMAT;
+        }
+
+        line = skipSpaces(line);
+    }
+
+    unit[0] = '\0';
+
+    // Note: The unit can be empty, so it is optional for sscanf
+    if(*line != ':' || sscanf(line + 1, " %u|%u@%c%c (%lf,%lf) [%lf|%lf] \"%15[^\"]\"", &startBit, &length, &order,
+                              &sign, &scale, &offset, &minimum, &maximum, unit) < 8){
+        return ERR_DBC_FORMAT;
+    }
+
+    if(length < 1 || length > 64 || (order != '0' && order != '1') || (sign != '+' && sign != '-') ||
+       message->nsignals >= DBC_MAX_SIGNALS || (isMultiplexor && message->multiplexor != DBC_NO_MUX)){
+        return ERR_DBC_FORMAT;
+    }
+
+    // The position of the signal in the bit stream of its byte order.
+    // Note: A Motorola start bit is the most significant bit, counted like an Intel bit.
+    unsigned int position = startBit;
+
+    if(order == '0'){
+        position = (startBit / 8) * 8 + 7 - startBit % 8;
+    }
+
+    if(position + length > CANFD_MAX_DLEN * 8){
+        return ERR_DBC_FORMAT;
+    }
+
+    if(reserveSignal(dbc, capacity) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    struct bcmDbcSignal *const signal   = &dbc->signals[dbc->nsignals];
+    struct bcmDbcSignalInfo *const info = &dbc->infos[dbc->nsignals];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(signal, 0, sizeof(struct bcmDbcSignal));
+    memset(info, 0, sizeof(struct bcmDbcSignalInfo));
+
+    signal->mask        = length == 64 ? UINT64_MAX : (((uint64_t) 1 << length) - 1);
+    signal->signBit     = sign == '-' ? (uint64_t) 1 << (length - 1) : 0;
+    signal->byte        = (uint8_t) (position / 8);
+    signal->shift       = (uint8_t) (position % 8);
+    signal->length      = (uint8_t) length;
+    signal->isBigEndian = order == '0';
+    signal->muxValue    = (int16_t) muxValue;
+
+    memcpy(info->name, name, sizeof(name));
+    memcpy(info->unit, unit, sizeof(unit));
+    info->startBit = (uint16_t) startBit;
+    info->isSigned = sign == '-';
+    info->message  = dbc->nmessages - 1;
+    info->minimum  = minimum;
+    info->maximum  = maximum;
+
+    dbc->scales[dbc->nsignals]  = scale;
+    dbc->offsets[dbc->nsignals] = offset;
+
+    if(isMultiplexor){
+        message->multiplexor = (int16_t) message->nsignals;
+    }
+
+    message->nsignals++;
+    dbc->nsignals++;
+
+    return RET_E_OK;
+}
+
+/**
+ * Places the messages of the buckets in the slots.
+ * The buckets with the most messages are placed first, while most slots are free.
+ *
+ * @param dbc     - The signal database with the allocated slots and seeds.
+ * @param members - The messages sorted by bucket.
+ * @param starts  - The index of the first member of each bucket, one more entry than buckets.
+ * @param order   - The buckets sorted by their number of messages, largest first.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if a bucket could not be placed.
+ */
+static int placeBuckets(struct bcmDbc *const dbc, uint32_t const* members, uint32_t const* starts,
+                        uint32_t const* order){
+
+    uint32_t slots[DBC_MAX_BUCKET]; // The slots of the members of the current bucket
+
+    for(uint32_t slot = 0; slot <= dbc->slotMask; slot++){
+        dbc->slots[slot].canID   = 0;
+        dbc->slots[slot].message = DBC_EMPTY_SLOT;
+    }
+
+    for(uint32_t index = 0; index <= dbc->bucketMask; index++){
+
+        uint32_t bucket   = order[index];
+        uint32_t nmembers = starts[bucket + 1] - starts[bucket];
+        uint32_t seed     = 0;
+
+        dbc->seeds[bucket] = 0;
+
+        if(nmembers == 0){
+            continue;
+        }
+
+        // Note: Only happens with a very unlucky hash, more slots do not help then
+        if(nmembers > DBC_MAX_BUCKET){
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        for(seed = 1; seed <= DBC_SEED_TRIES; seed++){
+
+            uint32_t placed = 0;
+
+            for(; placed < nmembers; placed++){
+
+                canid_t key   = dbc->messages[members[starts[bucket] + placed]].canID;
+                uint32_t slot = hashKey(key, seed) & dbc->slotMask;
+                int isFree    = dbc->slots[slot].message == DBC_EMPTY_SLOT;
+
+                for(uint32_t other = 0; other < placed && isFree; other++){
+                    isFree = slots[other] != slot;
+                }
+
+                if(!isFree){
+                    break;
+                }
+
+                slots[placed] = slot;
+            }
+
+            if(placed == nmembers){
+                break;
+            }
+        }
+
+        if(seed > DBC_SEED_TRIES){
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        dbc->seeds[bucket] = seed;
+
+        for(uint32_t member = 0; member < nmembers; member++){
+            uint32_t message = members[starts[bucket] + member];
+
+            dbc->slots[slots[member]].canID   = dbc->messages[message].canID;
+            dbc->slots[slots[member]].message = message;
+        }
+    }
+
+    return RET_E_OK;
+}
+
+/**
+ * Builds the perfect hash of the messages.
+ * If the buckets can not be placed the number of slots is doubled.
+ *
+ * @param dbc - The signal database with all messages.
+ * @return RET_E_OK, ERR_DBC_FORMAT if a CAN ID is defined twice, ERR_SETUP_FAILED or ERR_MALLOC_FAILED.
+ */
+static int buildHash(struct bcmDbc *const dbc){
+
+    uint32_t nbuckets = getPowerOfTwo(dbc->nmessages / 4 + 1);
+    uint32_t nslots   = getPowerOfTwo(dbc->nmessages * 2 + 1);
+    int retCode       = RET_E_OK;
+
+    uint32_t *members = malloc(sizeof(uint32_t) * (dbc->nmessages + 1));
+    uint32_t *starts  = calloc(nbuckets + 1, sizeof(uint32_t));
+    uint32_t *order   = malloc(sizeof(uint32_t) * nbuckets);
+    dbc->seeds        = malloc(sizeof(uint32_t) * nbuckets);
+    dbc->bucketMask   = nbuckets - 1;
+
+    if(members == NULL || starts == NULL || order == NULL || dbc->seeds == NULL){
+        retCode = ERR_MALLOC_FAILED;
+        goto cleanup;
+    }
+
+    // Sort the messages by bucket (counting sort)
+    for(uint32_t message = 0; message < dbc->nmessages; message++){
+        starts[(hashKey(dbc->messages[message].canID, DBC_BUCKET_SEED) & dbc->bucketMask) + 1]++;
+    }
+
+    for(uint32_t bucket = 0; bucket < nbuckets; bucket++){
+        starts[bucket + 1] += starts[bucket];
+        order[bucket]       = starts[bucket];
+    }
+
+    for(uint32_t message = 0; message < dbc->nmessages; message++){
+        members[order[hashKey(dbc->messages[message].canID, DBC_BUCKET_SEED) & dbc->bucketMask]++] = message;
+    }
+
+    // Two messages with the same CAN ID are always in the same bucket
+    for(uint32_t bucket = 0; bucket < nbuckets; bucket++){
+        for(uint32_t first = starts[bucket]; first < starts[bucket + 1]; first++){
+            for(uint32_t second = first + 1; second < starts[bucket + 1]; second++){
+
+                if(dbc->messages[members[first]].canID == dbc->messages[members[second]].canID){
+                    printf("Error the CAN ID 0x%X is defined twice in the DBC \n", dbc->messages[members[first]].canID);
+                    retCode = ERR_DBC_FORMAT;
+                    goto cleanup;
+                }
+            }
+        }
+    }
+
+    // Sort the buckets by their number of messages (insertion sort, most buckets hold a few messages)
+    for(uint32_t index = 0; index < nbuckets; index++){
+
+        uint32_t bucket = index;
+        uint32_t size   = starts[bucket + 1] - starts[bucket];
+        uint32_t pos    = index;
+
+        while(pos > 0 && starts[order[pos - 1] + 1] - starts[order[pos - 1]] < size){
+            order[pos] = order[pos - 1];
+            pos--;
+        }
+
+        order[pos] = bucket;
+    }
+
+    for(int tries = 0; tries < DBC_GROW_TRIES; tries++, nslots *= 2){
+
+        free(dbc->slots);
+        dbc->slots    = malloc(sizeof(struct bcmDbcSlot) * nslots);
+        dbc->slotMask = nslots - 1;
+
+        if(dbc->slots == NULL){
+            retCode = ERR_MALLOC_FAILED;
+            goto cleanup;
+        }
+
+        if(placeBuckets(dbc, members, starts, order) == RET_E_OK){
+            goto cleanup;
+        }
+    }
+
+    printf("Error could not build the perfect hash of the DBC \n");
+    retCode = ERR_SETUP_FAILED;
+
+cleanup:
+    free(members);
+    free(starts);
+    free(order);
+
+    return retCode;
+}
+
+int loadDbc(struct bcmDbc *const dbc, char const *const path){
+
+    uint32_t messageCapacity = 0; // The number of messages the array has room for
+    uint32_t signalCapacity  = 0; // The number of signals the arrays have room for
+    int hasMessage           = 0; // Flag for a message the following signals belong to
+    char *line               = NULL;
+    size_t lineSize          = 0;
+    int retCode              = RET_E_OK;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(dbc, 0, sizeof(struct bcmDbc));
+
+    FILE *file = fopen(path, "r");
+
+    if(file == NULL){
+        printf("Error could not open the DBC %s: %s\n", path, strerror(errno));
+        return ERR_OPEN_FAILED;
+    }
+
+    // Note: The file is only read once at startup, so getline is fast enough
+    while(retCode == RET_E_OK && getline(&line, &lineSize, file) != -1){
+
+        char const *text = skipSpaces(line);
+
+        if(strncmp(text, "BO_ ", 4) == 0){
+            retCode    = readMessage(dbc, &messageCapacity, text + 4);
+            hasMessage = retCode == RET_E_OK;
+        }else if(strncmp(text, "SG_ ", 4) == 0 && hasMessage){
+            retCode = readSignal(dbc, &signalCapacity, text + 4);
+        }else if(strncmp(text, "SG_ ", 4) == 0){
+            dbc->skipped++;
+        }else if(*text != '\r' && *text != '\n' && *text != '\0'){
+            // Note: Every other section ends the signals of the message
+            hasMessage = 0;
+        }
+
+        if(retCode == ERR_DBC_FORMAT){
+            dbc->skipped++;
+            retCode = RET_E_OK;
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    if(retCode == RET_E_OK){
+        retCode = buildHash(dbc);
+    }
+
+    if(retCode == ERR_MALLOC_FAILED){
+        printf("Error could not allocate the decode tables of the DBC \n");
+    }
+
+    if(retCode != RET_E_OK){
+        freeDbc(dbc);
+    }
+
+    return retCode;
+}
+
+struct bcmDbcMessage const* findDbcMessage(struct bcmDbc const* const dbc, canid_t canID){
+
+    canid_t key     = getKey(canID);
+    uint32_t bucket = hashKey(key, DBC_BUCKET_SEED) & dbc->bucketMask;
+    struct bcmDbcSlot const* const slot = &dbc->slots[hashKey(key, dbc->seeds[bucket]) & dbc->slotMask];
+
+    // Note: A CAN ID that is not in the database ends up in any slot
+    if(slot->canID != key || slot->message == DBC_EMPTY_SLOT){
+        return NULL;
+    }
+
+    return &dbc->messages[slot->message];
+}
+
+int findDbcSignal(struct bcmDbc const* const dbc, struct bcmDbcMessage const* const message, char const *const name){
+
+    for(uint32_t index = message->firstSignal; index < message->firstSignal + message->nsignals; index++){
+        if(strcmp(dbc->infos[index].name, name) == 0){
+            return (int) index;
+        }
+    }
+
+    return ERR_INVALID_ARGUMENT;
+}
+
+/**
+ * Extracts the raw value of a signal. Signed values are sign extended.
+ * Both byte orders are computed and one is selected, so there is no
+ * branch on the byte order.
+ *
+ * @param signal - The extractor of the signal.
+ * @param buffer - The payload padded with 8 zero bytes.
+ */
+static uint64_t extractRaw(struct bcmDbcSignal const* const signal, uint8_t const* const buffer){
+
+    uint64_t word = 0;
+
+    memcpy(&word, buffer + signal->byte, sizeof(word));
+
+    uint64_t next  = buffer[signal->byte + sizeof(word)];
+    uint64_t shift = signal->shift;
+
+    // Note: The shifts are split, so a shift of 0 does not shift by 64
+    uint64_t intel    = ((le64toh(word) >> shift) | ((next << 1) << (63 - shift))) & signal->mask;
+    uint64_t motorola = ((be64toh(word) << shift) | (next >> (8 - shift))) >> (64 - signal->length);
+    uint64_t raw      = signal->isBigEndian ? motorola : intel;
+
+    return (raw ^ signal->signBit) - signal->signBit;
+}
+
+int decodeDbcMessage(struct bcmDbc const* const dbc, struct bcmDbcMessage const* const message,
+                     uint8_t const* const data, size_t len, double values[]){
+
+    uint8_t buffer[CANFD_MAX_DLEN + 8];                    // The payload padded for the 8 byte reads
+    struct bcmDbcSignal const* const signals = &dbc->signals[message->firstSignal];
+    double const* const scales  = &dbc->scales[message->firstSignal];
+    double const* const offsets = &dbc->offsets[message->firstSignal];
+    int nsignals = message->nsignals;
+
+    memset(buffer, 0, sizeof(buffer));
+    memcpy(buffer, data, len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : len);
+
+    for(int index = 0; index < nsignals; index++){
+
+        uint64_t raw = extractRaw(&signals[index], buffer);
+
+        values[index] = signals[index].signBit ? (double) (int64_t) raw : (double) raw;
+    }
+
+    // Note: Kept apart from the extraction so the compiler can vectorize it
+    for(int index = 0; index < nsignals; index++){
+        values[index] = values[index] * scales[index] + offsets[index];
+    }
+
+    if(message->multiplexor != DBC_NO_MUX){
+
+        int64_t muxValue = (int64_t) extractRaw(&signals[message->multiplexor], buffer);
+
+        for(int index = 0; index < nsignals; index++){
+            if(signals[index].muxValue != DBC_NO_MUX && signals[index].muxValue != muxValue){
+                values[index] = NAN;
+            }
+        }
+    }
+
+    return nsignals;
+}
+
+/**
+ * Converts a physical value to the raw value of a signal.
+ *
+ * @param signal - The extractor of the signal.
+ * @param scale  - The factor of the signal.
+ * @param offset - The offset of the signal.
+ * @param value  - The physical value.
+ */
+static uint64_t getRaw(struct bcmDbcSignal const* const signal, double scale, double offset, double value){
+
+    double raw = scale != 0 ? (value - offset) / scale : 0;
+
+    // Note: The largest doubles below 2^63 and 2^64 keep the casts of 64 bit signals defined
+    double minimum = signal->signBit ? -(double) signal->signBit : 0;
+    double maximum = signal->signBit ? (signal->length == 64 ? 0x1.fffffffffffffp62 : (double) (signal->signBit - 1))
+                                     : (signal->length == 64 ? 0x1.fffffffffffffp63 : (double) signal->mask);
+
+    if(raw != raw){
+        raw = 0;
+    }
+
+    raw = raw < minimum ? minimum : (raw > maximum ? maximum : raw);
+    raw = raw < 0 ? raw - 0.5 : raw + 0.5;
+
+    // Note: Adding 0.5 can move a value at the limit out of the range again
+    raw = raw > maximum ? maximum : (raw < minimum ? minimum : raw);
+
+    if(signal->signBit){
+        return (uint64_t) (int64_t) raw & signal->mask;
+    }
+
+    return (uint64_t) raw & signal->mask;
+}
+
+/**
+ * Writes the raw value of a signal into a payload.
+ * Only the bits of the signal are changed.
+ *
+ * @param extractor - The extractor of the signal.
+ * @param raw       - The raw value with length bits.
+ * @param data      - The payload of CANFD_MAX_DLEN bytes.
+ */
+static void writeRaw(struct bcmDbcSignal const* const extractor, uint64_t raw, uint8_t data[]){
+
+    uint8_t buffer[CANFD_MAX_DLEN + 8]; // The payload padded for the 8 byte writes
+    uint64_t shift = extractor->shift;
+    uint64_t word  = 0;
+    uint64_t bits, mask, nextBits, nextMask;
+
+    memcpy(buffer, data, CANFD_MAX_DLEN);
+    memset(buffer + CANFD_MAX_DLEN, 0, sizeof(buffer) - CANFD_MAX_DLEN);
+    memcpy(&word, buffer + extractor->byte, sizeof(word));
+
+    // Place the raw value like extractRaw reads it: Intel from the lowest bit
+    // of the little endian word, Motorola from the highest bit of the big endian word.
+    // Note: The shifts are split, so a shift of 0 does not shift by 64
+    if(extractor->isBigEndian){
+        uint64_t top  = raw << (64 - extractor->length);
+        uint64_t tops = extractor->mask << (64 - extractor->length);
+
+        bits     = top >> shift;
+        mask     = tops >> shift;
+        nextBits = (top << (8 - shift)) & 0xFF;
+        nextMask = (tops << (8 - shift)) & 0xFF;
+        word     = htobe64((be64toh(word) & ~mask) | bits);
+    }else{
+        bits     = raw << shift;
+        mask     = extractor->mask << shift;
+        nextBits = ((raw >> 1) >> (63 - shift)) & 0xFF;
+        nextMask = ((extractor->mask >> 1) >> (63 - shift)) & 0xFF;
+        word     = htole64((le64toh(word) & ~mask) | bits);
+    }
+
+    memcpy(buffer + extractor->byte, &word, sizeof(word));
+    buffer[extractor->byte + sizeof(word)] = (uint8_t) ((buffer[extractor->byte + sizeof(word)] & ~nextMask) | nextBits);
+
+    // Note: The signals never reach the padding, see readSignal
+    memcpy(data, buffer, CANFD_MAX_DLEN);
+}
+
+void encodeDbcSignal(struct bcmDbc const* const dbc, uint32_t signal, double value, uint8_t data[]){
+
+    struct bcmDbcSignal const* const extractor = &dbc->signals[signal];
+
+    writeRaw(extractor, getRaw(extractor, dbc->scales[signal], dbc->offsets[signal], value), data);
+}
+
+void addDbcSignalMask(struct bcmDbc const* const dbc, uint32_t signal, uint8_t mask[]){
+
+    struct bcmDbcMessage const* const message = &dbc->messages[dbc->infos[signal].message];
+
+    // Note: Writing all ones sets exactly the bits of the signal
+    writeRaw(&dbc->signals[signal], dbc->signals[signal].mask, mask);
+
+    // A multiplexed signal changes its meaning with the multiplexor
+    if(dbc->signals[signal].muxValue != DBC_NO_MUX && message->multiplexor != DBC_NO_MUX){
+
+        uint32_t multiplexor = message->firstSignal + (uint32_t) message->multiplexor;
+
+        writeRaw(&dbc->signals[multiplexor], dbc->signals[multiplexor].mask, mask);
+    }
+}
+
+void freeDbc(struct bcmDbc *const dbc){
+
+    free(dbc->messages);
+    free(dbc->signals);
+    free(dbc->infos);
+    free(dbc->scales);
+    free(dbc->offsets);
+    free(dbc->slots);
+    free(dbc->seeds);
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(dbc, 0, sizeof(struct bcmDbc));
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
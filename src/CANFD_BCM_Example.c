@@ -13,8 +13,20 @@
  ******************************************************************************/
 #include "CANFD_BCM_Error.h"
 #include "CANFD_BCM_Config.h"
-#include "CANFD_BCM_Socket.h"
-#include <errno.h>
+#include "CANFD_BCM_Bridge.h"
+#include "CANFD_BCM_Capture.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Dbc.h"
+#include "CANFD_BCM_Fanout.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Scenario.h"
+#include "CANFD_BCM_Shm.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Stepper.h"
+#include "CANFD_BCM_Uring.h"
+#include "CANFD_BCM_Watchdog.h"
+#include "CANFD_BCM_Worker.h"
 #include <linux/can.h>
 #include <linux/can/bcm.h>
 #include <signal.h>
@@ -22,63 +34,13 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
-#include <sys/socket.h>
 #include <unistd.h>
 
 
-/*******************************************************************************
- * DEFINES
- ******************************************************************************/
-
-/**
- * Defines how many frames can be put in a bcmMsgMultipleFrames operation.
- * The socketCAN BCM can send up to 256 CAN frames in a sequence in the case
- * of a cyclic TX task configuration. Check the socketCAN documentation.
- */
-#define MAXFRAMES 256
-
-
-/*******************************************************************************
- * STRUCTS
- ******************************************************************************/
-
-/**
- * Struct for a BCM message with a single CAN frame.
- */
-struct bcmMsgSingleFrameCan{
-    struct bcm_msg_head msg_head;
-    struct can_frame canFrame[1];
-};
-
-/**
- * Struct for a BCM message with a single CANFD frame.
- */
-struct bcmMsgSingleFrameCanFD{
-    struct bcm_msg_head msg_head;
-    struct canfd_frame canfdFrame[1];
-};
-
-/**
- * Struct for a BCM message with multiple CAN frames.
- */
- struct bcmMsgMultipleFramesCan{
-     struct bcm_msg_head msg_head;
-     struct can_frame canFrames[MAXFRAMES];
- };
-
-/**
-* Struct for a BCM message with multiple CANFD frames.
-*/
-struct bcmMsgMultipleFramesCanFD{
-    struct bcm_msg_head msg_head;
-    struct canfd_frame canfdFrames[MAXFRAMES];
-};
-
-
 /*******************************************************************************
  * VARIABLES
  ******************************************************************************/
-volatile int keepRunning = 1; // Keep running till CTRL + F is pressed
+static struct bcmWorkers *runningWorkers = NULL; // The workers that are stopped by CTRL + F
 
 
 /*******************************************************************************
@@ -93,655 +55,247 @@ volatile int keepRunning = 1; // Keep running till CTRL + F is pressed
 static void handleTerminationSignal(int signumber){
 
     // Stop the application
-    keepRunning = 0;
+    if(runningWorkers != NULL){
+        stopWorkers(runningWorkers);
+    }
 }
 
 /**
- * Handles the shutdown procedure.
+ * Handles the shutdown procedure for all channels.
  *
  * @param retCode  - The return code.
- * @param socketFD - The socket file descriptor.
+ * @param channels - The channels with the contexts of the BCM sockets.
  */
-void shutdownHandler(int retCode, int const *const socketFD){
+static void shutdownChannels(int retCode, struct bcmChannels *const channels){
 
-    // Close the socket
-    if(*socketFD != -1){
-        close(*socketFD);
-    }
+    // Free the message buffers and close the sockets
+    closeChannels(channels);
 
     exit(retCode);
 }
 
-/**
- * Create a non cyclic transmission task for multiple CAN/CANFD frames.
- *
- * @param socketFD - The socket file descriptor.
- * @param frames   - The array of CAN/CANFD frames that should be send.
- * @param nframes  - The number of CAN/CANFD frames that should be send.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createTxSend(int const *const socketFD, struct canfd_frame frames[], int nframes, int isCANFD){
-
-    // BCM message we are sending with a single CAN or CANFD frame
-    void* msg      = NULL;
-    size_t msgSize = 0;
-
-    // Check if we are sending CAN or CANFD frames.
-    if(isCANFD){
-        msgSize = sizeof(struct bcmMsgSingleFrameCanFD);
-        msg = malloc(msgSize);
-    }else {
-        msgSize = sizeof(struct bcmMsgSingleFrameCan);
-        msg = malloc(msgSize);
-    }
-
-    // Error handling
-    if(msg == NULL){
-        printf("Error could not allocate memory for the message \n");
-        shutdownHandler(ERR_MALLOC_FAILED, socketFD);
-    }
+int main(int argc, char *argv[]){
 
-    // Note: Always initialize the whole struct with 0.
-    // Random values in the memory can cause weird bugs!
-    memset(msg, 0, msgSize);
-
-    if(isCANFD){
-        struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
-        msgCANFD->msg_head.opcode  = TX_SEND;
-        msgCANFD->msg_head.flags   = CAN_FD_FRAME;
-        msgCANFD->msg_head.nframes = 1;
-    }else{
-        struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
-        msgCAN->msg_head.opcode    = TX_SEND;
-        msgCAN->msg_head.nframes   = 1;
-    }
-
-    // Note: TX_SEND can only send one frame at a time unlike TX_SETUP!
-    // This is the reason why we must use a loop instead of a struct
-    // that can contain multiple frames.
-    for(int index = 0; index < nframes; index++){
-
-        if(isCANFD){
-            struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
-            msgCANFD->msg_head.can_id = frames[index].can_id;
-            msgCANFD->canfdFrame[0]   = frames[index];
-        }else{
-            struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
-            struct can_frame* canFrame = (struct can_frame *) &frames[index];
-            msgCAN->msg_head.can_id = canFrame->can_id;
-            msgCAN->canFrame[0]     = *canFrame;
-        }
-
-        // Send the TX_SEND configuration message.
-        if(send(*socketFD, msg, msgSize, 0) < 0){
-            printf("Error could not write TX_SEND message \n");
-            shutdownHandler(ERR_TX_SEND_FAILED, socketFD);
-        }
-
-    }
-
-    // Free the allocated memory for the BCM message
-    if(msg != NULL){
-        free(msg);
-    }
-}
-
-/**
- * Create a cyclic transmission task for one or multiple CAN/CANFD frames.
- *
- * Note: The frames will not be send as a atomic sequence. For each frame
- * a new cyclic transmission task will be created. There will be a delay
- * between the frames.
- *
- * @param socketFD - The socket file descriptor.
- * @param frames   - The array of CAN/CANFD frames that should be send cyclic.
- * @param nframes  - The number of CAN/CANFD frames that should be send cyclic.
- * @param count    - Number of times the frame is send with the first interval.
- *                   If count is zero only the second interval is being used.
- * @param ival1    - First interval.
- * @param ival2    - Second interval.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createTxSetup(int const *const socketFD, struct canfd_frame frames[], int nframes, const uint32_t count[],
-                           struct bcm_timeval ival1[], struct bcm_timeval ival2[], int isCANFD){
-
-    // BCM message we are sending with multiple CAN or CANFD frame
-    void* msg      = NULL;
-    size_t msgSize = 0;
+    struct sigaction sigAction;                     // Signal action for CTRL + F
 
-    // Check if we are sending CAN or CANFD frames.
-    if(isCANFD){
-        msgSize = sizeof(struct bcmMsgSingleFrameCanFD);
-        msg = malloc(msgSize);
-    }else{
-        msgSize = sizeof(struct bcmMsgSingleFrameCan);
-        msg = malloc(msgSize);
-    }
+    struct bcmChannels channels;                    // Channels with the contexts of the BCM sockets
+    char const *defaultInterfaces[] = INTERFACES;   // Interfaces if none are given on the command line
 
-    // Error handling
-    if(msg == NULL){
-        printf("Error could not allocate memory for the message \n");
-        shutdownHandler(ERR_MALLOC_FAILED, socketFD);
-    }
-
-    // Note: Always initialize the whole struct with 0.
-    // Random values in the memory can cause weird bugs!
-    memset(msg, 0, msgSize);
+    struct bcmWorkers workers;                      // Workers that run the event loops for the channels
+    int workerCPUs[] = WORKER_CPUS;                 // CPU of each worker
+    int retCode = RET_E_OK;                         // Result of the event loops
 
-    // Note: By combining the flags SETTIMER and STARTTIMER
-    // the BCM will start sending the messages immediately
-    if(isCANFD){
-        struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
+    struct bcmCapture capture;                      // Capture of all received messages (CAPTURE_FILE)
+    struct bcmDbc dbc;                              // Signal database of the received frames (DBC_FILE)
+    struct bcmWatchdog watchdogs[MAX_CHANNELS];     // Supervision of the cyclic RX CAN IDs of each channel (WATCHDOG_IDS)
+    struct bcmUring urings[MAX_CHANNELS];           // The io_uring of the control messages of each channel (URING_ENTRIES)
+    struct bcmStepper steppers[MAX_CHANNELS];       // The cyclic TX tasks of each channel in simulation time (STEPPER_TASKS)
+    struct bcmSequencer sequencers[MAX_CHANNELS];   // The long sequences of each channel (SEQUENCER_TASKS)
+    struct bcmFanout fanouts[MAX_CHANNELS];         // The subscribers of the RX events of each worker (FANOUT_QUEUE_SIZE)
+    struct bcmShm shms[MAX_CHANNELS];               // The queues of each worker in shared memory (SHM_PATH)
+    struct bcmBridge bridge;                        // The queues of all workers on UDP (BRIDGE_PORT)
 
-        msgCANFD->msg_head.opcode  = TX_SETUP;
-        msgCANFD->msg_head.flags   = CAN_FD_FRAME | SETTIMER | STARTTIMER;
-        msgCANFD->msg_head.nframes = 1;
+    // Start with no channels so the shutdown handler can always be called
+    initChannels(&channels);
+    initWorkers(&workers);
 
-    }else{
-        struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
+    // Process termination signal for CTRL + F
+    // Note: Without SA_RESTART the signal interrupts epoll_wait in the event loop.
+    // The handler only stops workers that are set up, so it can be installed before them.
+    memset(&sigAction, 0, sizeof(sigAction));
+    sigAction.sa_handler = handleTerminationSignal;
 
-        msgCAN->msg_head.opcode    = TX_SETUP;
-        msgCAN->msg_head.flags     = SETTIMER | STARTTIMER;
-        msgCAN->msg_head.nframes   = 1;
+    if(sigaction(SIGINT, &sigAction, NULL) < 0){
+        printf("Setting signal handler for SIGINT failed \n");
+        shutdownChannels(ERR_SIGACTION_FAILED, &channels);
     }
 
-    // Note: We send for each TX_SETUP a single CAN/CANFD frame with its CAN ID in the
-    // bcm_msg_head. This way we do not create a cyclic transmission sequence which can
-    // only be removed with the CAN ID that was set in the bcm_msg_head. Another benefit
-    // is that each CAN/CANFD frame can have different count, ival1, and ival2 values.
-    for(int index = 0; index < nframes; index++){
-
-        // Fill out the CAN ID and frame data
-        if(isCANFD){
-            struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
-            struct canfd_frame *canfdFrame = &frames[index];
-
-            msgCANFD->msg_head.can_id = canfdFrame->can_id;
-            msgCANFD->msg_head.count  = count[index];
-            msgCANFD->msg_head.ival1  = ival1[index];
-            msgCANFD->msg_head.ival2  = ival2[index];
-            msgCANFD->canfdFrame[0]   = *canfdFrame;
-
-        }else{
-            struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
-            struct can_frame *canFrame = (struct can_frame*) &frames[index];
-
-            msgCAN->msg_head.can_id = canFrame->can_id;
-            msgCAN->msg_head.count  = count[index];
-            msgCAN->msg_head.ival1  = ival1[index];
-            msgCAN->msg_head.ival2  = ival2[index];
-            msgCAN->canFrame[0]     = *canFrame;
-        }
-
-        // Send the TX_SETUP configuration message
-        if(send(*socketFD, msg, msgSize, 0) < 0){
-            printf("Error could not send TX_SETUP message \n");
-            shutdownHandler(ERR_TX_SETUP_FAILED, socketFD);
-        }
+    // Set up one socket per interface. The interfaces on the command line
+    // are used in the given order, otherwise the configured ones.
+    char const *const *interfaces = defaultInterfaces;
+    int ninterfaces = (int) (sizeof(defaultInterfaces) / sizeof(defaultInterfaces[0]));
 
+    if(argc > 1){
+        interfaces  = (char const *const *) &argv[1];
+        ninterfaces = argc - 1;
     }
 
-    // Free the allocated memory for the BCM message
-    if(msg != NULL){
-        free(msg);
-    }
-}
-
-
-/**
- * Create a cyclic transmission task for one or multiple CAN/CANFD frames.
- * If more than one frame should be send cyclic the provided sequence of
- * the frames is kept by the BCM.
- *
- * Note: The cyclic transmission task for the sequence can only be deleted
- * with the CAN ID that was set in the bcm_msg_head!
- *
- * @param socketFD - The socket file descriptor.
- * @param frames   - The array of CAN/CANFD frames that should be send cyclic.
- * @param nframes  - The number of CAN/CANFD frames that should be send cyclic.
- * @param count    - Number of times the frame is send with the first interval.
- *                   If count is zero only the second interval is being used.
- * @param ival1    - First interval.
- * @param ival2    - Second interval.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createTxSetupSequence(int const *const socketFD, struct canfd_frame frames[], int nframes, uint32_t count,
-                           struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
-
-    // BCM message we are sending with multiple CAN or CANFD frame
-    void* msg      = NULL;
-    size_t msgSize = 0;
-
-    // Check if we are sending CAN or CANFD frames.
-    if(isCANFD){
-        msgSize = sizeof(struct bcmMsgMultipleFramesCanFD);
-        msg = malloc(msgSize);
-    }else{
-        msgSize = sizeof(struct bcmMsgMultipleFramesCan);
-        msg = malloc(msgSize);
+    // Note: The event queues are assigned to the channels by setupWorkers
+    if(openChannels(&channels, interfaces, ninterfaces, 0, NULL) != RET_E_OK){
+        printf("Error could not setup the channels \n");
+        shutdownChannels(ERR_SETUP_FAILED, &channels);
     }
 
-    // Error handling
-    if(msg == NULL){
-        printf("Error could not allocate memory for the message \n");
-        shutdownHandler(ERR_MALLOC_FAILED, socketFD);
+    // Set up the workers with their operation and event queues.
+    // Without worker threads a single worker runs on the main thread.
+    if(setupWorkers(&workers, &channels, WORKER_THREADS > 0 ? WORKER_THREADS : 1, workerCPUs,
+                    (int) (sizeof(workerCPUs) / sizeof(workerCPUs[0])), WORKER_PRIORITY) != RET_E_OK){
+        printf("Error could not setup the workers \n");
+        freeWorkers(&workers);
+        shutdownChannels(ERR_SETUP_FAILED, &channels);
     }
 
+    // Record all received messages if a capture file is configured
     // Note: Always initialize the whole struct with 0.
     // Random values in the memory can cause weird bugs!
-    memset(msg, 0, msgSize);
-
-    // Note: By combining the flags SETTIMER and STARTTIMER
-    // the BCM will start sending the messages immediately
-    if(isCANFD){
-        struct bcmMsgMultipleFramesCanFD *msgCANFD = (struct bcmMsgMultipleFramesCanFD *) msg;
-
-        msgCANFD->msg_head.opcode  = TX_SETUP;
-        msgCANFD->msg_head.flags   = CAN_FD_FRAME | SETTIMER | STARTTIMER;
-        msgCANFD->msg_head.can_id  = frames[0].can_id;
-        msgCANFD->msg_head.count   = count;
-        msgCANFD->msg_head.ival1   = ival1;
-        msgCANFD->msg_head.ival2   = ival2;
-        msgCANFD->msg_head.nframes = nframes;
-
-        size_t arrSize = sizeof(struct canfd_frame) * nframes;
-        memcpy(msgCANFD->canfdFrames, frames, arrSize);
-    }else{
-        struct bcmMsgMultipleFramesCan *msgCAN = (struct bcmMsgMultipleFramesCan *) msg;
-        struct can_frame *firstCanFrame = (struct can_frame*) &frames[0];
-
-        msgCAN->msg_head.opcode    = TX_SETUP;
-        msgCAN->msg_head.flags     = SETTIMER | STARTTIMER;
-        msgCAN->msg_head.can_id    = firstCanFrame->can_id;
-        msgCAN->msg_head.count     = count;
-        msgCAN->msg_head.ival1     = ival1;
-        msgCAN->msg_head.ival2     = ival2;
-        msgCAN->msg_head.nframes   = nframes;
-
-        for(int index = 0; index < nframes; index++){
-            struct can_frame *canFrame = (struct can_frame*) &frames[index];
-            msgCAN->canFrames[index] = *canFrame;
-        }
-    }
+    memset(&capture, 0, sizeof(capture));
 
-    // Send the TX_SETUP configuration message
-    if(send(*socketFD, msg, msgSize, 0) < 0){
-        printf("Error could not send TX_SETUP message \n");
-        shutdownHandler(ERR_TX_SETUP_FAILED, socketFD);
-    }
-
-    // Free the allocated memory for the BCM message
-    if(msg != NULL){
-        free(msg);
-    }
-}
-
-/**
- * Updates a cyclic transmission task for one or multiple CAN/CANFD frames.
- *
- * @param socketFD - The socket file descriptor.
- * @param frames   - The array of CAN/CANFD frames with the updated data.
- * @param nframes  - The number of CAN/CANFD frames that should be updated.
- * @param isCANFD  - Flag for CANFD frames.
- * @param announce - The cycle is retained but the changed data will be send immediately once.
- */
-void createTxSetupUpdate(int const *const socketFD, struct canfd_frame frames[], int nframes, int isCANFD, int announce){
-
-    // BCM message we are sending with multiple CAN or CANFD frame
-    void* msg      = NULL;
-    size_t msgSize = 0;
-
-    // Check if we are sending CAN or CANFD frames.
-    if(isCANFD){
-        msgSize = sizeof(struct bcmMsgSingleFrameCanFD);
-        msg = malloc(msgSize);
-    }else{
-        msgSize = sizeof(struct bcmMsgSingleFrameCan);
-        msg = malloc(msgSize);
-    }
-
-    // Error handling
-    if(msg == NULL){
-        printf("Error could not allocate memory for the message \n");
-        shutdownHandler(ERR_MALLOC_FAILED, socketFD);
+    if(CAPTURE_FILE[0] != '\0' &&
+       (setupCapture(&capture, CAPTURE_FILE, &channels) != RET_E_OK || startCapture(&capture) != RET_E_OK)){
+        printf("Error could not start the capture \n");
+        freeCapture(&capture);
+        freeWorkers(&workers);
+        shutdownChannels(ERR_SETUP_FAILED, &channels);
     }
 
+    // Decode the received frames into signal values if a DBC is configured
     // Note: Always initialize the whole struct with 0.
     // Random values in the memory can cause weird bugs!
-    memset(msg, 0, msgSize);
-
-    // Note: By combining the flags SETTIMER and STARTTIMER
-    // the BCM will start sending the messages immediately
-    if(isCANFD){
-        struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
+    memset(&dbc, 0, sizeof(dbc));
 
-        msgCANFD->msg_head.opcode  = TX_SETUP;
-        msgCANFD->msg_head.flags   = CAN_FD_FRAME;
-        msgCANFD->msg_head.nframes = 1;
+    if(DBC_FILE[0] != '\0'){
 
-        if(announce){
-            msgCANFD->msg_head.flags = msgCANFD->msg_head.flags | TX_ANNOUNCE;
+        if(loadDbc(&dbc, DBC_FILE) != RET_E_OK){
+            printf("Error could not load the DBC \n");
+            freeWorkers(&workers);
+            shutdownChannels(ERR_SETUP_FAILED, &channels);
         }
 
-    }else{
-        struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
-
-        msgCAN->msg_head.opcode    = TX_SETUP;
-        msgCAN->msg_head.nframes   = 1;
+        printf("Loaded %u messages with %u signals from the DBC, %llu lines skipped\n", dbc.nmessages, dbc.nsignals,
+               (unsigned long long) dbc.skipped);
 
-        if(announce){
-            msgCAN->msg_head.flags = TX_ANNOUNCE;
+        for(int channel = 0; channel < channels.nchannels; channel++){
+            getChannel(&channels, channel)->dbc = &dbc;
         }
-
     }
 
-    for(int index = 0; index < nframes; index++){
-
-        // Fill out the CAN ID and frame data
-        if(isCANFD){
-            struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
-            struct canfd_frame *canfdFrame = &frames[index];
-
-            msgCANFD->msg_head.can_id = canfdFrame->can_id;
-            msgCANFD->canfdFrame[0]   = *canfdFrame;
+    // Supervise the cyclic RX CAN IDs if the watchdog is configured
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(watchdogs, 0, sizeof(watchdogs));
 
-        }else{
-            struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
-            struct can_frame *canFrame = (struct can_frame*) &frames[index];
+    for(int channel = 0; WATCHDOG_IDS > 0 && channel < channels.nchannels; channel++){
 
-            msgCAN->msg_head.can_id = canFrame->can_id;
-            msgCAN->canFrame[0]     = *canFrame;
+        if(setupWatchdog(&watchdogs[channel], WATCHDOG_IDS) != RET_E_OK){
+            printf("Error could not set up the watchdog \n");
+            freeWorkers(&workers);
+            shutdownChannels(ERR_SETUP_FAILED, &channels);
         }
 
-        // Send the TX_SETUP configuration message
-        if(send(*socketFD, msg, msgSize, 0) < 0){
-            printf("Error could not send TX_SETUP message \n");
-            shutdownHandler(ERR_TX_SETUP_FAILED, socketFD);
-        }
-
-    }
-
-    // Free the allocated memory for the BCM message
-    if(msg != NULL){
-        free(msg);
+        getChannel(&channels, channel)->watchdog = &watchdogs[channel];
     }
-}
-
-/**
- * Removes a cyclic transmission task for a CAN ID.
- *
- * Note: If the cyclic transmission task was created with createTxSetupSequence
- * it can only be removed with the CAN ID that was set in the bcm_msg_head even
- * if the CAN IDs of the sequence are different. If you try to delete a cyclic
- * transmission task which CAN ID was not set in the bcm_msg_head the delete
- * will fail with an error! If you delete the transmission task that was set
- * in the bcm_msg_head the cyclic transmission of all frames in the sequence
- * will be stopped.
- *
- * @param socketFD - The socket file descriptor.
- * @param canID    - The CAN ID of the cyclic transmission task that should be removed.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createTxDelete(int const *const socketFD, canid_t canID, int isCANFD){
-
-    struct bcm_msg_head msg;
 
+    // Queue the control messages on an io_uring per channel if it is configured
+    // Note: The multishot receive is armed by the event loop
     // Note: Always initialize the whole struct with 0.
     // Random values in the memory can cause weird bugs!
-    memset(&msg, 0, sizeof(msg));
+    memset(urings, 0, sizeof(urings));
 
-    msg.opcode = TX_DELETE;
-    msg.can_id = canID;
-
-    if(isCANFD){
-        msg.flags = CAN_FD_FRAME;
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+        urings[channel].ringFD = -1;
     }
 
-    // Send the TX_DELETE configuration message
-    if(send(*socketFD, &msg, sizeof(msg), 0) < 0){
-        printf("Error could not send TX_DELETE message \n");
-        shutdownHandler(ERR_RX_SETUP_FAILED, socketFD);
-    }
-}
+    for(int channel = 0; URING_ENTRIES > 0 && channel < channels.nchannels; channel++){
 
-/**
- * Creates a RX filter for the CAN ID.
- * I. e. we get notified on all received frames with this CAN ID!
- *
- * @param socketFD - The socket file descriptor.
- * @param canID    - The CAN ID that should be added to the RX filter.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createRxSetupCanID(int const *const socketFD, canid_t canID, int isCANFD){
+        if(setupUring(&urings[channel], getChannel(&channels, channel), URING_ENTRIES, URING_BUFFERS) != RET_E_OK){
+            printf("Error could not set up the io_uring \n");
+            freeWorkers(&workers);
+            shutdownChannels(ERR_SETUP_FAILED, &channels);
+        }
 
-    struct bcm_msg_head msg;
+        getChannel(&channels, channel)->uring = &urings[channel];
+    }
 
+    // Run the cyclic TX tasks in simulation time if the stepped mode is configured
     // Note: Always initialize the whole struct with 0.
     // Random values in the memory can cause weird bugs!
-    memset(&msg, 0, sizeof(msg));
+    memset(steppers, 0, sizeof(steppers));
 
-    msg.opcode = RX_SETUP;
-    msg.flags  = RX_FILTER_ID;
-    msg.can_id = canID;
+    for(int channel = 0; STEPPER_TASKS > 0 && channel < channels.nchannels; channel++){
 
-    if(isCANFD){
-        msg.flags = msg.flags | CAN_FD_FRAME;
-    }
-
-    // Send the RX_SETUP configuration message
-    if(send(*socketFD, &msg, sizeof(msg), 0) < 0){
-        printf("Error could not send RX_SETUP message \n");
-        shutdownHandler(ERR_RX_SETUP_FAILED, socketFD);
-    }
-}
-
-/**
- * Creates a RX filter for the CAN ID and the relevant bits of the frame.
- * I. e. we only get notified on changes for the set bits in the mask.
- *
- * @param socketFD - The socket file descriptor.
- * @param canID    - The CAN ID that should be added to the RX filter.
- * @param mask     - The mask for the relevant bits of the frame.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createRxSetupMask(int const *const socketFD, canid_t canID, struct canfd_frame mask, int isCANFD){
-
-    // BCM message we are sending with a single CAN or CANFD frame
-    void* msg      = NULL;
-    size_t msgSize = 0;
-
-    // Check if we are sending CAN or CANFD frames.
-    if(isCANFD){
-        msgSize = sizeof(struct bcmMsgSingleFrameCanFD);
-        msg = malloc(msgSize);
-    }else {
-        msgSize = sizeof(struct bcmMsgSingleFrameCan);
-        msg = malloc(msgSize);
-    }
+        if(setupStepper(&steppers[channel], STEPPER_TASKS) != RET_E_OK){
+            printf("Error could not set up the stepper \n");
+            freeWorkers(&workers);
+            shutdownChannels(ERR_SETUP_FAILED, &channels);
+        }
 
-    // Error handling
-    if(msg == NULL){
-        printf("Error could not allocate memory for the message \n");
-        shutdownHandler(ERR_MALLOC_FAILED, socketFD);
+        getChannel(&channels, channel)->stepper = &steppers[channel];
     }
 
+    // Run the sequences of more than MAXFRAMES frames in user space if the kernel timers are used
     // Note: Always initialize the whole struct with 0.
     // Random values in the memory can cause weird bugs!
-    memset(msg, 0, msgSize);
-
-    if(isCANFD){
-        struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
+    memset(sequencers, 0, sizeof(sequencers));
 
-        msgCANFD->msg_head.opcode  = RX_SETUP;
-        msgCANFD->msg_head.flags   = CAN_FD_FRAME;
-        msgCANFD->msg_head.can_id  = canID;
-        msgCANFD->msg_head.nframes = 1;
+    for(int channel = 0; STEPPER_TASKS == 0 && SEQUENCER_TASKS > 0 && channel < channels.nchannels; channel++){
 
-        msgCANFD->canfdFrame[0]   = mask;
-    }else{
-        struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
-
-        msgCAN->msg_head.opcode    = RX_SETUP;
-        msgCAN->msg_head.can_id    = canID;
-        msgCAN->msg_head.nframes   = 1;
+        if(setupSequencer(&sequencers[channel], SEQUENCER_TASKS) != RET_E_OK){
+            printf("Error could not set up the sequencer \n");
+            freeWorkers(&workers);
+            shutdownChannels(ERR_SETUP_FAILED, &channels);
+        }
 
-        msgCAN->canFrame[0]       = *((struct can_frame*) &mask);
+        getChannel(&channels, channel)->sequencer = &sequencers[channel];
     }
 
-    // Send the RX_SETUP configuration message
-    if(send(*socketFD, msg, msgSize, 0) < 0){
-        printf("Error could not send RX_SETUP message \n");
-        shutdownHandler(ERR_TX_SETUP_FAILED, socketFD);
+    // Let several consumers subscribe the RX events if the fan-out is configured
+    for(int index = 0; index < MAX_CHANNELS; index++){
+        initFanout(&fanouts[index]);
     }
-}
 
-/**
- * Removes a RX filter for the CAN ID.
- *
- * @param socketFD - The socket file descriptor.
- * @param canID    - The CAN ID that should be removed from the RX filter.
- * @param isCANFD  - Flag for CANFD frames.
- */
-void createRxDelete(int const *const socketFD, canid_t canID, int isCANFD){
-
-    struct bcm_msg_head msg;
-
-    // Note: Always initialize the whole struct with 0.
-    // Random values in the memory can cause weird bugs!
-    memset(&msg, 0, sizeof(msg));
-
-    msg.opcode = RX_DELETE;
-    msg.can_id = canID;
-
-    if(isCANFD){
-        msg.flags = CAN_FD_FRAME;
+    for(int index = 0; FANOUT_QUEUE_SIZE > 0 && index < workers.nworkers; index++){
+        attachFanout(&fanouts[index], &workers.workers[index]);
     }
 
-    // Send the RX_DELETE configuration message
-    if(send(*socketFD, &msg, sizeof(msg), 0) < 0){
-        printf("Error could not send RX_DELETE message \n");
-        shutdownHandler(ERR_RX_SETUP_FAILED, socketFD);
+    // Let a simulation in another process use the queues if a socket path is configured
+    for(int index = 0; index < MAX_CHANNELS; index++){
+        initShmChannel(&shms[index]);
     }
-}
 
-/**
- * Processes the next operation of the queue from the simulation.
- *
- * @param socketFD - The socket file descriptor.
- */
-void processOperation(int const* const socketFD){
+    for(int index = 0; SHM_PATH[0] != '\0' && index < workers.nworkers; index++){
 
-    // Get operation from queue
+        char path[SHM_PATH_SIZE];
+        snprintf(path, sizeof(path), "%s.%d", SHM_PATH, index);
 
-    // Check what we need to do: send, send cyclic, add CAN ID to RX filter etc...
+        printf("Waiting for the simulation on %s\n", path);
 
-    // Process operation
+        if(createShmChannel(&shms[index], path, OPERATION_QUEUE_SIZE, EVENT_QUEUE_SIZE) != RET_E_OK ||
+           acceptShmChannel(&shms[index], SHM_TIMEOUT_MS) != RET_E_OK){
+            printf("Error could not share the queues with the simulation \n");
 
-    printf("Processed operation task from the simulation \n");
-}
+            for(int shm = 0; shm <= index; shm++){
+                closeShmChannel(&shms[shm]);
+            }
 
-/**
- * Processes the timeout of a cyclic CAN/CANFD message.
- *
- * @param msg - The received timeout message from the BCM socket.
- */
-void processTimeout(struct bcmMsgSingleFrameCanFD const* const msg){
-
-    //TODO: What do we do in this case?
-
-    printf("Timeout occurred! \n");
-}
-
-/**
- * Processes the content change of a CAN/CANFD message.
- *
- * @param msg - The received content change message from the BCM socket.
- */
-void processContentChange(struct bcmMsgSingleFrameCanFD const* const msg){
-
-    //TODO:
-    // 1. Extract needed information
-    // 2. Map information to the Event
-    // 3. Put the event in the queue
-
-    printf("Content changed! \n");
-}
-
-/**
- * Receive CAN/CANFD frame and put the extracted data in the queue to the simulation.
- *
- * @param socketFD - The socket file descriptor.
- */
-void processReceive(int const* const socketFD){
+            freeWorkers(&workers);
+            shutdownChannels(ERR_SETUP_FAILED, &channels);
+        }
 
-    int nbytes = 0;                    // Number of bytes we received
-    struct bcmMsgSingleFrameCanFD msg; // The buffer that stores the received message
+        attachShmChannel(&shms[index], &workers.workers[index]);
+    }
 
+    // Serve a simulation on another host if a bridge port is configured
+    // Note: The bridge takes the place of the simulation, so it excludes the shared memory
     // Note: Always initialize the whole struct with 0.
     // Random values in the memory can cause weird bugs!
-    memset(&msg, 0, sizeof(msg));
-
-    // Reset errno before calling receive on the socket that sets errno on failure
-    errno = 0;
-
-    // Receive on the BCM socket
-    nbytes = recv(*socketFD, &msg, sizeof(msg), 0);
-
-    // Check validity of the received message
-    if(nbytes < 0){
+    memset(&bridge, 0, sizeof(bridge));
 
-        // Check if there was an actual error or if there was nothing received on the socket.
-        // This can happen when the socket is set to be non-blocking.
-        if(errno != EAGAIN && errno != EWOULDBLOCK){
-            printf("Error could not receive on the socket \n");
-            shutdownHandler(ERR_RECV_FAILED, socketFD);
-        }
-
-        // There was nothing to receive so we can exit early
-        return;
-
-    }else if(nbytes != sizeof(struct bcmMsgSingleFrameCan) && nbytes != sizeof(struct bcmMsgSingleFrameCanFD)){
-        printf("Error received unexpected number of bytes \n");
-        shutdownHandler(ERR_RECV_FAILED, socketFD);
-    }
-
-    // Check if we got one of the expected operation codes:
-    // RX_CHANGED: Simple reception of a CAN/CANFD frame or a content change occurred.
-    // RX_TIMEOUT: Cyclic message is detected to be absent.
-    if(msg.msg_head.opcode != RX_CHANGED && msg.msg_head.opcode != RX_TIMEOUT){
-        printf("Error received returned unexpected operation code \n");
-        shutdownHandler(ERR_RECV_FAILED, socketFD);
-    }else if(msg.msg_head.opcode == RX_TIMEOUT){
-        processTimeout(&msg);
-    }else{
-        processContentChange(&msg);
+    if(BRIDGE_PORT > 0 && SHM_PATH[0] == '\0' &&
+       (setupBridgeGateway(&bridge, &workers, BRIDGE_BIND_ADDRESS, BRIDGE_PORT, BRIDGE_PEER_ADDRESS,
+                           BRIDGE_PEER_PORT) != RET_E_OK || startBridge(&bridge) != RET_E_OK)){
+        printf("Error could not start the bridge \n");
+        freeBridge(&bridge);
+        freeWorkers(&workers);
+        shutdownChannels(ERR_SETUP_FAILED, &channels);
     }
-}
-
-int main(){
-
-    struct sigaction sigAction;                     // Signal action for CTRL + F
-
-    int socketFD = -1;                              // Socket file descriptor
-    struct sockaddr_can socketAddr;                 // Socket address
-
-
-    // Process termination signal for CTRL + F
-    sigAction.sa_handler = handleTerminationSignal;
 
-    if(sigaction(SIGINT, &sigAction, NULL) < 0){
-        printf("Setting signal handler for SIGINT failed \n");
-        shutdownHandler(ERR_SIGACTION_FAILED, &socketFD);
-    }
+    runningWorkers = &workers;
 
-    // Set up the socket
-    if(setupSocket(&socketFD, &socketAddr, 0) != 0){
-        printf("Error could not setup the socket \n");
-        shutdownHandler(ERR_SETUP_FAILED, &socketFD);
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        printf("Setup the socket on the interface %s as channel %d\n", getChannel(&channels, channel)->interfaceName,
+               channel);
     }
 
-    printf("Setup the socket on the interface %s\n", INTERFACE);
-
     // Test CAN Frame
     struct can_frame canFrame1;
     canFrame1.can_id  = 0x123;
@@ -863,71 +417,190 @@ int main(){
     mask.len     = 1;
     mask.data[0] = 0xFF;
 
+    // The tests below use the first channel
+    //struct bcmContext *const context = getChannel(&channels, 0);
+
     // TX_SEND Test
-    //createTxSend(&socketFD, frameArrCAN, 2, 0);
-    //createTxSend(&socketFD, frameArrCANFD, 2, 1);
+    //createTxSend(context, frameArrCAN, 2, 0);
+    //createTxSend(context, frameArrCANFD, 2, 1);
 
     // TX_SETUP Test
-    //createTxSetup(&socketFD, frameArrCAN, 2, countArr, ivalArr1, ivalArr2,0);
+    //createTxSetup(context, frameArrCAN, 2, countArr, ivalArr1, ivalArr2,0);
+    //sleep(10);
+
+    //createTxSetup(context, frameArrCANFD, 2, countArr, ivalArr1, ivalArr2, 1);
     //sleep(10);
 
-    //createTxSetup(&socketFD, frameArrCANFD, 2, countArr, ivalArr1, ivalArr2, 1);
+    // TX_SETUP Batch Test
+    //int status[2];
+    //createTxSetupBatch(context, frameArrCANFD, 2, countArr, ivalArr1, ivalArr2, 1, status);
+    //sleep(10);
+    //createTxSetupUpdateBatch(context, frameArrCANFD, 2, 1, 0, status);
     //sleep(10);
 
     // TX_SETUP Sequence Test
-    //createTxSetupSequence(&socketFD, frameArrCAN, 2, 10, ival1, ival2, 0);
+    //createTxSetupSequence(context, frameArrCAN, 2, 10, ival1, ival2, 0);
     //sleep(10);
 
-    //createTxSetupSequence(&socketFD, frameArrCANFD, 2, 10, ival1, ival2, 1);
+    //createTxSetupSequence(context, frameArrCANFD, 2, 10, ival1, ival2, 1);
     //sleep(10);
 
     // TX_SETUP Announce Test without announce
-    //createTxSetup(&socketFD, frameArrCAN, 2, countArrZero, ivalArr1Zero, ivalArr2,0);
+    //createTxSetup(context, frameArrCAN, 2, countArrZero, ivalArr1Zero, ivalArr2,0);
     //sleep(10);
-    //createTxSetupUpdate(&socketFD, frameArrCANModified, 2, 0, 0);
+    //createTxSetupUpdate(context, frameArrCANModified, 2, 0, 0);
     //sleep(10);
 
     // TX_SETUP Announce Test with announce
-    //createTxSetup(&socketFD, frameArrCAN, 2, countArrZero, ivalArr1Zero, ivalArr2,0);
+    //createTxSetup(context, frameArrCAN, 2, countArrZero, ivalArr1Zero, ivalArr2,0);
     //sleep(10);
-    //createTxSetupUpdate(&socketFD, frameArrCANModified, 2, 0, 1);
+    //createTxSetupUpdate(context, frameArrCANModified, 2, 0, 1);
     //sleep(10);
 
     // TX_DELETE Test
-    //createTxSetupSequence(&socketFD, &canfdFrame1, 1, 10, ival1, ival2, 1);
+    //createTxSetupSequence(context, &canfdFrame1, 1, 10, ival1, ival2, 1);
     //sleep(5);
-    //createTxDelete(&socketFD, canfdFrame1.can_id, 1);
+    //createTxDelete(context, canfdFrame1.can_id, 1);
     //sleep(10);
 
-    //createTxSetupSequence(&socketFD, frameArrCANFD, 2, 10, ival1, ival2, 1);
+    //createTxSetupSequence(context, frameArrCANFD, 2, 10, ival1, ival2, 1);
     //sleep(5);
-    //createTxDelete(&socketFD, canfdFrame1.can_id, 1);
+    //createTxDelete(context, canfdFrame1.can_id, 1);
     //sleep(10);
 
     // RX_SETUP CAN ID Test
-    //createRxSetupCanID(&socketFD, 0x222, 0);
-    //createRxSetupCanID(&socketFD, 0x333, 1);
+    //createRxSetupCanID(context, 0x222, 0);
+    //createRxSetupCanID(context, 0x333, 1);
 
     // RX_SETUP CAN ID + Mask Test
-    //createRxSetupMask(&socketFD, 0x222, mask, 0);
-    //createRxSetupMask(&socketFD, 0x333, mask, 1);
+    //createRxSetupMask(context, 0x222, mask, 0);
+    //createRxSetupMask(context, 0x333, mask, 1);
+
+    // RX_SETUP Signals Test (needs DBC_FILE)
+    //struct bcmDbcMessage const* message = findDbcMessage(&dbc, 0x222);
+    //uint32_t rxSignals[1];
+    //rxSignals[0] = (uint32_t) findDbcSignal(&dbc, message, "Speed");
+    //createRxSetupSignals(context, rxSignals, 1, 0);
+
+    // Watchdog Test (needs WATCHDOG_IDS)
+    //watchCanID(context->watchdog, 0x222, 0, 100000);
+    //watchCanID(context->watchdog, 0x333, 1, 0);
+
+    // Stepped Mode Test (needs STEPPER_TASKS): Sends the frames of the cyclic tasks that are due in 10ms
+    //stepChannel(context, 10000000);
+
+    // Fan-out Test (needs FANOUT_QUEUE_SIZE): A monitoring UI gets 0x222 at most 10 times a second
+    //static struct bcmSubscriber monitor;
+    //setupSubscriber(&monitor, FANOUT_QUEUE_SIZE, 10, FANOUT_COALESCE_IDS);
+    //subscribeCanID(&monitor, 0x222);
+    //addSubscriber(&fanouts[0], &monitor);
+
+    // Scenario Test: Switching only sends what differs between the test cases
+    //struct bcmScenario scenario;
+    //struct bcmScenarioDiff diff;
+    //loadScenario(&scenario, "testcase1.scenario");
+    //applyScenario(context, &scenario, &diff);
+    //freeScenario(&scenario);
+    //sleep(10);
+    //loadScenario(&scenario, "testcase2.scenario");
+    //applyScenario(context, &scenario, &diff);
+    //freeScenario(&scenario);
 
     // RX_DELETE Test
-    //createRxDelete(&socketFD, 0x222, 0);
-    //createTxDelete(&socketFD, 0x333, 1);
+    //createRxDelete(context, 0x222, 0);
+    //createTxDelete(context, 0x333, 1);
 
     // Keep running until stopped
-    //while(keepRunning){
+    if(WORKER_THREADS > 0){
+
+        if(startWorkers(&workers) != RET_E_OK){
+            printf("Error could not start the workers \n");
+            retCode = ERR_THREAD_FAILED;
+        }else{
+            retCode = joinWorkers(&workers);
+        }
+
+    }else{
+        retCode = runWorker(&workers.workers[0]);
+    }
 
-        // Process operation message from the queue
-        //processOperation(&socketFD);
+    runningWorkers = NULL;
 
-        // Receive on the socket
-        //processReceive(&socketFD);
-    //}
+    // Send the events that are left after the event loops stopped
+    if(BRIDGE_PORT > 0 && SHM_PATH[0] == '\0'){
+
+        if(stopBridge(&bridge) != RET_E_OK){
+            printf("Error the bridge could not send all events \n");
+        }
+
+        freeBridge(&bridge);
+    }
+
+    // Write the rest of the capture after the event loops stopped
+    if(CAPTURE_FILE[0] != '\0'){
+
+        if(stopCapture(&capture) != RET_E_OK){
+            printf("Error the capture is incomplete \n");
+        }
+
+        printf("Captured %llu messages\n", (unsigned long long) capture.records);
+        freeCapture(&capture);
+    }
+
+    // Print the counters and latencies of all threads
+    if(VERBOSE && STATS){
+
+        struct bcmStatsSnapshot snapshot;
+
+        getStatsSnapshot(&snapshot);
+        printStatsSnapshot(&snapshot, NULL);
+    }
+
+    // Remove all tasks we created
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        deleteAllTasks(getChannel(&channels, channel));
+    }
+
+    // Note: freeUring waits for the deletes, afterwards the channels send synchronously
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        getChannel(&channels, channel)->uring = NULL;
+        freeUring(&urings[channel]);
+    }
+
+    // Note: The shared rings are unmapped before the workers free their queues
+    for(int index = 0; index < MAX_CHANNELS; index++){
+        closeShmChannel(&shms[index]);
+    }
+
+    freeWorkers(&workers);
+
+    // Note: The channels must not use the DBC anymore
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        getChannel(&channels, channel)->dbc = NULL;
+    }
+
+    freeDbc(&dbc);
+
+    // Note: The channels must not use the watchdogs anymore
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        getChannel(&channels, channel)->watchdog = NULL;
+        freeWatchdog(&watchdogs[channel]);
+    }
+
+    // Note: The channels must not use the steppers anymore
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        getChannel(&channels, channel)->stepper = NULL;
+        freeStepper(&steppers[channel]);
+    }
+
+    // Note: The channels must not use the sequencers anymore
+    for(int channel = 0; channel < channels.nchannels; channel++){
+        getChannel(&channels, channel)->sequencer = NULL;
+        freeSequencer(&sequencers[channel]);
+    }
 
     // Call the shutdown handler
-    shutdownHandler(RET_E_OK, &socketFD);
+    shutdownChannels(retCode, &channels);
     return RET_E_OK;
 }
 
@@ -0,0 +1,448 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Fanout.c
+ \brief     Provides the fan-out of the RX events to several subscribers with
+            their own CAN IDs, rates and rings.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Fanout.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define FANOUT_RETRY_NS ((uint64_t) FANOUT_RETRY_US * 1000u) // The wait on a full ring in nanoseconds
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Checks if a subscriber subscribed the CAN ID of an event.
+ */
+static int isSubscribed(struct bcmSubscriber const* const subscriber, canid_t canID){
+
+    if(subscriber->isAll){
+        return 1;
+    }
+
+    if(canID & CAN_EFF_FLAG){
+
+        uint32_t id = canID & CAN_EFF_MASK;
+        uint64_t const* const page = subscriber->extended[id >> FANOUT_PAGE_BITS];
+
+        id &= (1u << FANOUT_PAGE_BITS) - 1;
+
+        return page != NULL && ((page[id / 64] >> (id % 64)) & 1u);
+    }
+
+    uint32_t id = canID & CAN_SFF_MASK;
+
+    return (subscriber->standard[id / 64] >> (id % 64)) & 1u;
+}
+
+/**
+ * Checks if an entry holds the key of an event.
+ */
+static int isSameKey(struct bcmEvent const* const first, struct bcmEvent const* const second){
+
+    return first->canID == second->canID && first->isCANFD == second->isCANFD && first->channel == second->channel &&
+           first->type == second->type && first->first == second->first;
+}
+
+/**
+ * Finds the entry of the key of an event (fibonacci hashing).
+ *
+ * @return The entry or the unused entry where the key would be inserted.
+ */
+static uint32_t findEntry(struct bcmSubscriber const* const subscriber, struct bcmEvent const* const event){
+
+    uint64_t key = (uint64_t) event->canID | ((uint64_t) event->channel << 32) | ((uint64_t) event->type << 40) |
+                   ((uint64_t) event->isCANFD << 48) | ((uint64_t) event->first << 49);
+
+    uint32_t index = (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> subscriber->shift);
+
+    // Note: The table is at most half full, so there is always an unused entry
+    while(subscriber->entries[index].isUsed && !isSameKey(&subscriber->entries[index].event, event)){
+        index = (index + 1) & subscriber->mask;
+    }
+
+    return index;
+}
+
+/**
+ * Puts an event in the ring of a subscriber and counts it.
+ *
+ * @return 1 if the event was enqueued or 0 if the ring is full.
+ */
+static int deliverEvent(struct bcmSubscriber *const subscriber, struct bcmEvent const* const event){
+
+    if(!enqueueEvent(&subscriber->queue, event)){
+        return 0;
+    }
+
+    subscriber->delivered++;
+    addStatsCounter(STATS_FANOUT_EVENTS, 1);
+    return 1;
+}
+
+/**
+ * Passes an event to a subscriber of its CAN ID. Without a wait the event
+ * goes straight to the ring, otherwise it becomes the latest event of its
+ * entry and replaces an older one that still waits.
+ *
+ * @param fanout     - The fan-out.
+ * @param subscriber - The subscriber.
+ * @param event      - The event.
+ * @param now        - The monotonic time, read on the first use (0 = not read yet).
+ */
+static void passEvent(struct bcmFanout *const fanout, struct bcmSubscriber *const subscriber,
+                      struct bcmEvent const* const event, uint64_t *const now){
+
+    if(subscriber->entries == NULL){
+
+        if(!deliverEvent(subscriber, event)){
+            subscriber->dropped++;
+            addStatsCounter(STATS_FANOUT_DROPPED, 1);
+        }
+
+        return;
+    }
+
+    uint32_t index = findEntry(subscriber, event);
+    struct bcmSubscriberEntry *const entry = &subscriber->entries[index];
+
+    if(!entry->isUsed){
+
+        // Note: Without room for the latest event the event goes straight to the ring.
+        // With a maximum rate it can not wait for its interval, so it is dropped.
+        if(subscriber->nused >= subscriber->capacity){
+
+            if(subscriber->interval > 0 || !deliverEvent(subscriber, event)){
+                subscriber->dropped++;
+                addStatsCounter(STATS_FANOUT_DROPPED, 1);
+            }
+
+            return;
+        }
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(entry, 0, sizeof(struct bcmSubscriberEntry));
+
+        entry->event  = *event;
+        entry->isUsed = 1;
+        subscriber->nused++;
+    }
+
+    if(!entry->isPending){
+
+        // Note: The clock is only read for subscribers with a maximum rate
+        if(subscriber->interval > 0 && *now == 0){
+            *now = getStatsTime();
+        }
+
+        if(*now - entry->lastSent >= subscriber->interval && deliverEvent(subscriber, event)){
+            entry->lastSent = *now;
+            return;
+        }
+    }
+
+    if(*now == 0){
+        *now = getStatsTime();
+    }
+
+    // Only the latest event waits
+    if(entry->isPending){
+        subscriber->coalesced++;
+        addStatsCounter(STATS_FANOUT_MERGED, 1);
+    }else{
+        entry->isPending = 1;
+        subscriber->pending[subscriber->npending++] = index;
+    }
+
+    entry->event = *event;
+
+    // Note: A ring that is full now is tried again after FANOUT_RETRY_US
+    uint64_t due = *now - entry->lastSent >= subscriber->interval ? *now + FANOUT_RETRY_NS
+                                                                 : entry->lastSent + subscriber->interval;
+
+    fanout->due = due < fanout->due ? due : fanout->due;
+}
+
+/**
+ * Puts the latest events of a subscriber whose wait is over in its ring.
+ * The entries that still wait stay pending in their order.
+ *
+ * @param subscriber - The subscriber.
+ * @param now        - The monotonic time.
+ * @param due        - Updated with the time the next entry waits no longer.
+ * @return The number of events that were put in the ring.
+ */
+static int flushSubscriber(struct bcmSubscriber *const subscriber, uint64_t now, uint64_t *const due){
+
+    uint32_t kept  = 0; // Number of entries that still wait
+    int isFull     = 0; // Flag for a ring that took no more events
+    int ndelivered = 0; // Number of events put in the ring
+
+    for(uint32_t position = 0; position < subscriber->npending; position++){
+
+        uint32_t index = subscriber->pending[position];
+        struct bcmSubscriberEntry *const entry = &subscriber->entries[index];
+
+        if(!isFull && now - entry->lastSent >= subscriber->interval){
+
+            if(deliverEvent(subscriber, &entry->event)){
+                entry->isPending = 0;
+                entry->lastSent  = now;
+                ndelivered++;
+                continue;
+            }
+
+            // Note: The following entries would not fit either
+            isFull = 1;
+        }
+
+        uint64_t next = now - entry->lastSent >= subscriber->interval ? now + FANOUT_RETRY_NS
+                                                                      : entry->lastSent + subscriber->interval;
+
+        *due = next < *due ? next : *due;
+        subscriber->pending[kept++] = index;
+    }
+
+    subscriber->npending = kept;
+    return ndelivered;
+}
+
+void initFanout(struct bcmFanout *const fanout){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(fanout, 0, sizeof(struct bcmFanout));
+
+    atomic_init(&fanout->nsubscribers, 0);
+    fanout->due = UINT64_MAX;
+}
+
+int setupSubscriber(struct bcmSubscriber *const subscriber, uint32_t capacity, uint32_t maxRateHz,
+                    uint32_t coalesceIDs){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(subscriber, 0, sizeof(struct bcmSubscriber));
+
+    // Note: The wait of a maximum rate is kept in the table, without it every event would pass
+    if(maxRateHz > 0 && coalesceIDs == 0){
+        printf("Error a subscriber with a maximum rate needs at least one coalesced CAN ID \n");
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(setupEventQueue(&subscriber->queue, capacity) != RET_E_OK){
+        printf("Error could not allocate the ring of the subscriber \n");
+        return ERR_MALLOC_FAILED;
+    }
+
+    // Note: In-process, so the subscriber can still sleep in waitEvents
+    atomic_init(&subscriber->doorbell.sequence, 0);
+    atomic_init(&subscriber->doorbell.waiters, 0);
+    subscriber->queue.doorbell = &subscriber->doorbell;
+    subscriber->interval       = maxRateHz > 0 ? 1000000000u / maxRateHz : 0;
+
+    if(coalesceIDs == 0){
+        return RET_E_OK;
+    }
+
+    uint32_t nentries = 2;
+    uint32_t bits     = 1;
+
+    // Use at least twice as many entries as IDs to keep the probe sequences short
+    while(nentries < 2 * coalesceIDs){
+        nentries <<= 1;
+        bits++;
+    }
+
+    subscriber->entries = calloc(nentries, sizeof(struct bcmSubscriberEntry));
+    subscriber->pending = calloc(nentries, sizeof(uint32_t));
+
+    if(subscriber->entries == NULL || subscriber->pending == NULL){
+        printf("Error could not allocate memory for the latest events of the subscriber \n");
+        freeSubscriber(subscriber);
+        return ERR_MALLOC_FAILED;
+    }
+
+    subscriber->capacity = coalesceIDs;
+    subscriber->mask     = nentries - 1;
+    subscriber->shift    = 64 - bits;
+
+    return RET_E_OK;
+}
+
+void freeSubscriber(struct bcmSubscriber *const subscriber){
+
+    freeEventQueue(&subscriber->queue);
+
+    for(uint32_t page = 0; page < FANOUT_PAGES; page++){
+        free(subscriber->extended[page]);
+        subscriber->extended[page] = NULL;
+    }
+
+    free(subscriber->entries);
+    free(subscriber->pending);
+
+    subscriber->queue.doorbell = NULL;
+    subscriber->entries        = NULL;
+    subscriber->pending        = NULL;
+    subscriber->capacity       = 0;
+    subscriber->nused          = 0;
+    subscriber->npending       = 0;
+}
+
+int subscribeCanID(struct bcmSubscriber *const subscriber, canid_t canID){
+
+    if(!(canID & CAN_EFF_FLAG)){
+        uint32_t id = canID & CAN_SFF_MASK;
+
+        subscriber->standard[id / 64] |= 1ull << (id % 64);
+        return RET_E_OK;
+    }
+
+    uint32_t id    = canID & CAN_EFF_MASK;
+    uint32_t page  = id >> FANOUT_PAGE_BITS;
+
+    if(subscriber->extended[page] == NULL){
+
+        subscriber->extended[page] = calloc(FANOUT_PAGE_WORDS, sizeof(uint64_t));
+
+        if(subscriber->extended[page] == NULL){
+            printf("Error could not allocate memory for the CAN IDs of the subscriber \n");
+            return ERR_MALLOC_FAILED;
+        }
+    }
+
+    id &= (1u << FANOUT_PAGE_BITS) - 1;
+    subscriber->extended[page][id / 64] |= 1ull << (id % 64);
+
+    return RET_E_OK;
+}
+
+void unsubscribeCanID(struct bcmSubscriber *const subscriber, canid_t canID){
+
+    if(!(canID & CAN_EFF_FLAG)){
+        uint32_t id = canID & CAN_SFF_MASK;
+
+        subscriber->standard[id / 64] &= ~(1ull << (id % 64));
+        return;
+    }
+
+    uint32_t id   = canID & CAN_EFF_MASK;
+    uint32_t page = id >> FANOUT_PAGE_BITS;
+
+    // Note: The page stays, the ID may be subscribed again
+    if(subscriber->extended[page] != NULL){
+        id &= (1u << FANOUT_PAGE_BITS) - 1;
+        subscriber->extended[page][id / 64] &= ~(1ull << (id % 64));
+    }
+}
+
+void subscribeAllCanIDs(struct bcmSubscriber *const subscriber){
+
+    subscriber->isAll = 1;
+}
+
+int addSubscriber(struct bcmFanout *const fanout, struct bcmSubscriber *const subscriber){
+
+    uint32_t nsubscribers = atomic_load_explicit(&fanout->nsubscribers, memory_order_relaxed);
+
+    if(nsubscribers >= FANOUT_MAX_SUBSCRIBERS){
+        printf("Error the fan-out can not serve more than %d subscribers \n", FANOUT_MAX_SUBSCRIBERS);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Note: The release publishes the set up subscriber to the event loop
+    fanout->subscribers[nsubscribers] = subscriber;
+    atomic_store_explicit(&fanout->nsubscribers, nsubscribers + 1, memory_order_release);
+
+    return RET_E_OK;
+}
+
+void attachFanout(struct bcmFanout *const fanout, struct bcmWorker *const worker){
+
+    worker->fanout = fanout;
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+        if(worker->contexts[channel] != NULL){
+            worker->contexts[channel]->fanout = fanout;
+        }
+    }
+}
+
+void dispatchFanout(struct bcmFanout *const fanout, struct bcmEvent const* const event){
+
+    uint32_t nsubscribers = atomic_load_explicit(&fanout->nsubscribers, memory_order_acquire);
+    uint64_t now          = 0;
+
+    for(uint32_t index = 0; index < nsubscribers; index++){
+
+        struct bcmSubscriber *const subscriber = fanout->subscribers[index];
+
+        if(isSubscribed(subscriber, event->canID)){
+            passEvent(fanout, subscriber, event, &now);
+        }
+    }
+}
+
+int flushFanout(struct bcmFanout *const fanout){
+
+    uint32_t nsubscribers = atomic_load_explicit(&fanout->nsubscribers, memory_order_acquire);
+    int ndelivered        = 0;
+
+    // Note: Nothing waits most of the time, so the clock is only read when it is due
+    if(fanout->due != UINT64_MAX){
+
+        uint64_t now = getStatsTime();
+
+        if(now >= fanout->due){
+
+            fanout->due = UINT64_MAX;
+
+            for(uint32_t index = 0; index < nsubscribers; index++){
+                if(fanout->subscribers[index]->npending > 0){
+                    ndelivered += flushSubscriber(fanout->subscribers[index], now, &fanout->due);
+                }
+            }
+        }
+    }
+
+    // Wake up the subscribers once for all events of the wakeup
+    for(uint32_t index = 0; index < nsubscribers; index++){
+        notifyEvents(&fanout->subscribers[index]->queue);
+    }
+
+    return ndelivered;
+}
+
+uint64_t getFanoutDue(struct bcmFanout const* const fanout){
+
+    return fanout->due;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
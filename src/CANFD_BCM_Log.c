@@ -0,0 +1,520 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Log.c
+ \brief     Provides a memory mapped reader and the formats of candump and binary CAN/CANFD logs.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Log.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+
+/**
+ * The valid CANFD payload lengths for each DLC.
+ */
+static uint8_t const canfdLengths[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 12, 16, 20, 24, 32, 48, 64};
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Returns the value of a hex digit.
+ *
+ * @param digit - The character.
+ * @return The value or -1 if the character is no hex digit.
+ */
+static int getHexValue(char digit){
+
+    if(digit >= '0' && digit <= '9'){
+        return digit - '0';
+    }
+
+    if(digit >= 'a' && digit <= 'f'){
+        return digit - 'a' + 10;
+    }
+
+    if(digit >= 'A' && digit <= 'F'){
+        return digit - 'A' + 10;
+    }
+
+    return -1;
+}
+
+/**
+ * Returns the smallest valid CANFD payload length that fits len bytes.
+ *
+ * @param len - The number of bytes.
+ */
+static uint8_t getCanFDLength(uint8_t len){
+
+    for(size_t index = 0; index < sizeof(canfdLengths); index++){
+        if(canfdLengths[index] >= len){
+            return canfdLengths[index];
+        }
+    }
+
+    return CANFD_MAX_DLEN;
+}
+
+/**
+ * Releases the pages of the mapping behind the read position.
+ * They are loaded from the file again if the log is rewound.
+ *
+ * @param reader - The reader.
+ */
+static void releaseLogPages(struct bcmLogReader *const reader){
+
+    if(reader->offset - reader->released < LOG_RELEASE_SIZE){
+        return;
+    }
+
+    size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+    size_t end      = reader->offset & ~(pageSize - 1);
+
+    if(madvise((void *) (reader->data + reader->released), end - reader->released, MADV_DONTNEED) == 0){
+        reader->released = end;
+    }
+}
+
+/**
+ * Reads the next frame of a candump log.
+ *
+ * @param reader - The reader.
+ * @param frame  - Storage for the frame.
+ * @return 1 for a frame or 0 at the end of the log.
+ */
+static int readCandumpFrame(struct bcmLogReader *const reader, struct bcmLogFrame *const frame){
+
+    while(reader->offset < reader->size){
+
+        char const *const line    = (char const *) reader->data + reader->offset;
+        char const *const newline = memchr(line, '\n', reader->size - reader->offset);
+        size_t length             = newline != NULL ? (size_t) (newline - line) : reader->size - reader->offset;
+
+        reader->offset += length + (newline != NULL ? 1 : 0);
+        reader->line++;
+        releaseLogPages(reader);
+
+        if(length > 0 && line[length - 1] == '\r'){
+            length--;
+        }
+
+        // Skip empty lines and comments
+        size_t first = 0;
+
+        while(first < length && (line[first] == ' ' || line[first] == '\t')){
+            first++;
+        }
+
+        if(first == length || line[first] == '#'){
+            continue;
+        }
+
+        if(parseCandumpLine(line, length, frame) == RET_E_OK){
+            return 1;
+        }
+
+        reader->skipped++;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the next frame of a binary log.
+ *
+ * @param reader - The reader.
+ * @param frame  - Storage for the frame.
+ * @return 1 for a frame, 0 at the end of the log or ERR_LOG_FORMAT for a truncated log.
+ */
+static int readBinaryFrame(struct bcmLogReader *const reader, struct bcmLogFrame *const frame){
+
+    struct bcmLogRecord record;
+
+    while(reader->offset < reader->size){
+
+        if(reader->size - reader->offset < sizeof(record)){
+            printf("Error the binary log is truncated at offset %zu \n", reader->offset);
+            return ERR_LOG_FORMAT;
+        }
+
+        memcpy(&record, reader->data + reader->offset, sizeof(record));
+
+        size_t recordSize = LOG_RECORD_SIZE(record.len);
+
+        if(record.len > CANFD_MAX_DLEN || reader->size - reader->offset < recordSize){
+            printf("Error the binary log is truncated at offset %zu \n", reader->offset);
+            return ERR_LOG_FORMAT;
+        }
+
+        unsigned char const *const payload = reader->data + reader->offset + sizeof(record);
+
+        reader->offset += recordSize;
+        releaseLogPages(reader);
+
+        int isCANFD = (record.kind & LOG_RECORD_CANFD) != 0;
+
+        // Error frames and oversized CAN frames can not be sent
+        if((record.canID & CAN_ERR_FLAG) || (!isCANFD && record.len > CAN_MAX_DLEN)){
+            reader->skipped++;
+            continue;
+        }
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(frame, 0, sizeof(struct bcmLogFrame));
+
+        frame->timestamp    = record.timestamp;
+        frame->frame.can_id = record.canID;
+        frame->frame.len    = record.len;
+        frame->frame.flags  = isCANFD ? record.flags : 0;
+        frame->isCANFD      = isCANFD;
+        frame->opcode       = record.opcode;
+        frame->channel      = record.kind & LOG_RECORD_CHANNEL;
+        memcpy(frame->frame.data, payload, record.len);
+
+        return 1;
+    }
+
+    return 0;
+}
+
+int openLogReader(struct bcmLogReader *const reader, char const *const path){
+
+    struct stat fileStat;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(reader, 0, sizeof(struct bcmLogReader));
+    reader->fileFD = open(path, O_RDONLY | O_CLOEXEC);
+
+    if(reader->fileFD == -1){
+        printf("Error could not open the log %s: %s\n", path, strerror(errno));
+        return ERR_OPEN_FAILED;
+    }
+
+    if(fstat(reader->fileFD, &fileStat) < 0){
+        printf("Error could not get the size of the log %s: %s\n", path, strerror(errno));
+        closeLogReader(reader);
+        return ERR_OPEN_FAILED;
+    }
+
+    reader->size = (size_t) fileStat.st_size;
+
+    // Note: An empty file can not be mapped, it is a log without frames
+    if(reader->size == 0){
+        return RET_E_OK;
+    }
+
+    void *data = mmap(NULL, reader->size, PROT_READ, MAP_PRIVATE, reader->fileFD, 0);
+
+    if(data == MAP_FAILED){
+        printf("Error could not map the log %s: %s\n", path, strerror(errno));
+        reader->size = 0;
+        closeLogReader(reader);
+        return ERR_MMAP_FAILED;
+    }
+
+    reader->data = data;
+
+    // The log is read once from the start to the end
+    madvise(data, reader->size, MADV_SEQUENTIAL);
+
+    if(reader->size >= sizeof(struct bcmLogHeader) && memcmp(reader->data, LOG_MAGIC, 8) == 0){
+
+        struct bcmLogHeader header;
+        memcpy(&header, reader->data, sizeof(header));
+
+        if(header.version != LOG_VERSION){
+            printf("Error the binary log %s has the unknown version %u \n", path, header.version);
+            closeLogReader(reader);
+            return ERR_LOG_FORMAT;
+        }
+
+        reader->isBinary = 1;
+        reader->start    = sizeof(struct bcmLogHeader);
+        reader->offset   = reader->start;
+    }
+
+    return RET_E_OK;
+}
+
+int readLogFrame(struct bcmLogReader *const reader, struct bcmLogFrame *const frame){
+
+    if(reader->isBinary){
+        return readBinaryFrame(reader, frame);
+    }
+
+    return readCandumpFrame(reader, frame);
+}
+
+void rewindLogReader(struct bcmLogReader *const reader){
+
+    reader->offset   = reader->start;
+    reader->released = 0;
+    reader->line     = 0;
+}
+
+void closeLogReader(struct bcmLogReader *const reader){
+
+    if(reader->data != NULL){
+        munmap((void *) reader->data, reader->size);
+        reader->data = NULL;
+    }
+
+    if(reader->fileFD != -1){
+        close(reader->fileFD);
+        reader->fileFD = -1;
+    }
+
+    reader->size   = 0;
+    reader->offset = 0;
+}
+
+int parseCandumpLine(char const *const line, size_t length, struct bcmLogFrame *const frame){
+
+    char const *pos       = line;
+    char const *const end = line + length;
+    uint64_t seconds      = 0;
+    uint64_t nanoseconds  = 0;
+    int digits            = 0;
+    size_t nameLength     = 0;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(frame, 0, sizeof(struct bcmLogFrame));
+    frame->channel = -1;
+
+    while(pos < end && *pos == ' '){
+        pos++;
+    }
+
+    // The timestamp "(seconds.fraction)"
+    if(pos == end || *pos++ != '('){
+        return ERR_LOG_FORMAT;
+    }
+
+    for(; pos < end && *pos >= '0' && *pos <= '9'; pos++, digits++){
+        seconds = seconds * 10 + (uint64_t) (*pos - '0');
+    }
+
+    if(digits == 0){
+        return ERR_LOG_FORMAT;
+    }
+
+    if(pos < end && *pos == '.'){
+
+        pos++;
+
+        for(digits = 0; pos < end && *pos >= '0' && *pos <= '9'; pos++, digits++){
+            if(digits < 9){
+                nanoseconds = nanoseconds * 10 + (uint64_t) (*pos - '0');
+            }
+        }
+
+        for(; digits < 9; digits++){
+            nanoseconds *= 10;
+        }
+    }
+
+    if(pos == end || *pos++ != ')'){
+        return ERR_LOG_FORMAT;
+    }
+
+    frame->timestamp = seconds * 1000000000u + nanoseconds;
+
+    // The interface name
+    while(pos < end && *pos == ' '){
+        pos++;
+    }
+
+    while(pos < end && *pos != ' '){
+
+        if(nameLength == IFNAMSIZ - 1){
+            return ERR_LOG_FORMAT;
+        }
+
+        frame->interfaceName[nameLength++] = *pos++;
+    }
+
+    while(pos < end && *pos == ' '){
+        pos++;
+    }
+
+    if(nameLength == 0){
+        return ERR_LOG_FORMAT;
+    }
+
+    return parseCandumpFrame(pos, (size_t) (end - pos), &frame->frame, &frame->isCANFD);
+}
+
+int parseCandumpFrame(char const *const text, size_t length, struct canfd_frame *const frame, int *const isCANFD){
+
+    char const *pos       = text;
+    char const *const end = text + length;
+    int digits            = 0;
+    uint32_t canID        = 0;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(frame, 0, sizeof(struct canfd_frame));
+    *isCANFD = 0;
+
+    // The CAN ID with 3 (SFF) or 8 (EFF) hex digits
+    for(digits = 0; pos < end && getHexValue(*pos) >= 0; pos++, digits++){
+        canID = (canID << 4) | (uint32_t) getHexValue(*pos);
+    }
+
+    if(pos == end || *pos++ != '#'){
+        return ERR_LOG_FORMAT;
+    }
+
+    if(digits == 3 && canID <= CAN_SFF_MASK){
+        frame->can_id = canID;
+    }else if(digits == 8 && !(canID & CAN_ERR_FLAG)){
+        frame->can_id = (canID & CAN_EFF_MASK) | CAN_EFF_FLAG;
+    }else{
+        // Note: Error frames are written with the CAN_ERR_FLAG and can not be sent
+        return ERR_LOG_FORMAT;
+    }
+
+    // "##" and the flags nibble for CANFD frames
+    if(pos < end && *pos == '#'){
+
+        pos++;
+
+        if(pos == end || getHexValue(*pos) < 0){
+            return ERR_LOG_FORMAT;
+        }
+
+        frame->flags = (uint8_t) getHexValue(*pos++);
+        *isCANFD = 1;
+
+    }else if(pos < end && (*pos == 'R' || *pos == 'r')){
+
+        // Remote frames have no data, only an optional length
+        pos++;
+        frame->can_id |= CAN_RTR_FLAG;
+
+        if(pos < end && getHexValue(*pos) >= 0 && getHexValue(*pos) <= CAN_MAX_DLEN){
+            frame->len = (uint8_t) getHexValue(*pos++);
+        }
+
+        return (pos == end || *pos == ' ') ? RET_E_OK : ERR_LOG_FORMAT;
+    }
+
+    // The payload as hex byte pairs, optionally separated by dots
+    size_t maxLength = *isCANFD ? CANFD_MAX_DLEN : CAN_MAX_DLEN;
+
+    while(pos < end && *pos != ' ' && *pos != '_'){
+
+        if(*pos == '.'){
+            pos++;
+            continue;
+        }
+
+        if(end - pos < 2 || getHexValue(pos[0]) < 0 || getHexValue(pos[1]) < 0 || frame->len == maxLength){
+            return ERR_LOG_FORMAT;
+        }
+
+        frame->data[frame->len++] = (uint8_t) ((getHexValue(pos[0]) << 4) | getHexValue(pos[1]));
+        pos += 2;
+    }
+
+    // Skip the raw DLC of CAN frames with 8 bytes ("_D")
+    if(pos < end && *pos == '_'){
+        pos++;
+
+        if(pos == end || getHexValue(*pos) < 0){
+            return ERR_LOG_FORMAT;
+        }
+
+        pos++;
+    }
+
+    if(pos < end && *pos != ' '){
+        return ERR_LOG_FORMAT;
+    }
+
+    // Note: The unused bytes are already 0
+    if(*isCANFD){
+        frame->len = getCanFDLength(frame->len);
+    }
+
+    return RET_E_OK;
+}
+
+int formatCandumpLine(struct bcmLogFrame const* const frame, char const *const interfaceName, char *const buffer,
+                      size_t size){
+
+    static char const hexDigits[] = "0123456789ABCDEF";
+
+    canid_t canID = frame->frame.can_id;
+    uint8_t len   = frame->frame.len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->frame.len;
+
+    int length = snprintf(buffer, size, "(%llu.%06llu) %s ", (unsigned long long) (frame->timestamp / 1000000000u),
+                          (unsigned long long) (frame->timestamp % 1000000000u / 1000u), interfaceName);
+
+    if(length < 0 || (size_t) length >= size){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(canID & CAN_EFF_FLAG){
+        length += snprintf(buffer + length, size - (size_t) length, "%08X#", canID & CAN_EFF_MASK);
+    }else{
+        length += snprintf(buffer + length, size - (size_t) length, "%03X#", canID & CAN_SFF_MASK);
+    }
+
+    // "##", the flags, the payload and the terminating 0 must fit
+    if((size_t) length + 3 + 2 * (size_t) len >= size){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(frame->isCANFD){
+        buffer[length++] = '#';
+        buffer[length++] = hexDigits[frame->frame.flags & 0x0F];
+    }else if(canID & CAN_RTR_FLAG){
+        buffer[length++] = 'R';
+
+        if(len > 0){
+            buffer[length++] = hexDigits[len & 0x0F];
+        }
+
+        buffer[length] = '\0';
+        return length;
+    }
+
+    for(uint8_t index = 0; index < len; index++){
+        buffer[length++] = hexDigits[frame->frame.data[index] >> 4];
+        buffer[length++] = hexDigits[frame->frame.data[index] & 0x0F];
+    }
+
+    buffer[length] = '\0';
+    return length;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,84 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_LogDump.c
+ \brief     Converts a binary capture into a candump log on stdout.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Log.h"
+#include <linux/can/bcm.h>
+#include <net/if.h>
+#include <stdio.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+int main(int argc, char *argv[]){
+
+    struct bcmLogReader reader;              // The capture
+    struct bcmLogFrame frame;                // The current frame of the capture
+    char line[LOG_LINE_SIZE];                // The candump line of the frame
+    char defaultName[IFNAMSIZ];              // The interface name of channels without a given name
+    uint64_t timeouts = 0;                   // Number of RX_TIMEOUT records
+    int retCode;
+
+    if(argc < 2 || argc - 2 > MAX_CHANNELS){
+        printf("Usage: %s <capture> [interface of channel 0] [interface of channel 1]...\n", argv[0]);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    retCode = openLogReader(&reader, argv[1]);
+
+    if(retCode != RET_E_OK){
+        return retCode;
+    }
+
+    while((retCode = readLogFrame(&reader, &frame)) > 0){
+
+        char const *interfaceName = frame.interfaceName;
+
+        // Binary captures only know the channel
+        if(frame.channel >= 0 && frame.channel + 2 < argc){
+            interfaceName = argv[frame.channel + 2];
+        }else if(frame.channel >= 0){
+            snprintf(defaultName, sizeof(defaultName), "can%d", frame.channel);
+            interfaceName = defaultName;
+        }
+
+        // Note: candump has no notation for a timeout, so it becomes a comment
+        if(frame.opcode == RX_TIMEOUT){
+            printf("# (%llu.%06llu) %s RX_TIMEOUT %X\n", (unsigned long long) (frame.timestamp / 1000000000u),
+                   (unsigned long long) (frame.timestamp % 1000000000u / 1000u), interfaceName, frame.frame.can_id);
+            timeouts++;
+            continue;
+        }
+
+        if(formatCandumpLine(&frame, interfaceName, line, sizeof(line)) < 0){
+            reader.skipped++;
+            continue;
+        }
+
+        puts(line);
+    }
+
+    fprintf(stderr, "%llu RX_TIMEOUT records, %llu records skipped\n", (unsigned long long) timeouts,
+            (unsigned long long) reader.skipped);
+
+    closeLogReader(&reader);
+    return retCode < 0 ? retCode : RET_E_OK;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,1827 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Operations.c
+ \brief     Provides the BCM operations for CAN/CANFD transmission tasks and RX filters.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Dbc.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Registry.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Stepper.h"
+#include "CANFD_BCM_Uring.h"
+#include <errno.h>
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+void shutdownHandler(int retCode, struct bcmContext *const ctx){
+
+    // Free the message buffers
+    freeContext(ctx);
+
+    // Close the sockets
+    if(ctx->socketFD != -1){
+        close(ctx->socketFD);
+    }
+
+    if(ctx->rawSocketFD != -1){
+        close(ctx->rawSocketFD);
+    }
+
+    exit(retCode);
+}
+
+int isFatalSocketError(int error){
+
+    // Note: ENETDOWN is not fatal, a CAN interface is also down while it recovers from bus-off
+    return error == EBADF || error == ENOTSOCK || error == ENODEV || error == ENXIO;
+}
+
+void shutdownChannel(struct bcmContext *const ctx, int error){
+
+    struct bcmEvent event;
+
+    if(ctx->isDown){
+        return;
+    }
+
+    printf("Error the channel %d on %s is shut down: %s\n", ctx->channel, ctx->interfaceName, strerror(error));
+
+    ctx->isDown = 1;
+
+    // Note: The sockets leave the event loop before they are closed, so a
+    // reused file descriptor never reports to this channel.
+    if(ctx->epollFD != -1){
+
+        if(ctx->uring != NULL){
+            epoll_ctl(ctx->epollFD, EPOLL_CTL_DEL, ctx->uring->ringFD, NULL);
+        }
+
+        if(ctx->socketFD != -1){
+            epoll_ctl(ctx->epollFD, EPOLL_CTL_DEL, ctx->socketFD, NULL);
+        }
+
+        if(ctx->sequencer != NULL){
+            epoll_ctl(ctx->epollFD, EPOLL_CTL_DEL, ctx->sequencer->timerFD, NULL);
+        }
+    }
+
+    if(ctx->socketFD != -1){
+        close(ctx->socketFD);
+        ctx->socketFD = -1;
+    }
+
+    if(ctx->rawSocketFD != -1){
+        close(ctx->rawSocketFD);
+        ctx->rawSocketFD = -1;
+    }
+
+    // The held back messages can never be sent
+    addStatsCounter(STATS_RETRY_DROPPED, ctx->nretries);
+    ctx->nretries = 0;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&event, 0, sizeof(event));
+
+    event.timestamp = getStatsRealtime();
+    event.type      = EVENT_CHANNEL_DOWN;
+    event.channel   = (uint8_t) ctx->channel;
+    event.op.error  = error;
+
+    if(ctx->eventQueue != NULL && enqueueEvent(ctx->eventQueue, &event)){
+        addStatsCounter(STATS_EVENTS, 1);
+    }else{
+        addStatsCounter(STATS_EVENTS_DROPPED, 1);
+    }
+}
+
+/**
+ * Records the duration and the result of a send in the statistics.
+ *
+ * @param msg   - The first sent message, its head tells the opcode.
+ * @param start - The monotonic time before the send in nanoseconds.
+ * @param error - The errno of a failed send (0 = sent).
+ */
+static void recordSend(void const* const msg, uint64_t start, int error){
+
+    int histogram = getSendHistogram(((struct bcm_msg_head const*) msg)->opcode);
+
+    if(histogram >= 0){
+        recordStatsValue(histogram, getStatsTime() - start);
+    }
+
+    addStatsCounter(STATS_SENDS, 1);
+
+    if(error != 0){
+        addStatsCounter(STATS_SEND_ERRORS, 1);
+    }
+
+    // Note: The BCM socket reports a full TX queue of the interface with ENOBUFS
+    if(error == ENOBUFS){
+        addStatsCounter(STATS_TX_QUEUE_FULL, 1);
+    }
+}
+
+/**
+ * Checks if a send only failed because the socket or the TX queue of the
+ * interface can not take the message right now.
+ *
+ * @param error - The errno of the send.
+ * @return 1 if the message should be sent again later, otherwise 0.
+ */
+static int isTransientError(int error){
+
+    return error == ENOBUFS || error == EAGAIN || error == EWOULDBLOCK || error == EINTR;
+}
+
+/**
+ * Returns the wait before the next send of a held back message.
+ * The wait doubles with every failed send up to SEND_RETRY_MAX_US.
+ *
+ * @param attempts - Number of sends of the message that failed.
+ * @return The wait in nanoseconds.
+ */
+static uint64_t getRetryWait(uint32_t attempts){
+
+    if(attempts == 0){
+        return 0;
+    }
+
+    uint64_t wait = (uint64_t) SEND_RETRY_BASE_US << (attempts - 1 < 16 ? attempts - 1 : 16);
+
+    return (wait < SEND_RETRY_MAX_US ? wait : SEND_RETRY_MAX_US) * 1000u;
+}
+
+/**
+ * Holds a control message back for processSendRetries.
+ * The message is copied, so the caller can reuse its buffer right away.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param msg      - The message that starts with a bcm_msg_head.
+ * @param size     - The size of the message.
+ * @param attempts - Number of sends of the message that failed.
+ * @param queued   - The monotonic time of the first send in nanoseconds.
+ * @return RET_E_OK or ERR_INVALID_ARGUMENT if the queue is full or the message does not fit.
+ */
+static int queueRetry(struct bcmContext *const ctx, void const* const msg, size_t size, uint32_t attempts,
+                      uint64_t queued){
+
+    // Note: Sequences are larger than a single frame message and fail right away
+    if(size > sizeof(struct bcmMsgSingleFrameCanFD) || ctx->nretries >= ctx->retryCapacity){
+        addStatsCounter(STATS_RETRY_DROPPED, 1);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    struct bcmRetry *const retry = &ctx->retries[(ctx->retryHead + ctx->nretries) % ctx->retryCapacity];
+
+    memcpy(&retry->msg, msg, size);
+    retry->size     = (uint32_t) size;
+    retry->attempts = attempts;
+    retry->queued   = queued;
+    retry->due      = getStatsTime() + getRetryWait(attempts);
+
+    ctx->nretries++;
+
+    return RET_E_OK;
+}
+
+/**
+ * Sends a BCM message on the socket of the context.
+ * Works like send but the duration is recorded per opcode.
+ *
+ * If the context has an io_uring the message is only queued and its result
+ * is handled by processControlCompletion. Messages that do not fit in a
+ * slot of the ring (sequences) are sent right away after the queued
+ * messages, so the kernel still sees them in order.
+ *
+ * A message the socket can not take right now is held back and counts as
+ * sent. While messages are held back the following messages wait behind
+ * them, so nothing overtakes a held back message.
+ *
+ * In the stepped mode the TX_SETUP and TX_DELETE messages are applied to
+ * the stepper instead, the cyclic tasks run in simulation time. The ones of
+ * the long sequences a sequencer runs are applied to the sequencer.
+ *
+ * @param ctx  - The context of the BCM socket.
+ * @param msg  - The message that starts with a bcm_msg_head.
+ * @param size - The size of the message.
+ * @return The result of send or size if the message was queued. errno is kept.
+ */
+static ssize_t sendMessage(struct bcmContext *const ctx, void const* const msg, size_t size){
+
+    if(ctx->stepper != NULL){
+
+        int held = holdStepMessage(ctx->stepper, msg, size);
+
+        if(held != 0){
+            return held > 0 ? (ssize_t) size : -1;
+        }
+    }
+
+    if(ctx->sequencer != NULL){
+
+        int held = holdSequencerMessage(ctx, msg, size);
+
+        if(held != 0){
+            return held > 0 ? (ssize_t) size : -1;
+        }
+    }
+
+    if(ctx->nretries > 0){
+
+        if(queueRetry(ctx, msg, size, 0, getStatsTime()) == RET_E_OK){
+            return (ssize_t) size;
+        }
+
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    if(ctx->uring != NULL){
+
+        if(queueUringMessage(ctx->uring, msg, size) == RET_E_OK){
+            return (ssize_t) size;
+        }
+
+        flushUring(ctx->uring);
+    }
+
+    uint64_t start = getStatsTime();
+    ssize_t ret    = send(ctx->socketFD, msg, size, 0);
+    int error      = errno;
+
+    recordSend(msg, start, ret < 0 ? error : 0);
+
+    if(ret < 0 && isTransientError(error) && queueRetry(ctx, msg, size, 1, start) == RET_E_OK){
+        return (ssize_t) size;
+    }
+
+    errno = error;
+    return ret;
+}
+
+/**
+ * Reports a control message that could not be sent.
+ * A fatal error shuts the channel down, errCode is returned in any case.
+ *
+ * Note: Call it right after the failed send, the error is taken from errno.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param name    - The opcode for the error message.
+ * @param errCode - The return code.
+ * @return errCode.
+ */
+static int handleSendError(struct bcmContext *const ctx, char const *name, int errCode){
+
+    int error = errno;
+
+    printf("Error could not send %s message: %s\n", name, strerror(error));
+
+    if(isFatalSocketError(error)){
+        shutdownChannel(ctx, error);
+    }
+
+    return errCode;
+}
+
+/**
+ * Sends a TX_DELETE message for a BCM task.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param canID   - The CAN ID in the bcm_msg_head of the task.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return RET_E_OK or ERR_TX_SETUP_FAILED.
+ */
+static int sendTxDelete(struct bcmContext *const ctx, canid_t canID, int isCANFD){
+
+    struct bcm_msg_head msg;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&msg, 0, sizeof(msg));
+
+    msg.opcode = TX_DELETE;
+    msg.can_id = canID;
+
+    if(isCANFD){
+        msg.flags = CAN_FD_FRAME;
+    }
+
+    // Send the TX_DELETE configuration message
+    if(sendMessage(ctx, &msg, sizeof(msg)) < 0){
+        return handleSendError(ctx, "TX_DELETE", ERR_TX_SETUP_FAILED);
+    }
+
+    return RET_E_OK;
+}
+
+/**
+ * Removes a cyclic transmission task and the members of its sequence from the registry.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param canID   - The CAN ID of the cyclic transmission task.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static void unregisterTxTask(struct bcmContext *const ctx, canid_t canID, int isCANFD){
+
+    struct bcmTask *task = findTask(&ctx->registry, canID, isCANFD, TASK_KIND_TX);
+
+    if(task == NULL){
+        return;
+    }
+
+    // Walk the members of the sequence.
+    // Note: Stop at a member that was taken over by another sequence.
+    canid_t nextID = task->nextID;
+    int hasNext    = task->hasNext;
+
+    removeTask(&ctx->registry, canID, isCANFD, TASK_KIND_TX);
+
+    while(hasNext){
+        struct bcmTask *member = findTask(&ctx->registry, nextID, isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+
+        if(member == NULL || member->headID != canID){
+            break;
+        }
+
+        canid_t memberID = nextID;
+        nextID  = member->nextID;
+        hasNext = member->hasNext;
+
+        removeTask(&ctx->registry, memberID, isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+    }
+}
+
+/**
+ * Adds a task to the registry and warns once when the registry is full.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param canID   - The CAN ID of the task.
+ * @param isCANFD - Flag for CANFD frames.
+ * @param kind    - The enum bcmTaskKind of the task.
+ * @return The task or NULL if the registry is full.
+ */
+static struct bcmTask* registerTask(struct bcmContext *const ctx, canid_t canID, int isCANFD, int kind){
+
+    int overflowed = ctx->registry.overflowed;
+
+    struct bcmTask *task = addTask(&ctx->registry, canID, isCANFD, kind);
+
+    if(task == NULL && !overflowed){
+        printf("Warning the task registry is full. Tasks are no longer tracked \n");
+    }
+
+    return task;
+}
+
+/**
+ * Registers a cyclic transmission task for a single frame.
+ * The frame is kept as shadow copy of the payload the BCM is sending.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frame   - The frame of the cyclic transmission task.
+ * @param isCANFD - Flag for CANFD frames.
+ * @param count   - Number of times the frame is send with the first interval.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ */
+static void registerTxTask(struct bcmContext *const ctx, struct canfd_frame const* const frame, int isCANFD,
+                           uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2){
+
+    canid_t canID = frame->can_id;
+
+    struct bcmTask *task = findTask(&ctx->registry, canID, isCANFD, TASK_KIND_TX);
+
+    // Note: A TX_SETUP for the CAN ID of a sequence replaces the sequence
+    if(task != NULL && task->type == TASK_TX_SEQUENCE){
+        unregisterTxTask(ctx, canID, isCANFD);
+    }
+
+    task = registerTask(ctx, canID, isCANFD, TASK_KIND_TX);
+
+    if(task == NULL){
+        return;
+    }
+
+    task->type    = TASK_TX_CYCLIC;
+    task->nframes = 1;
+    task->count   = count;
+    task->ival1   = ival1;
+    task->ival2   = ival2;
+
+    setShadowFrame(task, frame, isCANFD);
+}
+
+/**
+ * Updates the shadow copy of a cyclic transmission task after an update was sent.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frame   - The frame with the updated data.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static void updateTxShadow(struct bcmContext *const ctx, struct canfd_frame const* const frame, int isCANFD){
+
+    struct bcmTask *task = findTask(&ctx->registry, frame->can_id, isCANFD, TASK_KIND_TX);
+
+    // Note: An update for an unknown CAN ID creates a task without a timer
+    if(task == NULL){
+        struct bcm_timeval ivalZero = {0, 0};
+        registerTxTask(ctx, frame, isCANFD, 0, ivalZero, ivalZero);
+
+    }else if(task->type == TASK_TX_CYCLIC){
+        setShadowFrame(task, frame, isCANFD);
+    }
+}
+
+/**
+ * Checks if an update would send the payload the BCM is already sending.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frame   - The frame with the updated data.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return 1 if the update can be skipped, otherwise 0.
+ */
+static int isUnchangedUpdate(struct bcmContext *const ctx, struct canfd_frame const* const frame, int isCANFD){
+
+    struct bcmTask *task = findTask(&ctx->registry, frame->can_id, isCANFD, TASK_KIND_TX);
+
+    if(task == NULL || task->type != TASK_TX_CYCLIC || !hasSamePayload(task, frame, isCANFD)){
+        return 0;
+    }
+
+    addStatsCounter(STATS_UPDATES_SKIPPED, 1);
+
+    return 1;
+}
+
+/**
+ * Registers a cyclic transmission task for a sequence of frames.
+ * The frames with another CAN ID than the first frame are registered
+ * as members that point to the sequence task.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frames  - The array of CAN/CANFD frames of the sequence.
+ * @param nframes - The number of CAN/CANFD frames of the sequence.
+ * @param count   - Number of times the frame is send with the first interval.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static void registerTxSequence(struct bcmContext *const ctx, struct canfd_frame const frames[], int nframes, uint32_t count,
+                               struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    // Note: can_id is at the same offset for CAN and CANFD frames
+    canid_t headID = frames[0].can_id;
+
+    // Forget the members of an older sequence with the same CAN ID
+    unregisterTxTask(ctx, headID, isCANFD);
+
+    struct bcmTask *head = registerTask(ctx, headID, isCANFD, TASK_KIND_TX);
+
+    if(head == NULL){
+        return;
+    }
+
+    head->type    = TASK_TX_SEQUENCE;
+    head->nframes = nframes;
+    head->count   = count;
+    head->ival1   = ival1;
+    head->ival2   = ival2;
+    head->digest  = getFramesDigest(frames, nframes, isCANFD);
+
+    // Link the members so the sequence can be removed without scanning
+    struct bcmTask *last = head;
+
+    for(int index = 1; index < nframes; index++){
+
+        canid_t canID = frames[index].can_id;
+
+        if(canID == headID){
+            continue;
+        }
+
+        struct bcmTask *member = findTask(&ctx->registry, canID, isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+
+        // The CAN ID appears more than once in the sequence
+        if(member != NULL && member->headID == headID){
+            continue;
+        }
+
+        member = registerTask(ctx, canID, isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+
+        if(member == NULL){
+            return;
+        }
+
+        member->type    = TASK_SEQUENCE_MEMBER;
+        member->headID  = headID;
+        member->hasNext = 0;
+
+        last->nextID  = canID;
+        last->hasNext = 1;
+        last = member;
+    }
+}
+
+/**
+ * Sends the first nmsgs messages of a contiguous buffer with sendmmsg.
+ * A message that could not be sent is skipped and the remaining
+ * messages are still sent. A message the socket can not take right now
+ * is held back like in sendMessage, the messages after it wait behind it.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param buffer  - The buffer with the messages, usually the batch buffer of the context.
+ * @param msgSize - The size of a single message in the buffer.
+ * @param nmsgs   - The number of messages in the buffer (at most TX_BATCH_SIZE).
+ * @param status  - Storage for the status of each message.
+ * @param errCode - The error code that is stored for a failed message.
+ * @return The number of messages that could not be sent.
+ */
+static int sendBatch(struct bcmContext *const ctx, unsigned char *const buffer, size_t msgSize, int nmsgs, int status[],
+                     int errCode){
+
+    int failed = 0; // Number of messages that could not be sent
+    int offset = 0; // Index of the next message that should be sent
+
+    // Note: On the io_uring the whole batch is one submit. A message the kernel
+    // rejects is reported with an EVENT_OP_FAILED instead of its status.
+    if(ctx->uring != NULL){
+
+        beginUringBatch(ctx->uring);
+
+        for(int index = 0; index < nmsgs; index++){
+            sendMessage(ctx, buffer + (size_t) index * msgSize, msgSize);
+            status[index] = RET_E_OK;
+        }
+
+        endUringBatch(ctx->uring);
+        return 0;
+    }
+
+    // Point each iovec to its message in the contiguous buffer
+    for(int index = 0; index < nmsgs; index++){
+        ctx->txBatchIovecs[index].iov_base = buffer + (size_t) index * msgSize;
+        ctx->txBatchIovecs[index].iov_len  = msgSize;
+    }
+
+    // Note: sendmmsg stops at the first message that fails. If no message was sent
+    // it returns -1, otherwise it returns the number of sent messages and the failed
+    // message is the next one. We mark the failed message and continue after it.
+    while(offset < nmsgs){
+
+        // Note: Nothing overtakes a held back message and the stepper sees each message
+        if(ctx->nretries > 0 || ctx->stepper != NULL){
+
+            for(; offset < nmsgs; offset++){
+                status[offset] = sendMessage(ctx, buffer + (size_t) offset * msgSize, msgSize) < 0 ? errCode : RET_E_OK;
+                failed += status[offset] != RET_E_OK;
+            }
+
+            break;
+        }
+
+        uint64_t start = getStatsTime();
+        int sent       = sendmmsg(ctx->socketFD, &ctx->txBatchMsgs[offset], nmsgs - offset, 0);
+        int error      = errno;
+
+        recordSend(ctx->txBatchMsgs[offset].msg_hdr.msg_iov->iov_base, start, sent < 0 ? error : 0);
+
+        if(sent < 0){
+
+            if(error == EINTR){
+                continue;
+            }
+
+            if(isTransientError(error) && queueRetry(ctx, buffer + (size_t) offset * msgSize, msgSize, 1, start) == RET_E_OK){
+                status[offset] = RET_E_OK;
+                offset++;
+                continue;
+            }
+
+            errno = error;
+            handleSendError(ctx, "batched", errCode);
+
+            status[offset] = errCode;
+            failed++;
+            offset++;
+            continue;
+        }
+
+        for(int index = offset; index < offset + sent; index++){
+            status[index] = RET_E_OK;
+        }
+
+        offset += sent;
+    }
+
+    return failed;
+}
+
+/**
+ * Sends one-shot CAN/CANFD frames on the CAN_RAW socket with as few
+ * sendmmsg calls as possible. The frames are sent from where they are,
+ * nothing is copied.
+ *
+ * Note: If the TX queue of the interface is full the send is retried
+ * RAW_ENOBUFS_RETRIES times with a short wait in between. If it is still
+ * full the remaining frames of the call fail, so a saturated bus does not
+ * block the caller for every single frame.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param frames   - The array of CAN/CANFD frames that should be send.
+ * @param nframes  - The number of CAN/CANFD frames that should be send.
+ * @param isCANFD  - Flag for CANFD frames.
+ * @param status   - Storage for the status of each frame (NULL = not needed).
+ * @return The number of frames that could not be sent.
+ */
+static int sendRawFrames(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, int isCANFD,
+                         int status[]){
+
+    // Note: The MTU tells the raw socket if it is a CAN or a CANFD frame.
+    // A CAN frame has the same layout as the start of a CANFD frame.
+    size_t frameSize = isCANFD ? CANFD_MTU : CAN_MTU;
+    struct timespec wait = {0, 100000};
+    int failed = 0;
+
+    for(int start = 0; start < nframes; start += TX_BATCH_SIZE){
+
+        int nmsgs   = (nframes - start < TX_BATCH_SIZE) ? nframes - start : TX_BATCH_SIZE;
+        int offset  = 0;
+        int retries = 0;
+
+        for(int index = 0; index < nmsgs; index++){
+            ctx->txBatchIovecs[index].iov_base = &frames[start + index];
+            ctx->txBatchIovecs[index].iov_len  = frameSize;
+        }
+
+        while(offset < nmsgs){
+
+            uint64_t begin = getStatsTime();
+            int sent       = sendmmsg(ctx->rawSocketFD, &ctx->txBatchMsgs[offset], nmsgs - offset, 0);
+            int error      = errno;
+
+            recordStatsValue(STATS_SEND_RAW, getStatsTime() - begin);
+            addStatsCounter(STATS_SENDS, 1);
+
+            if(sent >= 0){
+
+                for(int index = offset; status != NULL && index < offset + sent; index++){
+                    status[start + index] = RET_E_OK;
+                }
+
+                offset += sent;
+                retries = 0;
+                continue;
+            }
+
+            addStatsCounter(STATS_SEND_ERRORS, 1);
+
+            if(error == EINTR){
+                continue;
+            }
+
+            if(error == ENOBUFS){
+                addStatsCounter(STATS_TX_QUEUE_FULL, 1);
+            }
+
+            // The interface can not take more frames right now
+            if((error == ENOBUFS || error == EAGAIN) && retries < RAW_ENOBUFS_RETRIES){
+                retries++;
+                nanosleep(&wait, NULL);
+                continue;
+            }
+
+            printf("Error could not send the frames on the raw socket: %s\n", strerror(error));
+
+            if(isFatalSocketError(error)){
+                shutdownChannel(ctx, error);
+            }
+
+            // Note: A full TX queue or a channel that is down fails the rest of the call,
+            // any other error only this frame
+            int last = (error == ENOBUFS || error == EAGAIN || ctx->isDown) ? nframes - start : offset + 1;
+
+            for(int index = offset; status != NULL && index < last; index++){
+                status[start + index] = ERR_TX_SEND_FAILED;
+            }
+
+            failed += last - offset;
+
+            if(last > nmsgs){
+                return failed;
+            }
+
+            offset  = last;
+            retries = 0;
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * Defines the message builders of one frame type.
+ * The builders are generated once for CAN and once for CANFD frames, so the
+ * loops over the frames know the message layout at compile time and neither
+ * branch nor cast per frame. The runtime isCANFD flag only selects the
+ * variant once per call.
+ *
+ * fillSingles##SUFFIX fills nmsgs single frame messages one after the other
+ * in a buffer, the frame of message k is frames[picks[k]] or frames[k] if
+ * picks is NULL. copyFrames##SUFFIX copies the frames into a message with
+ * multiple frames.
+ *
+ * Note: A CAN frame has the same layout as the start of a CANFD frame, so
+ * each frame is one fixed size copy. CANFD frames are copied as a whole block.
+ */
+#define DEFINE_TX_BUILDERS(SUFFIX, SINGLE, SINGLE_FRAME, MULTIPLE, MULTIPLE_FRAMES, FRAME, FD_FLAG)                    \
+                                                                                                                      \
+static void fillSingles##SUFFIX(unsigned char *const buffer, struct canfd_frame const frames[], int const picks[],      \
+                                int nmsgs, uint32_t opcode, uint32_t flags){                                          \
+                                                                                                                      \
+    SINGLE *const msgs = (SINGLE *) buffer;                                                                           \
+                                                                                                                      \
+    /* Note: Always initialize the whole struct with 0. */                                                            \
+    /* Random values in the memory can cause weird bugs! */                                                           \
+    memset(msgs, 0, sizeof(SINGLE) * (size_t) nmsgs);                                                                 \
+                                                                                                                      \
+    for(int index = 0; index < nmsgs; index++){                                                                       \
+                                                                                                                      \
+        struct canfd_frame const* const frame = &frames[picks != NULL ? picks[index] : index];                        \
+                                                                                                                      \
+        msgs[index].msg_head.opcode  = opcode;                                                                        \
+        msgs[index].msg_head.flags   = flags | (FD_FLAG);                                                             \
+        msgs[index].msg_head.nframes = 1;                                                                             \
+        msgs[index].msg_head.can_id  = frame->can_id;                                                                 \
+        memcpy(&msgs[index].SINGLE_FRAME[0], frame, sizeof(FRAME));                                                   \
+    }                                                                                                                 \
+}                                                                                                                     \
+                                                                                                                      \
+static void copyFrames##SUFFIX(void *const buffer, struct canfd_frame const frames[], int nframes){                   \
+                                                                                                                      \
+    MULTIPLE *const msg = (MULTIPLE *) buffer;                                                                        \
+                                                                                                                      \
+    if(sizeof(FRAME) == sizeof(struct canfd_frame)){                                                                  \
+        memcpy(msg->MULTIPLE_FRAMES, frames, sizeof(FRAME) * (size_t) nframes);                                       \
+        return;                                                                                                       \
+    }                                                                                                                 \
+                                                                                                                      \
+    for(int index = 0; index < nframes; index++){                                                                     \
+        memcpy(&msg->MULTIPLE_FRAMES[index], &frames[index], sizeof(FRAME));                                          \
+    }                                                                                                                 \
+}
+
+DEFINE_TX_BUILDERS(Can, struct bcmMsgSingleFrameCan, canFrame, struct bcmMsgMultipleFramesCan, canFrames,
+                   struct can_frame, 0)
+DEFINE_TX_BUILDERS(CanFD, struct bcmMsgSingleFrameCanFD, canfdFrame, struct bcmMsgMultipleFramesCanFD, canfdFrames,
+                   struct canfd_frame, CAN_FD_FRAME)
+
+/**
+ * Returns the size of a BCM message with a single CAN or CANFD frame.
+ *
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static size_t getSingleSize(int isCANFD){
+
+    return isCANFD ? sizeof(struct bcmMsgSingleFrameCanFD) : sizeof(struct bcmMsgSingleFrameCan);
+}
+
+/**
+ * Fills nmsgs single frame messages one after the other in a buffer with the
+ * builder of the frame type. The CAN ID of each message is the one of its frame.
+ *
+ * @param buffer  - The buffer, usually the batch buffer of the context.
+ * @param frames  - The array of CAN/CANFD frames.
+ * @param picks   - The index of the frame of each message (NULL = the first nmsgs frames).
+ * @param nmsgs   - The number of messages (at most TX_BATCH_SIZE).
+ * @param opcode  - The opcode of the messages.
+ * @param flags   - The flags of the messages without CAN_FD_FRAME.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static void fillSingles(unsigned char *const buffer, struct canfd_frame const frames[], int const picks[], int nmsgs,
+                        uint32_t opcode, uint32_t flags, int isCANFD){
+
+    if(isCANFD){
+        fillSinglesCanFD(buffer, frames, picks, nmsgs, opcode, flags);
+    }else{
+        fillSinglesCan(buffer, frames, picks, nmsgs, opcode, flags);
+    }
+}
+
+/**
+ * Sets the count and the intervals of single frame messages in a buffer.
+ * Only the bcm_msg_head is written, so this works for CAN and CANFD messages.
+ *
+ * @param buffer  - The buffer filled by fillSingles.
+ * @param msgSize - The size of a single message in the buffer.
+ * @param nmsgs   - The number of messages.
+ * @param count   - Number of times each frame is send with the first interval.
+ * @param ival1   - First interval of each frame.
+ * @param ival2   - Second interval of each frame.
+ */
+static void setSingleTimers(unsigned char *const buffer, size_t msgSize, int nmsgs, uint32_t const count[],
+                            struct bcm_timeval const ival1[], struct bcm_timeval const ival2[]){
+
+    for(int index = 0; index < nmsgs; index++){
+
+        struct bcm_msg_head *const head = (struct bcm_msg_head *) (buffer + (size_t) index * msgSize);
+
+        head->count = count[index];
+        head->ival1 = ival1[index];
+        head->ival2 = ival2[index];
+    }
+}
+
+/**
+ * Sends the first nmsgs messages of a buffer one at a time.
+ * A message that could not be sent is reported and the remaining
+ * messages are still sent.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param buffer  - The buffer filled by fillSingles.
+ * @param msgSize - The size of a single message in the buffer.
+ * @param nmsgs   - The number of messages.
+ * @param status  - Storage for the status of each message (NULL = not needed).
+ * @param name    - The opcode for the error message.
+ * @param errCode - The error code that is stored for a failed message.
+ * @return The number of messages that could not be sent.
+ */
+static int sendSingles(struct bcmContext *const ctx, unsigned char const* const buffer, size_t msgSize, int nmsgs,
+                       int status[], char const *name, int errCode){
+
+    int failed = 0;
+
+    if(ctx->uring != NULL){
+        beginUringBatch(ctx->uring);
+    }
+
+    for(int index = 0; index < nmsgs; index++){
+
+        int ret = RET_E_OK;
+
+        if(sendMessage(ctx, buffer + (size_t) index * msgSize, msgSize) < 0){
+            ret = handleSendError(ctx, name, errCode);
+            failed++;
+        }
+
+        if(status != NULL){
+            status[index] = ret;
+        }
+    }
+
+    if(ctx->uring != NULL){
+        endUringBatch(ctx->uring);
+    }
+
+    return failed;
+}
+
+int setTxSendPolicy(struct bcmContext *const ctx, int policy){
+
+    if(policy != TX_SEND_POLICY_BCM && policy != TX_SEND_POLICY_RAW && policy != TX_SEND_POLICY_AUTO){
+        printf("Error unknown TX_SEND policy %d \n", policy);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(policy != TX_SEND_POLICY_BCM && ctx->rawSocketFD == -1){
+        printf("Error the TX_SEND policy %d needs a raw socket \n", policy);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    ctx->txSendPolicy = policy;
+    return RET_E_OK;
+}
+
+/**
+ * Checks if the frames of a createTxSend go over the CAN_RAW socket.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param nframes - The number of CAN/CANFD frames.
+ */
+static int isRawSend(struct bcmContext const* const ctx, int nframes){
+
+    return ctx->txSendPolicy == TX_SEND_POLICY_RAW ||
+           (ctx->txSendPolicy == TX_SEND_POLICY_AUTO && nframes >= RAW_BULK_THRESHOLD);
+}
+
+int createTxSend(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, int isCANFD){
+
+    size_t msgSize = getSingleSize(isCANFD);
+    int failed     = 0;
+
+    // Bulk one-shot frames do not need the BCM, so skip its header
+    if(isRawSend(ctx, nframes)){
+        return sendRawFrames(ctx, frames, nframes, isCANFD, NULL);
+    }
+
+    // Note: TX_SEND can only send one frame at a time unlike TX_SETUP!
+    // This is the reason why we must send one message per frame instead
+    // of a struct that can contain multiple frames. The messages are
+    // built a chunk at a time in the batch buffer of the context.
+    for(int start = 0; start < nframes; start += TX_BATCH_SIZE){
+
+        int nmsgs = (nframes - start < TX_BATCH_SIZE) ? nframes - start : TX_BATCH_SIZE;
+
+        fillSingles(ctx->txBatch, &frames[start], NULL, nmsgs, TX_SEND, 0, isCANFD);
+        failed += sendSingles(ctx, ctx->txBatch, msgSize, nmsgs, NULL, "TX_SEND", ERR_TX_SEND_FAILED);
+    }
+
+    return failed;
+}
+
+int createTxSendBatch(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, int isCANFD,
+                      int status[]){
+
+    size_t msgSize = getSingleSize(isCANFD);
+    int failed     = 0;
+
+    if(isRawSend(ctx, nframes)){
+        return sendRawFrames(ctx, frames, nframes, isCANFD, status);
+    }
+
+    for(int start = 0; start < nframes; start += TX_BATCH_SIZE){
+
+        int nmsgs = (nframes - start < TX_BATCH_SIZE) ? nframes - start : TX_BATCH_SIZE;
+
+        fillSingles(ctx->txBatch, &frames[start], NULL, nmsgs, TX_SEND, 0, isCANFD);
+        failed += sendBatch(ctx, ctx->txBatch, msgSize, nmsgs, &status[start], ERR_TX_SEND_FAILED);
+    }
+
+    return failed;
+}
+
+int createTxSetup(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, const uint32_t count[],
+                  struct bcm_timeval ival1[], struct bcm_timeval ival2[], int isCANFD){
+
+    size_t msgSize = getSingleSize(isCANFD);
+    int status[TX_BATCH_SIZE]; // The status of each message in the batch buffer
+    int failed = 0;
+
+    // Note: We send for each TX_SETUP a single CAN/CANFD frame with its CAN ID in the
+    // bcm_msg_head. This way we do not create a cyclic transmission sequence which can
+    // only be removed with the CAN ID that was set in the bcm_msg_head. Another benefit
+    // is that each CAN/CANFD frame can have different count, ival1, and ival2 values.
+    for(int start = 0; start < nframes; start += TX_BATCH_SIZE){
+
+        int nmsgs = (nframes - start < TX_BATCH_SIZE) ? nframes - start : TX_BATCH_SIZE;
+
+        // Note: By combining the flags SETTIMER and STARTTIMER
+        // the BCM will start sending the messages immediately
+        fillSingles(ctx->txBatch, &frames[start], NULL, nmsgs, TX_SETUP, SETTIMER | STARTTIMER, isCANFD);
+        setSingleTimers(ctx->txBatch, msgSize, nmsgs, &count[start], &ival1[start], &ival2[start]);
+        failed += sendSingles(ctx, ctx->txBatch, msgSize, nmsgs, status, "TX_SETUP", ERR_TX_SETUP_FAILED);
+
+        // Remember the tasks and their intervals
+        for(int index = start; index < start + nmsgs; index++){
+            if(status[index - start] == RET_E_OK){
+                registerTxTask(ctx, &frames[index], isCANFD, count[index], ival1[index], ival2[index]);
+            }
+        }
+    }
+
+    return failed;
+}
+
+/**
+ * Returns the size of a TX_SETUP message with nframes frames.
+ * The BCM only reads the frames given in nframes, so nothing more is sent.
+ *
+ * @param nframes - The number of CAN/CANFD frames.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static size_t getSequenceSize(int nframes, int isCANFD){
+
+    if(isCANFD){
+        return offsetof(struct bcmMsgMultipleFramesCanFD, canfdFrames) + sizeof(struct canfd_frame) * (size_t) nframes;
+    }
+
+    return offsetof(struct bcmMsgMultipleFramesCan, canFrames) + sizeof(struct can_frame) * (size_t) nframes;
+}
+
+/**
+ * Fills a TX_SETUP message for a sequence. The first frame gives the CAN ID in the bcm_msg_head.
+ *
+ * @param msg     - The message buffer of getSequenceSize bytes.
+ * @param frames  - The array of CAN/CANFD frames.
+ * @param nframes - The number of CAN/CANFD frames of the message.
+ * @param count   - Number of times the frame is send with the first interval.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ * @param isCANFD - Flag for CANFD frames.
+ */
+static void fillSequence(void *const msg, struct canfd_frame const frames[], int nframes, uint32_t count,
+                         struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    struct bcm_msg_head *const head = msg;
+
+    // Note: Only the head is reset because the kernel only reads the first nframes
+    // frames and those are overwritten below.
+    memset(head, 0, sizeof(struct bcm_msg_head));
+
+    // Note: By combining the flags SETTIMER and STARTTIMER
+    // the BCM will start sending the messages immediately
+    head->opcode  = TX_SETUP;
+    head->flags   = SETTIMER | STARTTIMER;
+    head->can_id  = frames[0].can_id;
+    head->count   = count;
+    head->ival1   = ival1;
+    head->ival2   = ival2;
+    head->nframes = nframes;
+
+    if(isCANFD){
+        head->flags = head->flags | CAN_FD_FRAME;
+        copyFramesCanFD(msg, frames, nframes);
+    }else{
+        copyFramesCan(msg, frames, nframes);
+    }
+}
+
+/**
+ * Creates a cyclic transmission task for a sequence of more than MAXFRAMES
+ * frames. The BCM can not run it, so all frames run from the one timer of a
+ * task of the stepper or, with the kernel timers, of the sequencer.
+ * See createTxSetupSequence.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frames  - The array of CAN/CANFD frames that should be send cyclic.
+ * @param nframes - The number of CAN/CANFD frames that should be send cyclic.
+ * @param count   - Number of times the frame is send with the first interval.
+ * @param ival1   - First interval.
+ * @param ival2   - Second interval.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT or ERR_TX_SETUP_FAILED.
+ */
+static int createTxSetupLongSequence(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes,
+                                     uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    // Note: Several BCM tasks can not keep the order of the frames, because STARTTIMER
+    // sends the first frame of every task right away and their timers drift apart.
+    if(ctx->stepper == NULL && ctx->sequencer == NULL){
+        printf("Error a sequence of more than %d frames needs the stepped mode or a sequencer \n", MAXFRAMES);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Note: A task can not grow, so an older task with the same CAN ID is removed first
+    if(findTask(&ctx->registry, frames[0].can_id, isCANFD, TASK_KIND_TX) != NULL){
+        createTxDelete(ctx, frames[0].can_id, isCANFD);
+    }
+
+    int held = ctx->stepper != NULL
+             ? holdStepSequence(ctx->stepper, frames, (uint32_t) nframes, count, ival1, ival2, isCANFD)
+             : holdSequencerSequence(ctx, frames, (uint32_t) nframes, count, ival1, ival2, isCANFD);
+
+    if(held < 0){
+        return handleSendError(ctx, "TX_SETUP", ERR_TX_SETUP_FAILED);
+    }
+
+    // Remember the sequence task and its members
+    registerTxSequence(ctx, frames, nframes, count, ival1, ival2, isCANFD);
+
+    return RET_E_OK;
+}
+
+int createTxSetupSequence(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, uint32_t count,
+                          struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    if(nframes <= 0){
+        printf("Error a sequence needs at least one frame \n");
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Long sequences do not fit in a BCM task
+    if(nframes > MAXFRAMES){
+        return createTxSetupLongSequence(ctx, frames, nframes, count, ival1, ival2, isCANFD);
+    }
+
+    // BCM message we are sending with multiple CAN or CANFD frame.
+    // Note: The message buffers are owned by the context and reused for every call.
+    // Only the head and the first nframes frames are sent, not all MAXFRAMES frames.
+    void* msg      = isCANFD ? (void *) ctx->txMultipleCanFD : (void *) ctx->txMultipleCan;
+    size_t msgSize = getSequenceSize(nframes, isCANFD);
+
+    fillSequence(msg, frames, nframes, count, ival1, ival2, isCANFD);
+
+    // Send the TX_SETUP configuration message
+    if(sendMessage(ctx, msg, msgSize) < 0){
+        return handleSendError(ctx, "TX_SETUP", ERR_TX_SETUP_FAILED);
+    }
+
+    // Remember the sequence task and its members
+    registerTxSequence(ctx, frames, nframes, count, ival1, ival2, isCANFD);
+
+    return RET_E_OK;
+}
+
+/**
+ * Collects the frames of a TX_SETUP update that change the payload of their task,
+ * at most TX_BATCH_SIZE frames per call.
+ *
+ * @param ctx     - The context of the BCM socket.
+ * @param frames  - The array of CAN/CANFD frames.
+ * @param nframes - The number of CAN/CANFD frames.
+ * @param next    - The index of the first frame that is checked, advanced past the checked frames.
+ * @param isCANFD - Flag for CANFD frames.
+ * @param picks   - Storage for the indices of the changed frames.
+ * @param status  - Storage for the status of the frames that are skipped (NULL = none).
+ * @return The number of changed frames.
+ */
+static int pickChangedFrames(struct bcmContext *const ctx, struct canfd_frame const frames[], int nframes,
+                             int *const next, int isCANFD, int picks[], int status[]){
+
+    int npicks = 0;
+
+    while(*next < nframes && npicks < TX_BATCH_SIZE){
+
+        // Skip the frame if the BCM is already sending this payload
+        if(!isUnchangedUpdate(ctx, &frames[*next], isCANFD)){
+            picks[npicks++] = *next;
+        }else if(status != NULL){
+            status[*next] = RET_E_OK;
+        }
+
+        (*next)++;
+    }
+
+    return npicks;
+}
+
+int createTxSetupUpdate(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, int isCANFD, int announce){
+
+    size_t msgSize = getSingleSize(isCANFD);
+    int picks[TX_BATCH_SIZE];  // The index of the frame of each message in the batch buffer
+    int status[TX_BATCH_SIZE]; // The status of each message in the batch buffer
+    int failed = 0;
+
+    for(int next = 0; next < nframes;){
+
+        int nmsgs = pickChangedFrames(ctx, frames, nframes, &next, isCANFD, picks, NULL);
+
+        fillSingles(ctx->txBatch, frames, picks, nmsgs, TX_SETUP, announce ? TX_ANNOUNCE : 0, isCANFD);
+        failed += sendSingles(ctx, ctx->txBatch, msgSize, nmsgs, status, "TX_SETUP", ERR_TX_SETUP_FAILED);
+
+        // Remember the payload the BCM is sending now
+        for(int index = 0; index < nmsgs; index++){
+            if(status[index] == RET_E_OK){
+                updateTxShadow(ctx, &frames[picks[index]], isCANFD);
+            }
+        }
+    }
+
+    return failed;
+}
+
+int createTxSetupBatch(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, const uint32_t count[],
+                       struct bcm_timeval ival1[], struct bcm_timeval ival2[], int isCANFD, int status[]){
+
+    int failed     = 0;
+    size_t msgSize = getSingleSize(isCANFD);
+
+    // Split the frames in chunks that fit in the batch buffer
+    for(int start = 0; start < nframes; start += TX_BATCH_SIZE){
+
+        int nmsgs = (nframes - start < TX_BATCH_SIZE) ? nframes - start : TX_BATCH_SIZE;
+
+        // Note: By combining the flags SETTIMER and STARTTIMER
+        // the BCM will start sending the messages immediately
+        fillSingles(ctx->txBatch, &frames[start], NULL, nmsgs, TX_SETUP, SETTIMER | STARTTIMER, isCANFD);
+        setSingleTimers(ctx->txBatch, msgSize, nmsgs, &count[start], &ival1[start], &ival2[start]);
+
+        failed += sendBatch(ctx, ctx->txBatch, msgSize, nmsgs, &status[start], ERR_TX_SETUP_FAILED);
+
+        // Remember the tasks that were set up
+        for(int index = start; index < start + nmsgs; index++){
+            if(status[index] == RET_E_OK){
+                registerTxTask(ctx, &frames[index], isCANFD, count[index], ival1[index], ival2[index]);
+            }
+        }
+    }
+
+    return failed;
+}
+
+int createTxSetupUpdateBatch(struct bcmContext *const ctx, struct canfd_frame frames[], int nframes, int isCANFD,
+                             int announce, int status[]){
+
+    int failed     = 0;
+    size_t msgSize = getSingleSize(isCANFD);
+
+    int picks[TX_BATCH_SIZE];       // The index of the frame of each message in the batch
+    int batchStatus[TX_BATCH_SIZE]; // The status of each message in the batch
+
+    for(int next = 0; next < nframes;){
+
+        int nmsgs = pickChangedFrames(ctx, frames, nframes, &next, isCANFD, picks, status);
+
+        if(nmsgs == 0){
+            continue;
+        }
+
+        fillSingles(ctx->txBatch, frames, picks, nmsgs, TX_SETUP, announce ? TX_ANNOUNCE : 0, isCANFD);
+
+        failed += sendBatch(ctx, ctx->txBatch, msgSize, nmsgs, batchStatus, ERR_TX_SETUP_FAILED);
+
+        for(int index = 0; index < nmsgs; index++){
+
+            status[picks[index]] = batchStatus[index];
+
+            // Remember the payload the BCM is sending now
+            if(batchStatus[index] == RET_E_OK){
+                updateTxShadow(ctx, &frames[picks[index]], isCANFD);
+            }
+        }
+    }
+
+    return failed;
+}
+
+int setTxSignal(struct bcmContext *const ctx, uint32_t signal, double value){
+
+    if(ctx->dbc == NULL || signal >= ctx->dbc->nsignals){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    struct bcmDbcMessage const* const message = &ctx->dbc->messages[ctx->dbc->infos[signal].message];
+    struct bcmTask *task = NULL;
+
+    // Note: The DBC does not know if a short message is sent as CAN or CANFD frame
+    if(message->len <= CAN_MAX_DLEN){
+        task = findTask(&ctx->registry, message->canID, 0, TASK_KIND_TX);
+    }
+
+    if(task == NULL){
+        task = findTask(&ctx->registry, message->canID, 1, TASK_KIND_TX);
+    }
+
+    if(task == NULL || task->type != TASK_TX_CYCLIC || !task->hasShadow){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // The first change of a step starts from the frame the BCM is sending
+    if(!task->isDirty){
+
+        task->image = task->shadow;
+
+        if(task->image.len < message->len && message->len <= (task->isCANFD ? CANFD_MAX_DLEN : CAN_MAX_DLEN)){
+            task->image.len = message->len;
+        }
+
+        markTaskDirty(&ctx->registry, task);
+    }
+
+    encodeDbcSignal(ctx->dbc, signal, value, task->image.data);
+
+    return RET_E_OK;
+}
+
+int flushTxSignals(struct bcmContext *const ctx, int announce){
+
+    struct bcmRegistry *const registry = &ctx->registry;
+    struct canfd_frame frames[TX_BATCH_SIZE]; // The images of a batch
+    uint32_t tasks[TX_BATCH_SIZE];            // The index of the task of each image in the batch
+    int status[TX_BATCH_SIZE];                // The status of each image in the batch
+    int failed = 0;
+
+    // Note: The updates of CAN and CANFD tasks are sent in their own batches
+    for(int isCANFD = 0; isCANFD <= 1; isCANFD++){
+
+        int nframes = 0;
+
+        for(uint32_t entry = 0; entry <= registry->ndirty; entry++){
+
+            if(entry < registry->ndirty && registry->tasks[registry->dirty[entry]].isCANFD == isCANFD){
+                frames[nframes] = registry->tasks[registry->dirty[entry]].image;
+                tasks[nframes]  = registry->dirty[entry];
+                nframes++;
+            }
+
+            // Send the batch when it is full or all dirty tasks were checked
+            if(nframes == TX_BATCH_SIZE || (entry == registry->ndirty && nframes > 0)){
+
+                failed += createTxSetupUpdateBatch(ctx, frames, nframes, isCANFD, announce, status);
+
+                for(int index = 0; index < nframes; index++){
+                    if(status[index] == RET_E_OK){
+                        registry->tasks[tasks[index]].isDirty = 0;
+                    }
+                }
+
+                nframes = 0;
+            }
+        }
+    }
+
+    // Keep the tasks that could not be updated in the list
+    uint32_t kept = 0;
+
+    for(uint32_t entry = 0; entry < registry->ndirty; entry++){
+        if(registry->tasks[registry->dirty[entry]].isDirty){
+            registry->dirty[kept++] = registry->dirty[entry];
+        }
+    }
+
+    registry->ndirty = kept;
+
+    return failed;
+}
+
+int createTxDelete(struct bcmContext *const ctx, canid_t canID, int isCANFD){
+
+    struct bcmTask *task = findTask(&ctx->registry, canID, isCANFD, TASK_KIND_TX);
+
+    // Resolve a frame of a sequence to the CAN ID of the sequence task
+    if(task == NULL){
+
+        struct bcmTask *member = findTask(&ctx->registry, canID, isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+
+        if(member != NULL){
+            canID = member->headID;
+
+        }else if(!ctx->registry.overflowed){
+            // Note: Without a task the BCM would reject the delete anyway
+            return RET_E_OK;
+        }
+    }
+
+    // Note: The task keeps running if the delete could not be sent
+    if(sendTxDelete(ctx, canID, isCANFD) != RET_E_OK){
+        return ERR_TX_SETUP_FAILED;
+    }
+
+    unregisterTxTask(ctx, canID, isCANFD);
+
+    return RET_E_OK;
+}
+
+int createRxSetupCanID(struct bcmContext *const ctx, canid_t canID, int isCANFD){
+
+    struct bcm_msg_head msg;
+
+    // Skip the BCM if the same filter is already set up
+    struct bcmTask *task = findTask(&ctx->registry, canID, isCANFD, TASK_KIND_RX);
+
+    if(task != NULL && task->type == TASK_RX_FILTER_ID){
+        return RET_E_OK;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&msg, 0, sizeof(msg));
+
+    msg.opcode = RX_SETUP;
+    msg.flags  = RX_FILTER_ID;
+    msg.can_id = canID;
+
+    if(isCANFD){
+        msg.flags = msg.flags | CAN_FD_FRAME;
+    }
+
+    // Send the RX_SETUP configuration message
+    if(sendMessage(ctx, &msg, sizeof(msg)) < 0){
+        return handleSendError(ctx, "RX_SETUP", ERR_RX_SETUP_FAILED);
+    }
+
+    // Remember the filter
+    task = registerTask(ctx, canID, isCANFD, TASK_KIND_RX);
+
+    if(task != NULL){
+        task->type    = TASK_RX_FILTER_ID;
+        task->nframes = 0;
+    }
+
+    return RET_E_OK;
+}
+
+int createRxSetupMask(struct bcmContext *const ctx, canid_t canID, struct canfd_frame mask, int isCANFD){
+
+    // BCM message we are sending with a single CAN or CANFD frame
+    void* msg      = NULL;
+    size_t msgSize = 0;
+
+    // Check if we are sending CAN or CANFD frames.
+    // Note: The message buffers are owned by the context and reused for every call.
+    if(isCANFD){
+        msgSize = sizeof(struct bcmMsgSingleFrameCanFD);
+        msg = ctx->txSingleCanFD;
+    }else {
+        msgSize = sizeof(struct bcmMsgSingleFrameCan);
+        msg = ctx->txSingleCan;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(msg, 0, msgSize);
+
+    if(isCANFD){
+        struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) msg;
+
+        msgCANFD->msg_head.opcode  = RX_SETUP;
+        msgCANFD->msg_head.flags   = CAN_FD_FRAME;
+        msgCANFD->msg_head.can_id  = canID;
+        msgCANFD->msg_head.nframes = 1;
+
+        msgCANFD->canfdFrame[0]   = mask;
+    }else{
+        struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) msg;
+
+        msgCAN->msg_head.opcode    = RX_SETUP;
+        msgCAN->msg_head.can_id    = canID;
+        msgCAN->msg_head.nframes   = 1;
+
+        msgCAN->canFrame[0]       = *((struct can_frame*) &mask);
+    }
+
+    // Send the RX_SETUP configuration message
+    if(sendMessage(ctx, msg, msgSize) < 0){
+        return handleSendError(ctx, "RX_SETUP", ERR_RX_SETUP_FAILED);
+    }
+
+    // Remember the filter
+    struct bcmTask *task = registerTask(ctx, canID, isCANFD, TASK_KIND_RX);
+
+    if(task != NULL){
+        task->type    = TASK_RX_FILTER_MASK;
+        task->nframes = 1;
+        setShadowFrame(task, &mask, isCANFD);
+    }
+
+    return RET_E_OK;
+}
+
+/**
+ * Compares two entries of a signal list that hold the message in the upper
+ * and the signal in the lower 32 bits. Used with qsort.
+ *
+ * @param first  - The first entry.
+ * @param second - The second entry.
+ */
+static int compareSignalEntries(void const *first, void const *second){
+
+    uint64_t a = *(uint64_t const*) first;
+    uint64_t b = *(uint64_t const*) second;
+
+    return (a > b) - (a < b);
+}
+
+int createRxSetupSignals(struct bcmContext *const ctx, uint32_t const signals[], int nsignals, int isCANFD){
+
+    struct bcmDbc const* const dbc = ctx->dbc;
+    struct canfd_frame masks[TX_BATCH_SIZE]; // The CAN ID and the mask of each filter in the batch
+    int status[TX_BATCH_SIZE];        // The status of each filter in the batch
+    int failed = 0;
+
+    if(dbc == NULL || nsignals < 0){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Sort the signals by message, so each message is visited once
+    uint64_t *entries = malloc(sizeof(uint64_t) * (size_t) (nsignals + 1));
+
+    if(entries == NULL){
+        printf("Error could not allocate the signal list \n");
+        return ERR_MALLOC_FAILED;
+    }
+
+    for(int index = 0; index < nsignals; index++){
+
+        if(signals[index] >= dbc->nsignals){
+            free(entries);
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        entries[index] = ((uint64_t) dbc->infos[signals[index]].message << 32) | signals[index];
+    }
+
+    qsort(entries, (size_t) nsignals, sizeof(uint64_t), compareSignalEntries);
+
+    // Note: The filters for CAN and CANFD frames are sent in their own batches
+    for(int isFD = 0; isFD <= 1; isFD++){
+
+        size_t msgSize = isFD ? sizeof(struct bcmMsgSingleFrameCanFD) : sizeof(struct bcmMsgSingleFrameCan);
+        int nmsgs = 0;
+
+        for(int first = 0; first <= nsignals;){
+
+            int last = first;
+
+            if(first < nsignals){
+
+                uint32_t index = (uint32_t) (entries[first] >> 32);
+                struct bcmDbcMessage const* const message = &dbc->messages[index];
+                struct canfd_frame mask;
+
+                // Find the signals of the same message
+                while(last < nsignals && (uint32_t) (entries[last] >> 32) == index){
+                    last++;
+                }
+
+                if((isCANFD || message->len > CAN_MAX_DLEN) == isFD){
+
+                    // Note: Always initialize the whole struct with 0.
+                    // Random values in the memory can cause weird bugs!
+                    memset(&mask, 0, sizeof(mask));
+                    memset(ctx->txBatch + (size_t) nmsgs * msgSize, 0, msgSize);
+
+                    mask.can_id = message->canID;
+                    mask.len    = isFD ? message->len : (message->len > CAN_MAX_DLEN ? CAN_MAX_DLEN : message->len);
+
+                    for(int entry = first; entry < last; entry++){
+                        addDbcSignalMask(dbc, (uint32_t) entries[entry], mask.data);
+                    }
+
+                    if(isFD){
+                        struct bcmMsgSingleFrameCanFD *msgCANFD = (struct bcmMsgSingleFrameCanFD *) ctx->txBatch + nmsgs;
+
+                        msgCANFD->msg_head.opcode  = RX_SETUP;
+                        msgCANFD->msg_head.flags   = CAN_FD_FRAME;
+                        msgCANFD->msg_head.can_id  = message->canID;
+                        msgCANFD->msg_head.nframes = 1;
+                        msgCANFD->canfdFrame[0]    = mask;
+                    }else{
+                        struct bcmMsgSingleFrameCan *msgCAN = (struct bcmMsgSingleFrameCan *) ctx->txBatch + nmsgs;
+
+                        msgCAN->msg_head.opcode    = RX_SETUP;
+                        msgCAN->msg_head.can_id    = message->canID;
+                        msgCAN->msg_head.nframes   = 1;
+                        msgCAN->canFrame[0]        = *((struct can_frame*) &mask);
+                    }
+
+                    masks[nmsgs] = mask;
+                    nmsgs++;
+                }
+            }
+
+            // Send the batch when it is full or all messages were checked
+            if(nmsgs == TX_BATCH_SIZE || (first == nsignals && nmsgs > 0)){
+
+                failed += sendBatch(ctx, ctx->txBatch, msgSize, nmsgs, status, ERR_RX_SETUP_FAILED);
+
+                // Remember the filters
+                for(int index = 0; index < nmsgs; index++){
+
+                    struct bcmTask *task = status[index] == RET_E_OK ?
+                                           registerTask(ctx, masks[index].can_id, isFD, TASK_KIND_RX) : NULL;
+
+                    if(task != NULL){
+                        task->type    = TASK_RX_FILTER_MASK;
+                        task->nframes = 1;
+                        setShadowFrame(task, &masks[index], isFD);
+                    }
+                }
+
+                nmsgs = 0;
+            }
+
+            first = first < nsignals ? last : first + 1;
+        }
+    }
+
+    free(entries);
+
+    return failed;
+}
+
+int createRxDelete(struct bcmContext *const ctx, canid_t canID, int isCANFD){
+
+    struct bcm_msg_head msg;
+
+    // Note: Without a filter the BCM would reject the delete anyway
+    if(findTask(&ctx->registry, canID, isCANFD, TASK_KIND_RX) == NULL && !ctx->registry.overflowed){
+        return RET_E_OK;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&msg, 0, sizeof(msg));
+
+    msg.opcode = RX_DELETE;
+    msg.can_id = canID;
+
+    if(isCANFD){
+        msg.flags = CAN_FD_FRAME;
+    }
+
+    // Send the RX_DELETE configuration message
+    if(sendMessage(ctx, &msg, sizeof(msg)) < 0){
+        return handleSendError(ctx, "RX_DELETE", ERR_RX_SETUP_FAILED);
+    }
+
+    removeTask(&ctx->registry, canID, isCANFD, TASK_KIND_RX);
+
+    return RET_E_OK;
+}
+
+void deleteAllTasks(struct bcmContext *const ctx){
+
+    struct bcm_msg_head msg;
+
+    if(ctx->uring != NULL){
+        beginUringBatch(ctx->uring);
+    }
+
+    for(uint32_t index = 0; index < ctx->registry.ntasks; index++){
+
+        struct bcmTask const* const task = &ctx->registry.tasks[index];
+
+        // Note: The members of a sequence stop with their sequence task
+        if(task->kind == TASK_KIND_SEQUENCE_MEMBER){
+            continue;
+        }
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(&msg, 0, sizeof(msg));
+
+        msg.opcode = (task->kind == TASK_KIND_TX) ? TX_DELETE : RX_DELETE;
+        msg.can_id = task->canID;
+        msg.flags  = task->isCANFD ? CAN_FD_FRAME : 0;
+
+        if(sendMessage(ctx, &msg, sizeof(msg)) < 0){
+            printf("Error could not delete the task of CAN ID 0x%X: %s\n", task->canID, strerror(errno));
+        }
+    }
+
+    if(ctx->uring != NULL){
+        endUringBatch(ctx->uring);
+    }
+
+    // Note: Deletes may be held back, wait until they were sent or given up
+    while(ctx->nretries > 0){
+
+        uint64_t due = getNextSendRetry(ctx);
+        uint64_t now = getStatsTime();
+
+        if(due > now){
+            struct timespec wait = {(time_t) ((due - now) / 1000000000u), (long) ((due - now) % 1000000000u)};
+            nanosleep(&wait, NULL);
+        }
+
+        processSendRetries(ctx);
+    }
+
+    clearRegistry(&ctx->registry);
+}
+
+/**
+ * Handles a control message that was given up: The registry forgets the
+ * task it was about (a failed update only drops the shadow frame) and the
+ * simulation gets an EVENT_OP_FAILED.
+ *
+ * @param ctx   - The context of the BCM socket.
+ * @param head  - The head of the message.
+ * @param error - The errno of the last send.
+ */
+static void reportFailedMessage(struct bcmContext *const ctx, struct bcm_msg_head const* const head, int error){
+
+    struct bcmEvent event;
+
+    int isCANFD = (head->flags & CAN_FD_FRAME) ? 1 : 0;
+
+    printf("Error the kernel rejected the message with opcode %u for CAN ID 0x%X: %s\n", head->opcode, head->can_id,
+           strerror(error));
+
+    // Forget what the registry assumed about the message
+    if(head->opcode == TX_SETUP){
+
+        struct bcmTask *const task = findTask(&ctx->registry, head->can_id, isCANFD, TASK_KIND_TX);
+
+        if(task != NULL && (head->flags & SETTIMER)){
+            unregisterTxTask(ctx, head->can_id, isCANFD);
+        }else if(task != NULL && task->type == TASK_TX_CYCLIC){
+            // Note: The next update must not be skipped as unchanged
+            task->hasShadow = 0;
+        }
+    }else if(head->opcode == RX_SETUP){
+        removeTask(&ctx->registry, head->can_id, isCANFD, TASK_KIND_RX);
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&event, 0, sizeof(event));
+
+    event.timestamp = getStatsRealtime();
+    event.canID     = head->can_id;
+    event.type      = EVENT_OP_FAILED;
+    event.isCANFD   = (uint8_t) isCANFD;
+    event.channel   = (uint8_t) ctx->channel;
+    event.op.error  = error;
+    event.op.opcode = head->opcode;
+
+    if(ctx->eventQueue != NULL && enqueueEvent(ctx->eventQueue, &event)){
+        addStatsCounter(STATS_EVENTS, 1);
+    }else{
+        addStatsCounter(STATS_EVENTS_DROPPED, 1);
+    }
+}
+
+void processControlCompletion(struct bcmContext *const ctx, void const* const msg, size_t size, int res,
+                              uint64_t queued){
+
+    // Note: The duration covers the queue and the submit, not only the send
+    recordSend(msg, queued, res < 0 ? -res : 0);
+
+    if(res >= 0){
+        return;
+    }
+
+    // Note: The message is sent again on the socket, the io_uring may already carry newer ones
+    if(isTransientError(-res) && queueRetry(ctx, msg, size, 1, queued) == RET_E_OK){
+        return;
+    }
+
+    if(isFatalSocketError(-res)){
+        printf("Error could not send on %s: %s\n", ctx->interfaceName, strerror(-res));
+        shutdownChannel(ctx, -res);
+    }
+
+    reportFailedMessage(ctx, msg, -res);
+}
+
+int processSendRetries(struct bcmContext *const ctx){
+
+    struct bcmMsgSingleFrameCanFD msg; // The copy of a message that is released before it is handled
+    int processed = 0;
+
+    while(ctx->nretries > 0){
+
+        struct bcmRetry *const retry = &ctx->retries[ctx->retryHead];
+        uint64_t start = getStatsTime();
+
+        // Note: The messages behind the oldest one wait as well to keep the order
+        if(retry->due > start){
+            break;
+        }
+
+        ssize_t ret = send(ctx->socketFD, &retry->msg, retry->size, 0);
+        int error   = errno;
+
+        recordSend(&retry->msg, start, ret < 0 ? error : 0);
+        addStatsCounter(STATS_SEND_RETRIES, 1);
+
+        // Wait twice as long before the next attempt
+        if(ret < 0 && isTransientError(error) && retry->attempts < SEND_RETRY_ATTEMPTS){
+            retry->attempts++;
+            retry->due = start + getRetryWait(retry->attempts);
+            break;
+        }
+
+        // Release the message before it is handled, the handler may send messages
+        memcpy(&msg, &retry->msg, retry->size);
+
+        ctx->retryHead = (ctx->retryHead + 1) % ctx->retryCapacity;
+        ctx->nretries--;
+        processed++;
+
+        if(ret >= 0){
+            continue;
+        }
+
+        // Note: The shutdown drops the other held back messages and ends the loop
+        if(isFatalSocketError(error)){
+            printf("Error could not send on %s: %s\n", ctx->interfaceName, strerror(error));
+            shutdownChannel(ctx, error);
+        }
+
+        if(isTransientError(error)){
+            addStatsCounter(STATS_RETRY_DROPPED, 1);
+        }
+
+        reportFailedMessage(ctx, &msg.msg_head, error);
+    }
+
+    return processed;
+}
+
+uint64_t getNextSendRetry(struct bcmContext const* const ctx){
+
+    return ctx->nretries > 0 ? ctx->retries[ctx->retryHead].due : UINT64_MAX;
+}
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
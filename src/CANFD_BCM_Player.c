@@ -0,0 +1,145 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Player.c
+ \brief     Replays a recorded candump or binary log on one or more (v)can interfaces.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Channel.h"
+#include "CANFD_BCM_Replay.h"
+#include "CANFD_BCM_Stats.h"
+#include <net/if.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+static struct bcmReplay replay; // The replay, too large for the stack
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Stops the replay on CTRL + C.
+ *
+ * @param signal - The signal.
+ */
+static void handleTerminationSignal(int signal){
+
+    (void) signal;
+    stopReplay(&replay);
+}
+
+int main(int argc, char *argv[]){
+
+    struct sigaction sigAction;                         // Signal action for CTRL + C
+    struct bcmChannels channels;                        // The channels the log is replayed on
+    char const *defaultInterfaces[] = INTERFACES;       // Interfaces if none are given on the command line
+    char names[MAX_CHANNELS][IFNAMSIZ];                 // The interfaces given on the command line
+    char const *interfaces[MAX_CHANNELS];               // The interfaces of the channels
+    char const *logInterfaces[MAX_CHANNELS];            // The interface in the log of each channel (NULL = the same)
+    int ninterfaces = 0;                                // Number of interfaces
+    double speed    = argc > 2 ? atof(argv[2]) : 1.0;   // Factor of the recorded speed (0 = max speed)
+
+    if(argc < 2 || speed < 0 || argc - 3 > MAX_CHANNELS){
+        printf("Usage: %s <log> [speed (0 = max speed)] [interface[=log interface]]...\n", argv[0]);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(names, 0, sizeof(names));
+    memset(logInterfaces, 0, sizeof(logInterfaces));
+
+    // "vcan0=can0" replays the frames of can0 in the log on vcan0
+    for(int index = 3; index < argc; index++, ninterfaces++){
+
+        char *const assignment = strchr(argv[index], '=');
+
+        if(assignment != NULL){
+            *assignment = '\0';
+            logInterfaces[ninterfaces] = assignment + 1;
+        }
+
+        snprintf(names[ninterfaces], IFNAMSIZ, "%s", argv[index]);
+        interfaces[ninterfaces] = names[ninterfaces];
+    }
+
+    if(ninterfaces == 0){
+        ninterfaces = (int) (sizeof(defaultInterfaces) / sizeof(defaultInterfaces[0]));
+        memcpy(interfaces, defaultInterfaces, sizeof(defaultInterfaces));
+    }
+
+    initChannels(&channels);
+
+    // Note: Blocking sockets, so a full TX queue slows the replay down instead of failing it
+    if(openChannels(&channels, interfaces, ninterfaces, 1, NULL) != RET_E_OK){
+        printf("Error could not setup the channels \n");
+        closeChannels(&channels);
+        return ERR_SETUP_FAILED;
+    }
+
+    // Note: No workers, the frames are sent directly from this thread
+    int retCode = setupReplay(&replay, argv[1], &channels, NULL, speed);
+
+    for(int channel = 0; retCode == RET_E_OK && channel < ninterfaces; channel++){
+        if(logInterfaces[channel] != NULL){
+            retCode = setReplayInterface(&replay, channel, logInterfaces[channel]);
+        }
+    }
+
+    if(retCode != RET_E_OK){
+        freeReplay(&replay);
+        closeChannels(&channels);
+        return retCode;
+    }
+
+    memset(&sigAction, 0, sizeof(sigAction));
+    sigAction.sa_handler = handleTerminationSignal;
+
+    if(sigaction(SIGINT, &sigAction, NULL) < 0){
+        printf("Setting signal handler for SIGINT failed \n");
+        freeReplay(&replay);
+        closeChannels(&channels);
+        return ERR_SIGACTION_FAILED;
+    }
+
+    uint64_t start = getStatsTime();
+    retCode        = runReplay(&replay);
+    double elapsed = (double) (getStatsTime() - start) / 1e9;
+
+    printf("Replayed %llu frames in %.3f s (%.0f frames/s), %llu skipped\n", (unsigned long long) replay.frames,
+           elapsed, elapsed > 0 ? (double) replay.frames / elapsed : 0.0, (unsigned long long) replay.skipped);
+
+    // Print the counters and latencies
+    if(VERBOSE && STATS){
+
+        struct bcmStatsSnapshot snapshot;
+
+        getStatsSnapshot(&snapshot);
+        printStatsSnapshot(&snapshot, NULL);
+    }
+
+    freeReplay(&replay);
+    closeChannels(&channels);
+    return retCode;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
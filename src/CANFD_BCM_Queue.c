@@ -0,0 +1,380 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Queue.c
+ \brief     Provides lock-free single-producer/single-consumer queues between
+            the simulation and the BCM socket.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Stats.h"
+#include <errno.h>
+#include <linux/futex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+size_t getRingSize(uint32_t capacity, uint32_t elemSize){
+
+    return sizeof(struct bcmRing) + (size_t) capacity * elemSize;
+}
+
+int initRing(struct bcmRing *const ring, uint32_t capacity, uint32_t elemSize){
+
+    // The index wraps with a mask so the capacity must be a power of two
+    if(capacity == 0 || (capacity & (capacity - 1)) != 0 || elemSize == 0){
+        printf("Error the ring capacity must be a power of two \n");
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(ring, 0, sizeof(struct bcmRing));
+
+    ring->capacity = capacity;
+    ring->mask     = capacity - 1;
+    ring->elemSize = elemSize;
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+
+    return RET_E_OK;
+}
+
+struct bcmRing* allocateRing(uint32_t capacity, uint32_t elemSize){
+
+    void *memory = NULL;
+
+    if(posix_memalign(&memory, CACHE_LINE_SIZE, getRingSize(capacity, elemSize)) != 0){
+        printf("Error could not allocate memory for the ring \n");
+        return NULL;
+    }
+
+    if(initRing(memory, capacity, elemSize) != RET_E_OK){
+        free(memory);
+        return NULL;
+    }
+
+    return memory;
+}
+
+void freeRing(struct bcmRing *const ring){
+
+    free(ring);
+}
+
+/**
+ * Copies up to nelems elements into a ring with the slots of a geometry.
+ * A corrupted tail in shared memory makes the ring look full.
+ *
+ * @param ring     - The ring.
+ * @param geometry - The geometry of the ring the producer copied.
+ * @param elems    - The elements that should be enqueued.
+ * @param nelems   - The number of elements.
+ * @return The number of enqueued elements.
+ */
+static uint32_t putRing(struct bcmRing *const ring, struct bcmRingGeometry const* const geometry,
+                        void const *const elems, uint32_t nelems){
+
+    // Note: Only the producer writes the head so a relaxed load is enough.
+    // The tail is only reloaded when the cached value says the ring is full.
+    uint32_t head  = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    uint32_t space = geometry->capacity - (head - ring->cachedTail);
+
+    if(space < nelems || space > geometry->capacity){
+        ring->cachedTail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+        space = geometry->capacity - (head - ring->cachedTail);
+    }
+
+    // Note: The producer never gets more than the capacity ahead of the tail
+    if(space > geometry->capacity){
+        return 0;
+    }
+
+    if(nelems > space){
+        nelems = space;
+    }
+
+    if(nelems == 0){
+        return 0;
+    }
+
+    // Copy in at most two parts if the elements wrap around the end of the ring
+    uint32_t start = head & geometry->mask;
+    uint32_t first = (geometry->capacity - start < nelems) ? geometry->capacity - start : nelems;
+
+    memcpy(ring->data + (size_t) start * geometry->elemSize, elems, (size_t) first * geometry->elemSize);
+    memcpy(ring->data, (unsigned char const *) elems + (size_t) first * geometry->elemSize,
+           (size_t) (nelems - first) * geometry->elemSize);
+
+    // Publish the elements to the consumer
+    atomic_store_explicit(&ring->head, head + nelems, memory_order_release);
+
+    return nelems;
+}
+
+/**
+ * Copies up to maxElems elements out of a ring with the slots of a geometry.
+ * A corrupted head in shared memory makes the ring look empty.
+ *
+ * @param ring     - The ring.
+ * @param geometry - The geometry of the ring the consumer copied.
+ * @param elems    - The buffer for the dequeued elements.
+ * @param maxElems - The maximum number of elements.
+ * @return The number of dequeued elements.
+ */
+static uint32_t takeRing(struct bcmRing *const ring, struct bcmRingGeometry const* const geometry,
+                         void *const elems, uint32_t maxElems){
+
+    // Note: Only the consumer writes the tail so a relaxed load is enough.
+    // The head is only reloaded when the cached value says the ring is empty.
+    uint32_t tail      = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    uint32_t available = ring->cachedHead - tail;
+
+    if(available < maxElems || available > geometry->capacity){
+        ring->cachedHead = atomic_load_explicit(&ring->head, memory_order_acquire);
+        available = ring->cachedHead - tail;
+    }
+
+    // Note: The head is never more than the capacity ahead of the consumer
+    if(available > geometry->capacity){
+        return 0;
+    }
+
+    if(maxElems > available){
+        maxElems = available;
+    }
+
+    if(maxElems == 0){
+        return 0;
+    }
+
+    // Copy out in at most two parts if the elements wrap around the end of the ring
+    uint32_t start = tail & geometry->mask;
+    uint32_t first = (geometry->capacity - start < maxElems) ? geometry->capacity - start : maxElems;
+
+    memcpy(elems, ring->data + (size_t) start * geometry->elemSize, (size_t) first * geometry->elemSize);
+    memcpy((unsigned char *) elems + (size_t) first * geometry->elemSize, ring->data,
+           (size_t) (maxElems - first) * geometry->elemSize);
+
+    // Give the slots back to the producer
+    atomic_store_explicit(&ring->tail, tail + maxElems, memory_order_release);
+
+    return maxElems;
+}
+
+void initRingGeometry(struct bcmRingGeometry *const geometry, uint32_t capacity, uint32_t elemSize){
+
+    geometry->capacity = capacity;
+    geometry->mask     = capacity - 1;
+    geometry->elemSize = elemSize;
+}
+
+uint32_t enqueueRing(struct bcmRing *const ring, void const *const elems, uint32_t nelems){
+
+    struct bcmRingGeometry geometry;
+
+    // Note: A ring of allocateRing is private, so its own geometry can be trusted
+    initRingGeometry(&geometry, ring->capacity, ring->elemSize);
+
+    return putRing(ring, &geometry, elems, nelems);
+}
+
+uint32_t dequeueRing(struct bcmRing *const ring, void *const elems, uint32_t maxElems){
+
+    struct bcmRingGeometry geometry;
+
+    // Note: A ring of allocateRing is private, so its own geometry can be trusted
+    initRingGeometry(&geometry, ring->capacity, ring->elemSize);
+
+    return takeRing(ring, &geometry, elems, maxElems);
+}
+
+uint32_t getRingCount(struct bcmRing *const ring){
+
+    uint32_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    uint32_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+
+    return head - tail;
+}
+
+int setupOperationQueue(struct bcmOperationQueue *const queue, uint32_t capacity){
+
+    queue->eventFD = -1;
+    queue->ring    = allocateRing(capacity, sizeof(struct bcmOperation));
+
+    if(queue->ring == NULL){
+        return ERR_MALLOC_FAILED;
+    }
+
+    initRingGeometry(&queue->geometry, capacity, sizeof(struct bcmOperation));
+
+    // Note: The eventfd is non-blocking so the event loop can consume
+    // the notification without blocking if it was already consumed.
+    queue->eventFD = eventfd(0, EFD_NONBLOCK);
+
+    if(queue->eventFD < 0){
+        printf("Error could not create the eventfd: %s\n", strerror(errno));
+        freeOperationQueue(queue);
+        return ERR_EVENTFD_FAILED;
+    }
+
+    return RET_E_OK;
+}
+
+void freeOperationQueue(struct bcmOperationQueue *const queue){
+
+    if(queue->eventFD != -1){
+        close(queue->eventFD);
+    }
+
+    freeRing(queue->ring);
+
+    queue->eventFD = -1;
+    queue->ring    = NULL;
+}
+
+uint32_t enqueueOperations(struct bcmOperationQueue *const queue, struct bcmOperation ops[], uint32_t nops){
+
+    // Note: One clock read for the whole batch
+    uint64_t now = getStatsTime();
+
+    for(uint32_t index = 0; index < nops; index++){
+        ops[index].timestamp = now;
+    }
+
+    uint32_t enqueued = putRing(queue->ring, &queue->geometry, ops, nops);
+
+    // Note: One notification for the whole batch. The event loop drains
+    // the ring after it consumed the notification, so nothing is lost.
+    if(enqueued > 0){
+        uint64_t notify = 1;
+
+        if(write(queue->eventFD, &notify, sizeof(notify)) != sizeof(notify)){
+            printf("Error could not notify the event loop: %s\n", strerror(errno));
+        }
+    }
+
+    return enqueued;
+}
+
+uint32_t dequeueOperations(struct bcmOperationQueue *const queue, struct bcmOperation ops[], uint32_t maxOps){
+
+    return takeRing(queue->ring, &queue->geometry, ops, maxOps);
+}
+
+int setupEventQueue(struct bcmEventQueue *const queue, uint32_t capacity){
+
+    queue->dropped  = 0;
+    queue->doorbell = NULL;
+    queue->ring     = allocateRing(capacity, sizeof(struct bcmEvent));
+
+    if(queue->ring == NULL){
+        return ERR_MALLOC_FAILED;
+    }
+
+    initRingGeometry(&queue->geometry, capacity, sizeof(struct bcmEvent));
+
+    return RET_E_OK;
+}
+
+void freeEventQueue(struct bcmEventQueue *const queue){
+
+    freeRing(queue->ring);
+    queue->ring = NULL;
+}
+
+int enqueueEvent(struct bcmEventQueue *const queue, struct bcmEvent const *const event){
+
+    if(putRing(queue->ring, &queue->geometry, event, 1) == 0){
+        queue->dropped++;
+        return 0;
+    }
+
+    return 1;
+}
+
+uint32_t dequeueEvents(struct bcmEventQueue *const queue, struct bcmEvent events[], uint32_t maxEvents){
+
+    return takeRing(queue->ring, &queue->geometry, events, maxEvents);
+}
+
+void notifyEvents(struct bcmEventQueue *const queue){
+
+    struct bcmDoorbell *const doorbell = queue->doorbell;
+
+    if(doorbell == NULL){
+        return;
+    }
+
+    // Note: The fence orders the head of the ring before the load of the waiters.
+    // It pairs with the one in waitEvents, so either the simulation sees the
+    // events or the event loop sees the waiter, a wakeup is never lost.
+    atomic_thread_fence(memory_order_seq_cst);
+
+    if(atomic_load_explicit(&doorbell->waiters, memory_order_relaxed) == 0){
+        return;
+    }
+
+    atomic_fetch_add_explicit(&doorbell->sequence, 1, memory_order_release);
+
+    // Note: No FUTEX_PRIVATE_FLAG, the word is shared with another process
+    if(syscall(SYS_futex, &doorbell->sequence, FUTEX_WAKE, INT32_MAX, NULL, NULL, 0) < 0){
+        printf("Error could not wake up the simulation: %s\n", strerror(errno));
+    }
+}
+
+uint32_t waitEvents(struct bcmEventQueue *const queue, int timeoutMs){
+
+    struct bcmDoorbell *const doorbell = queue->doorbell;
+    uint32_t count = getRingCount(queue->ring);
+
+    if(doorbell == NULL || count > 0){
+        return count;
+    }
+
+    struct timespec timeout;
+    timeout.tv_sec  = timeoutMs / 1000;
+    timeout.tv_nsec = (long) (timeoutMs % 1000) * 1000000L;
+
+    atomic_fetch_add_explicit(&doorbell->waiters, 1, memory_order_relaxed);
+
+    // Note: The sequence is read before the ring is checked again. An event
+    // enqueued after the check increments it, so FUTEX_WAIT returns at once.
+    uint32_t sequence = atomic_load_explicit(&doorbell->sequence, memory_order_acquire);
+    atomic_thread_fence(memory_order_seq_cst);
+
+    count = getRingCount(queue->ring);
+
+    if(count == 0 &&
+       syscall(SYS_futex, &doorbell->sequence, FUTEX_WAIT, sequence, timeoutMs < 0 ? NULL : &timeout, NULL, 0) < 0 &&
+       errno != EAGAIN && errno != EINTR && errno != ETIMEDOUT){
+        printf("Error could not wait for events: %s\n", strerror(errno));
+    }
+
+    atomic_fetch_sub_explicit(&doorbell->waiters, 1, memory_order_relaxed);
+
+    return getRingCount(queue->ring);
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
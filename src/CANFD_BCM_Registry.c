@@ -0,0 +1,339 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Registry.c
+ \brief     Provides a hash-indexed registry of the active BCM TX/RX tasks.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Registry.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Packs the key of a task into one integer.
+ * The CAN ID uses 32 bits, so the flag and the kind are put above them.
+ */
+static uint64_t makeKey(canid_t canID, int isCANFD, int kind){
+
+    return (uint64_t) canID | ((uint64_t) (isCANFD ? 1 : 0) << 32) | ((uint64_t) kind << 33);
+}
+
+/**
+ * Returns the home slot of a key (fibonacci hashing).
+ */
+static uint32_t getHomeSlot(struct bcmRegistry const* const registry, uint64_t key){
+
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> registry->shift);
+}
+
+/**
+ * Returns the key of the task at the slot.
+ */
+static uint64_t getSlotKey(struct bcmRegistry const* const registry, uint32_t slot){
+
+    struct bcmTask const* const task = &registry->tasks[registry->slots[slot] - 1];
+
+    return makeKey(task->canID, task->isCANFD, task->kind);
+}
+
+/**
+ * Finds the slot of a key.
+ *
+ * @return The slot or the empty slot where the key would be inserted.
+ */
+static uint32_t findSlot(struct bcmRegistry const* const registry, uint64_t key){
+
+    uint32_t slot = getHomeSlot(registry, key);
+
+    // Note: The table is never full because it has twice as many slots as tasks
+    while(registry->slots[slot] != 0 && getSlotKey(registry, slot) != key){
+        slot = (slot + 1) & registry->mask;
+    }
+
+    return slot;
+}
+
+/**
+ * Empties a slot and moves the following entries of the probe sequence back,
+ * so lookups never need tombstones.
+ */
+static void clearSlot(struct bcmRegistry *const registry, uint32_t slot){
+
+    uint32_t next = (slot + 1) & registry->mask;
+
+    while(registry->slots[next] != 0){
+
+        uint32_t home = getHomeSlot(registry, getSlotKey(registry, next));
+
+        // Move the entry back if its home slot is not between the empty slot and its slot
+        if(((next - home) & registry->mask) >= ((next - slot) & registry->mask)){
+            registry->slots[slot] = registry->slots[next];
+            slot = next;
+        }
+
+        next = (next + 1) & registry->mask;
+    }
+
+    registry->slots[slot] = 0;
+}
+
+int setupRegistry(struct bcmRegistry *const registry, uint32_t capacity){
+
+    uint32_t nslots = 2;
+    uint32_t bits   = 1;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(registry, 0, sizeof(struct bcmRegistry));
+
+    // Use at least twice as many slots as tasks to keep the probe sequences short
+    while(nslots < 2 * capacity){
+        nslots <<= 1;
+        bits++;
+    }
+
+    registry->tasks = calloc(capacity, sizeof(struct bcmTask));
+    registry->slots = calloc(nslots, sizeof(uint32_t));
+    registry->dirty = calloc(capacity, sizeof(uint32_t));
+
+    if(registry->tasks == NULL || registry->slots == NULL || registry->dirty == NULL){
+        printf("Error could not allocate memory for the registry \n");
+        freeRegistry(registry);
+        return ERR_MALLOC_FAILED;
+    }
+
+    registry->capacity = capacity;
+    registry->mask     = nslots - 1;
+    registry->shift    = 64 - bits;
+
+    return RET_E_OK;
+}
+
+void freeRegistry(struct bcmRegistry *const registry){
+
+    free(registry->tasks);
+    free(registry->slots);
+    free(registry->dirty);
+
+    registry->tasks    = NULL;
+    registry->slots    = NULL;
+    registry->dirty    = NULL;
+    registry->ndirty   = 0;
+    registry->ntasks   = 0;
+    registry->capacity = 0;
+}
+
+struct bcmTask* findTask(struct bcmRegistry *const registry, canid_t canID, int isCANFD, int kind){
+
+    uint32_t slot = findSlot(registry, makeKey(canID, isCANFD, kind));
+
+    if(registry->slots[slot] == 0){
+        return NULL;
+    }
+
+    return &registry->tasks[registry->slots[slot] - 1];
+}
+
+struct bcmTask* addTask(struct bcmRegistry *const registry, canid_t canID, int isCANFD, int kind){
+
+    uint32_t slot = findSlot(registry, makeKey(canID, isCANFD, kind));
+
+    if(registry->slots[slot] != 0){
+        return &registry->tasks[registry->slots[slot] - 1];
+    }
+
+    if(registry->ntasks == registry->capacity){
+        registry->overflowed = 1;
+        return NULL;
+    }
+
+    struct bcmTask *const task = &registry->tasks[registry->ntasks];
+
+    memset(task, 0, sizeof(struct bcmTask));
+    task->canID   = canID;
+    task->isCANFD = isCANFD ? 1 : 0;
+    task->kind    = (uint8_t) kind;
+
+    registry->ntasks++;
+    registry->slots[slot] = registry->ntasks;
+
+    return task;
+}
+
+void markTaskDirty(struct bcmRegistry *const registry, struct bcmTask *const task){
+
+    // Note: Each task is in the list at most once, so the list never has more entries than tasks
+    if(!task->isDirty){
+        task->isDirty = 1;
+        registry->dirty[registry->ndirty++] = (uint32_t) (task - registry->tasks);
+    }
+}
+
+/**
+ * Replaces the index of a task in the dirty tasks.
+ * Dirty tasks are rare when tasks are removed, so the list is just searched.
+ *
+ * @param registry - The registry.
+ * @param index    - The old index of the task.
+ * @param newIndex - The new index of the task or UINT32_MAX to remove the task from the list.
+ */
+static void moveDirtyTask(struct bcmRegistry *const registry, uint32_t index, uint32_t newIndex){
+
+    for(uint32_t entry = 0; entry < registry->ndirty; entry++){
+
+        if(registry->dirty[entry] != index){
+            continue;
+        }
+
+        if(newIndex == UINT32_MAX){
+            registry->dirty[entry] = registry->dirty[--registry->ndirty];
+        }else{
+            registry->dirty[entry] = newIndex;
+        }
+
+        return;
+    }
+}
+
+void removeTask(struct bcmRegistry *const registry, canid_t canID, int isCANFD, int kind){
+
+    uint32_t slot = findSlot(registry, makeKey(canID, isCANFD, kind));
+
+    if(registry->slots[slot] == 0){
+        return;
+    }
+
+    uint32_t index = registry->slots[slot] - 1;
+    uint32_t last  = registry->ntasks - 1;
+
+    clearSlot(registry, slot);
+
+    if(registry->tasks[index].isDirty){
+        moveDirtyTask(registry, index, UINT32_MAX);
+    }
+
+    // Keep the array dense by moving the last task into the free place
+    if(index != last){
+        struct bcmTask const* const moved = &registry->tasks[last];
+
+        if(moved->isDirty){
+            moveDirtyTask(registry, last, index);
+        }
+
+        uint32_t movedSlot = getHomeSlot(registry, makeKey(moved->canID, moved->isCANFD, moved->kind));
+
+        while(registry->slots[movedSlot] != last + 1){
+            movedSlot = (movedSlot + 1) & registry->mask;
+        }
+
+        registry->tasks[index]     = *moved;
+        registry->slots[movedSlot] = index + 1;
+    }
+
+    registry->ntasks--;
+}
+
+void clearRegistry(struct bcmRegistry *const registry){
+
+    memset(registry->slots, 0, sizeof(uint32_t) * (registry->mask + 1));
+
+    registry->ntasks     = 0;
+    registry->ndirty     = 0;
+    registry->overflowed = 0;
+}
+
+int hasSamePayload(struct bcmTask const *const task, struct canfd_frame const *const frame, int isCANFD){
+
+    if(!task->hasShadow || task->shadow.len != frame->len){
+        return 0;
+    }
+
+    // Note: The flags byte is padding in a CAN frame
+    if(isCANFD && task->shadow.flags != frame->flags){
+        return 0;
+    }
+
+    uint32_t len = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+    uint64_t diff = 0;
+    uint64_t a, b;
+
+    // Compare 8 bytes at a time. The memcpy calls compile to plain loads.
+    // Note: OR-ing the differences keeps the loop free of early exits so it
+    // is a handful of instructions for the 64 byte CANFD payload.
+    uint32_t index = 0;
+
+    for(; index + 8 <= len; index += 8){
+        memcpy(&a, &task->shadow.data[index], 8);
+        memcpy(&b, &frame->data[index], 8);
+        diff |= a ^ b;
+    }
+
+    // Compare the remaining bytes. Bytes behind len must be ignored.
+    for(; index < len; index++){
+        diff |= (uint64_t) (task->shadow.data[index] ^ frame->data[index]);
+    }
+
+    return diff == 0;
+}
+
+void setShadowFrame(struct bcmTask *const task, struct canfd_frame const *const frame, int isCANFD){
+
+    // Note: A CAN frame only has 8 bytes of data. The frame array always holds
+    // struct canfd_frame elements so reading the whole struct is safe.
+    task->shadow    = *frame;
+    task->hasShadow = 1;
+
+    if(!isCANFD){
+        task->shadow.flags = 0;
+    }
+
+    // Note: The frame sent last wins over the signals changed before it
+    if(task->isDirty){
+        task->image = task->shadow;
+    }
+}
+
+uint64_t getFramesDigest(struct canfd_frame const frames[], int nframes, int isCANFD){
+
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for(int index = 0; index < nframes; index++){
+
+        struct canfd_frame const* const frame = &frames[index];
+        uint32_t len = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+        uint8_t head[6];
+
+        // Note: The flags byte is padding in a CAN frame
+        memcpy(head, &frame->can_id, sizeof(canid_t));
+        head[4] = frame->len;
+        head[5] = isCANFD ? frame->flags : 0;
+
+        for(uint32_t byte = 0; byte < sizeof(head); byte++){
+            hash = (hash ^ head[byte]) * 0x100000001B3ull;
+        }
+
+        for(uint32_t byte = 0; byte < len; byte++){
+            hash = (hash ^ frame->data[byte]) * 0x100000001B3ull;
+        }
+    }
+
+    return hash;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,296 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Replay.c
+ \brief     Provides the replay of recorded candump and binary logs on the channels.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Replay.h"
+#include "CANFD_BCM_Stats.h"
+#include <linux/can/bcm.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Returns the channel a frame of the log is sent on.
+ *
+ * @param replay - The replay.
+ * @param frame  - The frame of the log.
+ * @return The channel handle or -1 if no channel matches.
+ */
+static int getReplayChannel(struct bcmReplay *const replay, struct bcmLogFrame const* const frame){
+
+    // Binary logs know the channel
+    if(frame->channel >= 0){
+        return frame->channel < replay->channels->nchannels ? frame->channel : -1;
+    }
+
+    // Note: Most logs have only one or two interfaces, so the last lookup nearly always matches
+    if(strncmp(frame->interfaceName, replay->lastInterface, IFNAMSIZ) == 0){
+        return replay->lastChannel;
+    }
+
+    snprintf(replay->lastInterface, IFNAMSIZ, "%s", frame->interfaceName);
+    replay->lastChannel = -1;
+
+    for(int channel = 0; channel < replay->channels->nchannels; channel++){
+        if(strncmp(frame->interfaceName, replay->logInterfaces[channel], IFNAMSIZ) == 0){
+            replay->lastChannel = channel;
+            break;
+        }
+    }
+
+    return replay->lastChannel;
+}
+
+/**
+ * Returns the operation queue of the worker that serves a channel.
+ *
+ * @param workers - The workers.
+ * @param channel - The channel handle.
+ * @return The operation queue or NULL if no worker serves the channel.
+ */
+static struct bcmOperationQueue* getReplayQueue(struct bcmWorkers *const workers, int channel){
+
+    for(int index = 0; index < workers->nworkers; index++){
+        if(workers->workers[index].contexts[channel] != NULL){
+            return &workers->workers[index].operationQueue;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Sends the frames of the batch.
+ *
+ * @param replay - The replay.
+ */
+static void flushReplayBatch(struct bcmReplay *const replay){
+
+    if(replay->nbatch == 0){
+        return;
+    }
+
+    if(replay->workers == NULL){
+
+        createTxSend(getChannel(replay->channels, replay->batchChannel), replay->batch, replay->nbatch,
+                     replay->batchIsCANFD);
+
+    }else{
+
+        struct bcmOperationQueue *const queue = getReplayQueue(replay->workers, replay->batchChannel);
+        struct timespec wait = {0, REPLAY_QUEUE_WAIT_US * 1000};
+        uint32_t enqueued = 0;
+
+        if(queue == NULL){
+            replay->skipped += (uint64_t) replay->nbatch;
+            replay->nbatch   = 0;
+            return;
+        }
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(replay->ops, 0, sizeof(struct bcmOperation) * (size_t) replay->nbatch);
+
+        for(int index = 0; index < replay->nbatch; index++){
+            replay->ops[index].type    = OP_TX_SEND;
+            replay->ops[index].isCANFD = (uint8_t) replay->batchIsCANFD;
+            replay->ops[index].channel = (uint8_t) replay->batchChannel;
+            replay->ops[index].frame   = replay->batch[index];
+        }
+
+        // Wait for the worker if its queue is full
+        while(1){
+
+            enqueued += enqueueOperations(queue, &replay->ops[enqueued], (uint32_t) replay->nbatch - enqueued);
+
+            if(enqueued == (uint32_t) replay->nbatch || !atomic_load_explicit(&replay->running, memory_order_relaxed)){
+                break;
+            }
+
+            nanosleep(&wait, NULL);
+        }
+
+        replay->skipped += (uint64_t) replay->nbatch - enqueued;
+        replay->nbatch   = (int) enqueued;
+    }
+
+    addStatsCounter(STATS_REPLAY_FRAMES, (uint64_t) replay->nbatch);
+    replay->frames += (uint64_t) replay->nbatch;
+    replay->nbatch  = 0;
+}
+
+/**
+ * Waits until the monotonic time reached a deadline or the replay is stopped.
+ *
+ * Note: The replay checks running at least every EPOLL_TIMEOUT_MS,
+ * so long pauses in the log do not delay stopReplay.
+ *
+ * @param replay   - The replay.
+ * @param deadline - The monotonic time in nanoseconds.
+ * @return The monotonic time after the wait.
+ */
+static uint64_t waitReplayDeadline(struct bcmReplay *const replay, uint64_t deadline){
+
+    uint64_t now = getStatsTime();
+
+    while(now < deadline && atomic_load_explicit(&replay->running, memory_order_relaxed)){
+
+        uint64_t wake = deadline;
+
+        if(deadline - now > (uint64_t) EPOLL_TIMEOUT_MS * 1000000u){
+            wake = now + (uint64_t) EPOLL_TIMEOUT_MS * 1000000u;
+        }
+
+        struct timespec wakeTime = {(time_t) (wake / 1000000000u), (long) (wake % 1000000000u)};
+
+        // Note: An absolute deadline does not drift if the sleep is interrupted
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wakeTime, NULL);
+        now = getStatsTime();
+    }
+
+    return now;
+}
+
+int setupReplay(struct bcmReplay *const replay, char const *const path, struct bcmChannels *const channels,
+                struct bcmWorkers *const workers, double speed){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(replay, 0, sizeof(struct bcmReplay));
+
+    replay->channels    = channels;
+    replay->workers     = workers;
+    replay->speed       = speed > 0 ? speed : 0;
+    replay->lastChannel = -1;
+
+    // Candump logs are replayed on the interfaces they were recorded on
+    for(int channel = 0; channel < channels->nchannels; channel++){
+        snprintf(replay->logInterfaces[channel], IFNAMSIZ, "%s", getChannel(channels, channel)->interfaceName);
+    }
+
+    int retCode = openLogReader(&replay->reader, path);
+
+    if(retCode != RET_E_OK){
+        return retCode;
+    }
+
+    atomic_store(&replay->running, 1);
+    return RET_E_OK;
+}
+
+int setReplayInterface(struct bcmReplay *const replay, int channel, char const *const logInterface){
+
+    if(channel < 0 || channel >= replay->channels->nchannels){
+        printf("Error there is no channel %d \n", channel);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    snprintf(replay->logInterfaces[channel], IFNAMSIZ, "%s", logInterface);
+
+    // Forget the last lookup, it may now belong to another channel
+    replay->lastInterface[0] = '\0';
+    replay->lastChannel      = -1;
+
+    return RET_E_OK;
+}
+
+int runReplay(struct bcmReplay *const replay){
+
+    struct bcmLogFrame frame;           // The current frame of the log
+    uint64_t start    = getStatsTime(); // Monotonic time of the first frame
+    uint64_t now      = start;          // The last read monotonic time
+    uint64_t deadline = start;          // Monotonic time the current frame is due
+    uint64_t first    = 0;              // Recorded time of the first frame
+    int hasFirst      = 0;              // Flag for a seen first frame
+    int retCode       = 0;              // Result of the last read
+
+    while(atomic_load_explicit(&replay->running, memory_order_relaxed) &&
+          (retCode = readLogFrame(&replay->reader, &frame)) > 0){
+
+        int channel = getReplayChannel(replay, &frame);
+
+        // Note: A timeout in a capture is no frame on the bus
+        if(channel < 0 || frame.opcode == RX_TIMEOUT){
+            replay->skipped++;
+            continue;
+        }
+
+        if(replay->speed > 0){
+
+            if(!hasFirst){
+                first    = frame.timestamp;
+                hasFirst = 1;
+            }
+
+            // Note: Merged logs can go back in time a little. Those frames are due immediately.
+            if(frame.timestamp > first){
+
+                uint64_t due = start + (uint64_t) ((double) (frame.timestamp - first) / replay->speed);
+
+                if(due > deadline){
+                    deadline = due;
+                }
+            }
+
+            // Only read the clock again if the frame was not due at the last read
+            if(deadline > now){
+                now = getStatsTime();
+            }
+
+            if(deadline > now){
+                flushReplayBatch(replay);
+                now = waitReplayDeadline(replay, deadline);
+                recordStatsValue(STATS_REPLAY_LATENESS, now > deadline ? now - deadline : 0);
+            }
+        }
+
+        if(replay->nbatch == REPLAY_BATCH_SIZE ||
+           (replay->nbatch > 0 && (channel != replay->batchChannel || frame.isCANFD != replay->batchIsCANFD))){
+            flushReplayBatch(replay);
+        }
+
+        replay->batch[replay->nbatch++] = frame.frame;
+        replay->batchChannel            = channel;
+        replay->batchIsCANFD            = frame.isCANFD;
+    }
+
+    flushReplayBatch(replay);
+
+    // The lines and records the reader could not parse
+    replay->skipped        += replay->reader.skipped;
+    replay->reader.skipped  = 0;
+
+    return retCode < 0 ? retCode : RET_E_OK;
+}
+
+void stopReplay(struct bcmReplay *const replay){
+
+    atomic_store(&replay->running, 0);
+}
+
+void freeReplay(struct bcmReplay *const replay){
+
+    closeLogReader(&replay->reader);
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
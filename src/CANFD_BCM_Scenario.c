@@ -0,0 +1,848 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Scenario.c
+ \brief     Provides scenarios, complete sets of TX tasks and RX filters that are applied as difference.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Log.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Registry.h"
+#include "CANFD_BCM_Scenario.h"
+#include "CANFD_BCM_Uring.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for the key of a task that applyScenario removes.
+ */
+struct bcmScenarioKey{
+    canid_t canID;   // The CAN ID of the task
+    uint8_t isCANFD; // Flag for CANFD frames
+    uint8_t kind;    // The enum bcmTaskKind of the task
+};
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Makes sure an array has room for one more element.
+ *
+ * @param array    - The array.
+ * @param capacity - The number of elements the array has room for.
+ * @param count    - The number of elements in the array.
+ * @param elemSize - The size of one element in bytes.
+ * @return RET_E_OK or ERR_MALLOC_FAILED.
+ */
+static int reserveArray(void **const array, uint32_t *const capacity, uint32_t count, size_t elemSize){
+
+    if(count < *capacity){
+        return RET_E_OK;
+    }
+
+    uint32_t newCapacity = *capacity > 0 ? *capacity * 2 : 16;
+    void *newArray = realloc(*array, newCapacity * elemSize);
+
+    if(newArray == NULL){
+        return ERR_MALLOC_FAILED;
+    }
+
+    *array    = newArray;
+    *capacity = newCapacity;
+
+    return RET_E_OK;
+}
+
+/**
+ * Converts an interval to microseconds.
+ *
+ * @param ival - The interval.
+ */
+static uint64_t getIntervalUs(struct bcm_timeval ival){
+
+    return (uint64_t) ival.tv_sec * 1000000u + (uint64_t) ival.tv_usec;
+}
+
+/**
+ * Converts microseconds to an interval.
+ *
+ * @param us - The microseconds.
+ */
+static struct bcm_timeval getInterval(uint64_t us){
+
+    struct bcm_timeval ival;
+
+    ival.tv_sec  = (long) (us / 1000000u);
+    ival.tv_usec = (long) (us % 1000000u);
+
+    return ival;
+}
+
+/**
+ * Checks if a task sends with the given timers.
+ *
+ * @param task  - The task.
+ * @param count - Number of times the frame is send with the first interval.
+ * @param ival1 - First interval.
+ * @param ival2 - Second interval.
+ */
+static int hasTimers(struct bcmTask const* const task, uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2){
+
+    return task->count == count && getIntervalUs(task->ival1) == getIntervalUs(ival1) &&
+           getIntervalUs(task->ival2) == getIntervalUs(ival2);
+}
+
+/**
+ * Checks the length of a frame.
+ *
+ * @param frame   - The frame.
+ * @param isCANFD - Flag for CANFD frames.
+ * @return 1 if the frame can be sent, otherwise 0.
+ */
+static int isValidFrame(struct canfd_frame const* const frame, int isCANFD){
+
+    return frame->len <= (isCANFD ? CANFD_MAX_DLEN : CAN_MAX_DLEN);
+}
+
+/**
+ * Skips spaces and tabs.
+ *
+ * @param text - The text.
+ */
+static char const* skipSpaces(char const *text){
+
+    while(*text == ' ' || *text == '\t'){
+        text++;
+    }
+
+    return text;
+}
+
+/**
+ * Returns the length of the word at the start of a text.
+ *
+ * @param text - The text after leading spaces.
+ */
+static size_t getWordLength(char const *const text){
+
+    return strcspn(text, " \t\r\n");
+}
+
+/**
+ * Reads a number of microseconds.
+ *
+ * @param text - The text after leading spaces.
+ * @param us   - Storage for the number.
+ * @return The text after the number or NULL if there is no number.
+ */
+static char const* readNumber(char const *const text, uint64_t *const us){
+
+    char *end = NULL;
+
+    if(*text < '0' || *text > '9'){
+        return NULL;
+    }
+
+    errno = 0;
+    *us = strtoull(text, &end, 10);
+
+    if(errno != 0 || (size_t) (end - text) != getWordLength(text)){
+        return NULL;
+    }
+
+    return end;
+}
+
+/**
+ * Reads a frame in candump notation.
+ *
+ * @param text    - The text after leading spaces.
+ * @param frame   - Storage for the frame.
+ * @param isCANFD - Storage for the flag for CANFD frames.
+ * @return The text after the frame or NULL if there is no frame.
+ */
+static char const* readFrame(char const *const text, struct canfd_frame *const frame, int *const isCANFD){
+
+    size_t length = getWordLength(text);
+
+    if(length == 0 || parseCandumpFrame(text, length, frame, isCANFD) != RET_E_OK){
+        return NULL;
+    }
+
+    return text + length;
+}
+
+/**
+ * Reads a line of a scenario file.
+ *
+ * @param scenario - The scenario.
+ * @param line     - The line after leading spaces.
+ * @return RET_E_OK, ERR_SCENARIO_FORMAT or ERR_MALLOC_FAILED.
+ */
+static int readScenarioLine(struct bcmScenario *const scenario, char const *line){
+
+    struct canfd_frame frame;
+    uint64_t ival2 = 0;
+    int isCANFD    = 0;
+    int retCode    = RET_E_OK;
+
+    size_t length = getWordLength(line);
+    char const *text = skipSpaces(line + length);
+
+    if(length == 2 && strncmp(line, "TX", 2) == 0){
+
+        uint64_t count = 0;
+        uint64_t ival1 = 0;
+
+        if((text = readNumber(text, &ival2)) == NULL || (text = readFrame(skipSpaces(text), &frame, &isCANFD)) == NULL){
+            return ERR_SCENARIO_FORMAT;
+        }
+
+        text = skipSpaces(text);
+
+        // The optional first interval
+        if(getWordLength(text) > 0){
+
+            if((text = readNumber(text, &count)) == NULL || (text = readNumber(skipSpaces(text), &ival1)) == NULL ||
+               count > UINT32_MAX){
+                return ERR_SCENARIO_FORMAT;
+            }
+
+            text = skipSpaces(text);
+        }
+
+        retCode = addScenarioTx(scenario, &frame, (uint32_t) count, getInterval(ival1), getInterval(ival2), isCANFD);
+
+    }else if(length == 3 && strncmp(line, "SEQ", 3) == 0){
+
+        uint32_t first  = scenario->nframes;
+        int sequenceFD  = -1;
+
+        if((text = readNumber(text, &ival2)) == NULL){
+            return ERR_SCENARIO_FORMAT;
+        }
+
+        // Note: The frames are read right into the frames of the scenario
+        for(text = skipSpaces(text); getWordLength(text) > 0; text = skipSpaces(text)){
+
+            if(reserveArray((void **) &scenario->frames, &scenario->frameCapacity, scenario->nframes,
+                            sizeof(struct canfd_frame)) != RET_E_OK){
+                return ERR_MALLOC_FAILED;
+            }
+
+            if((text = readFrame(text, &scenario->frames[scenario->nframes], &isCANFD)) == NULL ||
+               (sequenceFD >= 0 && sequenceFD != isCANFD)){
+                scenario->nframes = first;
+                return ERR_SCENARIO_FORMAT;
+            }
+
+            sequenceFD = isCANFD;
+            scenario->nframes++;
+        }
+
+        // Note: addScenarioSequence copies the frames to the end, so take them out first
+        uint32_t nframes  = scenario->nframes - first;
+        scenario->nframes = first;
+
+        if(nframes == 0){
+            return ERR_SCENARIO_FORMAT;
+        }
+
+        retCode = addScenarioSequence(scenario, &scenario->frames[first], (int) nframes, getInterval(ival2), sequenceFD);
+
+    }else if(length == 2 && strncmp(line, "RX", 2) == 0){
+
+        if((text = readFrame(text, &frame, &isCANFD)) == NULL){
+            return ERR_SCENARIO_FORMAT;
+        }
+
+        text    = skipSpaces(text);
+        retCode = addScenarioRx(scenario, frame.can_id, frame.len > 0 ? &frame : NULL, isCANFD);
+
+    }else{
+        return ERR_SCENARIO_FORMAT;
+    }
+
+    if(retCode == RET_E_OK && getWordLength(text) > 0){
+        return ERR_SCENARIO_FORMAT;
+    }
+
+    return retCode;
+}
+
+/**
+ * Checks a scenario and fills a registry with the tasks it describes.
+ * The registry holds the same entries the create functions would register.
+ *
+ * @param scenario - The scenario.
+ * @param desired  - The registry, set up by this function.
+ * @return RET_E_OK, ERR_INVALID_ARGUMENT or ERR_MALLOC_FAILED. The registry is freed on failure.
+ */
+static int buildScenarioRegistry(struct bcmScenario const* const scenario, struct bcmRegistry *const desired){
+
+    uint64_t ntasks = (uint64_t) scenario->ntxs + scenario->nframes + scenario->nrxs;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(desired, 0, sizeof(struct bcmRegistry));
+
+    if(ntasks > REGISTRY_SIZE){
+        printf("Error the scenario has more than %d tasks \n", REGISTRY_SIZE);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(setupRegistry(desired, ntasks > 0 ? (uint32_t) ntasks : 1) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    for(uint32_t index = 0; index < scenario->ntxs; index++){
+
+        struct bcmScenarioTx const* const tx = &scenario->txs[index];
+        canid_t canID = tx->frame.can_id;
+
+        if(!isValidFrame(&tx->frame, tx->isCANFD) ||
+           (getIntervalUs(tx->ival2) == 0 && (tx->count == 0 || getIntervalUs(tx->ival1) == 0))){
+            printf("Error the TX task of CAN ID 0x%X in the scenario has no interval or an invalid frame \n", canID);
+            freeRegistry(desired);
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        if(findTask(desired, canID, tx->isCANFD, TASK_KIND_TX) != NULL){
+            printf("Error the CAN ID 0x%X is sent by more than one task of the scenario \n", canID);
+            freeRegistry(desired);
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        struct bcmTask *const task = addTask(desired, canID, tx->isCANFD, TASK_KIND_TX);
+
+        task->type    = TASK_TX_CYCLIC;
+        task->nframes = 1;
+        task->count   = tx->count;
+        task->ival1   = tx->ival1;
+        task->ival2   = tx->ival2;
+
+        setShadowFrame(task, &tx->frame, tx->isCANFD);
+    }
+
+    for(uint32_t index = 0; index < scenario->nsequences; index++){
+
+        struct bcmScenarioSequence const* const sequence = &scenario->sequences[index];
+        struct canfd_frame const* const frames = &scenario->frames[sequence->firstFrame];
+        canid_t headID = frames[0].can_id;
+
+        if(getIntervalUs(sequence->ival2) == 0 || findTask(desired, headID, sequence->isCANFD, TASK_KIND_TX) != NULL ||
+           findTask(desired, headID, sequence->isCANFD, TASK_KIND_SEQUENCE_MEMBER) != NULL){
+            printf("Error the sequence of CAN ID 0x%X in the scenario has no interval or its CAN ID is used twice \n",
+                   headID);
+            freeRegistry(desired);
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        struct bcmTask *const head = addTask(desired, headID, sequence->isCANFD, TASK_KIND_TX);
+
+        head->type    = TASK_TX_SEQUENCE;
+        head->nframes = sequence->nframes;
+        head->ival2   = sequence->ival2;
+        head->digest  = getFramesDigest(frames, (int) sequence->nframes, sequence->isCANFD);
+
+        // The other CAN IDs of the sequence must not be sent by another task
+        for(uint32_t frame = 0; frame < sequence->nframes; frame++){
+
+            canid_t canID = frames[frame].can_id;
+
+            if(!isValidFrame(&frames[frame], sequence->isCANFD)){
+                printf("Error the sequence of CAN ID 0x%X in the scenario has an invalid frame \n", headID);
+                freeRegistry(desired);
+                return ERR_INVALID_ARGUMENT;
+            }
+
+            struct bcmTask *member = findTask(desired, canID, sequence->isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+
+            if(canID == headID || (member != NULL && member->headID == headID)){
+                continue;
+            }
+
+            if(member != NULL || findTask(desired, canID, sequence->isCANFD, TASK_KIND_TX) != NULL){
+                printf("Error the CAN ID 0x%X is sent by more than one task of the scenario \n", canID);
+                freeRegistry(desired);
+                return ERR_INVALID_ARGUMENT;
+            }
+
+            member = addTask(desired, canID, sequence->isCANFD, TASK_KIND_SEQUENCE_MEMBER);
+            member->type   = TASK_SEQUENCE_MEMBER;
+            member->headID = headID;
+        }
+    }
+
+    for(uint32_t index = 0; index < scenario->nrxs; index++){
+
+        struct bcmScenarioRx const* const rx = &scenario->rxs[index];
+        canid_t canID = rx->mask.can_id;
+
+        if(!isValidFrame(&rx->mask, rx->isCANFD) || findTask(desired, canID, rx->isCANFD, TASK_KIND_RX) != NULL){
+            printf("Error the RX filter of CAN ID 0x%X in the scenario is invalid or defined twice \n", canID);
+            freeRegistry(desired);
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        struct bcmTask *const task = addTask(desired, canID, rx->isCANFD, TASK_KIND_RX);
+
+        task->type    = rx->hasMask ? TASK_RX_FILTER_MASK : TASK_RX_FILTER_ID;
+        task->nframes = rx->hasMask ? 1 : 0;
+
+        if(rx->hasMask){
+            setShadowFrame(task, &rx->mask, rx->isCANFD);
+        }
+    }
+
+    return RET_E_OK;
+}
+
+/**
+ * Checks if an active task is not described by the scenario or can not be changed in place.
+ *
+ * @param task    - The task in the registry of the context.
+ * @param desired - The registry of the scenario.
+ * @return 1 if the task must be deleted, otherwise 0.
+ */
+static int isStaleTask(struct bcmTask const* const task, struct bcmRegistry *const desired){
+
+    struct bcmTask const* const want = findTask(desired, task->canID, task->isCANFD, task->kind);
+
+    if(want == NULL){
+        return 1;
+    }
+
+    // Note: A sequence can not be turned into a single frame task and the BCM does
+    // not let a sequence grow, so a changed sequence is set up again from scratch.
+    if(task->type == TASK_TX_SEQUENCE){
+        return want->type != TASK_TX_SEQUENCE || want->nframes != task->nframes || want->digest != task->digest ||
+               !hasTimers(task, want->count, want->ival1, want->ival2);
+    }
+
+    return task->type == TASK_TX_CYCLIC && want->type != TASK_TX_CYCLIC;
+}
+
+/**
+ * Sets up or updates the cyclic transmission tasks of a scenario that are not active as described.
+ *
+ * @param ctx      - The context of the BCM socket.
+ * @param scenario - The scenario.
+ * @param isCANFD  - The tasks with this flag are applied.
+ * @param diff     - The counts of the changes.
+ * @return The number of frames that could not be set up or updated or ERR_MALLOC_FAILED.
+ */
+static int applyScenarioTxs(struct bcmContext *const ctx, struct bcmScenario const* const scenario, int isCANFD,
+                            struct bcmScenarioDiff *const diff){
+
+    int nsetups  = 0;
+    int nupdates = 0;
+    int failed   = 0;
+    size_t ntxs  = scenario->ntxs > 0 ? scenario->ntxs : 1;
+
+    struct canfd_frame *const setups  = malloc(ntxs * sizeof(struct canfd_frame));
+    struct canfd_frame *const updates = malloc(ntxs * sizeof(struct canfd_frame));
+    uint32_t *const count             = malloc(ntxs * sizeof(uint32_t));
+    struct bcm_timeval *const ival1   = malloc(ntxs * sizeof(struct bcm_timeval));
+    struct bcm_timeval *const ival2   = malloc(ntxs * sizeof(struct bcm_timeval));
+    int *const status                 = malloc(ntxs * sizeof(int));
+
+    if(setups == NULL || updates == NULL || count == NULL || ival1 == NULL || ival2 == NULL || status == NULL){
+        printf("Error could not allocate memory for the scenario \n");
+        failed = ERR_MALLOC_FAILED;
+        goto cleanup;
+    }
+
+    for(uint32_t index = 0; index < scenario->ntxs; index++){
+
+        struct bcmScenarioTx const* const tx = &scenario->txs[index];
+
+        if(tx->isCANFD != isCANFD){
+            continue;
+        }
+
+        struct bcmTask const* const task = findTask(&ctx->registry, tx->frame.can_id, isCANFD, TASK_KIND_TX);
+
+        // Note: A task with the same timers only needs the payload
+        if(task != NULL && task->type == TASK_TX_CYCLIC && hasTimers(task, tx->count, tx->ival1, tx->ival2)){
+
+            if(hasSamePayload(task, &tx->frame, isCANFD)){
+                diff->kept++;
+            }else{
+                updates[nupdates++] = tx->frame;
+            }
+            continue;
+        }
+
+        setups[nsetups] = tx->frame;
+        count[nsetups]  = tx->count;
+        ival1[nsetups]  = tx->ival1;
+        ival2[nsetups]  = tx->ival2;
+        nsetups++;
+    }
+
+    if(nsetups > 0){
+        failed += createTxSetupBatch(ctx, setups, nsetups, count, ival1, ival2, isCANFD, status);
+    }
+
+    if(nupdates > 0){
+        failed += createTxSetupUpdateBatch(ctx, updates, nupdates, isCANFD, 0, status);
+    }
+
+    diff->added   += (uint32_t) nsetups;
+    diff->updated += (uint32_t) nupdates;
+
+cleanup:
+    free(setups);
+    free(updates);
+    free(count);
+    free(ival1);
+    free(ival2);
+    free(status);
+
+    return failed;
+}
+
+void initScenario(struct bcmScenario *const scenario){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(scenario, 0, sizeof(struct bcmScenario));
+}
+
+void freeScenario(struct bcmScenario *const scenario){
+
+    free(scenario->txs);
+    free(scenario->sequences);
+    free(scenario->frames);
+    free(scenario->rxs);
+
+    initScenario(scenario);
+}
+
+int addScenarioTx(struct bcmScenario *const scenario, struct canfd_frame const* const frame, uint32_t count,
+                  struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    if(reserveArray((void **) &scenario->txs, &scenario->txCapacity, scenario->ntxs,
+                    sizeof(struct bcmScenarioTx)) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    struct bcmScenarioTx *const tx = &scenario->txs[scenario->ntxs++];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(tx, 0, sizeof(struct bcmScenarioTx));
+
+    tx->frame   = *frame;
+    tx->count   = count;
+    tx->ival1   = ival1;
+    tx->ival2   = ival2;
+    tx->isCANFD = isCANFD ? 1 : 0;
+
+    if(!isCANFD){
+        tx->frame.flags = 0;
+    }
+
+    return RET_E_OK;
+}
+
+int addScenarioSequence(struct bcmScenario *const scenario, struct canfd_frame const frames[], int nframes,
+                        struct bcm_timeval ival2, int isCANFD){
+
+    if(nframes <= 0){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Note: The frames may already be stored behind the last sequence (loadScenario)
+    int isInside  = scenario->frames != NULL && frames >= scenario->frames &&
+                    frames < scenario->frames + scenario->frameCapacity;
+    size_t offset = isInside ? (size_t) (frames - scenario->frames) : 0;
+    uint64_t size = (uint64_t) scenario->nframes + (uint64_t) nframes;
+
+    if(size > scenario->frameCapacity){
+
+        uint64_t newCapacity = scenario->frameCapacity > 0 ? scenario->frameCapacity : 16;
+
+        while(newCapacity < size){
+            newCapacity *= 2;
+        }
+
+        struct canfd_frame *const newFrames = newCapacity <= UINT32_MAX ?
+                                              realloc(scenario->frames, newCapacity * sizeof(struct canfd_frame)) : NULL;
+
+        if(newFrames == NULL){
+            return ERR_MALLOC_FAILED;
+        }
+
+        scenario->frames        = newFrames;
+        scenario->frameCapacity = (uint32_t) newCapacity;
+
+        if(isInside){
+            frames = scenario->frames + offset;
+        }
+    }
+
+    if(reserveArray((void **) &scenario->sequences, &scenario->sequenceCapacity, scenario->nsequences,
+                    sizeof(struct bcmScenarioSequence)) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    struct bcmScenarioSequence *const sequence = &scenario->sequences[scenario->nsequences++];
+
+    memmove(&scenario->frames[scenario->nframes], frames, (size_t) nframes * sizeof(struct canfd_frame));
+
+    sequence->firstFrame = scenario->nframes;
+    sequence->nframes    = (uint32_t) nframes;
+    sequence->ival2      = ival2;
+    sequence->isCANFD    = isCANFD ? 1 : 0;
+
+    scenario->nframes += (uint32_t) nframes;
+
+    return RET_E_OK;
+}
+
+int addScenarioRx(struct bcmScenario *const scenario, canid_t canID, struct canfd_frame const* const mask, int isCANFD){
+
+    if(reserveArray((void **) &scenario->rxs, &scenario->rxCapacity, scenario->nrxs,
+                    sizeof(struct bcmScenarioRx)) != RET_E_OK){
+        return ERR_MALLOC_FAILED;
+    }
+
+    struct bcmScenarioRx *const rx = &scenario->rxs[scenario->nrxs++];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(rx, 0, sizeof(struct bcmScenarioRx));
+
+    if(mask != NULL){
+        rx->mask    = *mask;
+        rx->hasMask = 1;
+    }
+
+    rx->mask.can_id = canID;
+    rx->isCANFD     = isCANFD ? 1 : 0;
+
+    if(!isCANFD){
+        rx->mask.flags = 0;
+    }
+
+    return RET_E_OK;
+}
+
+int loadScenario(struct bcmScenario *const scenario, char const *const path){
+
+    char *line        = NULL;
+    size_t lineSize   = 0;
+    uint64_t lineNo   = 0;
+    int retCode       = RET_E_OK;
+
+    initScenario(scenario);
+
+    FILE *file = fopen(path, "r");
+
+    if(file == NULL){
+        printf("Error could not open the scenario %s: %s\n", path, strerror(errno));
+        return ERR_OPEN_FAILED;
+    }
+
+    while(retCode == RET_E_OK && getline(&line, &lineSize, file) != -1){
+
+        char const *text = skipSpaces(line);
+
+        lineNo++;
+
+        // Skip empty lines and comments
+        if(*text == '#' || getWordLength(text) == 0){
+            continue;
+        }
+
+        retCode = readScenarioLine(scenario, text);
+
+        if(retCode == ERR_SCENARIO_FORMAT){
+            printf("Error could not read line %llu of the scenario %s \n", (unsigned long long) lineNo, path);
+        }
+    }
+
+    free(line);
+    fclose(file);
+
+    if(retCode == RET_E_OK){
+        retCode = checkScenario(scenario);
+    }
+
+    if(retCode == ERR_MALLOC_FAILED){
+        printf("Error could not allocate memory for the scenario \n");
+    }
+
+    if(retCode != RET_E_OK){
+        freeScenario(scenario);
+    }
+
+    return retCode;
+}
+
+int checkScenario(struct bcmScenario const* const scenario){
+
+    struct bcmRegistry desired;
+
+    int retCode = buildScenarioRegistry(scenario, &desired);
+
+    if(retCode == RET_E_OK){
+        freeRegistry(&desired);
+    }
+
+    return retCode;
+}
+
+int applyScenario(struct bcmContext *const ctx, struct bcmScenario const* const scenario,
+                  struct bcmScenarioDiff *const diff){
+
+    struct bcmRegistry desired;   // The tasks of the scenario
+    struct bcmScenarioDiff changes;
+    int failed = 0;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&changes, 0, sizeof(changes));
+
+    // Note: Nothing is sent for a scenario that is not valid as a whole
+    int retCode = buildScenarioRegistry(scenario, &desired);
+
+    if(retCode != RET_E_OK){
+        return retCode;
+    }
+
+    // Collect the active tasks that have to go before anything is changed,
+    // deleting them right away would reorder the dense task array
+    uint32_t nstale = 0;
+    struct bcmScenarioKey *const stale = malloc(sizeof(struct bcmScenarioKey) * (ctx->registry.ntasks + 1));
+
+    if(stale == NULL){
+        printf("Error could not allocate memory for the scenario \n");
+        freeRegistry(&desired);
+        return ERR_MALLOC_FAILED;
+    }
+
+    for(uint32_t index = 0; index < ctx->registry.ntasks; index++){
+
+        struct bcmTask const* const task = &ctx->registry.tasks[index];
+
+        // Note: Members stop with their sequence task
+        if(task->kind == TASK_KIND_SEQUENCE_MEMBER || !isStaleTask(task, &desired)){
+            continue;
+        }
+
+        stale[nstale].canID   = task->canID;
+        stale[nstale].isCANFD = task->isCANFD;
+        stale[nstale].kind    = task->kind;
+        nstale++;
+    }
+
+    // Note: With an io_uring the whole difference is one submit
+    if(ctx->uring != NULL){
+        beginUringBatch(ctx->uring);
+    }
+
+    for(uint32_t index = 0; index < nstale; index++){
+
+        int ret = stale[index].kind == TASK_KIND_TX ? createTxDelete(ctx, stale[index].canID, stale[index].isCANFD)
+                                                    : createRxDelete(ctx, stale[index].canID, stale[index].isCANFD);
+
+        failed += ret != RET_E_OK;
+    }
+
+    changes.deleted = nstale;
+
+    for(int isCANFD = 0; isCANFD <= 1 && retCode == RET_E_OK; isCANFD++){
+
+        int ret = applyScenarioTxs(ctx, scenario, isCANFD, &changes);
+
+        if(ret == ERR_MALLOC_FAILED){
+            retCode = ret;
+        }else{
+            failed += ret;
+        }
+    }
+
+    for(uint32_t index = 0; index < scenario->nsequences && retCode == RET_E_OK; index++){
+
+        struct bcmScenarioSequence const* const sequence = &scenario->sequences[index];
+        struct canfd_frame *const frames = &scenario->frames[sequence->firstFrame];
+        struct bcm_timeval ivalZero = {0, 0};
+
+        // Note: Changed sequences were deleted above
+        if(findTask(&ctx->registry, frames[0].can_id, sequence->isCANFD, TASK_KIND_TX) != NULL){
+            changes.kept++;
+            continue;
+        }
+
+        if(createTxSetupSequence(ctx, frames, (int) sequence->nframes, 0, ivalZero, sequence->ival2,
+                                 sequence->isCANFD) != RET_E_OK){
+            failed++;
+        }
+
+        changes.added++;
+    }
+
+    for(uint32_t index = 0; index < scenario->nrxs && retCode == RET_E_OK; index++){
+
+        struct bcmScenarioRx const* const rx = &scenario->rxs[index];
+        struct bcmTask const* const task = findTask(&ctx->registry, rx->mask.can_id, rx->isCANFD, TASK_KIND_RX);
+
+        if(task != NULL && (rx->hasMask ? task->type == TASK_RX_FILTER_MASK && hasSamePayload(task, &rx->mask, rx->isCANFD)
+                                        : task->type == TASK_RX_FILTER_ID)){
+            changes.kept++;
+            continue;
+        }
+
+        // Note: A RX_SETUP replaces the filter of an existing RX task
+        int ret = rx->hasMask ? createRxSetupMask(ctx, rx->mask.can_id, rx->mask, rx->isCANFD)
+                              : createRxSetupCanID(ctx, rx->mask.can_id, rx->isCANFD);
+
+        failed += ret != RET_E_OK;
+
+        changes.added++;
+    }
+
+    if(ctx->uring != NULL){
+        endUringBatch(ctx->uring);
+    }
+
+    free(stale);
+    freeRegistry(&desired);
+
+    if(diff != NULL){
+        *diff = changes;
+    }
+
+    if(retCode == RET_E_OK && failed > 0){
+        printf("Error %d tasks of the scenario could not be set up or deleted \n", failed);
+        retCode = ERR_TX_SETUP_FAILED;
+    }
+
+    return retCode;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
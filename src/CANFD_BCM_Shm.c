@@ -0,0 +1,464 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Shm.c
+ \brief     Provides the shared memory transport of the operation and event
+            queues to a simulation in another process.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Shm.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define SHM_NFDS 2 // The memfd and the eventfd are handed to the simulation
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Rounds a size up to a multiple of the cache line.
+ *
+ * @param size - The size in bytes.
+ */
+static uint64_t alignToCacheLine(uint64_t size){
+
+    return (size + CACHE_LINE_SIZE - 1) & ~(uint64_t) (CACHE_LINE_SIZE - 1);
+}
+
+/**
+ * Points the queues of the transport into the mapping.
+ * The geometry of the rings is given by the caller and not read from the
+ * mapping, the other process can change the mapping at any time.
+ *
+ * @param shm               - The transport with a mapped header.
+ * @param eventFD           - The eventfd of the operation queue.
+ * @param operationOffset   - The offset of the operation ring.
+ * @param operationCapacity - The number of operations the ring holds.
+ * @param eventOffset       - The offset of the event ring.
+ * @param eventCapacity     - The number of events the ring holds.
+ */
+static void mapShmQueues(struct bcmShm *const shm, int eventFD, uint64_t operationOffset, uint32_t operationCapacity,
+                         uint64_t eventOffset, uint32_t eventCapacity){
+
+    unsigned char *const base = (unsigned char*) shm->header;
+
+    shm->operationQueue.ring    = (struct bcmRing*) (base + operationOffset);
+    shm->operationQueue.eventFD = eventFD;
+    initRingGeometry(&shm->operationQueue.geometry, operationCapacity, sizeof(struct bcmOperation));
+
+    shm->eventQueue.ring     = (struct bcmRing*) (base + eventOffset);
+    shm->eventQueue.dropped  = 0;
+    shm->eventQueue.doorbell = &shm->header->eventDoorbell;
+    initRingGeometry(&shm->eventQueue.geometry, eventCapacity, sizeof(struct bcmEvent));
+}
+
+/**
+ * Checks that a ring at an offset of the mapping fits and holds the records.
+ * Each field of the ring is read once, the capacity that was checked is the
+ * one the queue keeps.
+ *
+ * @param header   - The mapped header.
+ * @param size     - The size of the mapping.
+ * @param offset   - The offset of the ring.
+ * @param elemSize - The size of the records the ring must hold.
+ * @return The capacity of the ring or 0 if it can not be used.
+ */
+static uint32_t checkShmRing(struct bcmShmHeader const* const header, size_t size, uint64_t offset,
+                             uint32_t elemSize){
+
+    if(offset % CACHE_LINE_SIZE != 0 || offset < sizeof(struct bcmShmHeader) || offset + sizeof(struct bcmRing) > size){
+        return 0;
+    }
+
+    struct bcmRing const* const ring = (struct bcmRing const*) ((unsigned char const*) header + offset);
+
+    uint32_t capacity = ring->capacity;
+    uint32_t mask     = ring->mask;
+
+    if(ring->elemSize != elemSize || capacity == 0 || (capacity & (capacity - 1)) != 0 || mask != capacity - 1 ||
+       offset + getRingSize(capacity, elemSize) > size){
+        return 0;
+    }
+
+    return capacity;
+}
+
+void initShmChannel(struct bcmShm *const shm){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(shm, 0, sizeof(struct bcmShm));
+
+    shm->memFD                  = -1;
+    shm->listenFD               = -1;
+    shm->operationQueue.eventFD = -1;
+}
+
+int createShmChannel(struct bcmShm *const shm, char const *const path, uint32_t operationCapacity,
+                     uint32_t eventCapacity){
+
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= SHM_PATH_SIZE){
+        printf("Error the socket path %s is too long \n", path);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // The header, then each ring on its own cache line
+    uint64_t operationOffset = alignToCacheLine(sizeof(struct bcmShmHeader));
+    uint64_t operationSize   = getRingSize(operationCapacity, sizeof(struct bcmOperation));
+    uint64_t eventOffset     = alignToCacheLine(operationOffset + operationSize);
+    uint64_t size            = alignToCacheLine(eventOffset + getRingSize(eventCapacity, sizeof(struct bcmEvent)));
+
+    shm->memFD = memfd_create("CANFD_BCM", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+
+    if(shm->memFD < 0){
+        printf("Error could not create the shared memory: %s\n", strerror(errno));
+        return ERR_SHM_FAILED;
+    }
+
+    // Note: The seals keep the simulation from resizing the memory,
+    // a shrunk memfd would kill the gateway with SIGBUS.
+    if(ftruncate(shm->memFD, (off_t) size) < 0 ||
+       fcntl(shm->memFD, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0){
+        printf("Error could not size the shared memory: %s\n", strerror(errno));
+        closeShmChannel(shm);
+        return ERR_SHM_FAILED;
+    }
+
+    void *memory = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, shm->memFD, 0);
+
+    if(memory == MAP_FAILED){
+        printf("Error could not map the shared memory: %s\n", strerror(errno));
+        closeShmChannel(shm);
+        return ERR_MMAP_FAILED;
+    }
+
+    shm->header       = memory;
+    shm->header->size = size;
+    shm->size         = size;
+
+    // Note: A new memfd is zeroed, the rings only need their capacities
+    if(initRing((struct bcmRing*) ((unsigned char*) memory + operationOffset), operationCapacity,
+                sizeof(struct bcmOperation)) != RET_E_OK ||
+       initRing((struct bcmRing*) ((unsigned char*) memory + eventOffset), eventCapacity,
+                sizeof(struct bcmEvent)) != RET_E_OK){
+        closeShmChannel(shm);
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Note: The simulation only gets the memfd after the header is complete
+    shm->header->magic           = SHM_MAGIC;
+    shm->header->version         = SHM_VERSION;
+    shm->header->operationSize   = sizeof(struct bcmOperation);
+    shm->header->eventSize       = sizeof(struct bcmEvent);
+    shm->header->operationOffset = operationOffset;
+    shm->header->eventOffset     = eventOffset;
+
+    atomic_init(&shm->header->eventDoorbell.sequence, 0);
+    atomic_init(&shm->header->eventDoorbell.waiters, 0);
+
+    int eventFD = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+    if(eventFD < 0){
+        printf("Error could not create the eventfd: %s\n", strerror(errno));
+        closeShmChannel(shm);
+        return ERR_EVENTFD_FAILED;
+    }
+
+    mapShmQueues(shm, eventFD, operationOffset, operationCapacity, eventOffset, eventCapacity);
+
+    // Note: SOCK_SEQPACKET keeps the handshake one message
+    shm->listenFD = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if(shm->listenFD < 0){
+        printf("Error could not create the socket of the shared memory: %s\n", strerror(errno));
+        closeShmChannel(shm);
+        return ERR_SOCKET_FAILED;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    // A socket left behind by a gateway that crashed would block the bind
+    unlink(path);
+
+    if(bind(shm->listenFD, (struct sockaddr*) &addr, sizeof(addr)) < 0 || listen(shm->listenFD, 1) < 0){
+        printf("Error could not bind the socket %s: %s\n", path, strerror(errno));
+        closeShmChannel(shm);
+        return ERR_BIND_FAILED;
+    }
+
+    strcpy(shm->path, path);
+
+    return RET_E_OK;
+}
+
+int acceptShmChannel(struct bcmShm *const shm, int timeoutMs){
+
+    struct pollfd pfd;
+    pfd.fd      = shm->listenFD;
+    pfd.events  = POLLIN;
+    pfd.revents = 0;
+
+    int ret;
+
+    do{
+        ret = poll(&pfd, 1, timeoutMs);
+    }while(ret < 0 && errno == EINTR);
+
+    if(ret <= 0){
+        printf("Error no simulation connected to %s \n", shm->path);
+        return ERR_SHM_FAILED;
+    }
+
+    int connFD = accept4(shm->listenFD, NULL, NULL, SOCK_CLOEXEC);
+
+    if(connFD < 0){
+        printf("Error could not accept the simulation: %s\n", strerror(errno));
+        return ERR_SHM_FAILED;
+    }
+
+    // The version travels as data so a simulation can tell a wrong peer from a lost message
+    uint32_t version = SHM_VERSION;
+    union{
+        char buffer[CMSG_SPACE(SHM_NFDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = &version;
+    iov.iov_len  = sizeof(version);
+
+    struct msghdr hdr;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&control, 0, sizeof(control));
+
+    hdr.msg_iov        = &iov;
+    hdr.msg_iovlen     = 1;
+    hdr.msg_control    = control.buffer;
+    hdr.msg_controllen = sizeof(control.buffer);
+
+    struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type  = SCM_RIGHTS;
+    cmsg->cmsg_len   = CMSG_LEN(SHM_NFDS * sizeof(int));
+
+    int fds[SHM_NFDS] = {shm->memFD, shm->operationQueue.eventFD};
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t nbytes = sendmsg(connFD, &hdr, MSG_NOSIGNAL);
+    int error      = errno;
+
+    close(connFD);
+
+    if(nbytes != sizeof(version)){
+        printf("Error could not hand the shared memory to the simulation: %s\n", strerror(error));
+        return ERR_WRITE_FAILED;
+    }
+
+    return RET_E_OK;
+}
+
+int connectShmChannel(struct bcmShm *const shm, char const *const path){
+
+    struct sockaddr_un addr;
+
+    if(strlen(path) >= SHM_PATH_SIZE){
+        printf("Error the socket path %s is too long \n", path);
+        return ERR_SOCKET_FAILED;
+    }
+
+    int connFD = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+
+    if(connFD < 0){
+        printf("Error could not create the socket of the shared memory: %s\n", strerror(errno));
+        return ERR_SOCKET_FAILED;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+
+    if(connect(connFD, (struct sockaddr*) &addr, sizeof(addr)) < 0){
+        printf("Error could not connect to the gateway %s: %s\n", path, strerror(errno));
+        close(connFD);
+        return ERR_SOCKET_FAILED;
+    }
+
+    uint32_t version = 0;
+    union{
+        char buffer[CMSG_SPACE(SHM_NFDS * sizeof(int))];
+        struct cmsghdr align;
+    } control;
+
+    struct iovec iov;
+    iov.iov_base = &version;
+    iov.iov_len  = sizeof(version);
+
+    struct msghdr hdr;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&hdr, 0, sizeof(hdr));
+    memset(&control, 0, sizeof(control));
+
+    hdr.msg_iov        = &iov;
+    hdr.msg_iovlen     = 1;
+    hdr.msg_control    = control.buffer;
+    hdr.msg_controllen = sizeof(control.buffer);
+
+    ssize_t nbytes;
+
+    do{
+        nbytes = recvmsg(connFD, &hdr, MSG_CMSG_CLOEXEC);
+    }while(nbytes < 0 && errno == EINTR);
+
+    close(connFD);
+
+    struct cmsghdr *const cmsg = CMSG_FIRSTHDR(&hdr);
+
+    if(nbytes != sizeof(version) || cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS ||
+       cmsg->cmsg_len != CMSG_LEN(SHM_NFDS * sizeof(int))){
+        printf("Error the gateway %s did not hand over the shared memory \n", path);
+        return ERR_RECV_FAILED;
+    }
+
+    int fds[SHM_NFDS];
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    shm->memFD = fds[0];
+    shm->operationQueue.eventFD = fds[1];
+
+    struct stat info;
+
+    if(version != SHM_VERSION){
+        printf("Error the gateway %s uses version %u of the shared memory instead of %u \n", path, version,
+               SHM_VERSION);
+        closeShmChannel(shm);
+        return ERR_SHM_FAILED;
+    }
+
+    if(fstat(shm->memFD, &info) < 0){
+        printf("Error could not get the size of the shared memory of the gateway %s: %s\n", path, strerror(errno));
+        closeShmChannel(shm);
+        return ERR_SHM_FAILED;
+    }
+
+    if((size_t) info.st_size < sizeof(struct bcmShmHeader)){
+        printf("Error the shared memory of the gateway %s is smaller than its header \n", path);
+        closeShmChannel(shm);
+        return ERR_SHM_FAILED;
+    }
+
+    void *memory = mmap(NULL, (size_t) info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, shm->memFD, 0);
+
+    if(memory == MAP_FAILED){
+        printf("Error could not map the shared memory: %s\n", strerror(errno));
+        closeShmChannel(shm);
+        return ERR_MMAP_FAILED;
+    }
+
+    shm->header = memory;
+    shm->size   = (size_t) info.st_size;
+
+    // Note: The sizes of the records tell a gateway built with other
+    // defines (e.g. CANFD_MAX_DLEN or the alignment) from a matching one.
+    // The offsets are read once, the gateway can write the header at any time.
+    struct bcmShmHeader const* const header = shm->header;
+
+    uint64_t operationOffset   = header->operationOffset;
+    uint64_t eventOffset       = header->eventOffset;
+    uint32_t operationCapacity = checkShmRing(header, shm->size, operationOffset, sizeof(struct bcmOperation));
+    uint32_t eventCapacity     = checkShmRing(header, shm->size, eventOffset, sizeof(struct bcmEvent));
+
+    if(header->magic != SHM_MAGIC || header->version != SHM_VERSION || header->size != (uint64_t) info.st_size ||
+       header->operationSize != sizeof(struct bcmOperation) || header->eventSize != sizeof(struct bcmEvent) ||
+       operationCapacity == 0 || eventCapacity == 0){
+        printf("Error the shared memory of the gateway %s does not match the records of the simulation \n", path);
+        closeShmChannel(shm);
+        return ERR_SHM_FAILED;
+    }
+
+    mapShmQueues(shm, shm->operationQueue.eventFD, operationOffset, operationCapacity, eventOffset, eventCapacity);
+
+    return RET_E_OK;
+}
+
+void attachShmChannel(struct bcmShm *const shm, struct bcmWorker *const worker){
+
+    // The worker drops its own rings, its channels keep the pointer to its event queue
+    freeOperationQueue(&worker->operationQueue);
+    freeEventQueue(&worker->eventQueue);
+
+    worker->operationQueue = shm->operationQueue;
+    worker->eventQueue     = shm->eventQueue;
+    shm->worker            = worker;
+}
+
+void closeShmChannel(struct bcmShm *const shm){
+
+    // Note: The rings belong to the mapping, freeWorkers must not free them
+    if(shm->worker != NULL){
+        shm->worker->operationQueue.ring    = NULL;
+        shm->worker->operationQueue.eventFD = -1;
+        shm->worker->eventQueue.ring        = NULL;
+        shm->worker->eventQueue.doorbell    = NULL;
+        shm->worker = NULL;
+    }
+
+    // Note: The size in the header belongs to the shared memory, the private one is unmapped
+    if(shm->header != NULL){
+        munmap(shm->header, shm->size);
+    }
+
+    if(shm->memFD != -1){
+        close(shm->memFD);
+    }
+
+    if(shm->operationQueue.eventFD != -1){
+        close(shm->operationQueue.eventFD);
+    }
+
+    if(shm->listenFD != -1){
+        close(shm->listenFD);
+        unlink(shm->path);
+    }
+
+    initShmChannel(shm);
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -16,20 +16,151 @@
 #include "CANFD_BCM_Socket.h"
 #include <errno.h>
 #include <linux/can.h>
+#include <linux/can/raw.h>
 #include <net/if.h>
 #include <string.h>
 #include <stdio.h>
 #include <sys/ioctl.h>
+#include <sys/socket.h>
 #include <unistd.h>
 #include <fcntl.h>
 
 
+/*******************************************************************************
+ * STRUCTS
+ ******************************************************************************/
+
+/**
+ * Struct for a cached ifindex lookup.
+ */
+struct ifindexCacheEntry{
+    char name[IFNAMSIZ]; // The name of the interface
+    int ifindex;         // The ifindex of the interface
+};
+
+
+/*******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+static struct ifindexCacheEntry ifindexCache[MAX_CHANNELS]; // The cached ifindex lookups
+static int ifindexCacheSize = 0;                            // Number of cached ifindex lookups
+
+
 /*******************************************************************************
  * FUNCTION DEFINITIONS
  ******************************************************************************/
 
+/**
+ * Sets the size of a socket buffer. The FORCE option is tried first, it
+ * needs CAP_NET_ADMIN but is not capped by net.core.rmem_max/wmem_max.
+ * A capped buffer is reported but is no error.
+ *
+ * @param socketFD    - The socket descriptor.
+ * @param forceOption - SO_RCVBUFFORCE or SO_SNDBUFFORCE.
+ * @param option      - SO_RCVBUF or SO_SNDBUF.
+ * @param size        - The size of the buffer in bytes (0 = keep the kernel default).
+ * @param name        - The name of the buffer for the messages.
+ * @return RET_E_OK or ERR_SETSOCKOPT_FAILED.
+ */
+static int setBufferSize(int socketFD, int forceOption, int option, int size, char const *name){
+
+    int actual = 0;                   // The size the kernel applied
+    socklen_t length = sizeof(actual); // The length of the option value
+
+    if(size <= 0 || setsockopt(socketFD, SOL_SOCKET, forceOption, &size, sizeof(size)) == 0){
+        return RET_E_OK;
+    }
+
+    if(setsockopt(socketFD, SOL_SOCKET, option, &size, sizeof(size)) < 0){
+        printf("Error could not set the %s buffer to %d bytes: %s\n", name, size, strerror(errno));
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    // Note: The kernel doubles the value for its bookkeeping overhead
+    if(getsockopt(socketFD, SOL_SOCKET, option, &actual, &length) == 0 && actual / 2 < size){
+        printf("Warning the %s buffer is capped at %d bytes, raise net.core.%s_max or grant CAP_NET_ADMIN\n",
+               name, actual / 2, option == SO_RCVBUF ? "rmem" : "wmem");
+    }
+
+    return RET_E_OK;
+}
+
+int setSocketBuffers(int socketFD, int rcvbuf, int sndbuf){
+
+    if(setBufferSize(socketFD, SO_RCVBUFFORCE, SO_RCVBUF, rcvbuf, "receive") != RET_E_OK ||
+       setBufferSize(socketFD, SO_SNDBUFFORCE, SO_SNDBUF, sndbuf, "send") != RET_E_OK){
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    return RET_E_OK;
+}
+
+int getSocketBuffers(int socketFD, int *const rcvbuf, int *const sndbuf){
+
+    socklen_t rcvLength = sizeof(*rcvbuf); // The length of the receive buffer size
+    socklen_t sndLength = sizeof(*sndbuf); // The length of the send buffer size
+
+    if(getsockopt(socketFD, SOL_SOCKET, SO_RCVBUF, rcvbuf, &rcvLength) < 0 ||
+       getsockopt(socketFD, SOL_SOCKET, SO_SNDBUF, sndbuf, &sndLength) < 0){
+        printf("Error could not get the socket buffer sizes: %s\n", strerror(errno));
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    return RET_E_OK;
+}
+
+int getInterfaceTxQueueLength(int socketFD, char const *const ifname){
+
+    // Set the interface name in the ifr
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+
+    if(ioctl(socketFD, SIOCGIFTXQLEN, &ifr) < 0){
+        printf("Error could not get the TX queue length of %s: %s\n", ifname, strerror(errno));
+        return ERR_IF_NOT_FOUND;
+    }
+
+    return ifr.ifr_qlen;
+}
+
+int getInterfaceIndex(int socketFD, char const *const ifname){
+
+    // Check if we already know the interface
+    for(int index = 0; index < ifindexCacheSize; index++){
+        if(strncmp(ifindexCache[index].name, ifname, IFNAMSIZ) == 0){
+            return ifindexCache[index].ifindex;
+        }
+    }
+
+    // Set the interface name in the ifr
+    struct ifreq ifr;
+    memset(&ifr, 0, sizeof(ifr));
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", ifname);
+
+    // Get the ifrindex of the interface name
+    if(ioctl(socketFD, SIOCGIFINDEX, &ifr) < 0){
+        printf("Error could not get ifrindex of %s: %s\n", ifname, strerror(errno));
+        return ERR_IF_NOT_FOUND;
+    }
+
+    // Remember the lookup if there is space left
+    if(ifindexCacheSize < MAX_CHANNELS){
+        snprintf(ifindexCache[ifindexCacheSize].name, IFNAMSIZ, "%s", ifname);
+        ifindexCache[ifindexCacheSize].ifindex = ifr.ifr_ifindex;
+        ifindexCacheSize++;
+    }
+
+    return ifr.ifr_ifindex;
+}
+
 int setupSocket(int *const socketFD, struct sockaddr_can *const addr, int isBlocking){
 
+    return setupSocketOnInterface(socketFD, addr, INTERFACE, isBlocking);
+}
+
+int setupSocketOnInterface(int *const socketFD, struct sockaddr_can *const addr, char const *const ifname, int isBlocking){
+
     // Get the socket file descriptor for ioctl
     *socketFD = socket(PF_CAN, SOCK_DGRAM, CAN_BCM);
 
@@ -39,36 +170,65 @@ int setupSocket(int *const socketFD, struct sockaddr_can *const addr, int isBloc
         return ERR_SOCKET_FAILED;
     }
 
-    // Set the interface name in the ifr
-    struct ifreq ifr;
-    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", INTERFACE);
-
     // Get the ifrindex of the interface name
-    if(ioctl(*socketFD, SIOCGIFINDEX, &ifr) < 0){
-        printf("Error could not get ifrindex: %s\n", strerror(errno));
+    int ifindex = getInterfaceIndex(*socketFD, ifname);
+
+    if(ifindex < 0){
+        close(*socketFD);
+        *socketFD = -1;
         return ERR_IF_NOT_FOUND;
     }
 
     // Fill in the family and ifrindex
+    memset(addr, 0, sizeof(struct sockaddr_can));
     addr->can_family  = AF_CAN;
-    addr->can_ifindex = ifr.ifr_ifindex;
+    addr->can_ifindex = ifindex;
 
     // Connect to the socket
     if(connect(*socketFD, (struct sockaddr *) addr, sizeof(struct sockaddr_can)) != 0){
         perror("Error could not connect to the socket");
         close(*socketFD);
+        *socketFD = -1;
         return ERR_SETUP_FAILED;
     }
 
     // Note: In contrast to a raw CAN socket there is no need to
     // explicitly enable CANFD for an BCM socket with setsockopt!
 
+    // Let the kernel put the receive time of each BCM message in a control message.
+    // Note: For RX_CHANGED this is the time the frame was received by the BCM.
+    int enable = 1;
+
+    if(setsockopt(*socketFD, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0){
+        perror("Error could not enable the receive timestamps");
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    // Let the kernel put its drop counter in a control message, so we notice
+    // the BCM messages that did not fit in the receive buffer.
+    if(setsockopt(*socketFD, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) < 0){
+        perror("Error could not enable the drop counter");
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    // Note: A burst of RX_CHANGED messages must fit in the receive buffer
+    if(setSocketBuffers(*socketFD, SOCKET_RCVBUF, SOCKET_SNDBUF) != RET_E_OK){
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
     // Put the socket in non-blocking mode
     if(!isBlocking) {
 
         if (fcntl(*socketFD, F_SETFL, fcntl(*socketFD, F_GETFL) | O_NONBLOCK) < 0) {
             printf("Setting socket to non blocking mode failed \n");
             close(*socketFD);
+            *socketFD = -1;
             return ERR_FCNTL_FAILED;
         }
 
@@ -77,6 +237,69 @@ int setupSocket(int *const socketFD, struct sockaddr_can *const addr, int isBloc
     return RET_E_OK;
 }
 
+int setupRawSocketOnInterface(int *const socketFD, char const *const ifname){
+
+    struct sockaddr_can addr; // The address the socket is bound to
+    int enable = 1;           // Value for the boolean socket options
+
+    // Get the socket file descriptor
+    *socketFD = socket(PF_CAN, SOCK_RAW, CAN_RAW);
+
+    // Error handling
+    if(*socketFD == -1){
+        perror("Error getting raw socket file descriptor failed");
+        return ERR_SOCKET_FAILED;
+    }
+
+    // Get the ifrindex of the interface name
+    int ifindex = getInterfaceIndex(*socketFD, ifname);
+
+    if(ifindex < 0){
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_IF_NOT_FOUND;
+    }
+
+    // Note: In contrast to a BCM socket a raw socket only sends
+    // CANFD frames if it is explicitly enabled with setsockopt!
+    if(setsockopt(*socketFD, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &enable, sizeof(enable)) < 0){
+        perror("Error could not enable CANFD frames on the raw socket");
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    // The socket is only used for sending. Without a filter nothing is received.
+    if(setsockopt(*socketFD, SOL_CAN_RAW, CAN_RAW_FILTER, NULL, 0) < 0){
+        perror("Error could not clear the filter of the raw socket");
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    // Note: The send buffer limits how many frames wait for the TX queue of the interface
+    if(setSocketBuffers(*socketFD, 0, SOCKET_SNDBUF) != RET_E_OK){
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_SETSOCKOPT_FAILED;
+    }
+
+    // Fill in the family and ifrindex
+    memset(&addr, 0, sizeof(addr));
+    addr.can_family  = AF_CAN;
+    addr.can_ifindex = ifindex;
+
+    // Bind the socket to the interface
+    if(bind(*socketFD, (struct sockaddr *) &addr, sizeof(addr)) != 0){
+        perror("Error could not bind the raw socket");
+        close(*socketFD);
+        *socketFD = -1;
+        return ERR_BIND_FAILED;
+    }
+
+    return RET_E_OK;
+}
+
 
 /*******************************************************************************
  * END OF FILE
@@ -0,0 +1,379 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Stats.c
+ \brief     Provides lock-free counters and latency histograms for the event loops.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Stats.h"
+#include <linux/can/bcm.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+
+/*******************************************************************************
+ * VARIABLES
+ ******************************************************************************/
+static struct bcmStatsSlot slots[STATS_MAX_SLOTS];          // The slots of all threads
+static _Atomic int nslots = 0;                              // Number of handed out slots
+static _Thread_local struct bcmStatsSlot *threadSlot = NULL; // The slot of the calling thread
+static _Thread_local int hasNoSlot = 0;                     // Flag for a thread that did not get a slot
+
+static _Atomic uint64_t nextDumpTime = 0;                   // Monotonic time of the next periodic dump
+static struct bcmStatsSnapshot dumpSnapshots[2];            // The current and the previous periodic snapshot
+static int dumpIndex = 0;                                   // Index of the previous periodic snapshot
+static int hasDumpSnapshot = 0;                             // Flag for an existing previous periodic snapshot
+
+/**
+ * The names of the counters for printing.
+ */
+static char const *const counterNames[STATS_COUNTERS] = {
+    "operations", "sends", "send errors", "receives", "receives with EAGAIN", "messages", "events",
+    "events dropped", "updates skipped", "wakeups", "idle wakeups", "busy polls",
+    "replayed frames", "captured", "capture dropped", "decoded", "uring queued", "uring submits", "send retries",
+    "retry dropped", "receive errors", "rx overruns", "tx queue full", "bridge sent", "bridge received",
+    "bridge lost", "bridge late", "bridge invalid", "bridge rejected", "bridge dropped", "steps", "step frames",
+    "fanout events", "fanout merged", "fanout dropped"
+};
+
+/**
+ * The names of the high-water marks for printing.
+ */
+static char const *const maximumNames[STATS_MAXIMA] = {
+    "operation queue", "event queue"
+};
+
+/**
+ * The names of the histograms for printing.
+ */
+static char const *const histogramNames[STATS_HISTOGRAMS] = {
+    "dequeue to send", "rx to handler", "send TX_SEND", "send TX_SETUP", "send TX_DELETE", "send RX_SETUP",
+    "send RX_DELETE", "send raw", "replay lateness"
+};
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Returns the slot of the calling thread.
+ * The first call of a thread hands out the next free slot.
+ *
+ * @return The slot or NULL if all slots are taken.
+ */
+static struct bcmStatsSlot* getThreadSlot(void){
+
+    if(threadSlot != NULL || hasNoSlot){
+        return threadSlot;
+    }
+
+    int index = atomic_fetch_add(&nslots, 1);
+
+    if(index >= STATS_MAX_SLOTS){
+        printf("Warning all %d statistics slots are taken. The thread is not counted.\n", STATS_MAX_SLOTS);
+        hasNoSlot = 1;
+        return NULL;
+    }
+
+    threadSlot = &slots[index];
+    return threadSlot;
+}
+
+/**
+ * Returns the bucket of a value.
+ *
+ * @param value - The value.
+ */
+static int getBucket(uint64_t value){
+
+    if(value < STATS_SUB_BUCKETS){
+        return (int) value;
+    }
+
+    if(value >> STATS_MAX_BITS){
+        return STATS_BUCKETS - 1;
+    }
+
+    // The highest bit selects the power of two, the bits after it the sub bucket
+    int msb   = 63 - __builtin_clzll(value);
+    int group = msb - STATS_SUB_BITS + 1;
+    int sub   = (int) (value >> (msb - STATS_SUB_BITS)) & (STATS_SUB_BUCKETS - 1);
+
+    return group * STATS_SUB_BUCKETS + sub;
+}
+
+/**
+ * Returns the smallest value of a bucket.
+ *
+ * @param bucket - The bucket.
+ */
+static uint64_t getBucketValue(int bucket){
+
+    int group = bucket / STATS_SUB_BUCKETS;
+    int sub   = bucket % STATS_SUB_BUCKETS;
+
+    if(group == 0){
+        return (uint64_t) sub;
+    }
+
+    return (uint64_t) (STATS_SUB_BUCKETS + sub) << (group - 1);
+}
+
+/**
+ * Adds a value to an atomic that only the calling thread writes.
+ *
+ * @param target - The atomic.
+ * @param value  - The value that is added.
+ */
+static void addRelaxed(_Atomic uint64_t *const target, uint64_t value){
+
+    // Note: A plain load and store is enough for a single writer and
+    // avoids the locked instruction of atomic_fetch_add.
+    atomic_store_explicit(target, atomic_load_explicit(target, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+uint64_t getStatsTime(void){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+uint64_t getStatsRealtime(void){
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+
+    return (uint64_t) now.tv_sec * 1000000000u + (uint64_t) now.tv_nsec;
+}
+
+void addStatsCounter(int counter, uint64_t value){
+
+    if(!STATS){
+        return;
+    }
+
+    struct bcmStatsSlot *const slot = getThreadSlot();
+
+    if(slot != NULL){
+        addRelaxed(&slot->counters[counter], value);
+    }
+}
+
+void updateStatsMaximum(int maximum, uint64_t value){
+
+    if(!STATS){
+        return;
+    }
+
+    struct bcmStatsSlot *const slot = getThreadSlot();
+
+    if(slot != NULL && value > atomic_load_explicit(&slot->maxima[maximum], memory_order_relaxed)){
+        atomic_store_explicit(&slot->maxima[maximum], value, memory_order_relaxed);
+    }
+}
+
+void recordStatsValue(int histogram, uint64_t value){
+
+    if(!STATS){
+        return;
+    }
+
+    struct bcmStatsSlot *const slot = getThreadSlot();
+
+    if(slot == NULL){
+        return;
+    }
+
+    struct bcmHistogram *const hist = &slot->histograms[histogram];
+
+    addRelaxed(&hist->counts[getBucket(value)], 1);
+    addRelaxed(&hist->total, 1);
+    addRelaxed(&hist->sum, value);
+
+    if(value > atomic_load_explicit(&hist->max, memory_order_relaxed)){
+        atomic_store_explicit(&hist->max, value, memory_order_relaxed);
+    }
+}
+
+void addHistogramValue(struct bcmHistogramSnapshot *const histogram, uint64_t value){
+
+    histogram->counts[getBucket(value)]++;
+    histogram->total++;
+    histogram->sum += value;
+
+    if(value > histogram->max){
+        histogram->max = value;
+    }
+}
+
+int getSendHistogram(uint32_t opcode){
+
+    switch(opcode){
+        case TX_SEND:   return STATS_SEND_TX_SEND;
+        case TX_SETUP:  return STATS_SEND_TX_SETUP;
+        case TX_DELETE: return STATS_SEND_TX_DELETE;
+        case RX_SETUP:  return STATS_SEND_RX_SETUP;
+        case RX_DELETE: return STATS_SEND_RX_DELETE;
+        default:        return -1;
+    }
+}
+
+void getStatsSnapshot(struct bcmStatsSnapshot *const snapshot){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(snapshot, 0, sizeof(struct bcmStatsSnapshot));
+
+    snapshot->time = getStatsTime();
+
+    int count = atomic_load(&nslots);
+
+    if(count > STATS_MAX_SLOTS){
+        count = STATS_MAX_SLOTS;
+    }
+
+    // Merge the slots of all threads
+    for(int index = 0; index < count; index++){
+
+        struct bcmStatsSlot *const slot = &slots[index];
+
+        for(int counter = 0; counter < STATS_COUNTERS; counter++){
+            snapshot->counters[counter] += atomic_load_explicit(&slot->counters[counter], memory_order_relaxed);
+        }
+
+        for(int maximum = 0; maximum < STATS_MAXIMA; maximum++){
+
+            uint64_t value = atomic_load_explicit(&slot->maxima[maximum], memory_order_relaxed);
+
+            if(value > snapshot->maxima[maximum]){
+                snapshot->maxima[maximum] = value;
+            }
+        }
+
+        for(int histogram = 0; histogram < STATS_HISTOGRAMS; histogram++){
+
+            struct bcmHistogram *const hist        = &slot->histograms[histogram];
+            struct bcmHistogramSnapshot *const out = &snapshot->histograms[histogram];
+
+            for(int bucket = 0; bucket < STATS_BUCKETS; bucket++){
+                out->counts[bucket] += atomic_load_explicit(&hist->counts[bucket], memory_order_relaxed);
+            }
+
+            out->total += atomic_load_explicit(&hist->total, memory_order_relaxed);
+            out->sum   += atomic_load_explicit(&hist->sum, memory_order_relaxed);
+
+            uint64_t max = atomic_load_explicit(&hist->max, memory_order_relaxed);
+
+            if(max > out->max){
+                out->max = max;
+            }
+        }
+    }
+}
+
+uint64_t getHistogramPercentile(struct bcmHistogramSnapshot const* const histogram, double percentile){
+
+    if(histogram->total == 0){
+        return 0;
+    }
+
+    // Note: The buckets are read one by one while the threads keep writing,
+    // so the sum of the buckets can differ a little from the total.
+    uint64_t rank = (uint64_t) ((double) histogram->total * percentile / 100.0);
+    uint64_t seen = 0;
+
+    for(int bucket = 0; bucket < STATS_BUCKETS; bucket++){
+
+        seen += histogram->counts[bucket];
+
+        if(seen > rank){
+            return getBucketValue(bucket);
+        }
+    }
+
+    return histogram->max;
+}
+
+void printStatsSnapshot(struct bcmStatsSnapshot const* const snapshot, struct bcmStatsSnapshot const* const previous){
+
+    double elapsed = 0; // Seconds since the previous snapshot
+
+    if(previous != NULL && snapshot->time > previous->time){
+        elapsed = (double) (snapshot->time - previous->time) / 1e9;
+    }
+
+    printf("Statistics:\n");
+
+    for(int counter = 0; counter < STATS_COUNTERS; counter++){
+
+        if(elapsed > 0){
+            printf("  %-22s %12llu (%.0f/s)\n", counterNames[counter], (unsigned long long) snapshot->counters[counter],
+                   (double) (snapshot->counters[counter] - previous->counters[counter]) / elapsed);
+        }else{
+            printf("  %-22s %12llu\n", counterNames[counter], (unsigned long long) snapshot->counters[counter]);
+        }
+    }
+
+    for(int maximum = 0; maximum < STATS_MAXIMA; maximum++){
+        printf("  %-22s %12llu max\n", maximumNames[maximum], (unsigned long long) snapshot->maxima[maximum]);
+    }
+
+    for(int histogram = 0; histogram < STATS_HISTOGRAMS; histogram++){
+
+        struct bcmHistogramSnapshot const* const hist = &snapshot->histograms[histogram];
+
+        if(hist->total == 0){
+            continue;
+        }
+
+        printf("  %-22s n=%llu mean=%lluns p50=%lluns p99=%lluns p99.9=%lluns max=%lluns\n", histogramNames[histogram],
+               (unsigned long long) hist->total, (unsigned long long) (hist->sum / hist->total),
+               (unsigned long long) getHistogramPercentile(hist, 50.0),
+               (unsigned long long) getHistogramPercentile(hist, 99.0),
+               (unsigned long long) getHistogramPercentile(hist, 99.9), (unsigned long long) hist->max);
+    }
+}
+
+void dumpStatsPeriodic(void){
+
+    if(!STATS || STATS_DUMP_INTERVAL_MS <= 0){
+        return;
+    }
+
+    uint64_t now  = getStatsTime();
+    uint64_t next = atomic_load_explicit(&nextDumpTime, memory_order_relaxed);
+
+    if(now < next){
+        return;
+    }
+
+    // Only the thread that moves the deadline prints
+    if(!atomic_compare_exchange_strong(&nextDumpTime, &next, now + (uint64_t) STATS_DUMP_INTERVAL_MS * 1000000u)){
+        return;
+    }
+
+    struct bcmStatsSnapshot *const current = &dumpSnapshots[1 - dumpIndex];
+
+    getStatsSnapshot(current);
+    printStatsSnapshot(current, hasDumpSnapshot ? &dumpSnapshots[dumpIndex] : NULL);
+
+    dumpIndex       = 1 - dumpIndex;
+    hasDumpSnapshot = 1;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
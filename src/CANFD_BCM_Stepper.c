@@ -0,0 +1,845 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Stepper.c
+ \brief     Provides the stepped mode that runs the cyclic TX tasks in
+            simulation time with a hierarchical timer wheel.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Stepper.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define STEPPER_TICK_NS ((uint64_t) STEPPER_TICK_US * 1000u) // The tick in nanoseconds
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Returns the home entry of a task (fibonacci hashing).
+ */
+static uint32_t getHomeEntry(struct bcmStepper const* const stepper, canid_t canID, int isCANFD){
+
+    uint64_t key = (uint64_t) canID | ((uint64_t) (isCANFD ? 1 : 0) << 32);
+
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> stepper->shift);
+}
+
+/**
+ * Finds the entry of a task.
+ *
+ * @return The entry or the unused entry where the task would be inserted.
+ */
+static uint32_t findEntry(struct bcmStepper const* const stepper, canid_t canID, int isCANFD){
+
+    uint32_t index = getHomeEntry(stepper, canID, isCANFD);
+
+    // Note: The table is at most half full, so there is always an unused entry
+    while(stepper->tasks[index].isUsed &&
+          (stepper->tasks[index].canID != canID || stepper->tasks[index].isCANFD != (isCANFD ? 1 : 0))){
+        index = (index + 1) & stepper->mask;
+    }
+
+    return index;
+}
+
+/**
+ * Removes a task from its slot of the timer wheel.
+ */
+static void unlinkEntry(struct bcmStepper *const stepper, uint32_t index){
+
+    struct bcmStepTask *const task = &stepper->tasks[index];
+
+    if(task->slot == STEPPER_NONE){
+        return;
+    }
+
+    if(task->prev != STEPPER_NONE){
+        stepper->tasks[task->prev].next = task->next;
+    }else{
+        stepper->wheel[task->slot / STEPPER_SLOTS][task->slot % STEPPER_SLOTS] = task->next;
+    }
+
+    if(task->next != STEPPER_NONE){
+        stepper->tasks[task->next].prev = task->prev;
+    }
+
+    task->slot = STEPPER_NONE;
+    task->next = STEPPER_NONE;
+    task->prev = STEPPER_NONE;
+}
+
+/**
+ * Puts a task in the slot of its expire tick.
+ * The level is chosen by the distance to the current tick, so a task is
+ * moved down at most STEPPER_LEVELS - 1 times before it expires.
+ */
+static void linkEntry(struct bcmStepper *const stepper, uint32_t index){
+
+    struct bcmStepTask *const task = &stepper->tasks[index];
+
+    // Note: A task that is cascaded at its expire tick goes to the slot that is
+    // checked next. Due times behind the wheel are checked at the end of the
+    // wheel and linked again, expireTask only sends a frame at the due tick.
+    if(task->expire < stepper->tick){
+        task->expire = stepper->tick + 1;
+    }else if(task->expire - stepper->tick >= STEPPER_SPAN){
+        task->expire = stepper->tick + STEPPER_SPAN - 1;
+    }
+
+    uint64_t delta = task->expire - stepper->tick;
+    uint32_t level = 0;
+
+    while(level + 1 < STEPPER_LEVELS && delta >= (1ull << (STEPPER_SLOT_BITS * (level + 1)))){
+        level++;
+    }
+
+    uint32_t slot = (uint32_t) (task->expire >> (STEPPER_SLOT_BITS * level)) & (STEPPER_SLOTS - 1);
+
+    task->slot = level * STEPPER_SLOTS + slot;
+    task->prev = STEPPER_NONE;
+    task->next = stepper->wheel[level][slot];
+
+    if(task->next != STEPPER_NONE){
+        stepper->tasks[task->next].prev = index;
+    }
+
+    stepper->wheel[level][slot] = index;
+}
+
+/**
+ * Stops the timer of a task.
+ */
+static void stopTimer(struct bcmStepper *const stepper, uint32_t index){
+
+    unlinkEntry(stepper, index);
+
+    if(stepper->tasks[index].isRunning){
+        stepper->tasks[index].isRunning = 0;
+        stepper->nrunning--;
+    }
+}
+
+/**
+ * Schedules the next frame of a task one interval after a tick.
+ * Like the BCM the task uses ival1 while count frames are left and ival2 after
+ * that. Without an interval the timer stops.
+ */
+static void scheduleTask(struct bcmStepper *const stepper, uint32_t index, uint64_t base){
+
+    struct bcmStepTask *const task = &stepper->tasks[index];
+    uint64_t interval = (task->ival1 != 0 && task->count > 0) ? task->ival1 : task->ival2;
+
+    if(interval == 0){
+        stopTimer(stepper, index);
+        return;
+    }
+
+    if(!task->isRunning){
+        task->isRunning = 1;
+        stepper->nrunning++;
+    }
+
+    unlinkEntry(stepper, index);
+
+    task->due    = base + interval;
+    task->expire = task->due;
+    linkEntry(stepper, index);
+}
+
+/**
+ * Sends the frames of the batch with TX_SEND.
+ * Each run of frames of the same type is one createTxSend, so the
+ * frames keep the order they got due in.
+ */
+static void flushBatch(struct bcmContext *const ctx, struct bcmStepper *const stepper){
+
+    uint32_t start = 0;
+
+    while(start < stepper->nbatch){
+
+        uint32_t end = start + 1;
+
+        while(end < stepper->nbatch && stepper->batchIsCANFD[end] == stepper->batchIsCANFD[start]){
+            end++;
+        }
+
+        stepper->failed += (uint32_t) createTxSend(ctx, &stepper->batch[start], (int) (end - start),
+                                                   stepper->batchIsCANFD[start]);
+        start = end;
+    }
+
+    stepper->sent  += stepper->nbatch;
+    stepper->nbatch = 0;
+}
+
+/**
+ * Puts a frame of a task in the batch of the step.
+ */
+static void emitFrame(struct bcmContext *const ctx, struct bcmStepper *const stepper,
+                      struct bcmStepTask const* const task, uint32_t frame){
+
+    if(stepper->nbatch == STEPPER_BATCH_SIZE){
+        flushBatch(ctx, stepper);
+    }
+
+    stepper->batch[stepper->nbatch]        = task->frames[frame];
+    stepper->batchIsCANFD[stepper->nbatch] = task->isCANFD;
+    stepper->nbatch++;
+}
+
+/**
+ * Sends the current frame of a task and moves on to the next frame of its sequence.
+ */
+static void emitTask(struct bcmContext *const ctx, struct bcmStepper *const stepper, struct bcmStepTask *const task){
+
+    emitFrame(ctx, stepper, task, task->currentFrame);
+
+    task->currentFrame = (task->currentFrame + 1) % task->nframes;
+}
+
+/**
+ * Handles a task whose expire tick was reached. Like the timeout handler
+ * of the BCM one frame is sent with ival1 while count frames are left,
+ * otherwise with ival2, then the next frame is scheduled.
+ */
+static void expireTask(struct bcmContext *const ctx, struct bcmStepper *const stepper, uint32_t index){
+
+    struct bcmStepTask *const task = &stepper->tasks[index];
+
+    // The due tick was behind the wheel, check again at the due tick
+    if(task->due > stepper->tick){
+        task->expire = task->due;
+        linkEntry(stepper, index);
+        return;
+    }
+
+    if(task->ival1 != 0 && task->count > 0){
+        task->count--;
+        emitTask(ctx, stepper, task);
+    }else if(task->ival2 != 0){
+        emitTask(ctx, stepper, task);
+    }
+
+    // Note: The next frame is due one interval after the due tick and not
+    // after the current tick, so the simulation time has no drift.
+    scheduleTask(stepper, index, task->due);
+}
+
+/**
+ * Moves the tasks of a slot of a higher level down to the lower levels.
+ */
+static void cascadeSlot(struct bcmStepper *const stepper, uint32_t level, uint32_t slot){
+
+    uint32_t index = stepper->wheel[level][slot];
+
+    stepper->wheel[level][slot] = STEPPER_NONE;
+
+    while(index != STEPPER_NONE){
+
+        uint32_t next = stepper->tasks[index].next;
+
+        linkEntry(stepper, index);
+        index = next;
+    }
+}
+
+/**
+ * Advances the timer wheel by one tick and sends the frames of the tick.
+ */
+static void advanceWheel(struct bcmContext *const ctx, struct bcmStepper *const stepper){
+
+    stepper->tick++;
+
+    // Cascade the next slot of a level each time the level below wrapped around
+    for(uint32_t level = 1; level < STEPPER_LEVELS; level++){
+
+        if((stepper->tick & ((1ull << (STEPPER_SLOT_BITS * level)) - 1)) != 0){
+            break;
+        }
+
+        cascadeSlot(stepper, level, (uint32_t) (stepper->tick >> (STEPPER_SLOT_BITS * level)) & (STEPPER_SLOTS - 1));
+    }
+
+    uint32_t slot  = (uint32_t) stepper->tick & (STEPPER_SLOTS - 1);
+    uint32_t index = stepper->wheel[0][slot];
+
+    // Note: Take the whole list first, the tasks are put in other slots
+    stepper->wheel[0][slot] = STEPPER_NONE;
+
+    while(index != STEPPER_NONE){
+
+        uint32_t next = stepper->tasks[index].next;
+
+        stepper->tasks[index].slot = STEPPER_NONE;
+        stepper->tasks[index].next = STEPPER_NONE;
+        stepper->tasks[index].prev = STEPPER_NONE;
+
+        expireTask(ctx, stepper, index);
+        index = next;
+    }
+}
+
+/**
+ * Sends the frames of the tasks that were announced since the last step.
+ * They are sent first, at the simulation time of the TX_SETUP.
+ */
+static void emitAnnounced(struct bcmContext *const ctx, struct bcmStepper *const stepper){
+
+    for(uint32_t index = 0; index < stepper->nannounced; index++){
+
+        struct bcmStepTask *const task = &stepper->tasks[stepper->announced[index]];
+
+        emitFrame(ctx, stepper, task, task->announceFrame);
+        task->isAnnounced = 0;
+    }
+
+    stepper->nannounced = 0;
+}
+
+/**
+ * Advances the timer wheel to a simulation time. The announced frames are
+ * sent first, then the frames that got due, all with the TX_SEND batches.
+ *
+ * @param ctx     - The context that sends the frames.
+ * @param stepper - The stepper of the context.
+ * @param now     - The simulation time in nanoseconds, not before the current one.
+ */
+static void runStepper(struct bcmContext *const ctx, struct bcmStepper *const stepper, uint64_t now){
+
+    emitAnnounced(ctx, stepper);
+
+    stepper->now = now;
+
+    uint64_t target = stepper->now / STEPPER_TICK_NS;
+
+    while(stepper->tick < target){
+
+        // Note: Without a running timer the wheel is empty, so it can jump to the end of the step
+        if(stepper->nrunning == 0){
+            stepper->tick = target;
+            break;
+        }
+
+        advanceWheel(ctx, stepper);
+    }
+
+    flushBatch(ctx, stepper);
+}
+
+/**
+ * Removes a task from the announced list.
+ */
+static void removeAnnounced(struct bcmStepper *const stepper, uint32_t index){
+
+    for(uint32_t position = 0; position < stepper->nannounced; position++){
+
+        if(stepper->announced[position] == index){
+            memmove(&stepper->announced[position], &stepper->announced[position + 1],
+                    (stepper->nannounced - position - 1) * sizeof(uint32_t));
+            stepper->nannounced--;
+            break;
+        }
+    }
+
+    stepper->tasks[index].isAnnounced = 0;
+}
+
+/**
+ * Returns the number of ticks of a BCM interval, rounded up.
+ */
+static uint64_t getIntervalTicks(struct bcm_timeval ival){
+
+    uint64_t ns = (uint64_t) ival.tv_sec * 1000000000u + (uint64_t) ival.tv_usec * 1000u;
+
+    return (ns + STEPPER_TICK_NS - 1) / STEPPER_TICK_NS;
+}
+
+/**
+ * Applies a TX_DELETE message.
+ */
+static int holdTxDelete(struct bcmStepper *const stepper, struct bcm_msg_head const* const head){
+
+    uint32_t index = findEntry(stepper, head->can_id, (head->flags & CAN_FD_FRAME) != 0);
+    struct bcmStepTask *const task = &stepper->tasks[index];
+
+    // Note: Like the BCM a task that does not exist can not be deleted
+    if(!task->isUsed || !task->isActive){
+        errno = EINVAL;
+        return -1;
+    }
+
+    stopTimer(stepper, index);
+
+    if(task->isAnnounced){
+        removeAnnounced(stepper, index);
+    }
+
+    task->isActive = 0;
+    return 1;
+}
+
+/**
+ * Applies a TX_SETUP like bcm_tx_setup of the BCM. The frames follow each
+ * other with frameSize bytes, the number of frames is not limited.
+ */
+static int applyTxSetup(struct bcmStepper *const stepper, struct bcm_msg_head const* const head,
+                        unsigned char const* const data, size_t frameSize){
+
+    int isCANFD = (head->flags & CAN_FD_FRAME) != 0;
+
+    uint32_t index = findEntry(stepper, head->can_id, isCANFD);
+    struct bcmStepTask *const task = &stepper->tasks[index];
+
+    if(!task->isUsed){
+
+        if(stepper->nused >= stepper->capacity){
+            printf("Error the stepper can not run more than %u cyclic tasks \n", stepper->capacity);
+            errno = ENOMEM;
+            return -1;
+        }
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(task, 0, sizeof(struct bcmStepTask));
+
+        task->canID   = head->can_id;
+        task->isCANFD = (uint8_t) isCANFD;
+        task->isUsed  = 1;
+        task->slot    = STEPPER_NONE;
+        task->next    = STEPPER_NONE;
+        task->prev    = STEPPER_NONE;
+        stepper->nused++;
+    }
+
+    // Note: Like the BCM an existing task can not grow, a new one takes
+    // the place of a deleted task and keeps its frames.
+    if(task->isActive && head->nframes > task->nframes){
+        errno = E2BIG;
+        return -1;
+    }
+
+    if(head->nframes > task->frameCapacity){
+
+        struct canfd_frame *frames = realloc(task->frames, head->nframes * sizeof(struct canfd_frame));
+
+        if(frames == NULL){
+            errno = ENOMEM;
+            return -1;
+        }
+
+        task->frames        = frames;
+        task->frameCapacity = head->nframes;
+    }
+
+    for(uint32_t frame = 0; frame < head->nframes; frame++){
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(&task->frames[frame], 0, sizeof(struct canfd_frame));
+        memcpy(&task->frames[frame], data + frame * frameSize, frameSize);
+
+        if(head->flags & TX_CP_CAN_ID){
+            task->frames[frame].can_id = head->can_id;
+        }
+    }
+
+    if(!task->isActive || task->nframes != head->nframes || (head->flags & TX_RESET_MULTI_IDX)){
+        task->nframes      = head->nframes;
+        task->currentFrame = 0;
+
+        // Note: An announce that waits for the next step must not point past the new frames
+        if(task->announceFrame >= task->nframes){
+            task->announceFrame = 0;
+        }
+    }
+
+    if(!task->isActive || (head->flags & SETTIMER)){
+        task->count = head->count;
+    }
+
+    task->isActive = 1;
+
+    if(head->flags & SETTIMER){
+
+        task->ival1 = getIntervalTicks(head->ival1);
+        task->ival2 = getIntervalTicks(head->ival2);
+
+        if(task->ival1 == 0 && task->ival2 == 0){
+            stopTimer(stepper, index);
+        }
+    }
+
+    // Note: Like the BCM STARTTIMER sends the first frame right away. The frame is
+    // sent at the start of the next step, that is the simulation time of the setup.
+    if(head->flags & (STARTTIMER | TX_ANNOUNCE)){
+
+        if(!task->isAnnounced){
+            task->isAnnounced = 1;
+            stepper->announced[stepper->nannounced++] = index;
+        }
+
+        task->announceFrame = task->currentFrame;
+        task->currentFrame  = (task->currentFrame + 1) % task->nframes;
+
+        if(task->count > 0){
+            task->count--;
+        }
+    }
+
+    if(head->flags & STARTTIMER){
+        scheduleTask(stepper, index, stepper->tick);
+    }
+
+    return 1;
+}
+
+/**
+ * Applies a TX_SETUP message like bcm_tx_setup of the BCM.
+ */
+static int holdTxSetup(struct bcmStepper *const stepper, struct bcm_msg_head const* const head, size_t size){
+
+    int isCANFD      = (head->flags & CAN_FD_FRAME) != 0;
+    size_t frameSize = isCANFD ? sizeof(struct canfd_frame) : sizeof(struct can_frame);
+
+    if(head->nframes < 1 || head->nframes > MAXFRAMES ||
+       size < sizeof(struct bcm_msg_head) + head->nframes * frameSize){
+        errno = EINVAL;
+        return -1;
+    }
+
+    return applyTxSetup(stepper, head, (unsigned char const*) (head + 1), frameSize);
+}
+
+/**
+ * Returns the simulation time of a sequencer, the monotonic time since its setup in nanoseconds.
+ */
+static uint64_t getSequencerTime(struct bcmSequencer const* const sequencer){
+
+    uint64_t now = getStatsTime();
+
+    return now > sequencer->origin ? now - sequencer->origin : 0;
+}
+
+/**
+ * Arms the timerfd of a sequencer at the due time of its next frame or
+ * stops it if no timer runs.
+ *
+ * Note: A sequencer only runs the few sequences the BCM can not run, so
+ * scanning its table is cheaper than keeping the earliest due time.
+ */
+static void armSequencer(struct bcmSequencer *const sequencer){
+
+    struct bcmStepper const* const stepper = &sequencer->stepper;
+    struct itimerspec timer;    // The expiration of the timerfd (0 = stopped)
+    uint64_t due = UINT64_MAX;  // The earliest due tick of the running tasks
+
+    for(uint32_t index = 0; stepper->nrunning > 0 && index <= stepper->mask; index++){
+
+        struct bcmStepTask const* const task = &stepper->tasks[index];
+
+        if(task->isRunning && task->due < due){
+            due = task->due;
+        }
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&timer, 0, sizeof(timer));
+
+    if(due != UINT64_MAX){
+
+        uint64_t at = sequencer->origin + due * STEPPER_TICK_NS;
+
+        timer.it_value.tv_sec  = (time_t) (at / 1000000000u);
+        timer.it_value.tv_nsec = (long) (at % 1000000000u);
+    }
+
+    if(timerfd_settime(sequencer->timerFD, TFD_TIMER_ABSTIME, &timer, NULL) < 0){
+        printf("Error could not arm the sequencer timer: %s\n", strerror(errno));
+    }
+}
+
+/**
+ * Brings a sequencer up to the current time before one of its tasks is changed,
+ * so the change takes effect now and not at the time of the last run.
+ */
+static void syncSequencer(struct bcmContext *const ctx, struct bcmSequencer *const sequencer){
+
+    runStepper(ctx, &sequencer->stepper, getSequencerTime(sequencer));
+}
+
+/**
+ * Sends the frames a change of a sequencer task announced right away, like
+ * STARTTIMER and TX_ANNOUNCE of the BCM, and arms the timer for the next frame.
+ */
+static void restartSequencer(struct bcmContext *const ctx, struct bcmSequencer *const sequencer){
+
+    runStepper(ctx, &sequencer->stepper, sequencer->stepper.now);
+    armSequencer(sequencer);
+}
+
+int setupStepper(struct bcmStepper *const stepper, uint32_t capacity){
+
+    uint32_t nentries = 2;
+    uint32_t bits     = 1;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(stepper, 0, sizeof(struct bcmStepper));
+
+    if(capacity == 0){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Use at least twice as many entries as tasks to keep the probe sequences short
+    while(nentries < 2 * capacity){
+        nentries <<= 1;
+        bits++;
+    }
+
+    stepper->tasks        = calloc(nentries, sizeof(struct bcmStepTask));
+    stepper->announced    = calloc(nentries, sizeof(uint32_t));
+    stepper->batch        = calloc(STEPPER_BATCH_SIZE, sizeof(struct canfd_frame));
+    stepper->batchIsCANFD = calloc(STEPPER_BATCH_SIZE, sizeof(uint8_t));
+
+    if(stepper->tasks == NULL || stepper->announced == NULL || stepper->batch == NULL || stepper->batchIsCANFD == NULL){
+        printf("Error could not allocate memory for the stepper \n");
+        freeStepper(stepper);
+        return ERR_MALLOC_FAILED;
+    }
+
+    stepper->capacity = capacity;
+    stepper->mask     = nentries - 1;
+    stepper->shift    = 64 - bits;
+
+    memset(stepper->wheel, 0xFF, sizeof(stepper->wheel));
+
+    return RET_E_OK;
+}
+
+void freeStepper(struct bcmStepper *const stepper){
+
+    if(stepper->tasks != NULL){
+        for(uint32_t index = 0; index <= stepper->mask; index++){
+            free(stepper->tasks[index].frames);
+        }
+    }
+
+    free(stepper->tasks);
+    free(stepper->announced);
+    free(stepper->batch);
+    free(stepper->batchIsCANFD);
+
+    stepper->tasks        = NULL;
+    stepper->announced    = NULL;
+    stepper->batch        = NULL;
+    stepper->batchIsCANFD = NULL;
+    stepper->capacity     = 0;
+    stepper->nused        = 0;
+    stepper->nrunning     = 0;
+    stepper->nannounced   = 0;
+    stepper->nbatch       = 0;
+}
+
+int holdStepMessage(struct bcmStepper *const stepper, void const* const msg, size_t size){
+
+    struct bcm_msg_head const* const head = msg;
+
+    if(size < sizeof(struct bcm_msg_head)){
+        return 0;
+    }
+
+    switch(head->opcode){
+
+        case TX_SETUP:
+            return holdTxSetup(stepper, head, size);
+
+        case TX_DELETE:
+            return holdTxDelete(stepper, head);
+
+        // Note: TX_SEND and the RX filters still go to the BCM
+        default:
+            return 0;
+    }
+}
+
+int holdStepSequence(struct bcmStepper *const stepper, struct canfd_frame const frames[], uint32_t nframes,
+                     uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    struct bcm_msg_head head;
+
+    if(nframes < 1){
+        errno = EINVAL;
+        return -1;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&head, 0, sizeof(struct bcm_msg_head));
+
+    head.opcode  = TX_SETUP;
+    head.flags   = SETTIMER | STARTTIMER | (isCANFD ? CAN_FD_FRAME : 0);
+    head.count   = count;
+    head.ival1   = ival1;
+    head.ival2   = ival2;
+    head.can_id  = frames[0].can_id;
+    head.nframes = nframes;
+
+    return applyTxSetup(stepper, &head, (unsigned char const*) frames, sizeof(struct canfd_frame));
+}
+
+int stepChannel(struct bcmContext *const ctx, uint64_t duration){
+
+    struct bcmStepper *const stepper = ctx->stepper;
+    struct bcmEvent event;
+
+    stepper->sent   = 0;
+    stepper->failed = 0;
+
+    runStepper(ctx, stepper, stepper->now + duration);
+
+    addStatsCounter(STATS_STEPS, 1);
+    addStatsCounter(STATS_STEP_FRAMES, stepper->sent - stepper->failed);
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&event, 0, sizeof(event));
+
+    event.timestamp    = getStatsRealtime();
+    event.type         = EVENT_STEP_DONE;
+    event.channel      = (uint8_t) ctx->channel;
+    event.step.time    = stepper->now;
+    event.step.nframes = stepper->sent;
+    event.step.failed  = stepper->failed;
+
+    if(ctx->eventQueue != NULL && enqueueEvent(ctx->eventQueue, &event)){
+        addStatsCounter(STATS_EVENTS, 1);
+    }else{
+        addStatsCounter(STATS_EVENTS_DROPPED, 1);
+    }
+
+    return (int) stepper->failed;
+}
+
+
+int setupSequencer(struct bcmSequencer *const sequencer, uint32_t capacity){
+
+    int ret = setupStepper(&sequencer->stepper, capacity);
+
+    sequencer->timerFD = -1;
+
+    if(ret != RET_E_OK){
+        return ret;
+    }
+
+    sequencer->timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if(sequencer->timerFD < 0){
+        printf("Error could not create the sequencer timer: %s\n", strerror(errno));
+        freeStepper(&sequencer->stepper);
+        return ERR_EPOLL_FAILED;
+    }
+
+    sequencer->origin = getStatsTime();
+
+    return RET_E_OK;
+}
+
+void freeSequencer(struct bcmSequencer *const sequencer){
+
+    // Note: Only a set up sequencer has a table, so a zeroed sequencer closes nothing
+    if(sequencer->stepper.tasks != NULL && sequencer->timerFD >= 0){
+        close(sequencer->timerFD);
+    }
+
+    sequencer->timerFD = -1;
+    freeStepper(&sequencer->stepper);
+}
+
+int holdSequencerMessage(struct bcmContext *const ctx, void const* const msg, size_t size){
+
+    struct bcmSequencer *const sequencer  = ctx->sequencer;
+    struct bcm_msg_head const* const head = msg;
+
+    if(size < sizeof(struct bcm_msg_head) || (head->opcode != TX_SETUP && head->opcode != TX_DELETE)){
+        return 0;
+    }
+
+    struct bcmStepTask const* const task =
+        &sequencer->stepper.tasks[findEntry(&sequencer->stepper, head->can_id, (head->flags & CAN_FD_FRAME) != 0)];
+
+    // Note: Every task that is not a long sequence runs in the BCM
+    if(!task->isUsed || !task->isActive){
+        return 0;
+    }
+
+    syncSequencer(ctx, sequencer);
+
+    int held = holdStepMessage(&sequencer->stepper, msg, size);
+
+    restartSequencer(ctx, sequencer);
+
+    return held;
+}
+
+int holdSequencerSequence(struct bcmContext *const ctx, struct canfd_frame const frames[], uint32_t nframes,
+                          uint32_t count, struct bcm_timeval ival1, struct bcm_timeval ival2, int isCANFD){
+
+    struct bcmSequencer *const sequencer = ctx->sequencer;
+
+    syncSequencer(ctx, sequencer);
+
+    int held = holdStepSequence(&sequencer->stepper, frames, nframes, count, ival1, ival2, isCANFD);
+
+    restartSequencer(ctx, sequencer);
+
+    return held;
+}
+
+int runSequencer(struct bcmContext *const ctx){
+
+    struct bcmSequencer *const sequencer = ctx->sequencer;
+    uint64_t expirations = 0; // Number of expirations since the last read
+
+    // Note: The timerfd is non-blocking so this returns immediately if nothing is pending.
+    // The sequencer catches up on the current time anyway, so the count is not needed.
+    if(read(sequencer->timerFD, &expirations, sizeof(expirations)) != sizeof(expirations)){
+        return 0;
+    }
+
+    sequencer->stepper.sent   = 0;
+    sequencer->stepper.failed = 0;
+
+    syncSequencer(ctx, sequencer);
+    armSequencer(sequencer);
+
+    return (int) sequencer->stepper.sent;
+}
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
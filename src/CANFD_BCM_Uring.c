@@ -0,0 +1,544 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Uring.c
+ \brief     Provides the io_uring backend for the BCM control messages and the multishot receive.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Uring.h"
+#include "CANFD_BCM_Worker.h"
+#include <errno.h>
+#include <linux/io_uring.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define URING_NO_SLOT UINT32_MAX // Marks the end of the free list of the slots
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Enters the kernel to submit the queued entries and optionally wait for completions.
+ *
+ * @param uring       - The io_uring.
+ * @param minComplete - The number of completions to wait for (0 = do not wait).
+ * @return The number of submitted entries or ERR_URING_FAILED.
+ */
+static int enterUring(struct bcmUring *const uring, uint32_t minComplete){
+
+    int ret;
+
+    do{
+        ret = (int) syscall(__NR_io_uring_enter, uring->ringFD, uring->queued, minComplete,
+                            minComplete > 0 ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+    }while(ret < 0 && errno == EINTR);
+
+    addStatsCounter(STATS_URING_SUBMITS, 1);
+
+    if(ret < 0){
+        printf("Error could not submit to the io_uring: %s\n", strerror(errno));
+        return ERR_URING_FAILED;
+    }
+
+    uring->queued -= (uint32_t) ret;
+    return ret;
+}
+
+/**
+ * Returns the next free submission entry or NULL if the submission ring is full.
+ * The entry is zeroed and becomes visible to the kernel with commitEntry.
+ */
+static struct io_uring_sqe* getEntry(struct bcmUring *const uring){
+
+    uint32_t head = atomic_load_explicit((_Atomic uint32_t *) uring->sqHead, memory_order_acquire);
+    uint32_t tail = *uring->sqTail;
+
+    if(tail - head >= uring->sqEntries){
+        return NULL;
+    }
+
+    struct io_uring_sqe *const sqe = &uring->sqes[tail & uring->sqMask];
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    return sqe;
+}
+
+/**
+ * Hands the entry returned by getEntry to the kernel.
+ */
+static void commitEntry(struct bcmUring *const uring){
+
+    uint32_t tail = *uring->sqTail;
+
+    uring->sqArray[tail & uring->sqMask] = tail & uring->sqMask;
+    atomic_store_explicit((_Atomic uint32_t *) uring->sqTail, tail + 1, memory_order_release);
+
+    uring->queued++;
+}
+
+/**
+ * Gives a receive buffer back to the kernel.
+ */
+static void recycleBuffer(struct bcmUring *const uring, uint16_t bid){
+
+    struct io_uring_buf *const buf = &uring->bufRing->bufs[uring->bufTail & (uring->nbuffers - 1)];
+
+    buf->addr = (uint64_t) (uintptr_t) (uring->buffers + (size_t) bid * URING_BUFFER_SIZE);
+    buf->len  = URING_BUFFER_SIZE;
+    buf->bid  = bid;
+
+    uring->bufTail++;
+    atomic_store_explicit((_Atomic uint16_t *) &uring->bufRing->tail, uring->bufTail, memory_order_release);
+}
+
+/**
+ * Maps the rings of a created io_uring.
+ *
+ * @param uring  - The io_uring with a valid ringFD.
+ * @param params - The parameters returned by io_uring_setup.
+ * @return RET_E_OK or ERR_MMAP_FAILED.
+ */
+static int mapRings(struct bcmUring *const uring, struct io_uring_params const* const params){
+
+    uring->sqRingSize = params->sq_off.array + params->sq_entries * sizeof(uint32_t);
+    uring->cqRingSize = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+    uring->sqesSize   = params->sq_entries * sizeof(struct io_uring_sqe);
+
+    // Note: Newer kernels put both rings in one mapping
+    if(params->features & IORING_FEAT_SINGLE_MMAP){
+        uring->sqRingSize = uring->sqRingSize > uring->cqRingSize ? uring->sqRingSize : uring->cqRingSize;
+        uring->cqRingSize = 0;
+    }
+
+    uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFD,
+                         IORING_OFF_SQ_RING);
+    uring->cqRing = uring->sqRing;
+
+    if(uring->sqRing != MAP_FAILED && uring->cqRingSize > 0){
+        uring->cqRing = mmap(NULL, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                             uring->ringFD, IORING_OFF_CQ_RING);
+    }
+
+    uring->sqes = mmap(NULL, uring->sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->ringFD,
+                       IORING_OFF_SQES);
+
+    if(uring->sqRing == MAP_FAILED || uring->cqRing == MAP_FAILED || uring->sqes == MAP_FAILED){
+        printf("Error could not map the io_uring: %s\n", strerror(errno));
+        return ERR_MMAP_FAILED;
+    }
+
+    unsigned char *const sq = uring->sqRing;
+    unsigned char *const cq = uring->cqRing;
+
+    uring->sqHead    = (uint32_t *) (sq + params->sq_off.head);
+    uring->sqTail    = (uint32_t *) (sq + params->sq_off.tail);
+    uring->sqArray   = (uint32_t *) (sq + params->sq_off.array);
+    uring->sqFlags   = (uint32_t *) (sq + params->sq_off.flags);
+    uring->sqMask    = *(uint32_t *) (sq + params->sq_off.ring_mask);
+    uring->sqEntries = params->sq_entries;
+
+    uring->cqHead = (uint32_t *) (cq + params->cq_off.head);
+    uring->cqTail = (uint32_t *) (cq + params->cq_off.tail);
+    uring->cqMask = *(uint32_t *) (cq + params->cq_off.ring_mask);
+    uring->cqes   = (struct io_uring_cqe *) (cq + params->cq_off.cqes);
+
+    return RET_E_OK;
+}
+
+/**
+ * Allocates the receive buffers and registers them as provided buffer ring.
+ *
+ * @param uring    - The io_uring.
+ * @param nbuffers - The number of receive buffers (power of two).
+ * @return RET_E_OK, ERR_MALLOC_FAILED or ERR_URING_FAILED.
+ */
+static int setupBuffers(struct bcmUring *const uring, uint32_t nbuffers){
+
+    struct io_uring_buf_reg reg;
+    void *ring    = NULL;
+    void *buffers = NULL;
+
+    // Note: The kernel needs the buffer ring page aligned
+    if(posix_memalign(&ring, (size_t) sysconf(_SC_PAGESIZE), nbuffers * sizeof(struct io_uring_buf)) != 0 ||
+       posix_memalign(&buffers, CACHE_LINE_SIZE, (size_t) nbuffers * URING_BUFFER_SIZE) != 0){
+        printf("Error could not allocate memory for the io_uring receive buffers \n");
+        free(ring);
+        return ERR_MALLOC_FAILED;
+    }
+
+    uring->bufRing  = ring;
+    uring->buffers  = buffers;
+    uring->nbuffers = nbuffers;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(ring, 0, nbuffers * sizeof(struct io_uring_buf));
+    memset(&reg, 0, sizeof(reg));
+
+    reg.ring_addr    = (uint64_t) (uintptr_t) ring;
+    reg.ring_entries = nbuffers;
+    reg.bgid         = URING_BUFFER_GROUP;
+
+    if(syscall(__NR_io_uring_register, uring->ringFD, IORING_REGISTER_PBUF_RING, &reg, 1) < 0){
+        printf("Error could not register the io_uring receive buffers: %s\n", strerror(errno));
+        return ERR_URING_FAILED;
+    }
+
+    for(uint32_t bid = 0; bid < nbuffers; bid++){
+        recycleBuffer(uring, (uint16_t) bid);
+    }
+
+    // Note: The multishot receive only needs the size of the control messages
+    memset(&uring->recvHdr, 0, sizeof(uring->recvHdr));
+    uring->recvHdr.msg_controllen = sizeof(union bcmRxControl);
+
+    return RET_E_OK;
+}
+
+int setupUring(struct bcmUring *const uring, struct bcmContext *const ctx, uint32_t entries, uint32_t nbuffers){
+
+    struct io_uring_params params;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(uring, 0, sizeof(struct bcmUring));
+    memset(&params, 0, sizeof(params));
+    uring->ringFD = -1;
+    uring->ctx    = ctx;
+
+    // Note: Each receive buffer can be a completion while all messages are in flight
+    params.flags      = IORING_SETUP_CQSIZE;
+    params.cq_entries = 2 * (entries + nbuffers);
+
+    // Note: The buffer IDs of the kernel are 16 bit
+    if(entries == 0 || (entries & (entries - 1)) != 0 || (nbuffers & (nbuffers - 1)) != 0 || nbuffers > 32768){
+        printf("Error the io_uring needs a power of two of entries and receive buffers \n");
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    uring->ringFD = (int) syscall(__NR_io_uring_setup, entries, &params);
+
+    if(uring->ringFD < 0){
+        printf("Error could not create the io_uring: %s\n", strerror(errno));
+        return ERR_URING_FAILED;
+    }
+
+    int retCode = mapRings(uring, &params);
+
+    if(retCode != RET_E_OK){
+        freeUring(uring);
+        return retCode;
+    }
+
+    // One slot per submission entry, all of them are free
+    uring->nslots = params.sq_entries;
+    uring->slots  = calloc(uring->nslots, sizeof(struct bcmUringSlot));
+
+    if(uring->slots == NULL){
+        printf("Error could not allocate memory for the io_uring \n");
+        freeUring(uring);
+        return ERR_MALLOC_FAILED;
+    }
+
+    for(uint32_t slot = 0; slot < uring->nslots; slot++){
+        uring->slots[slot].next = slot + 1 < uring->nslots ? slot + 1 : URING_NO_SLOT;
+    }
+
+    uring->freeSlot = 0;
+
+    if(nbuffers > 0){
+
+        retCode = setupBuffers(uring, nbuffers);
+
+        if(retCode != RET_E_OK){
+            freeUring(uring);
+            return retCode;
+        }
+    }
+
+    return RET_E_OK;
+}
+
+void freeUring(struct bcmUring *const uring){
+
+    if(uring->ringFD >= 0 && uring->slots != NULL){
+        flushUring(uring);
+    }
+
+    // Note: Closing the ring cancels the multishot receive
+    if(uring->sqes != NULL && uring->sqes != MAP_FAILED){
+        munmap(uring->sqes, uring->sqesSize);
+    }
+
+    if(uring->cqRingSize > 0 && uring->cqRing != NULL && uring->cqRing != MAP_FAILED){
+        munmap(uring->cqRing, uring->cqRingSize);
+    }
+
+    if(uring->sqRing != NULL && uring->sqRing != MAP_FAILED){
+        munmap(uring->sqRing, uring->sqRingSize);
+    }
+
+    if(uring->ringFD >= 0){
+        close(uring->ringFD);
+    }
+
+    free(uring->slots);
+    free(uring->bufRing);
+    free(uring->buffers);
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(uring, 0, sizeof(struct bcmUring));
+    uring->ringFD = -1;
+}
+
+int queueUringMessage(struct bcmUring *const uring, void const* const msg, size_t size){
+
+    struct io_uring_sqe *sqe = NULL;
+
+    if(size > sizeof(struct bcmMsgSingleFrameCanFD)){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Make room by submitting and, if all slots are in flight, waiting for the oldest messages
+    while(uring->freeSlot == URING_NO_SLOT || (sqe = getEntry(uring)) == NULL){
+
+        if(enterUring(uring, uring->freeSlot == URING_NO_SLOT ? 1 : 0) < 0){
+            return ERR_URING_FAILED;
+        }
+
+        processUring(uring);
+    }
+
+    uint32_t index = uring->freeSlot;
+    struct bcmUringSlot *const slot = &uring->slots[index];
+
+    uring->freeSlot = slot->next;
+
+    // Note: The kernel reads the message when it handles the entry, so it gets its own copy
+    memcpy(&slot->msg, msg, size);
+    memset(&slot->hdr, 0, sizeof(slot->hdr));
+
+    slot->iov.iov_base    = &slot->msg;
+    slot->iov.iov_len     = size;
+    slot->hdr.msg_iov     = &slot->iov;
+    slot->hdr.msg_iovlen  = 1;
+    slot->queued          = getStatsTime();
+
+    sqe->opcode    = IORING_OP_SENDMSG;
+    sqe->fd        = uring->ctx->socketFD;
+    sqe->addr      = (uint64_t) (uintptr_t) &slot->hdr;
+    sqe->len       = 1;
+    sqe->user_data = index;
+
+    commitEntry(uring);
+    uring->inflight++;
+    addStatsCounter(STATS_URING_QUEUED, 1);
+
+    if(uring->depth == 0){
+        enterUring(uring, 0);
+    }
+
+    return RET_E_OK;
+}
+
+void beginUringBatch(struct bcmUring *const uring){
+
+    uring->depth++;
+}
+
+void endUringBatch(struct bcmUring *const uring){
+
+    uring->depth--;
+
+    if(uring->depth == 0 && uring->queued > 0){
+        enterUring(uring, 0);
+    }
+}
+
+void flushUring(struct bcmUring *const uring){
+
+    if(uring->queued > 0){
+        enterUring(uring, 0);
+    }
+
+    while(uring->inflight > 0){
+
+        // Note: The completions of the multishot receive wake us up too
+        if(processUring(uring) == 0 && enterUring(uring, 1) < 0){
+            return;
+        }
+    }
+}
+
+int startUringReceive(struct bcmUring *const uring){
+
+    struct io_uring_sqe *sqe;
+
+    if(uring->bufRing == NULL || uring->isReceiving || uring->ctx->isDown){
+        return RET_E_OK;
+    }
+
+    while((sqe = getEntry(uring)) == NULL){
+
+        if(enterUring(uring, 0) < 0){
+            return ERR_URING_FAILED;
+        }
+    }
+
+    // Note: The kernel picks a provided buffer for each received message
+    sqe->opcode    = IORING_OP_RECVMSG;
+    sqe->fd        = uring->ctx->socketFD;
+    sqe->addr      = (uint64_t) (uintptr_t) &uring->recvHdr;
+    sqe->len       = 1;
+    sqe->ioprio    = IORING_RECV_MULTISHOT;
+    sqe->flags     = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = URING_RECV_TAG;
+
+    commitEntry(uring);
+    uring->isReceiving = 1;
+
+    if(uring->depth == 0 && enterUring(uring, 0) < 0){
+        return ERR_URING_FAILED;
+    }
+
+    return RET_E_OK;
+}
+
+/**
+ * Hands a message of the multishot receive to the receive path.
+ *
+ * @param uring - The io_uring.
+ * @param cqe   - The completion of the message.
+ */
+static void processReceiveCompletion(struct bcmUring *const uring, struct io_uring_cqe const* const cqe){
+
+    struct msghdr hdr; // The header that points the timestamp parser to the control messages
+
+    if(!(cqe->flags & IORING_CQE_F_MORE)){
+        uring->isReceiving = 0;
+    }
+
+    if(cqe->res < 0){
+
+        // Note: Running out of buffers only stops the receive until it is armed again
+        if(cqe->res != -ENOBUFS){
+            printf("Error could not receive on the io_uring: %s\n", strerror(-cqe->res));
+        }
+
+        if(isFatalSocketError(-cqe->res)){
+            shutdownChannel(uring->ctx, -cqe->res);
+        }
+        return;
+    }
+
+    if(!(cqe->flags & IORING_CQE_F_BUFFER)){
+        return;
+    }
+
+    uint16_t bid = (uint16_t) (cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    unsigned char *const buffer = uring->buffers + (size_t) bid * URING_BUFFER_SIZE;
+    struct io_uring_recvmsg_out const* const out = (struct io_uring_recvmsg_out const*) buffer;
+
+    // Note: The layout is the header, the name, the reserved control space and the payload
+    unsigned char *const control = buffer + sizeof(struct io_uring_recvmsg_out) + uring->recvHdr.msg_namelen;
+    unsigned char *const payload = control + uring->recvHdr.msg_controllen;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&hdr, 0, sizeof(hdr));
+
+    hdr.msg_control    = control;
+    hdr.msg_controllen = out->controllen;
+
+    addStatsCounter(STATS_MESSAGES, 1);
+    processReceivedMessage(uring->ctx, (struct bcmMsgSingleFrameCanFD const*) payload, (int) out->payloadlen, &hdr);
+
+    recycleBuffer(uring, bid);
+}
+
+int processUring(struct bcmUring *const uring){
+
+    struct bcmMsgSingleFrameCanFD msg; // The copy of a message whose slot is released before it is handled
+    int processed = 0;
+
+    // Note: If the completion ring was full the kernel keeps the completions
+    // back until they are asked for. Lost completions would leak slots.
+    if(atomic_load_explicit((_Atomic uint32_t *) uring->sqFlags, memory_order_relaxed) & IORING_SQ_CQ_OVERFLOW){
+        syscall(__NR_io_uring_enter, uring->ringFD, 0, 0, IORING_ENTER_GETEVENTS, NULL, 0);
+    }
+
+    while(1){
+
+        uint32_t head = *uring->cqHead;
+        uint32_t tail = atomic_load_explicit((_Atomic uint32_t *) uring->cqTail, memory_order_acquire);
+
+        if(head == tail){
+            break;
+        }
+
+        // Note: The entry is released before it is handled. A handler that
+        // queues messages can process completions again without seeing it twice.
+        struct io_uring_cqe cqe = uring->cqes[head & uring->cqMask];
+        atomic_store_explicit((_Atomic uint32_t *) uring->cqHead, head + 1, memory_order_release);
+
+        processed++;
+
+        if(cqe.user_data == URING_RECV_TAG){
+            processReceiveCompletion(uring, &cqe);
+            continue;
+        }
+
+        // Release the slot before the result is handled, the handler may queue messages.
+        // Note: Only a failed message is copied as a whole, it may be sent again.
+        uint32_t index = (uint32_t) cqe.user_data;
+        size_t size    = cqe.res < 0 ? uring->slots[index].iov.iov_len : sizeof(struct bcm_msg_head);
+        uint64_t queued = uring->slots[index].queued;
+
+        memcpy(&msg, &uring->slots[index].msg, size);
+
+        uring->slots[index].next = uring->freeSlot;
+        uring->freeSlot = index;
+        uring->inflight--;
+
+        processControlCompletion(uring->ctx, &msg, size, cqe.res, queued);
+    }
+
+    // The kernel stops a multishot receive e.g. when it ran out of buffers
+    if(uring->bufRing != NULL && !uring->isReceiving && processed > 0){
+        startUringReceive(uring);
+    }
+
+    return processed;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
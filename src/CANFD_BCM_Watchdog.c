@@ -0,0 +1,564 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Watchdog.c
+ \brief     Provides the supervision of cyclic RX CAN IDs with a hierarchical timer wheel.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Watchdog.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+#define WATCHDOG_TICK_NS   ((uint64_t) WATCHDOG_TICK_MS * 1000000u)   // The tick in nanoseconds
+#define WATCHDOG_SILENT_NS ((uint64_t) WATCHDOG_SILENT_MS * 1000000u) // The silence of a bus in nanoseconds
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Returns the home entry of a CAN ID (fibonacci hashing).
+ */
+static uint32_t getHomeEntry(struct bcmWatchdog const* const watchdog, canid_t canID, int isCANFD){
+
+    uint64_t key = (uint64_t) canID | ((uint64_t) (isCANFD ? 1 : 0) << 32);
+
+    return (uint32_t) ((key * 0x9E3779B97F4A7C15ull) >> watchdog->shift);
+}
+
+/**
+ * Finds the entry of a CAN ID.
+ *
+ * @return The entry or the unused entry where the CAN ID would be inserted.
+ */
+static uint32_t findEntry(struct bcmWatchdog const* const watchdog, canid_t canID, int isCANFD){
+
+    uint32_t index = getHomeEntry(watchdog, canID, isCANFD);
+
+    // Note: The table is at most half full, so there is always an unused entry
+    while(watchdog->entries[index].isUsed &&
+          (watchdog->entries[index].canID != canID || watchdog->entries[index].isCANFD != (isCANFD ? 1 : 0))){
+        index = (index + 1) & watchdog->mask;
+    }
+
+    return index;
+}
+
+/**
+ * Returns the supervised entry of a CAN ID or NULL.
+ */
+static struct bcmWatchEntry* getWatchedEntry(struct bcmWatchdog *const watchdog, canid_t canID, int isCANFD){
+
+    struct bcmWatchEntry *const entry = &watchdog->entries[findEntry(watchdog, canID, isCANFD)];
+
+    return entry->isUsed && entry->isWatched ? entry : NULL;
+}
+
+/**
+ * Removes an entry from its slot of the timer wheel.
+ */
+static void unlinkEntry(struct bcmWatchdog *const watchdog, uint32_t index){
+
+    struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+    if(entry->slot == WATCHDOG_NONE){
+        return;
+    }
+
+    if(entry->prev != WATCHDOG_NONE){
+        watchdog->entries[entry->prev].next = entry->next;
+    }else{
+        watchdog->wheel[entry->slot / WATCHDOG_SLOTS][entry->slot % WATCHDOG_SLOTS] = entry->next;
+    }
+
+    if(entry->next != WATCHDOG_NONE){
+        watchdog->entries[entry->next].prev = entry->prev;
+    }
+
+    entry->slot = WATCHDOG_NONE;
+    entry->next = WATCHDOG_NONE;
+    entry->prev = WATCHDOG_NONE;
+}
+
+/**
+ * Puts an entry in the slot of its expire tick.
+ * The level is chosen by the distance to the current tick, so an entry is
+ * moved down at most WATCHDOG_LEVELS - 1 times before it expires.
+ */
+static void linkEntry(struct bcmWatchdog *const watchdog, uint32_t index){
+
+    struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+    // Note: Deadlines behind the wheel are checked with the next tick. An entry
+    // that is cascaded at its expire tick goes to the slot that is checked next.
+    if(entry->expire < watchdog->tick){
+        entry->expire = watchdog->tick + 1;
+    }else if(entry->expire - watchdog->tick >= WATCHDOG_SPAN){
+        entry->expire = watchdog->tick + WATCHDOG_SPAN - 1;
+    }
+
+    uint64_t delta = entry->expire - watchdog->tick;
+    uint32_t level = 0;
+
+    while(level + 1 < WATCHDOG_LEVELS && delta >= (1ull << (WATCHDOG_SLOT_BITS * (level + 1)))){
+        level++;
+    }
+
+    uint32_t slot = (uint32_t) (entry->expire >> (WATCHDOG_SLOT_BITS * level)) & (WATCHDOG_SLOTS - 1);
+
+    entry->slot = level * WATCHDOG_SLOTS + slot;
+    entry->prev = WATCHDOG_NONE;
+    entry->next = watchdog->wheel[level][slot];
+
+    if(entry->next != WATCHDOG_NONE){
+        watchdog->entries[entry->next].prev = index;
+    }
+
+    watchdog->wheel[level][slot] = index;
+}
+
+/**
+ * Returns the time a frame may be missing before one cycle is missed.
+ * One tick is added because the times are only as exact as the tick.
+ */
+static uint64_t getAllowance(struct bcmWatchEntry const* const entry){
+
+    return entry->cycle + entry->cycle * WATCHDOG_JITTER_PERCENT / 100u + WATCHDOG_TICK_NS;
+}
+
+/**
+ * Schedules the check of an entry at the time it is lost if no frame is received.
+ */
+static void scheduleEntry(struct bcmWatchdog *const watchdog, uint32_t index){
+
+    struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+    unlinkEntry(watchdog, index);
+
+    // IDs without a cycle are only lost by a BCM RX_TIMEOUT
+    if(entry->cycle == 0){
+        return;
+    }
+
+    // Note: Frames only move lastSeen, so the entry is checked once per
+    // WATCHDOG_LOST_CYCLES cycles and not once per cycle or frame.
+    uint64_t deadline = entry->lastSeen + getAllowance(entry) + entry->cycle * (WATCHDOG_LOST_CYCLES - 1);
+
+    entry->expire = (deadline - watchdog->start + WATCHDOG_TICK_NS - 1) / WATCHDOG_TICK_NS;
+    linkEntry(watchdog, index);
+}
+
+/**
+ * Remembers an entry whose state changed for the next report.
+ */
+static void markPending(struct bcmWatchdog *const watchdog, uint32_t index){
+
+    if(!watchdog->entries[index].isPending){
+        watchdog->entries[index].isPending      = 1;
+        watchdog->pending[watchdog->npending++] = index;
+    }
+}
+
+/**
+ * Marks an entry as lost.
+ */
+static void loseEntry(struct bcmWatchdog *const watchdog, uint32_t index){
+
+    struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+    unlinkEntry(watchdog, index);
+
+    entry->isLost = 1;
+    entry->lostAt = watchdog->now;
+    watchdog->nlost++;
+
+    markPending(watchdog, index);
+}
+
+/**
+ * Checks an entry whose deadline passed. Frames received in the meantime
+ * only moved lastSeen, so the entry is just scheduled again for them.
+ */
+static void expireEntry(struct bcmWatchdog *const watchdog, uint32_t index){
+
+    struct bcmWatchEntry *const entry = &watchdog->entries[index];
+    uint64_t allowance = getAllowance(entry);
+    uint64_t elapsed   = watchdog->now - entry->lastSeen;
+
+    entry->missed = elapsed > allowance ? (uint32_t) ((elapsed - allowance) / entry->cycle) + 1 : 0;
+
+    if(entry->missed >= WATCHDOG_LOST_CYCLES){
+        loseEntry(watchdog, index);
+    }else{
+        scheduleEntry(watchdog, index);
+    }
+}
+
+/**
+ * Moves the entries of a slot of a higher level down to the lower levels.
+ */
+static void cascadeSlot(struct bcmWatchdog *const watchdog, uint32_t level, uint32_t slot){
+
+    uint32_t index = watchdog->wheel[level][slot];
+
+    watchdog->wheel[level][slot] = WATCHDOG_NONE;
+
+    while(index != WATCHDOG_NONE){
+
+        uint32_t next = watchdog->entries[index].next;
+
+        linkEntry(watchdog, index);
+        index = next;
+    }
+}
+
+/**
+ * Advances the timer wheel by one tick and checks the entries of the tick.
+ */
+static void advanceWheel(struct bcmWatchdog *const watchdog){
+
+    watchdog->tick++;
+
+    // Cascade the next slot of a level each time the level below wrapped around
+    for(uint32_t level = 1; level < WATCHDOG_LEVELS; level++){
+
+        if((watchdog->tick & ((1ull << (WATCHDOG_SLOT_BITS * level)) - 1)) != 0){
+            break;
+        }
+
+        cascadeSlot(watchdog, level, (uint32_t) (watchdog->tick >> (WATCHDOG_SLOT_BITS * level)) & (WATCHDOG_SLOTS - 1));
+    }
+
+    uint32_t slot  = (uint32_t) watchdog->tick & (WATCHDOG_SLOTS - 1);
+    uint32_t index = watchdog->wheel[0][slot];
+
+    // Note: Take the whole list first, the checks put the entries in other slots
+    watchdog->wheel[0][slot] = WATCHDOG_NONE;
+
+    while(index != WATCHDOG_NONE){
+
+        uint32_t next = watchdog->entries[index].next;
+
+        watchdog->entries[index].slot = WATCHDOG_NONE;
+        watchdog->entries[index].next = WATCHDOG_NONE;
+        watchdog->entries[index].prev = WATCHDOG_NONE;
+
+        expireEntry(watchdog, index);
+        index = next;
+    }
+}
+
+int setupWatchdog(struct bcmWatchdog *const watchdog, uint32_t capacity){
+
+    uint32_t nentries = 2;
+    uint32_t bits     = 1;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(watchdog, 0, sizeof(struct bcmWatchdog));
+
+    if(capacity == 0){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // Use at least twice as many entries as IDs to keep the probe sequences short
+    while(nentries < 2 * capacity){
+        nentries <<= 1;
+        bits++;
+    }
+
+    watchdog->entries = calloc(nentries, sizeof(struct bcmWatchEntry));
+    watchdog->pending = calloc(nentries, sizeof(uint32_t));
+
+    if(watchdog->entries == NULL || watchdog->pending == NULL){
+        printf("Error could not allocate memory for the watchdog \n");
+        freeWatchdog(watchdog);
+        return ERR_MALLOC_FAILED;
+    }
+
+    watchdog->capacity = capacity;
+    watchdog->mask     = nentries - 1;
+    watchdog->shift    = 64 - bits;
+
+    memset(watchdog->wheel, 0xFF, sizeof(watchdog->wheel));
+
+    // Note: The bus counts as active when the supervision starts
+    watchdog->start     = getStatsTime();
+    watchdog->now       = watchdog->start;
+    watchdog->lastFrame = watchdog->start;
+
+    return RET_E_OK;
+}
+
+void freeWatchdog(struct bcmWatchdog *const watchdog){
+
+    free(watchdog->entries);
+    free(watchdog->pending);
+
+    watchdog->entries  = NULL;
+    watchdog->pending  = NULL;
+    watchdog->capacity = 0;
+    watchdog->nused    = 0;
+    watchdog->npending = 0;
+}
+
+int watchCanID(struct bcmWatchdog *const watchdog, canid_t canID, int isCANFD, uint64_t cycleUs){
+
+    uint32_t index = findEntry(watchdog, canID, isCANFD);
+    struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+    if(!entry->isUsed){
+
+        if(watchdog->nused >= watchdog->capacity){
+            printf("Error the watchdog can not supervise more than %u CAN IDs \n", watchdog->capacity);
+            return ERR_INVALID_ARGUMENT;
+        }
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(entry, 0, sizeof(struct bcmWatchEntry));
+
+        entry->canID   = canID;
+        entry->isCANFD = isCANFD ? 1 : 0;
+        entry->isUsed  = 1;
+        entry->slot    = WATCHDOG_NONE;
+        entry->next    = WATCHDOG_NONE;
+        entry->prev    = WATCHDOG_NONE;
+        watchdog->nused++;
+    }
+
+    if(entry->isLost){
+        watchdog->nlost--;
+    }
+
+    // Note: A new supervision starts without a report of the old state
+    entry->cycle      = cycleUs * 1000u;
+    entry->lastSeen   = watchdog->now;
+    entry->missed     = 0;
+    entry->isWatched  = 1;
+    entry->isLost     = 0;
+    entry->isReported = 0;
+
+    scheduleEntry(watchdog, index);
+    return RET_E_OK;
+}
+
+int unwatchCanID(struct bcmWatchdog *const watchdog, canid_t canID, int isCANFD){
+
+    struct bcmWatchEntry *const entry = getWatchedEntry(watchdog, canID, isCANFD);
+
+    if(entry == NULL){
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    if(entry->isLost){
+        watchdog->nlost--;
+    }
+
+    unlinkEntry(watchdog, (uint32_t) (entry - watchdog->entries));
+
+    // Note: A pending entry is skipped by the next report
+    entry->isWatched  = 0;
+    entry->isLost     = 0;
+    entry->isReported = 0;
+
+    return RET_E_OK;
+}
+
+void noteWatchdogFrame(struct bcmWatchdog *const watchdog, canid_t canID, int isCANFD){
+
+    watchdog->lastFrame = watchdog->now;
+
+    struct bcmWatchEntry *const entry = getWatchedEntry(watchdog, canID, isCANFD);
+
+    if(entry == NULL){
+        return;
+    }
+
+    // Note: This is the hot path. The deadline stays where it is, the
+    // timer wheel sees the new lastSeen when the deadline passes.
+    entry->lastSeen = watchdog->now;
+    entry->missed   = 0;
+
+    if(entry->isLost){
+
+        uint32_t index = (uint32_t) (entry - watchdog->entries);
+
+        entry->isLost = 0;
+        watchdog->nlost--;
+
+        markPending(watchdog, index);
+        scheduleEntry(watchdog, index);
+    }
+}
+
+int noteWatchdogTimeout(struct bcmWatchdog *const watchdog, canid_t canID, int isCANFD){
+
+    struct bcmWatchEntry *const entry = getWatchedEntry(watchdog, canID, isCANFD);
+
+    if(entry == NULL){
+        return 0;
+    }
+
+    // Note: The BCM timer fires again after each further timeout, only the first one loses the ID
+    if(!entry->isLost){
+        entry->missed = entry->missed < WATCHDOG_LOST_CYCLES ? WATCHDOG_LOST_CYCLES : entry->missed;
+        loseEntry(watchdog, (uint32_t) (entry - watchdog->entries));
+    }
+
+    return 1;
+}
+
+/**
+ * Puts a watchdog event in the event queue of the context and counts it.
+ *
+ * @param ctx       - The context the watchdog is attached to.
+ * @param type      - The enum bcmEventType of the event.
+ * @param entry     - The entry the event is for (NULL for the bus events).
+ * @param silentFor - Nanoseconds since the ID or the bus was last seen or how long it was away.
+ * @param timestamp - The realtime clock of the tick in nanoseconds.
+ */
+static int queueWatchdogEvent(struct bcmContext *const ctx, int type, struct bcmWatchEntry const* const entry,
+                              uint64_t silentFor, uint64_t timestamp){
+
+    struct bcmEvent event;
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&event, 0, sizeof(event));
+
+    event.timestamp       = timestamp;
+    event.type            = (uint8_t) type;
+    event.channel         = (uint8_t) ctx->channel;
+    event.watch.silentFor = silentFor;
+    event.watch.nlost     = ctx->watchdog->nlost;
+
+    if(entry != NULL){
+        event.canID        = entry->canID;
+        event.isCANFD      = entry->isCANFD;
+        event.watch.missed = entry->missed;
+    }
+
+    if(enqueueEvent(ctx->eventQueue, &event)){
+        addStatsCounter(STATS_EVENTS, 1);
+    }else{
+        addStatsCounter(STATS_EVENTS_DROPPED, 1);
+    }
+
+    return 1;
+}
+
+/**
+ * Starts the supervision of the IDs that were lost while the bus was silent
+ * again. They were covered by EVENT_BUS_SILENT, so they are only reported
+ * if they stay away after the bus is back.
+ */
+static void restartHeldEntries(struct bcmWatchdog *const watchdog){
+
+    for(uint32_t pending = 0; pending < watchdog->npending; pending++){
+
+        uint32_t index = watchdog->pending[pending];
+        struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+        if(entry->isWatched && entry->isLost && !entry->isReported){
+            entry->isLost   = 0;
+            entry->missed   = 0;
+            entry->lastSeen = watchdog->now;
+            watchdog->nlost--;
+
+            scheduleEntry(watchdog, index);
+        }
+    }
+}
+
+int tickWatchdog(struct bcmContext *const ctx, uint64_t now){
+
+    struct bcmWatchdog *const watchdog = ctx->watchdog;
+    uint64_t timestamp = 0; // The realtime clock of the tick, only read if there is something to report
+    uint32_t held      = 0; // Number of pending entries that wait for the next report
+    int nevents        = 0;
+
+    if(now < watchdog->now){
+        return 0;
+    }
+
+    watchdog->now = now;
+
+    // Note: Catch up if the event loop was late, the ticks are checked in order
+    uint64_t target = (now - watchdog->start) / WATCHDOG_TICK_NS;
+
+    while(watchdog->tick < target){
+        advanceWheel(watchdog);
+    }
+
+    if(!watchdog->isSilent && now - watchdog->lastFrame >= WATCHDOG_SILENT_NS){
+
+        watchdog->isSilent    = 1;
+        watchdog->silentSince = watchdog->lastFrame;
+
+        timestamp = getStatsRealtime();
+        nevents  += queueWatchdogEvent(ctx, EVENT_BUS_SILENT, NULL, now - watchdog->lastFrame, timestamp);
+
+    }else if(watchdog->isSilent && watchdog->lastFrame > watchdog->silentSince){
+
+        watchdog->isSilent = 0;
+
+        timestamp = getStatsRealtime();
+        restartHeldEntries(watchdog);
+        nevents  += queueWatchdogEvent(ctx, EVENT_BUS_ACTIVE, NULL, now - watchdog->silentSince, timestamp);
+    }
+
+    for(uint32_t pending = 0; pending < watchdog->npending; pending++){
+
+        uint32_t index = watchdog->pending[pending];
+        struct bcmWatchEntry *const entry = &watchdog->entries[index];
+
+        if(entry->isWatched && entry->isLost && !entry->isReported){
+
+            // Note: An ID is only lost on its own if the bus was active after
+            // it got lost. Otherwise it waits for the verdict on the bus.
+            if(watchdog->isSilent || watchdog->lastFrame < entry->lostAt){
+                watchdog->pending[held++] = index;
+                continue;
+            }
+
+            timestamp          = timestamp != 0 ? timestamp : getStatsRealtime();
+            entry->isReported  = 1;
+            nevents           += queueWatchdogEvent(ctx, EVENT_ID_LOST, entry, now - entry->lastSeen, timestamp);
+
+        }else if(entry->isWatched && !entry->isLost && entry->isReported){
+
+            timestamp          = timestamp != 0 ? timestamp : getStatsRealtime();
+            entry->isReported  = 0;
+            nevents           += queueWatchdogEvent(ctx, EVENT_ID_RECOVERED, entry, now - entry->lostAt, timestamp);
+        }
+
+        entry->isPending = 0;
+    }
+
+    watchdog->npending = held;
+
+    return nevents;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/
@@ -0,0 +1,1230 @@
+/*******************************************************************************
+ \project   INFM_HIL_Interface
+ \file      CANFD_BCM_Worker.c
+ \brief     Provides the event loop and the worker threads that serve the channels.
+ \author    Matthias Bank
+ \version   1.0.0
+ \date      28.10.2021
+ ******************************************************************************/
+
+
+/*******************************************************************************
+ * INCLUDES
+ ******************************************************************************/
+#include "CANFD_BCM_Error.h"
+#include "CANFD_BCM_Config.h"
+#include "CANFD_BCM_Capture.h"
+#include "CANFD_BCM_Context.h"
+#include "CANFD_BCM_Dbc.h"
+#include "CANFD_BCM_Fanout.h"
+#include "CANFD_BCM_Operations.h"
+#include "CANFD_BCM_Queue.h"
+#include "CANFD_BCM_Stats.h"
+#include "CANFD_BCM_Stepper.h"
+#include "CANFD_BCM_Uring.h"
+#include "CANFD_BCM_Watchdog.h"
+#include "CANFD_BCM_Worker.h"
+#include <errno.h>
+#include <linux/can.h>
+#include <linux/can/bcm.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <time.h>
+#include <unistd.h>
+
+
+/*******************************************************************************
+ * DEFINES
+ ******************************************************************************/
+
+/**
+ * Defines how many file descriptors are watched by the event loop.
+ * The BCM socket, the io_uring and the sequencer timer of each channel,
+ * the eventfd of the operation queue and the timerfd of the watchdogs.
+ */
+#define LOOP_MAX_EVENTS (3 * MAX_CHANNELS + 2)
+
+/**
+ * Defines the epoll tags of the operation queue, the watchdog timer, the
+ * io_urings and the sequencer timers. The sockets are tagged with their
+ * channel handle, the io_urings with LOOP_URING_TAG + channel handle and
+ * the sequencer timers with LOOP_SEQUENCER_TAG + channel handle.
+ */
+#define LOOP_QUEUE_TAG     MAX_CHANNELS
+#define LOOP_TIMER_TAG     (MAX_CHANNELS + 1)
+#define LOOP_URING_TAG     (MAX_CHANNELS + 2)
+#define LOOP_SEQUENCER_TAG (2 * MAX_CHANNELS + 2)
+
+
+/*******************************************************************************
+ * FUNCTION DEFINITIONS
+ ******************************************************************************/
+
+/**
+ * Checks if two operations can be sent in the same batch.
+ *
+ * @param first  - The first operation of the batch.
+ * @param second - The operation that should be added to the batch.
+ */
+static int isSameBatch(struct bcmOperation const* const first, struct bcmOperation const* const second){
+
+    return first->type == second->type && first->channel == second->channel && first->isCANFD == second->isCANFD &&
+           first->announce == second->announce;
+}
+
+int processOperation(struct bcmWorker *const worker){
+
+    struct bcmOperation ops[OPERATION_BATCH_SIZE];   // The dequeued operations
+    struct canfd_frame frames[OPERATION_BATCH_SIZE]; // The frames of a batch
+    uint32_t count[OPERATION_BATCH_SIZE];            // The counts of a batch
+    struct bcm_timeval ival1[OPERATION_BATCH_SIZE];  // The first intervals of a batch
+    struct bcm_timeval ival2[OPERATION_BATCH_SIZE];  // The second intervals of a batch
+    int status[OPERATION_BATCH_SIZE];                // The status of each frame of a batch
+
+    // Remember how far the simulation got ahead of us
+    updateStatsMaximum(STATS_OPERATION_QUEUE_MAX, getRingCount(worker->operationQueue.ring));
+
+    // Get operations from queue
+    uint32_t nops = dequeueOperations(&worker->operationQueue, ops, OPERATION_BATCH_SIZE);
+
+    addStatsCounter(STATS_OPERATIONS, nops);
+
+    // Note: All control messages of the dequeued operations are one submit per io_uring
+    for(int channel = 0; nops > 0 && channel < MAX_CHANNELS; channel++){
+        if(worker->contexts[channel] != NULL && worker->contexts[channel]->uring != NULL){
+            beginUringBatch(worker->contexts[channel]->uring);
+        }
+    }
+
+    for(uint32_t index = 0; index < nops;){
+
+        struct bcmOperation const* const op = &ops[index];
+        uint32_t first = index;
+        struct bcmContext *const ctx = op->channel < MAX_CHANNELS ? worker->contexts[op->channel] : NULL;
+        int nframes = 0;
+        int failed  = 0;
+
+        // Drop operations for channels the worker does not serve
+        if(ctx == NULL){
+            printf("Error channel %d is not served by this worker \n", op->channel);
+            index++;
+            continue;
+        }
+
+        // Note: The simulation got an EVENT_CHANNEL_DOWN when the channel was shut down
+        if(ctx->isDown){
+            index++;
+            continue;
+        }
+
+        // Check what we need to do: send, send cyclic, add CAN ID to RX filter etc...
+        switch(op->type){
+
+            case OP_TX_SEND:
+            case OP_TX_SETUP:
+            case OP_TX_SETUP_UPDATE:
+
+                // Collect the following operations of the same kind
+                while(index + nframes < nops && isSameBatch(op, &ops[index + nframes])){
+                    frames[nframes] = ops[index + nframes].frame;
+                    count[nframes]  = ops[index + nframes].count;
+                    ival1[nframes]  = ops[index + nframes].ival1;
+                    ival2[nframes]  = ops[index + nframes].ival2;
+                    nframes++;
+                }
+
+                if(op->type == OP_TX_SEND){
+                    failed = createTxSendBatch(ctx, frames, nframes, op->isCANFD, status);
+                }else if(op->type == OP_TX_SETUP){
+                    failed = createTxSetupBatch(ctx, frames, nframes, count, ival1, ival2, op->isCANFD, status);
+                }else{
+                    failed = createTxSetupUpdateBatch(ctx, frames, nframes, op->isCANFD, op->announce, status);
+                }
+
+                if(failed > 0){
+                    printf("Error could not send %d of %d %s messages \n", failed, nframes,
+                           op->type == OP_TX_SEND ? "TX_SEND" : "TX_SETUP");
+                }
+
+                index += nframes;
+                break;
+
+            case OP_TX_DELETE:
+                createTxDelete(ctx, op->frame.can_id, op->isCANFD);
+                index++;
+                break;
+
+            case OP_RX_SETUP:
+                if(op->hasMask){
+                    createRxSetupMask(ctx, op->frame.can_id, op->frame, op->isCANFD);
+                }else{
+                    createRxSetupCanID(ctx, op->frame.can_id, op->isCANFD);
+                }
+                index++;
+                break;
+
+            case OP_RX_DELETE:
+                createRxDelete(ctx, op->frame.can_id, op->isCANFD);
+                index++;
+                break;
+
+            case OP_TX_SIGNAL:
+                if(setTxSignal(ctx, op->signal, op->value) != RET_E_OK){
+                    printf("Error signal %u has no cyclic transmission task on channel %d \n", op->signal, op->channel);
+                }
+                index++;
+                break;
+
+            case OP_TX_FLUSH:
+                failed = flushTxSignals(ctx, op->announce);
+
+                if(failed > 0){
+                    printf("Error could not send %d signal updates \n", failed);
+                }
+                index++;
+                break;
+
+            case OP_STEP:
+                if(ctx->stepper == NULL){
+                    printf("Error channel %d does not run in the stepped mode \n", op->channel);
+                }else if((failed = stepChannel(ctx, op->duration)) > 0){
+                    printf("Error could not send %d frames of the step \n", failed);
+                }
+                index++;
+                break;
+
+            default:
+                printf("Error unknown operation type %d from the simulation \n", op->type);
+                index++;
+                break;
+        }
+
+        // Note: One clock read for all operations that were sent together
+        uint64_t now = getStatsTime();
+
+        for(uint32_t sent = first; sent < index; sent++){
+            recordStatsValue(STATS_DEQUEUE_TO_SEND, now - ops[sent].timestamp);
+        }
+    }
+
+    for(int channel = 0; nops > 0 && channel < MAX_CHANNELS; channel++){
+        if(worker->contexts[channel] != NULL && worker->contexts[channel]->uring != NULL){
+            endUringBatch(worker->contexts[channel]->uring);
+        }
+    }
+
+    return (int) nops;
+}
+
+/**
+ * Consumes the notification of the operation queue and processes the operations.
+ * If the queue still holds operations afterwards the notification is raised again,
+ * so the event loop comes back to the queue after it served the socket.
+ *
+ * @param worker - The worker that serves the channels.
+ * @return The number of processed operations.
+ */
+static int processOperationNotification(struct bcmWorker *const worker){
+
+    struct bcmOperationQueue *const queue = &worker->operationQueue;
+
+    uint64_t pending = 0; // Number of notifications from the simulation
+
+    // Note: The eventfd is non-blocking so this returns immediately if nothing is pending.
+    if(read(queue->eventFD, &pending, sizeof(pending)) != sizeof(pending)){
+        pending = 0;
+    }
+
+    int processed = processOperation(worker);
+
+    if(getRingCount(queue->ring) > 0){
+        pending = 1;
+
+        if(write(queue->eventFD, &pending, sizeof(pending)) != sizeof(pending)){
+            printf("Error could not notify the event loop: %s\n", strerror(errno));
+        }
+    }
+
+    return processed;
+}
+
+/**
+ * Reads the control messages of a received message and returns its kernel
+ * receive time in nanoseconds. The time is taken from the SO_TIMESTAMPNS
+ * control message. If there is none the current time of the realtime
+ * clock is used instead.
+ *
+ * The SO_RXQ_OVFL control message carries the number of messages the
+ * socket dropped so far. The messages dropped since the last one are
+ * counted as rx overruns.
+ *
+ * @param ctx - The context of the BCM socket.
+ * @param hdr - The header of the received message.
+ */
+static uint64_t readRxControl(struct bcmContext *const ctx, struct msghdr *const hdr){
+
+    uint64_t timestamp = 0;
+
+    for(struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg)){
+
+        if(cmsg->cmsg_level != SOL_SOCKET){
+            continue;
+        }
+
+        if(cmsg->cmsg_type == SCM_TIMESTAMPNS){
+
+            struct timespec stamp;
+
+            // Note: The data of a control message is not necessarily aligned
+            memcpy(&stamp, CMSG_DATA(cmsg), sizeof(stamp));
+
+            timestamp = (uint64_t) stamp.tv_sec * 1000000000u + (uint64_t) stamp.tv_nsec;
+
+        }else if(cmsg->cmsg_type == SO_RXQ_OVFL){
+
+            uint32_t drops;
+
+            memcpy(&drops, CMSG_DATA(cmsg), sizeof(drops));
+
+            // Note: The counter wraps, the difference is still right
+            if(drops != ctx->rxDrops){
+                addStatsCounter(STATS_RX_OVERRUNS, drops - ctx->rxDrops);
+                ctx->rxDrops = drops;
+            }
+        }
+    }
+
+    return timestamp != 0 ? timestamp : getStatsRealtime();
+}
+
+/**
+ * Puts an event in the queue to the simulation and counts it.
+ * The subscribers of its CAN ID get it too.
+ *
+ * @param ctx   - The context of the BCM socket.
+ * @param event - The event.
+ */
+static void queueEvent(struct bcmContext *const ctx, struct bcmEvent const* const event){
+
+    if(enqueueEvent(ctx->eventQueue, event)){
+        addStatsCounter(STATS_EVENTS, 1);
+    }else{
+        addStatsCounter(STATS_EVENTS_DROPPED, 1);
+    }
+
+    if(ctx->fanout != NULL){
+        dispatchFanout(ctx->fanout, event);
+    }
+}
+
+/**
+ * Records the time from the kernel receive timestamp until the message is handled.
+ *
+ * @param timestamp - The kernel receive time in nanoseconds.
+ * @param now       - The realtime clock when the message is handled in nanoseconds.
+ */
+static void recordRxLatency(uint64_t timestamp, uint64_t now){
+
+    // Note: The realtime clock can be set back, so do not record negative times
+    if(now >= timestamp){
+        recordStatsValue(STATS_RX_TO_HANDLER, now - timestamp);
+    }
+}
+
+void processTimeout(struct bcmContext *const ctx, struct bcmMsgSingleFrameCanFD const* const msg, uint64_t timestamp){
+
+    struct bcmEvent event;
+
+    // Supervised IDs are reported by the watchdog with its next tick
+    if(ctx->watchdog != NULL &&
+       noteWatchdogTimeout(ctx->watchdog, msg->msg_head.can_id, (msg->msg_head.flags & CAN_FD_FRAME) ? 1 : 0)){
+        return;
+    }
+
+    // Note: A RX_TIMEOUT message has no frame. Only the head is valid.
+    event.timestamp = timestamp;
+    event.canID     = msg->msg_head.can_id;
+    event.type      = EVENT_RX_TIMEOUT;
+    event.flags     = 0;
+    event.len       = 0;
+    event.isCANFD   = (msg->msg_head.flags & CAN_FD_FRAME) ? 1 : 0;
+    event.channel   = (uint8_t) ctx->channel;
+
+    // Put the event in the queue
+    queueEvent(ctx, &event);
+}
+
+/**
+ * Decodes a received frame into the values of its signals and puts them
+ * in the queue to the simulation.
+ *
+ * @param ctx       - The context of the BCM socket.
+ * @param message   - The message of the frame in the DBC.
+ * @param msg       - The received content change message from the BCM socket.
+ * @param timestamp - The receive time in nanoseconds.
+ */
+static void processSignals(struct bcmContext *const ctx, struct bcmDbcMessage const* const message,
+                           struct bcmMsgSingleFrameCanFD const* const msg, uint64_t timestamp){
+
+    struct bcmEvent event;
+    double values[DBC_MAX_SIGNALS]; // The values of all signals of the message
+    struct canfd_frame const* const frame = &msg->canfdFrame[0];
+
+    int nvalues = decodeDbcMessage(ctx->dbc, message, frame->data, frame->len, values);
+
+    addStatsCounter(STATS_DECODED, 1);
+
+    event.timestamp = timestamp;
+    event.canID     = frame->can_id;
+    event.type      = EVENT_RX_SIGNALS;
+    event.isCANFD   = (msg->msg_head.flags & CAN_FD_FRAME) ? 1 : 0;
+    event.flags     = event.isCANFD ? frame->flags : 0;
+    event.channel   = (uint8_t) ctx->channel;
+    event.reserved  = 0;
+
+    // Note: At least one event is sent, so a message without signals is still reported
+    int first = 0;
+
+    do{
+        int nchunk = nvalues - first < (int) EVENT_MAX_VALUES ? nvalues - first : (int) EVENT_MAX_VALUES;
+
+        event.first = (uint16_t) first;
+        event.len   = (uint8_t) nchunk;
+        memcpy(event.values, &values[first], sizeof(double) * (size_t) nchunk);
+
+        // Put the event in the queue
+        queueEvent(ctx, &event);
+        first += nchunk;
+
+    }while(first < nvalues);
+}
+
+void processContentChange(struct bcmContext *const ctx, struct bcmMsgSingleFrameCanFD const* const msg, uint64_t timestamp){
+
+    struct bcmEvent event;
+    struct canfd_frame const* const frame = &msg->canfdFrame[0];
+
+    // Frames that are in the DBC are reported with their signal values
+    if(ctx->dbc != NULL){
+
+        struct bcmDbcMessage const* const message = findDbcMessage(ctx->dbc, frame->can_id);
+
+        if(message != NULL){
+            processSignals(ctx, message, msg, timestamp);
+            return;
+        }
+    }
+
+    // Map the frame to the event.
+    // Note: can_id, len and data are at the same offset for CAN and CANFD frames.
+    // The byte that holds the CANFD flags is padding for a CAN frame.
+    event.timestamp = timestamp;
+    event.canID     = frame->can_id;
+    event.type      = EVENT_RX_CHANGED;
+    event.isCANFD   = (msg->msg_head.flags & CAN_FD_FRAME) ? 1 : 0;
+    event.flags     = event.isCANFD ? frame->flags : 0;
+    event.len       = frame->len > CANFD_MAX_DLEN ? CANFD_MAX_DLEN : frame->len;
+    event.channel   = (uint8_t) ctx->channel;
+
+    memcpy(event.data, frame->data, event.len);
+
+    // Put the event in the queue
+    queueEvent(ctx, &event);
+}
+
+/**
+ * Checks a received BCM message and passes it to the matching handler.
+ * A message of unexpected size or opcode is counted and dropped.
+ *
+ * @param ctx       - The context of the BCM socket.
+ * @param msg       - The received message from the BCM socket.
+ * @param nbytes    - The number of bytes that were received.
+ * @param timestamp - The receive time in nanoseconds.
+ */
+static void processMessage(struct bcmContext *const ctx, struct bcmMsgSingleFrameCanFD const* const msg, int nbytes,
+                           uint64_t timestamp){
+
+    // Check validity of the received message.
+    // Note: A RX_TIMEOUT message only consists of the head.
+    if(nbytes != sizeof(struct bcmMsgSingleFrameCan) && nbytes != sizeof(struct bcmMsgSingleFrameCanFD) &&
+       !(nbytes == sizeof(struct bcm_msg_head) && msg->msg_head.opcode == RX_TIMEOUT)){
+        printf("Error received unexpected number of bytes \n");
+        addStatsCounter(STATS_RECV_ERRORS, 1);
+        return;
+    }
+
+    // Check if we got one of the expected operation codes:
+    // RX_CHANGED: Simple reception of a CAN/CANFD frame or a content change occurred.
+    // RX_TIMEOUT: Cyclic message is detected to be absent.
+    if(msg->msg_head.opcode != RX_CHANGED && msg->msg_head.opcode != RX_TIMEOUT){
+        printf("Error received returned unexpected operation code \n");
+        addStatsCounter(STATS_RECV_ERRORS, 1);
+        return;
+    }
+
+    // Note: Only a copy into the queue of the capture writer
+    if(ctx->capture != NULL){
+        captureMessage(ctx->capture, ctx->channel, msg, timestamp);
+    }
+
+    if(msg->msg_head.opcode == RX_TIMEOUT){
+        processTimeout(ctx, msg, timestamp);
+        return;
+    }
+
+    if(ctx->watchdog != NULL){
+        noteWatchdogFrame(ctx->watchdog, msg->msg_head.can_id, (msg->msg_head.flags & CAN_FD_FRAME) ? 1 : 0);
+    }
+
+    processContentChange(ctx, msg, timestamp);
+}
+
+/**
+ * Reports a failed receive. Only a fatal error shuts the channel down,
+ * otherwise the error is counted and the next receive is tried.
+ *
+ * Note: Call it right after the failed receive, the error is taken from errno.
+ *
+ * @param ctx - The context of the BCM socket.
+ */
+static void handleReceiveError(struct bcmContext *const ctx){
+
+    int error = errno;
+
+    // Note: A signal is no error
+    if(error == EINTR){
+        return;
+    }
+
+    printf("Error could not receive on the socket: %s\n", strerror(error));
+    addStatsCounter(STATS_RECV_ERRORS, 1);
+
+    if(isFatalSocketError(error)){
+        shutdownChannel(ctx, error);
+    }
+}
+
+void processReceive(struct bcmContext *const ctx){
+
+    int nbytes = 0;                    // Number of bytes we received
+    struct bcmMsgSingleFrameCanFD msg; // The buffer that stores the received message
+    union bcmRxControl control;        // The buffer that stores the receive time
+    struct iovec iov;                  // The iovec for the message buffer
+    struct msghdr hdr;                 // The header for recvmsg
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&msg, 0, sizeof(msg));
+    memset(&hdr, 0, sizeof(hdr));
+
+    iov.iov_base       = &msg;
+    iov.iov_len        = sizeof(msg);
+    hdr.msg_iov        = &iov;
+    hdr.msg_iovlen     = 1;
+    hdr.msg_control    = &control;
+    hdr.msg_controllen = sizeof(control);
+
+    // Reset errno before calling receive on the socket that sets errno on failure
+    errno = 0;
+
+    // Receive on the BCM socket
+    nbytes = recvmsg(ctx->socketFD, &hdr, 0);
+
+    addStatsCounter(STATS_RECEIVES, 1);
+
+    // Check validity of the received message
+    if(nbytes < 0){
+
+        // Check if there was an actual error or if there was nothing received on the socket.
+        // This can happen when the socket is set to be non-blocking.
+        if(errno != EAGAIN && errno != EWOULDBLOCK){
+            handleReceiveError(ctx);
+        }else{
+            // There was nothing to receive so we can exit early
+            addStatsCounter(STATS_RECEIVES_EAGAIN, 1);
+        }
+
+        return;
+    }
+
+    uint64_t timestamp = readRxControl(ctx, &hdr);
+
+    addStatsCounter(STATS_MESSAGES, 1);
+    recordRxLatency(timestamp, getStatsRealtime());
+
+    processMessage(ctx, &msg, nbytes, timestamp);
+}
+
+void processReceivedMessage(struct bcmContext *const ctx, struct bcmMsgSingleFrameCanFD const* const msg, int nbytes,
+                            struct msghdr *const hdr){
+
+    uint64_t timestamp = readRxControl(ctx, hdr);
+
+    recordRxLatency(timestamp, getStatsRealtime());
+    processMessage(ctx, msg, nbytes, timestamp);
+}
+
+int processReceiveBatch(struct bcmContext *const ctx){
+
+    int nmsgs = 0; // Number of messages we received
+
+    // The kernel overwrites the length of the control buffers on every receive
+    for(int index = 0; index < RX_BATCH_SIZE; index++){
+        ctx->rxMsgs[index].msg_hdr.msg_controllen = sizeof(union bcmRxControl);
+    }
+
+    // Reset errno before calling receive on the socket that sets errno on failure
+    errno = 0;
+
+    // Receive on the BCM socket. With MSG_WAITFORONE a blocking socket only
+    // waits for the first message and then takes what is already queued.
+    nmsgs = recvmmsg(ctx->socketFD, ctx->rxMsgs, RX_BATCH_SIZE, MSG_WAITFORONE, NULL);
+
+    addStatsCounter(STATS_RECEIVES, 1);
+
+    if(nmsgs < 0){
+
+        // Check if there was an actual error or if there was nothing received on the socket.
+        // This can happen when the socket is set to be non-blocking.
+        if(errno != EAGAIN && errno != EWOULDBLOCK){
+            handleReceiveError(ctx);
+        }else{
+            // There was nothing to receive so we can exit early
+            addStatsCounter(STATS_RECEIVES_EAGAIN, 1);
+        }
+
+        return 0;
+    }
+
+    // Note: All messages of the batch are handled at the same time
+    uint64_t now = getStatsRealtime();
+
+    addStatsCounter(STATS_MESSAGES, (uint64_t) nmsgs);
+
+    // Dispatch all received messages in one pass.
+    // Note: The receive time of each message comes with it in the control buffer.
+    for(int index = 0; index < nmsgs; index++){
+
+        uint64_t timestamp = readRxControl(ctx, &ctx->rxMsgs[index].msg_hdr);
+
+        recordRxLatency(timestamp, now);
+        processMessage(ctx, &ctx->rxBuffers[index], (int) ctx->rxMsgs[index].msg_len, timestamp);
+    }
+
+    // Remember how far the simulation got behind us
+    updateStatsMaximum(STATS_EVENT_QUEUE_MAX, getRingCount(ctx->eventQueue->ring));
+
+    return nmsgs;
+}
+
+/**
+ * Returns the current time of the monotonic clock in microseconds.
+ */
+static uint64_t getMonotonicTimeUs(){
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return (uint64_t) now.tv_sec * 1000000u + (uint64_t) now.tv_nsec / 1000u;
+}
+
+/**
+ * Creates the timerfd that ticks the watchdogs of a worker and adds it to epoll.
+ * The timer is only needed if one of the channels has a watchdog.
+ *
+ * @param worker  - The worker that serves the channels.
+ * @param epollFD - The epoll instance of the event loop.
+ * @return The timerfd, -1 if no channel has a watchdog or ERR_EPOLL_FAILED.
+ */
+static int setupWatchdogTimer(struct bcmWorker const* const worker, int epollFD){
+
+    struct itimerspec interval; // The tick of the watchdogs
+    struct epoll_event event;   // The event used for the registration
+    int needed = 0;
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+        needed |= worker->contexts[channel] != NULL && worker->contexts[channel]->watchdog != NULL;
+    }
+
+    if(!needed){
+        return -1;
+    }
+
+    int timerFD = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+
+    if(timerFD < 0){
+        printf("Error could not create the watchdog timer: %s\n", strerror(errno));
+        return ERR_EPOLL_FAILED;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&interval, 0, sizeof(interval));
+    memset(&event, 0, sizeof(event));
+
+    interval.it_interval.tv_sec  = WATCHDOG_TICK_MS / 1000;
+    interval.it_interval.tv_nsec = (WATCHDOG_TICK_MS % 1000) * 1000000L;
+    interval.it_value            = interval.it_interval;
+
+    event.events   = EPOLLIN;
+    event.data.u32 = LOOP_TIMER_TAG;
+
+    if(timerfd_settime(timerFD, 0, &interval, NULL) < 0 || epoll_ctl(epollFD, EPOLL_CTL_ADD, timerFD, &event) < 0){
+        printf("Error could not start the watchdog timer: %s\n", strerror(errno));
+        close(timerFD);
+        return ERR_EPOLL_FAILED;
+    }
+
+    return timerFD;
+}
+
+/**
+ * Consumes the expirations of the watchdog timer and ticks the watchdogs.
+ * Missed expirations are caught up by the timer wheels, so one tick
+ * per wakeup is enough.
+ *
+ * @param worker  - The worker that serves the channels.
+ * @param timerFD - The watchdog timer.
+ * @return The number of reported watchdog events.
+ */
+static int processWatchdogTimer(struct bcmWorker *const worker, int timerFD){
+
+    uint64_t expirations = 0; // Number of ticks since the last read
+
+    // Note: The timerfd is non-blocking so this returns immediately if nothing is pending.
+    if(read(timerFD, &expirations, sizeof(expirations)) != sizeof(expirations)){
+        return 0;
+    }
+
+    uint64_t now = getStatsTime();
+    int nevents  = 0;
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+
+        struct bcmContext *const ctx = worker->contexts[channel];
+
+        if(ctx != NULL && ctx->watchdog != NULL && !ctx->isDown){
+            nevents += tickWatchdog(ctx, now);
+        }
+    }
+
+    return nevents;
+}
+
+/**
+ * Sends the held back control messages of the channels of a worker whose wait is over.
+ *
+ * @param worker - The worker that serves the channels.
+ * @return The number of messages that were sent or given up.
+ */
+static int processRetries(struct bcmWorker *const worker){
+
+    int processed = 0;
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+
+        struct bcmContext *const ctx = worker->contexts[channel];
+
+        if(ctx != NULL && ctx->nretries > 0){
+            processed += processSendRetries(ctx);
+        }
+    }
+
+    return processed;
+}
+
+/**
+ * Returns how long the event loop may block. The wait is cut short when
+ * a held back control message or a latest event of a subscriber is due earlier.
+ *
+ * @param worker - The worker that serves the channels.
+ * @return The timeout of epoll_wait in milliseconds.
+ */
+static int getLoopTimeout(struct bcmWorker const* const worker){
+
+    uint64_t due = UINT64_MAX;
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+
+        struct bcmContext const* const ctx = worker->contexts[channel];
+        uint64_t next = ctx != NULL ? getNextSendRetry(ctx) : UINT64_MAX;
+
+        due = next < due ? next : due;
+    }
+
+    if(worker->fanout != NULL && getFanoutDue(worker->fanout) < due){
+        due = getFanoutDue(worker->fanout);
+    }
+
+    if(due == UINT64_MAX){
+        return EPOLL_TIMEOUT_MS;
+    }
+
+    uint64_t now = getStatsTime();
+
+    if(due <= now){
+        return 0;
+    }
+
+    // Note: Round up, waking up early would only spin
+    uint64_t timeout = (due - now + 999999u) / 1000000u;
+
+    return timeout < EPOLL_TIMEOUT_MS ? (int) timeout : EPOLL_TIMEOUT_MS;
+}
+
+/**
+ * Closes the epoll instance of the event loop and detaches the channels of the worker from it.
+ *
+ * @param worker  - The worker whose event loop stops
+ * @param epollFD - The epoll instance of the event loop
+ */
+static void closeEventLoop(struct bcmWorker *const worker, int epollFD){
+
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+        if(worker->contexts[channel] != NULL){
+            worker->contexts[channel]->epollFD = -1;
+        }
+    }
+
+    close(epollFD);
+}
+
+int runEventLoop(struct bcmWorker *const worker){
+
+    struct epoll_event events[LOOP_MAX_EVENTS]; // The events returned by epoll_wait
+    struct epoll_event event;                   // The event used for the registration
+
+    int epollFD = epoll_create1(0);
+
+    // Error handling
+    if(epollFD < 0){
+        printf("Error could not create the epoll instance: %s\n", strerror(errno));
+        return ERR_EPOLL_FAILED;
+    }
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(&event, 0, sizeof(event));
+
+    // Watch the BCM socket of each channel of the worker and the operation queue
+    for(int channel = 0; channel < MAX_CHANNELS; channel++){
+
+        struct bcmContext *const ctx = worker->contexts[channel];
+
+        if(ctx == NULL){
+            continue;
+        }
+
+        // Note: shutdownChannel takes the sockets of a failed channel out of the epoll instance
+        ctx->epollFD = epollFD;
+
+        // Note: The sequencer timer runs the long sequences of the kernel timer mode
+        if(ctx->sequencer != NULL){
+
+            event.events   = EPOLLIN;
+            event.data.u32 = (uint32_t) (LOOP_SEQUENCER_TAG + channel);
+
+            if(epoll_ctl(epollFD, EPOLL_CTL_ADD, ctx->sequencer->timerFD, &event) < 0){
+                printf("Error could not add the sequencer of %s to epoll: %s\n", ctx->interfaceName, strerror(errno));
+                closeEventLoop(worker, epollFD);
+                return ERR_EPOLL_FAILED;
+            }
+        }
+
+        // Note: The completions of the io_uring include the messages of the multishot receive
+        if(ctx->uring != NULL){
+
+            event.events   = EPOLLIN;
+            event.data.u32 = (uint32_t) (LOOP_URING_TAG + channel);
+
+            if(startUringReceive(ctx->uring) != RET_E_OK ||
+               epoll_ctl(epollFD, EPOLL_CTL_ADD, ctx->uring->ringFD, &event) < 0){
+                printf("Error could not add the io_uring of %s to epoll: %s\n", ctx->interfaceName, strerror(errno));
+                closeEventLoop(worker, epollFD);
+                return ERR_EPOLL_FAILED;
+            }
+
+            if(ctx->uring->isReceiving){
+                continue;
+            }
+        }
+
+        event.events   = EPOLLIN;
+        event.data.u32 = (uint32_t) channel;
+
+        if(epoll_ctl(epollFD, EPOLL_CTL_ADD, ctx->socketFD, &event) < 0){
+            printf("Error could not add the socket of %s to epoll: %s\n", ctx->interfaceName, strerror(errno));
+            closeEventLoop(worker, epollFD);
+            return ERR_EPOLL_FAILED;
+        }
+    }
+
+    event.events   = EPOLLIN;
+    event.data.u32 = LOOP_QUEUE_TAG;
+
+    if(epoll_ctl(epollFD, EPOLL_CTL_ADD, worker->operationQueue.eventFD, &event) < 0){
+        printf("Error could not add the operation queue to epoll: %s\n", strerror(errno));
+        closeEventLoop(worker, epollFD);
+        return ERR_EPOLL_FAILED;
+    }
+
+    int timerFD = setupWatchdogTimer(worker, epollFD);
+
+    if(timerFD == ERR_EPOLL_FAILED){
+        closeEventLoop(worker, epollFD);
+        return ERR_EPOLL_FAILED;
+    }
+
+    while(atomic_load_explicit(&worker->running, memory_order_relaxed)){
+
+        int nevents = epoll_wait(epollFD, events, LOOP_MAX_EVENTS, getLoopTimeout(worker));
+
+        if(nevents < 0){
+
+            // A signal interrupted the wait. Check if we should stop.
+            if(errno == EINTR){
+                continue;
+            }
+
+            printf("Error could not wait for events: %s\n", strerror(errno));
+
+            if(timerFD >= 0){
+                close(timerFD);
+            }
+
+            closeEventLoop(worker, epollFD);
+            return ERR_EPOLL_FAILED;
+        }
+
+        addStatsCounter(STATS_WAKEUPS, 1);
+        dumpStatsPeriodic();
+
+        int work = 0; // Number of messages and operations processed in this wakeup
+
+        for(int index = 0; index < nevents; index++){
+
+            uint32_t tag = events[index].data.u32;
+            struct bcmContext *const ctx = tag >= LOOP_SEQUENCER_TAG ? worker->contexts[tag - LOOP_SEQUENCER_TAG]
+                                         : tag >= LOOP_URING_TAG     ? worker->contexts[tag - LOOP_URING_TAG]
+                                         : tag < MAX_CHANNELS        ? worker->contexts[tag] : NULL;
+
+            // Note: A channel can go down while the other events of the wakeup are handled
+            if(ctx != NULL && ctx->isDown){
+                continue;
+            }
+
+            if(tag == LOOP_QUEUE_TAG){
+                work += processOperationNotification(worker);
+            }else if(tag == LOOP_TIMER_TAG){
+                work += processWatchdogTimer(worker, timerFD);
+            }else if(tag >= LOOP_SEQUENCER_TAG){
+                work += runSequencer(ctx);
+            }else if(tag >= LOOP_URING_TAG){
+                work += processUring(ctx->uring);
+            }else{
+                work += processReceiveBatch(ctx);
+            }
+        }
+
+        // Send the held back control messages whose wait is over
+        work += processRetries(worker);
+
+        // Send the latest events of the slow subscribers whose wait is over
+        if(worker->fanout != NULL){
+            work += flushFanout(worker->fanout);
+        }
+
+        // Wake up a simulation in another process once for all events of the wakeup
+        notifyEvents(&worker->eventQueue);
+
+        if(work == 0){
+            addStatsCounter(STATS_IDLE_WAKEUPS, 1);
+            continue;
+        }
+
+        // Note: New work often arrives shortly after the last one. Polling for a
+        // bounded time avoids the latency of going to sleep and getting woken up.
+        if(BUSY_POLL_US > 0){
+
+            uint64_t deadline = getMonotonicTimeUs() + BUSY_POLL_US;
+
+            while(atomic_load_explicit(&worker->running, memory_order_relaxed) && getMonotonicTimeUs() < deadline){
+
+                work = processOperation(worker);
+
+                for(int channel = 0; channel < MAX_CHANNELS; channel++){
+
+                    struct bcmContext *const ctx = worker->contexts[channel];
+
+                    if(ctx == NULL || ctx->isDown){
+                        continue;
+                    }
+
+                    if(ctx->uring != NULL){
+                        work += processUring(ctx->uring);
+                    }
+
+                    if(ctx->uring == NULL || !ctx->uring->isReceiving){
+                        work += processReceiveBatch(ctx);
+                    }
+
+                    // Note: The sequencer timer is not watched while polling
+                    if(ctx->sequencer != NULL){
+                        work += runSequencer(ctx);
+                    }
+                }
+
+                work += processRetries(worker);
+
+                if(worker->fanout != NULL){
+                    work += flushFanout(worker->fanout);
+                }
+
+                // Restart the window if we found something to do
+                if(work > 0){
+                    notifyEvents(&worker->eventQueue);
+                    addStatsCounter(STATS_BUSY_POLLS, 1);
+                    deadline = getMonotonicTimeUs() + BUSY_POLL_US;
+                }
+            }
+        }
+    }
+
+    if(timerFD >= 0){
+        close(timerFD);
+    }
+
+    closeEventLoop(worker, epollFD);
+    return RET_E_OK;
+}
+
+/**
+ * Pins the calling thread to the CPU of the worker and sets its scheduler.
+ * Failures are reported but the worker keeps running with the defaults.
+ * E.g. SCHED_FIFO needs CAP_SYS_NICE or a matching RLIMIT_RTPRIO.
+ *
+ * @param worker - The worker that runs on the calling thread.
+ */
+static void applyScheduling(struct bcmWorker const* const worker){
+
+    if(worker->cpu >= 0){
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->cpu, &cpus);
+
+        int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+
+        if(ret != 0){
+            printf("Warning could not pin the worker to CPU %d: %s\n", worker->cpu, strerror(ret));
+        }
+    }
+
+    if(worker->priority > 0){
+
+        struct sched_param param;
+
+        // Note: Always initialize the whole struct with 0.
+        // Random values in the memory can cause weird bugs!
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = worker->priority;
+
+        int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+
+        if(ret != 0){
+            printf("Warning could not use SCHED_FIFO with priority %d: %s\n", worker->priority, strerror(ret));
+        }
+    }
+}
+
+/**
+ * Entry point of a worker thread.
+ * If the event loop fails all other workers are stopped too.
+ *
+ * @param arg - The worker.
+ */
+static void* workerThread(void *arg){
+
+    struct bcmWorker *const worker = (struct bcmWorker*) arg;
+
+    worker->retCode = runWorker(worker);
+
+    if(worker->retCode != RET_E_OK){
+        stopWorkers(worker->group);
+    }
+
+    return NULL;
+}
+
+void initWorkers(struct bcmWorkers *const workers){
+
+    // Note: Always initialize the whole struct with 0.
+    // Random values in the memory can cause weird bugs!
+    memset(workers, 0, sizeof(struct bcmWorkers));
+
+    for(int index = 0; index < MAX_CHANNELS; index++){
+        atomic_init(&workers->workers[index].running, 0);
+        workers->workers[index].cpu = -1;
+    }
+}
+
+int setupWorkers(struct bcmWorkers *const workers, struct bcmChannels *const channels, int nworkers,
+                 int const cpus[], int ncpus, int priority){
+
+    if(nworkers <= 0 || channels->nchannels <= 0){
+        printf("Error there must be at least one worker and one channel \n");
+        return ERR_INVALID_ARGUMENT;
+    }
+
+    // A worker without a channel would only sleep
+    if(nworkers > channels->nchannels){
+        nworkers = channels->nchannels;
+    }
+
+    for(int index = 0; index < nworkers; index++){
+
+        struct bcmWorker *const worker = &workers->workers[index];
+
+        if(setupOperationQueue(&worker->operationQueue, OPERATION_QUEUE_SIZE) != RET_E_OK){
+            printf("Error could not setup the operation queue of worker %d \n", index);
+            return ERR_EVENTFD_FAILED;
+        }
+
+        if(setupEventQueue(&worker->eventQueue, EVENT_QUEUE_SIZE) != RET_E_OK){
+            printf("Error could not setup the event queue of worker %d \n", index);
+            freeOperationQueue(&worker->operationQueue);
+            return ERR_MALLOC_FAILED;
+        }
+
+        worker->cpu      = index < ncpus ? cpus[index] : -1;
+        worker->priority = priority;
+        worker->retCode  = RET_E_OK;
+        worker->group    = workers;
+        atomic_store(&worker->running, 1);
+
+        // Note: Count the worker after its queues exist so stopWorkers and freeWorkers only touch valid ones
+        workers->nworkers = index + 1;
+    }
+
+    // Distribute the channels round robin
+    for(int channel = 0; channel < channels->nchannels; channel++){
+
+        struct bcmWorker *const worker = &workers->workers[channel % nworkers];
+        struct bcmContext *const ctx   = getChannel(channels, channel);
+
+        worker->contexts[channel] = ctx;
+        worker->ncontexts++;
+        ctx->eventQueue = &worker->eventQueue;
+    }
+
+    return RET_E_OK;
+}
+
+int runWorker(struct bcmWorker *const worker){
+
+    applyScheduling(worker);
+
+    return runEventLoop(worker);
+}
+
+int startWorkers(struct bcmWorkers *const workers){
+
+    sigset_t allSignals; // Blocked in the worker threads
+    sigset_t oldSignals; // The signal mask of the caller
+
+    // Note: The new threads inherit the signal mask, so signals
+    // like CTRL + F are only delivered to the calling thread.
+    sigfillset(&allSignals);
+    pthread_sigmask(SIG_BLOCK, &allSignals, &oldSignals);
+
+    int retCode = RET_E_OK;
+
+    for(int index = 0; index < workers->nworkers; index++){
+
+        struct bcmWorker *const worker = &workers->workers[index];
+
+        int ret = pthread_create(&worker->thread, NULL, workerThread, worker);
+
+        if(ret != 0){
+            printf("Error could not start worker %d: %s\n", index, strerror(ret));
+            retCode = ERR_THREAD_FAILED;
+            break;
+        }
+
+        worker->hasThread = 1;
+    }
+
+    pthread_sigmask(SIG_SETMASK, &oldSignals, NULL);
+
+    // Do not leave a part of the workers running
+    if(retCode != RET_E_OK){
+        stopWorkers(workers);
+        joinWorkers(workers);
+    }
+
+    return retCode;
+}
+
+void stopWorkers(struct bcmWorkers *const workers){
+
+    uint64_t wakeup = 1; // Wakes the worker up from epoll_wait
+
+    for(int index = 0; index < workers->nworkers; index++){
+
+        struct bcmWorker *const worker = &workers->workers[index];
+
+        atomic_store(&worker->running, 0);
+
+        // Note: If the eventfd can not be written the worker notices
+        // the stop after EPOLL_TIMEOUT_MS at the latest.
+        if(write(worker->operationQueue.eventFD, &wakeup, sizeof(wakeup)) != sizeof(wakeup)){
+            continue;
+        }
+    }
+}
+
+int joinWorkers(struct bcmWorkers *const workers){
+
+    int retCode = RET_E_OK;
+
+    for(int index = 0; index < workers->nworkers; index++){
+
+        struct bcmWorker *const worker = &workers->workers[index];
+
+        if(!worker->hasThread){
+            continue;
+        }
+
+        pthread_join(worker->thread, NULL);
+        worker->hasThread = 0;
+
+        if(retCode == RET_E_OK){
+            retCode = worker->retCode;
+        }
+    }
+
+    return retCode;
+}
+
+void freeWorkers(struct bcmWorkers *const workers){
+
+    for(int index = 0; index < workers->nworkers; index++){
+        freeOperationQueue(&workers->workers[index].operationQueue);
+        freeEventQueue(&workers->workers[index].eventQueue);
+    }
+
+    workers->nworkers = 0;
+}
+
+
+/*******************************************************************************
+ * END OF FILE
+ ******************************************************************************/